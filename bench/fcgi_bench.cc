@@ -0,0 +1,345 @@
+/*
+ * Microbenchmark of the hot paths of codec.
+ *
+ * The record streams are shaped like the ones sent by nginx, and they
+ * are fed to the codec without socket, then the numbers only reflect the
+ * decoding and encoding.
+ *
+ * Usage: fcgi_bench [-n iterations] [filter]
+ */
+#include <chrono>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "fcgi/fcgi_admission.h"
+#include "fcgi/fcgi_codec.h"
+#include "fcgi/fcgi_record.h"
+
+#include "kanon/log/logger.h"
+#include "kanon/net/event_loop.h"
+
+using namespace fcgi;
+using namespace kanon;
+
+/*-----------------------*/
+/* Allocation counter    */
+/*-----------------------*/
+
+static size_t alloc_num = 0;
+
+void *operator new(size_t size)
+{
+  ++alloc_num;
+  void *p = ::malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) noexcept { ::free(p); }
+
+/* Used since C++14, e.g. the C++20 build */
+void operator delete(void *p, size_t) noexcept { ::free(p); }
+
+/*-----------------------*/
+/* Record stream builder */
+/*-----------------------*/
+
+static char const padding_bytes[8] = {0};
+
+static void AppendRecord(Buffer &output, FcgiType type, uint16_t id,
+                         char const *data, size_t len)
+{
+  /* nginx aligns the record to 8 bytes */
+  uint8_t padding = (8 - (len & 7)) & 7;
+  output.Append8(FCGI_VERSION_1);
+  output.Append8(type);
+  output.Append16(id);
+  output.Append16((uint16_t)len);
+  output.Append8(padding);
+  output.Append8(0);
+  output.Append(data, len);
+  output.Append(padding_bytes, padding);
+}
+
+static void AppendBegin(Buffer &output, uint16_t id)
+{
+  Buffer body;
+  body.Append16(FCGI_RESPONDER);
+  body.Append8(FCGI_KEEP_CONN);
+  body.Append(padding_bytes, 5);
+  AppendRecord(output, FCGI_BEGIN_REQUEST, id, body.GetReadBegin(),
+               body.GetReadableSize());
+}
+
+/* The PARAMS is split to records as nginx does */
+static void AppendParams(Buffer &output, uint16_t id, Buffer const &params)
+{
+  auto data = params.GetReadBegin();
+  auto len = params.GetReadableSize();
+  while (len > 0) {
+    size_t n = len > MAX_CONTENT_LENGTH ? MAX_CONTENT_LENGTH : len;
+    AppendRecord(output, FCGI_PARAMS, id, data, n);
+    data += n;
+    len -= n;
+  }
+  AppendRecord(output, FCGI_PARAMS, id, nullptr, 0);
+}
+
+static void AppendStdin(Buffer &output, uint16_t id, size_t body_len,
+                        size_t record_len)
+{
+  std::string chunk(record_len, 'x');
+  while (body_len > 0) {
+    size_t n = body_len > record_len ? record_len : body_len;
+    AppendRecord(output, FCGI_STDIN, id, chunk.data(), n);
+    body_len -= n;
+  }
+  AppendRecord(output, FCGI_STDIN, id, nullptr, 0);
+}
+
+static Buffer MakeNginxParams(size_t extra_header_num, size_t cookie_len)
+{
+  Buffer params;
+  AppendNameValuePair(params, "QUERY_STRING", "a=1&b=2");
+  AppendNameValuePair(params, "REQUEST_METHOD", "GET");
+  AppendNameValuePair(params, "CONTENT_TYPE", "");
+  AppendNameValuePair(params, "CONTENT_LENGTH", "");
+  AppendNameValuePair(params, "SCRIPT_NAME", "/echo/hello");
+  AppendNameValuePair(params, "REQUEST_URI", "/echo/hello?a=1&b=2");
+  AppendNameValuePair(params, "DOCUMENT_URI", "/echo/hello");
+  AppendNameValuePair(params, "DOCUMENT_ROOT", "/usr/share/nginx/html");
+  AppendNameValuePair(params, "SERVER_PROTOCOL", "HTTP/1.1");
+  AppendNameValuePair(params, "REQUEST_SCHEME", "http");
+  AppendNameValuePair(params, "GATEWAY_INTERFACE", "CGI/1.1");
+  AppendNameValuePair(params, "SERVER_SOFTWARE", "nginx/1.18.0");
+  AppendNameValuePair(params, "REMOTE_ADDR", "127.0.0.1");
+  AppendNameValuePair(params, "REMOTE_PORT", "52814");
+  AppendNameValuePair(params, "SERVER_ADDR", "127.0.0.1");
+  AppendNameValuePair(params, "SERVER_PORT", "80");
+  AppendNameValuePair(params, "SERVER_NAME", "localhost");
+  AppendNameValuePair(params, "REDIRECT_STATUS", "200");
+  AppendNameValuePair(params, "HTTP_HOST", "localhost");
+  AppendNameValuePair(params, "HTTP_USER_AGENT", "curl/7.68.0");
+  AppendNameValuePair(params, "HTTP_ACCEPT", "*/*");
+
+  for (size_t i = 0; i < extra_header_num; ++i) {
+    AppendNameValuePair(params, "HTTP_X_CUSTOM_HEADER_" + std::to_string(i),
+                        std::string(32, 'v'));
+  }
+
+  if (cookie_len > 0) {
+    AppendNameValuePair(params, "HTTP_COOKIE", std::string(cookie_len, 'c'));
+  }
+  return params;
+}
+
+/*-----------------------*/
+/* Benchmark cases       */
+/*-----------------------*/
+
+/* Average per request */
+struct Result {
+  double ns;
+  double allocs;
+  double copied;
+};
+
+struct DecodeCase {
+  char const *name;
+  std::string stream; /* The captured records */
+  size_t request_num;
+};
+
+static DecodeCase SmallGet()
+{
+  Buffer stream;
+  AppendBegin(stream, 1);
+  AppendParams(stream, 1, MakeNginxParams(0, 0));
+  AppendRecord(stream, FCGI_STDIN, 1, nullptr, 0);
+  return DecodeCase{"decode/small-get", stream.RetrieveAllAsString(), 1};
+}
+
+static DecodeCase LargeParams()
+{
+  Buffer stream;
+  AppendBegin(stream, 1);
+  AppendParams(stream, 1, MakeNginxParams(100, 4096));
+  AppendRecord(stream, FCGI_STDIN, 1, nullptr, 0);
+  return DecodeCase{"decode/large-params", stream.RetrieveAllAsString(), 1};
+}
+
+static DecodeCase MultiStdin()
+{
+  Buffer stream;
+  AppendBegin(stream, 1);
+  AppendParams(stream, 1, MakeNginxParams(0, 0));
+  /* nginx sends the body in records of its client_body_buffer_size */
+  AppendStdin(stream, 1, 64 * 1024, 8 * 1024);
+  return DecodeCase{"decode/multi-stdin", stream.RetrieveAllAsString(), 1};
+}
+
+static DecodeCase Interleaved()
+{
+  static constexpr uint16_t REQUEST_NUM = 8;
+  auto params = MakeNginxParams(0, 0);
+  std::string body(1024, 'x');
+
+  Buffer stream;
+  for (uint16_t id = 1; id <= REQUEST_NUM; ++id) {
+    AppendBegin(stream, id);
+  }
+  for (uint16_t id = 1; id <= REQUEST_NUM; ++id) {
+    AppendParams(stream, id, params);
+  }
+  for (int i = 0; i < 2; ++i) {
+    for (uint16_t id = 1; id <= REQUEST_NUM; ++id) {
+      AppendRecord(stream, FCGI_STDIN, id, body.data(), body.size());
+    }
+  }
+  for (uint16_t id = 1; id <= REQUEST_NUM; ++id) {
+    AppendRecord(stream, FCGI_STDIN, id, nullptr, 0);
+  }
+  return DecodeCase{"decode/interleaved", stream.RetrieveAllAsString(),
+                    REQUEST_NUM};
+}
+
+/**
+ * The bytes copied are the bytes buffered in the requests,
+ * i.e. the content of PARAMS and STDIN records.
+ * The copy from socket to input buffer is not counted.
+ */
+static Result RunDecode(EventLoop *loop, DecodeCase const &c, int iterations)
+{
+  FcgiCodec codec(loop);
+  std::vector<FcgiRequest> requests;
+  requests.reserve(c.request_num);
+
+  codec.SetRequestHandler(
+      [&requests](TransportPtr const &, FcgiRequest request) {
+        /* Keep them until the buffered bytes are counted */
+        requests.emplace_back(std::move(request));
+      });
+
+  TransportPtr conn;
+  Buffer input;
+  size_t copied = 0;
+  size_t allocs = 0;
+  std::chrono::nanoseconds elapsed(0);
+
+  /* Warm up the slot pool and buffers */
+  for (int i = -100; i < iterations; ++i) {
+    input.Append(c.stream.data(), c.stream.size());
+
+    auto start = std::chrono::steady_clock::now();
+    auto alloc_start = alloc_num;
+    codec.OnMessage(conn, input);
+    auto buffered = AdmissionControl::GetLoopBufferedBytes();
+    requests.clear();
+    auto end = std::chrono::steady_clock::now();
+
+    if (i < 0) continue;
+    elapsed += end - start;
+    allocs += alloc_num - alloc_start;
+    copied += buffered;
+  }
+
+  double n = (double)iterations * c.request_num;
+  return Result{elapsed.count() / n, allocs / n, copied / n};
+}
+
+struct EncodeCase {
+  char const *name;
+  size_t body_len;
+};
+
+/**
+ * Frame a response as FcgiCodec::SendStdout() and EndRequest() do.
+ * The bytes copied are the bytes of the output records.
+ */
+static Result RunEncode(EncodeCase const &c, int iterations)
+{
+  std::string body(c.body_len, 'x');
+  size_t copied = 0;
+  size_t allocs = 0;
+  std::chrono::nanoseconds elapsed(0);
+
+  for (int i = -100; i < iterations; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    auto alloc_start = alloc_num;
+    {
+      ChunkList output;
+      AppendStreamRecords(output, FCGI_STDOUT, 1, body.data(), body.size());
+      AppendTerminator(output, FCGI_STDOUT, 1);
+      AppendEndRequest(output, 1, 0, FCGI_REQUEST_COMPLETE);
+      if (i >= 0) copied += output.GetReadableSize();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    if (i < 0) continue;
+    elapsed += end - start;
+    allocs += alloc_num - alloc_start;
+  }
+
+  double n = iterations;
+  return Result{elapsed.count() / n, allocs / n, copied / n};
+}
+
+static void PrintResult(char const *name, Result const &r)
+{
+  printf("%-24s %12.1f %12.2f %14.1f\n", name, r.ns, r.allocs, r.copied);
+}
+
+static bool Match(char const *name, char const *filter)
+{
+  return !filter || strstr(name, filter);
+}
+
+int main(int argc, char *argv[])
+{
+  int iterations = 100000;
+  char const *filter = nullptr;
+
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      iterations = ::atoi(argv[++i]);
+    } else {
+      filter = argv[i];
+    }
+  }
+
+  if (iterations <= 0) {
+    fprintf(stderr, "Invalid iterations\n");
+    return 1;
+  }
+
+  kanon::EnableAllLog(false);
+
+  /* The released requests are given back in the loop of this thread */
+  EventLoop loop;
+
+  printf("%-24s %12s %12s %14s\n", "case", "ns/req", "allocs/req",
+         "copied B/req");
+
+  DecodeCase decode_cases[] = {SmallGet(), LargeParams(), MultiStdin(),
+                               Interleaved()};
+  for (auto const &c : decode_cases) {
+    if (Match(c.name, filter)) {
+      PrintResult(c.name, RunDecode(&loop, c, iterations));
+    }
+  }
+
+  EncodeCase encode_cases[] = {
+      {"encode/small", 256},
+      {"encode/medium", 16 * 1024},
+      {"encode/large", 256 * 1024},
+  };
+  for (auto const &c : encode_cases) {
+    if (Match(c.name, filter)) {
+      PrintResult(c.name, RunEncode(c, iterations));
+    }
+  }
+}
@@ -0,0 +1,507 @@
+/*
+ * FastCGI load generator which stands in for the web server.
+ *
+ * It talks to the application directly, then the result doesn't include
+ * the overhead of web server and HTTP load tool.
+ *
+ * Each connection keeps multiple requests in flight(multiplexed with
+ * FCGI_KEEP_CONN), the next request on the id is sent once the previous
+ * one ends.
+ *
+ * The sockets are driven by epoll directly instead of kanon, so the
+ * unix domain socket is supported and the client overhead is minimal.
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "fcgi/fcgi_record.h"
+
+#include "kanon/net/buffer.h"
+#include "kanon/net/endian_api.h"
+
+using namespace fcgi;
+using namespace kanon;
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  std::string ip = "127.0.0.1";
+  uint16_t port = 9999;
+  std::string unix_path; /* Not empty indicates unix domain socket */
+  int conn_num = 16;
+  int id_num = 1; /* Multiplexed request ids per connection */
+  int thread_num = 1;
+  long request_num = 100000;
+  size_t param_size = 0;
+  size_t stdin_size = 0;
+  std::string uri = "/echo/hello";
+};
+
+static Options options;
+
+/* The number of requests haven't been sent */
+static std::atomic<long> remaining(0);
+
+/*-----------------------*/
+/* Request encoding      */
+/*-----------------------*/
+
+static std::string Flatten(ChunkList const &output)
+{
+  std::string ret;
+  ret.reserve(output.GetReadableSize());
+  for (auto const &chunk : output) {
+    ret.append(chunk.GetReadBegin(), chunk.GetReadableSize());
+  }
+  return ret;
+}
+
+/* The records of a request is prebuilt, it is reused for each sending */
+static std::string EncodeRequest(uint16_t id)
+{
+  Buffer params;
+  AppendNameValuePair(params, "GATEWAY_INTERFACE", "CGI/1.1");
+  AppendNameValuePair(params, "SERVER_SOFTWARE", "fcgi_loadgen");
+  AppendNameValuePair(params, "SERVER_PROTOCOL", "HTTP/1.1");
+  AppendNameValuePair(params, "REQUEST_METHOD",
+                      options.stdin_size > 0 ? "POST" : "GET");
+  AppendNameValuePair(params, "REQUEST_URI", options.uri);
+  AppendNameValuePair(params, "SCRIPT_NAME", options.uri);
+  AppendNameValuePair(params, "QUERY_STRING", "");
+  AppendNameValuePair(params, "CONTENT_LENGTH",
+                      std::to_string(options.stdin_size));
+  AppendNameValuePair(params, "REMOTE_ADDR", "127.0.0.1");
+  AppendNameValuePair(params, "HTTP_HOST", "localhost");
+  if (options.param_size > 0) {
+    AppendNameValuePair(params, "HTTP_X_LOADGEN",
+                        std::string(options.param_size, 'p'));
+  }
+
+  ChunkList output;
+  AppendBeginRequest(output, id, FCGI_RESPONDER, FCGI_KEEP_CONN);
+  AppendStreamRecords(output, FCGI_PARAMS, id, params.GetReadBegin(),
+                      params.GetReadableSize());
+  AppendTerminator(output, FCGI_PARAMS, id);
+
+  std::string body(options.stdin_size, 'x');
+  AppendStreamRecords(output, FCGI_STDIN, id, body.data(), body.size());
+  AppendTerminator(output, FCGI_STDIN, id);
+  return Flatten(output);
+}
+
+/*-----------------------*/
+/* Connection            */
+/*-----------------------*/
+
+struct Connection {
+  int fd = -1;
+  Buffer input;
+  std::string output;
+  size_t written = 0;
+  bool want_write = false;
+  int in_flight = 0;
+  /* Indexed by request id */
+  std::vector<Clock::time_point> start_time;
+};
+
+struct Stats {
+  std::vector<int64_t> latencies; /* ns */
+  long completed = 0;
+  long errors = 0;
+  size_t stdout_bytes = 0;
+};
+
+static int Connect()
+{
+  int fd;
+  int ret;
+
+  if (!options.unix_path.empty()) {
+    fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, options.unix_path.c_str(),
+            sizeof(addr.sun_path) - 1);
+    ret = ::connect(fd, (sockaddr const *)&addr, sizeof addr);
+  } else {
+    fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    int on = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(options.port);
+    if (::inet_pton(AF_INET, options.ip.c_str(), &addr.sin_addr) != 1) {
+      ::close(fd);
+      errno = EINVAL;
+      return -1;
+    }
+    ret = ::connect(fd, (sockaddr const *)&addr, sizeof addr);
+  }
+
+  if (ret < 0) {
+    ::close(fd);
+    return -1;
+  }
+
+  ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+  return fd;
+}
+
+class LoadWorker {
+ public:
+  LoadWorker(int conn_num, std::vector<std::string> const *requests)
+    : conns_(conn_num)
+    , requests_(requests)
+  {
+  }
+
+  bool Run();
+
+  Stats &GetStats() noexcept { return stats_; }
+
+ private:
+  void SendRequest(Connection &conn, uint16_t id);
+  bool Flush(Connection &conn);
+  bool HandleInput(Connection &conn);
+  void UpdateEvents(Connection &conn);
+
+  int epfd_ = -1;
+  std::vector<Connection> conns_;
+  std::vector<std::string> const *requests_;
+  Stats stats_;
+};
+
+void LoadWorker::SendRequest(Connection &conn, uint16_t id)
+{
+  if (remaining.fetch_sub(1, std::memory_order_relaxed) <= 0) return;
+
+  conn.start_time[id] = Clock::now();
+  conn.output += (*requests_)[id];
+  ++conn.in_flight;
+}
+
+bool LoadWorker::Flush(Connection &conn)
+{
+  while (conn.written < conn.output.size()) {
+    auto n = ::write(conn.fd, conn.output.data() + conn.written,
+                     conn.output.size() - conn.written);
+    if (n < 0) {
+      if (errno == EAGAIN) break;
+      if (errno == EINTR) continue;
+      perror("write");
+      return false;
+    }
+    conn.written += n;
+  }
+
+  if (conn.written == conn.output.size()) {
+    conn.output.clear();
+    conn.written = 0;
+  }
+
+  UpdateEvents(conn);
+  return true;
+}
+
+void LoadWorker::UpdateEvents(Connection &conn)
+{
+  bool want_write = !conn.output.empty();
+  if (want_write == conn.want_write) return;
+
+  conn.want_write = want_write;
+  epoll_event ev;
+  ev.events = want_write ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+  ev.data.ptr = &conn;
+  ::epoll_ctl(epfd_, EPOLL_CTL_MOD, conn.fd, &ev);
+}
+
+bool LoadWorker::HandleInput(Connection &conn)
+{
+  int saved_errno = 0;
+  auto n = conn.input.ReadFd(conn.fd, saved_errno);
+  if (n == 0) {
+    fprintf(stderr, "The connection is closed by server\n");
+    return false;
+  } else if (n < 0) {
+    if (saved_errno == EAGAIN || saved_errno == EINTR) return true;
+    fprintf(stderr, "read: %s\n", strerror(saved_errno));
+    return false;
+  }
+
+  auto &buffer = conn.input;
+  while (buffer.GetReadableSize() >= FCGI_RECORD_HEADER_LENGTH) {
+    RecordHeader header;
+    memcpy(&header, buffer.GetReadBegin(), FCGI_RECORD_HEADER_LENGTH);
+    uint16_t id = sock::ToHostByteOrder16(header.request_id);
+    size_t clen = sock::ToHostByteOrder16(header.content_length);
+    size_t record_len =
+        FCGI_RECORD_HEADER_LENGTH + clen + header.padding_length;
+    if (buffer.GetReadableSize() < record_len) break;
+
+    char const *content = buffer.GetReadBegin() + FCGI_RECORD_HEADER_LENGTH;
+    switch (header.type) {
+      case FCGI_STDOUT:
+      {
+        stats_.stdout_bytes += clen;
+      } break;
+
+      case FCGI_END_REQUEST:
+      {
+        if (id == 0 || id >= conn.start_time.size() ||
+            clen < FCGI_END_REQUEST_BODY_LENGTH)
+        {
+          fprintf(stderr, "Invalid END_REQUEST of request %d\n", id);
+          return false;
+        }
+
+        EndRequestBody body;
+        memcpy(&body, content, FCGI_END_REQUEST_BODY_LENGTH);
+        if (body.protocol_status != FCGI_REQUEST_COMPLETE) ++stats_.errors;
+
+        stats_.latencies.push_back(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                Clock::now() - conn.start_time[id])
+                .count());
+        ++stats_.completed;
+        --conn.in_flight;
+        SendRequest(conn, id);
+      } break;
+
+      case FCGI_UNKNOWN_TYPE:
+      {
+        fprintf(stderr, "The server doesn't understand the request\n");
+        return false;
+      } break;
+    }
+
+    buffer.AdvanceRead(record_len);
+  }
+
+  return Flush(conn);
+}
+
+bool LoadWorker::Run()
+{
+  epfd_ = ::epoll_create1(EPOLL_CLOEXEC);
+  if (epfd_ < 0) {
+    perror("epoll_create1");
+    return false;
+  }
+
+  for (auto &conn : conns_) {
+    conn.fd = Connect();
+    if (conn.fd < 0) {
+      perror("connect");
+      return false;
+    }
+
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &conn;
+    ::epoll_ctl(epfd_, EPOLL_CTL_ADD, conn.fd, &ev);
+
+    conn.start_time.resize(options.id_num + 1);
+    for (int id = 1; id <= options.id_num; ++id) {
+      SendRequest(conn, id);
+    }
+    if (!Flush(conn)) return false;
+  }
+
+  std::vector<epoll_event> events(conns_.size());
+  bool ok = true;
+  for (;;) {
+    bool done = true;
+    for (auto const &conn : conns_) {
+      if (conn.in_flight > 0) done = false;
+    }
+    if (done) break;
+
+    int n = ::epoll_wait(epfd_, events.data(), events.size(), -1);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      perror("epoll_wait");
+      ok = false;
+      break;
+    }
+
+    for (int i = 0; i < n; ++i) {
+      auto conn = (Connection *)events[i].data.ptr;
+      if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+        ok = HandleInput(*conn);
+      } else if (events[i].events & EPOLLOUT) {
+        ok = Flush(*conn);
+      }
+      if (!ok) break;
+    }
+    if (!ok) break;
+  }
+
+  for (auto &conn : conns_) {
+    if (conn.fd >= 0) ::close(conn.fd);
+  }
+  ::close(epfd_);
+  return ok;
+}
+
+/*-----------------------*/
+/* Report                */
+/*-----------------------*/
+
+static double Percentile(std::vector<int64_t> const &sorted, double p)
+{
+  if (sorted.empty()) return 0;
+  size_t index = (size_t)(p * (sorted.size() - 1));
+  return sorted[index] / 1000.0;
+}
+
+static void PrintHistogram(std::vector<int64_t> const &sorted)
+{
+  /* Buckets of power of 2 microseconds */
+  printf("\nLatency histogram(us):\n");
+  size_t i = 0;
+  for (int64_t bound = 1; i < sorted.size(); bound <<= 1) {
+    size_t count = 0;
+    while (i < sorted.size() && sorted[i] / 1000 < bound) {
+      ++count;
+      ++i;
+    }
+    if (count == 0) continue;
+    printf("  < %-10ld %10zu %7.3f%%\n", (long)bound, count,
+           count * 100.0 / sorted.size());
+  }
+}
+
+static void Report(std::vector<Stats> &stats, double seconds)
+{
+  std::vector<int64_t> latencies;
+  long completed = 0;
+  long errors = 0;
+  size_t stdout_bytes = 0;
+  for (auto &s : stats) {
+    latencies.insert(latencies.end(), s.latencies.begin(), s.latencies.end());
+    completed += s.completed;
+    errors += s.errors;
+    stdout_bytes += s.stdout_bytes;
+  }
+  std::sort(latencies.begin(), latencies.end());
+
+  printf("Requests:     %ld(errors: %ld)\n", completed, errors);
+  printf("Duration:     %.3f s\n", seconds);
+  printf("Throughput:   %.1f req/s, %.2f MB/s\n", completed / seconds,
+         stdout_bytes / seconds / (1024 * 1024));
+  printf("Latency(us):  p50 %.1f, p99 %.1f, p999 %.1f, max %.1f\n",
+         Percentile(latencies, 0.5), Percentile(latencies, 0.99),
+         Percentile(latencies, 0.999), Percentile(latencies, 1));
+  PrintHistogram(latencies);
+}
+
+static void Usage(char const *name)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  -a ip          server ip(default: 127.0.0.1)\n"
+          "  -p port        server port(default: 9999)\n"
+          "  -u path        unix domain socket, overrides the ip and port\n"
+          "  -c num         connections(default: 16)\n"
+          "  -m num         multiplexed request ids per connection"
+          "(default: 1)\n"
+          "  -t num         threads, the connections are distributed to "
+          "them(default: 1)\n"
+          "  -n num         total requests(default: 100000)\n"
+          "  -P size        bytes of the extra param(default: 0)\n"
+          "  -i size        bytes of STDIN(default: 0)\n"
+          "  -U uri         REQUEST_URI(default: /echo/hello)\n",
+          name);
+}
+
+int main(int argc, char *argv[])
+{
+  int opt;
+  while ((opt = ::getopt(argc, argv, "a:p:u:c:m:t:n:P:i:U:h")) != -1) {
+    switch (opt) {
+      case 'a': options.ip = optarg; break;
+      case 'p': options.port = ::atoi(optarg); break;
+      case 'u': options.unix_path = optarg; break;
+      case 'c': options.conn_num = ::atoi(optarg); break;
+      case 'm': options.id_num = ::atoi(optarg); break;
+      case 't': options.thread_num = ::atoi(optarg); break;
+      case 'n': options.request_num = ::atol(optarg); break;
+      case 'P': options.param_size = ::atol(optarg); break;
+      case 'i': options.stdin_size = ::atol(optarg); break;
+      case 'U': options.uri = optarg; break;
+      default: Usage(argv[0]); return 1;
+    }
+  }
+
+  if (options.conn_num <= 0 || options.thread_num <= 0 ||
+      options.id_num <= 0 || options.id_num > 65535 ||
+      options.request_num <= 0)
+  {
+    Usage(argv[0]);
+    return 1;
+  }
+
+  if (options.thread_num > options.conn_num) {
+    options.thread_num = options.conn_num;
+  }
+
+  /* The request id 0 is reserved by management record */
+  std::vector<std::string> requests(options.id_num + 1);
+  for (int id = 1; id <= options.id_num; ++id) {
+    requests[id] = EncodeRequest(id);
+  }
+
+  remaining = options.request_num;
+
+  std::vector<LoadWorker *> workers;
+  for (int i = 0; i < options.thread_num; ++i) {
+    int conn_num = options.conn_num / options.thread_num +
+                   (i < options.conn_num % options.thread_num ? 1 : 0);
+    workers.push_back(new LoadWorker(conn_num, &requests));
+  }
+
+  std::atomic<bool> ok(true);
+  std::vector<std::thread> threads;
+  auto start = Clock::now();
+  for (auto worker : workers) {
+    threads.emplace_back([worker, &ok]() {
+      if (!worker->Run()) ok = false;
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+
+  std::vector<Stats> stats;
+  for (auto worker : workers) {
+    stats.emplace_back(std::move(worker->GetStats()));
+    delete worker;
+  }
+
+  Report(stats, elapsed.count());
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,249 @@
+/*
+ * FastCGI application serving the response scenarios to be measured,
+ * driven by fcgi_loadgen or the web server.
+ *
+ * Every request is answered by the same scenario:
+ *  - default: a small body, i.e. the URI
+ *  - -S size: a generated body produced by StdoutStream at the pace of
+ *    the web server
+ *  - -f path: the content of file, sent by sendfile(2)
+ *
+ * -i size interleaves the responses multiplexed on a connection in
+ * records of the size(see OutputScheduler), e.g. with fcgi_loadgen -m.
+ *
+ * The other options enable the features of the library to measure their
+ * cost or gain, e.g. the worker pool, the response cache, the SO_REUSEPORT
+ * listeners and the io_uring transport.
+ */
+#include <algorithm>
+#include <fcntl.h>
+#include <memory>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fcgi/fcgi_codec.h"
+#include "fcgi/fcgi_response_writer.h"
+#include "fcgi/fcgi_socket_server.h"
+#include "fcgi/fcgi_stdout_stream.h"
+#include "fcgi/fcgi_trace.h"
+#ifdef FCGI_WITH_URING
+#include "fcgi/fcgi_uring.h"
+#endif
+
+#include "kanon/log/logger.h"
+#include "kanon/net/event_loop.h"
+
+using namespace fcgi;
+using namespace kanon;
+
+struct Options {
+  uint16_t port = 9999;
+  /* Not empty indicates unix domain socket, "@name" indicates the abstract
+   * namespace */
+  std::string unix_path;
+  mode_t unix_mode = 0;
+  int loop_num = 0;
+  size_t stream_size = 0;
+  int file_fd = -1; /* Kept open and shared by the responses */
+  size_t record_size = 0;
+  int worker_num = 0;
+  double cache_ttl = 0;        /* In seconds */
+  char const *trace_path = nullptr;
+  bool reuseport = false;
+  bool use_uring = false;
+};
+
+static Options options;
+
+/* Generate a large body, produced at the pace of the web server */
+static void StreamBody(TransportPtr const &conn, FcgiRequest request)
+{
+  size_t remaining = options.stream_size;
+  bool header_sent = false;
+  StdoutStream::Start(
+      conn, std::move(request),
+      [remaining, header_sent](ResponseWriter &writer) mutable {
+        static std::string const chunk(16 * 1024, 'x');
+        if (!header_sent) {
+          writer.WriteStdout("Content-Type: text/plain\r\n\r\n");
+          header_sent = true;
+        }
+
+        size_t n = std::min(remaining, chunk.size());
+        writer.WriteStdout(chunk.data(), n);
+        remaining -= n;
+        return remaining > 0;
+      });
+}
+
+/* The body is sent from the file without copying it */
+static void FileBody(TransportPtr const &conn, FcgiRequest const &request)
+{
+  ResponseWriter writer(conn, request);
+  struct stat st;
+  if (::fstat(options.file_fd, &st) < 0) {
+    writer.EndRequest(1);
+    return;
+  }
+
+  writer.WriteStdout("Content-Type: application/octet-stream\r\n\r\n");
+  bool ok = writer.WriteStdoutFile(options.file_fd, 0, st.st_size);
+  writer.EndRequest(ok ? 0 : 1);
+}
+
+static void HandleRequest(TransportPtr const &conn, FcgiRequest request)
+{
+  if (options.stream_size > 0) {
+    StreamBody(conn, std::move(request));
+    return;
+  }
+
+  if (options.file_fd >= 0) {
+    FileBody(conn, request);
+    return;
+  }
+
+  ResponseWriter writer(conn, request);
+  writer.WriteStdout("Content-Type: text/plain\r\n\r\n");
+  writer.WriteStdout(request.Get(Param::RequestUri));
+  writer.EndRequest();
+}
+
+static void Usage(char const *name)
+{
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "  -p port        listening port(default: 9999)\n"
+          "  -u path        unix domain socket, overrides the port, "
+          "@name is abstract\n"
+          "  -M mode        mode of the unix domain socket, e.g. 0660\n"
+          "  -t num         IO loops(default: 0, i.e. the base loop)\n"
+          "  -r             listen in every IO loop by SO_REUSEPORT\n"
+          "  -U             serve by io_uring in the base loop\n"
+          "  -S size        stream a generated body of the bytes\n"
+          "  -f path        respond with the content of file\n"
+          "  -i size        interleave the responses in records of the "
+          "bytes\n"
+          "  -w num         run the handler in the workers\n"
+          "  -c ttl         serve the response from cache for the seconds\n"
+          "  -m path        serve the stats at the REQUEST_URI\n"
+          "  -T path        trace the requests, dumped to the file every 10s\n"
+          "  -s             silent mode\n",
+          name);
+}
+
+int main(int argc, char *argv[])
+{
+  int opt;
+  while ((opt = ::getopt(argc, argv, "p:u:M:t:rUS:f:i:w:c:m:T:sh")) != -1) {
+    switch (opt) {
+      case 'p': options.port = ::atoi(optarg); break;
+      case 'u': options.unix_path = optarg; break;
+      case 'M': options.unix_mode = ::strtol(optarg, nullptr, 8); break;
+      case 't': options.loop_num = ::atoi(optarg); break;
+      case 'r': options.reuseport = true; break;
+      case 'U': options.use_uring = true; break;
+      case 'S': options.stream_size = ::strtoul(optarg, nullptr, 10); break;
+      case 'f':
+        options.file_fd = ::open(optarg, O_RDONLY | O_CLOEXEC);
+        if (options.file_fd < 0) {
+          LOG_SYSERROR << "Failed to open " << optarg;
+          return 1;
+        }
+        break;
+      case 'i': options.record_size = ::strtoul(optarg, nullptr, 10); break;
+      case 'w': options.worker_num = ::atoi(optarg); break;
+      case 'c': options.cache_ttl = ::atof(optarg); break;
+      case 'm':
+        FcgiStats::Enable(true);
+        FcgiStats::SetManagementPath(optarg);
+        break;
+      case 'T':
+        FcgiTrace::Enable();
+        options.trace_path = optarg;
+        break;
+      case 's': kanon::EnableAllLog(false); break;
+      default: Usage(argv[0]); return 1;
+    }
+  }
+
+  ListenAddr addr = InetAddr(options.port);
+  if (!options.unix_path.empty() && options.unix_path[0] == '@') {
+    addr = ListenAddr::AbstractUnix(options.unix_path.substr(1));
+  } else if (!options.unix_path.empty()) {
+    addr = ListenAddr::Unix(options.unix_path, options.unix_mode);
+  }
+
+  /* sendfile(2) can't suppress SIGPIPE */
+  ::signal(SIGPIPE, SIG_IGN);
+
+  EventLoop loop;
+
+  /* Run handler in workers instead of IO loops */
+  std::unique_ptr<WorkerPool> worker_pool;
+  if (options.worker_num > 0) {
+    worker_pool.reset(new WorkerPool(options.worker_num, 1024));
+    worker_pool->StartRun();
+  }
+
+  /* The response of same REQUEST_URI is served from cache */
+  std::unique_ptr<ResponseCache> cache;
+  if (options.cache_ttl > 0) {
+    cache.reset(new ResponseCache(64 * 1024 * 1024, options.cache_ttl));
+  }
+
+  auto connection_callback = [&worker_pool, &cache](TransportPtr const &conn) {
+    if (conn->IsConnected()) {
+      auto codec = new FcgiCodec(conn);
+      if (options.record_size > 0) {
+        codec->EnableOutputScheduler(options.record_size);
+      }
+      codec->SetWorkerPool(worker_pool.get());
+      codec->SetResponseCache(cache.get());
+      codec->SetRequestHandler(&HandleRequest);
+      conn->SetContext(codec);
+    } else {
+      delete *AnyCast<FcgiCodec *>(conn->GetContext());
+    }
+  };
+
+  /* Decode it by fcgi_trace_dump */
+  if (options.trace_path) {
+    auto path = options.trace_path;
+    loop.RunEvery([path]() { FcgiTrace::Dump(path); }, 10);
+  }
+
+#ifdef FCGI_WITH_URING
+  std::unique_ptr<UringServer> uring_server;
+  if (options.use_uring) {
+    /* The io_uring server runs in the base loop only */
+    uring_server.reset(new UringServer(&loop, addr, "ResponseServer"));
+    uring_server->SetConnectionCallback(connection_callback);
+    if (!uring_server->StartRun()) {
+      LOG_WARN << "io_uring is unavailable, fall back to epoll";
+      uring_server.reset();
+    }
+  }
+
+  if (uring_server) {
+    loop.StartLoop();
+    return 0;
+  }
+#else
+  if (options.use_uring) {
+    LOG_WARN << "io_uring isn't built(BUILD_URING), fall back to epoll";
+  }
+#endif
+
+  SocketServer server(&loop, addr, "ResponseServer");
+  server.SetLoopNum(options.loop_num);
+  server.SetReusePort(options.reuseport);
+  server.SetConnectionCallback(connection_callback);
+
+  if (!server.StartRun()) return 1;
+  loop.StartLoop();
+}
@@ -0,0 +1,68 @@
+#include "fcgi/fcgi_codec.h"
+#include "fcgi/fcgi_coroutine.h"
+#include "fcgi/fcgi_tcp_transport.h"
+
+#include "kanon/net/user_server.h"
+#include "kanon/log/logger.h"
+
+using namespace fcgi;
+using namespace kanon;
+using namespace std;
+
+/* Seconds before responding, e.g. waiting for a backend */
+static double DELAY = 0;
+
+/* Echo the request body, the body is read and written chunk by chunk */
+static Task Echo(CoRequest request)
+{
+  if (DELAY > 0) co_await Sleep(request.GetLoop(), DELAY);
+
+  CoResponseWriter writer(request);
+  writer.GetWriter().WriteStdout("Content-Type: text/plain\r\n\r\n");
+
+  for (;;) {
+    auto chunk = co_await request.ReadStdin();
+    if (chunk.empty()) break;
+
+    /* Suspended until the web server catches up */
+    if (!co_await writer.Write(chunk)) co_return;
+  }
+
+  writer.EndRequest();
+}
+
+int main(int argc, char *argv[])
+{
+  uint16_t port = 9999;
+  int thread_num = 0;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "-p") == 0) {
+      port = ::atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "-t") == 0) {
+      thread_num = ::atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "-d") == 0) {
+      DELAY = ::atof(argv[i + 1]);
+    } else {
+      fprintf(stderr, "Usage: %s [-p port] [-t threads] [-d delay]\n",
+              argv[0]);
+      exit(0);
+    }
+  }
+
+  EventLoop loop;
+  TcpServer server(&loop, InetAddr(port), "CoroutineCgiServer");
+  server.SetLoopNum(thread_num);
+  server.SetConnectionCallback([](TcpConnectionPtr const &conn) {
+    if (conn->IsConnected()) {
+      auto transport = TcpTransport::New(conn);
+      auto codec = new FcgiCodec(transport);
+      SetCoroutineHandler(*codec, transport, Echo);
+      conn->SetContext(codec);
+    } else {
+      delete *AnyCast<FcgiCodec *>(conn->GetContext());
+    }
+  });
+  server.StartRun();
+
+  loop.StartLoop();
+}
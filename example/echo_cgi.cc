@@ -1,4 +1,6 @@
 #include "fcgi/fcgi_codec.h"
+#include "fcgi/fcgi_response_writer.h"
+#include "fcgi/fcgi_socket_server.h"
 
 #include "kanon/net/user_server.h"
 #include "kanon/log/logger.h"
@@ -14,25 +16,16 @@ class EchoCgiServer : kanon::noncopyable {
   EchoCgiServer(EventLoop *loop, InetAddr const &addr)
     : server_(loop, addr, "EchoCgiServer")
   {
-    server_.SetConnectionCallback([](TcpConnectionPtr const &conn) {
+    server_.SetConnectionCallback([](TransportPtr const &conn) {
       if (conn->IsConnected()) {
         auto codec = new FcgiCodec(conn);
         codec->SetRequestHandler(
-            [codec](TcpConnectionPtr const &conn, FcgiRequest request) {
-              std::string buffer;
-              buffer.reserve(4096);
-              buffer.append("Context-Type: text/plain\r\n\r\n");
-              StringView uri(request.param_map["REQUEST_URI"]);
-              StringView message = uri.substr(PATH.size());
-              buffer.append(message.data(), message.size());
-              codec->SendStdout(conn, request, buffer.data(), buffer.size());
-              // codec->SendStdout(conn, request.request_id, "Context-Type: text/plain\r\n\r\n");
-              // codec->SendStdout(conn, request.request_id, message);
-              // codec->SendStdout(conn, request.request_id, in.GetReadBegin(),
-              //                   in.GetReadableSize());
-              // in.AdvanceAll();
-              codec->EndStdout(conn, request);
-              codec->EndRequest(conn, request);
+            [](TransportPtr const &conn, FcgiRequest request) {
+              ResponseWriter writer(conn, request);
+              writer.WriteStdout("Context-Type: text/plain\r\n\r\n");
+              StringView uri = request.Get(Param::RequestUri);
+              writer.WriteStdout(uri.substr(PATH.size()));
+              writer.EndRequest();
             });
         conn->SetContext(codec);
       } else {
@@ -44,7 +37,7 @@ class EchoCgiServer : kanon::noncopyable {
   void Listen() { server_.StartRun(); }
   void SetLoopNum(int num) { server_.SetLoopNum(num); }
  private:
-  TcpServer server_;
+  SocketServer server_;
 };
 
 int main(int argc, char *argv[])
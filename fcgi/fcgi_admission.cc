@@ -0,0 +1,109 @@
+#include "fcgi_admission.h"
+
+#include <atomic>
+
+using namespace fcgi;
+
+static FcgiLimits limits;
+
+static std::atomic<size_t> request_num(0);
+static std::atomic<size_t> buffered_bytes(0);
+
+struct LoopCounter {
+  size_t request_num = 0;
+  size_t buffered_bytes = 0;
+};
+
+/* One loop per thread */
+static thread_local LoopCounter loop_counter;
+
+void AdmissionControl::SetLimits(FcgiLimits const &l) noexcept { limits = l; }
+
+FcgiLimits const &AdmissionControl::GetLimits() noexcept { return limits; }
+
+bool AdmissionControl::Admit() noexcept
+{
+  if (limits.max_loop_requests &&
+      loop_counter.request_num >= limits.max_loop_requests)
+  {
+    return false;
+  }
+
+  if (limits.max_loop_buffered_bytes &&
+      loop_counter.buffered_bytes >= limits.max_loop_buffered_bytes)
+  {
+    return false;
+  }
+
+  if (limits.max_buffered_bytes &&
+      buffered_bytes.load(std::memory_order_relaxed) >=
+          limits.max_buffered_bytes)
+  {
+    return false;
+  }
+
+  auto old = request_num.fetch_add(1, std::memory_order_relaxed);
+  if (limits.max_requests && old >= limits.max_requests) {
+    request_num.fetch_sub(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  ++loop_counter.request_num;
+  return true;
+}
+
+void AdmissionControl::Leave() noexcept
+{
+  --loop_counter.request_num;
+  request_num.fetch_sub(1, std::memory_order_relaxed);
+}
+
+bool AdmissionControl::TryAddBuffered(size_t n) noexcept
+{
+  if (limits.max_loop_buffered_bytes &&
+      loop_counter.buffered_bytes + n > limits.max_loop_buffered_bytes)
+  {
+    return false;
+  }
+
+  auto old = buffered_bytes.fetch_add(n, std::memory_order_relaxed);
+  if (limits.max_buffered_bytes && old + n > limits.max_buffered_bytes) {
+    buffered_bytes.fetch_sub(n, std::memory_order_relaxed);
+    return false;
+  }
+
+  loop_counter.buffered_bytes += n;
+  return true;
+}
+
+void AdmissionControl::AddBuffered(size_t n) noexcept
+{
+  loop_counter.buffered_bytes += n;
+  buffered_bytes.fetch_add(n, std::memory_order_relaxed);
+}
+
+void AdmissionControl::RemoveBuffered(size_t n) noexcept
+{
+  loop_counter.buffered_bytes -= n;
+  buffered_bytes.fetch_sub(n, std::memory_order_relaxed);
+}
+
+size_t AdmissionControl::GetLoopRequestNum() noexcept
+{
+  return loop_counter.request_num;
+}
+
+size_t AdmissionControl::GetRequestNum() noexcept
+{
+  return request_num.load(std::memory_order_relaxed);
+}
+
+size_t AdmissionControl::GetLoopBufferedBytes() noexcept
+{
+  return loop_counter.buffered_bytes;
+}
+
+size_t AdmissionControl::GetBufferedBytes() noexcept
+{
+  return buffered_bytes.load(std::memory_order_relaxed);
+}
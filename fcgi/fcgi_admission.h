@@ -0,0 +1,84 @@
+#ifndef FCGI_ADMISSION_H_
+#define FCGI_ADMISSION_H_
+
+#include <stddef.h>
+
+namespace fcgi {
+
+/*
+ * The limits of the in-flight requests and the bytes buffered by them.
+ * 0 indicates unlimited.
+ * The "loop" limits apply to each IO loop(thread), the "conn" and
+ * "request" limits apply to each connection and request,
+ * the others apply to the whole process.
+ */
+struct FcgiLimits {
+  size_t max_loop_requests = 0;
+  size_t max_requests = 0;
+  size_t max_loop_buffered_bytes = 0;
+  size_t max_buffered_bytes = 0;
+  /* The request ids in use of a connection */
+  size_t max_conn_requests = 0;
+  /* The PARAMS, STDIN and DATA buffered by a request */
+  size_t max_request_buffered_bytes = 0;
+  /* The bytes buffered by the requests and the input of a connection */
+  size_t max_conn_buffered_bytes = 0;
+};
+
+/**
+ * Admission control of requests.
+ *
+ * A request is admitted when its BEGIN_REQUEST arrives and it is
+ * counted until its resource is freed. Once a limit is hit, the codec
+ * rejects the new request with FCGI_OVERLOADED immediately, then the
+ * web server can fail over instead of waiting the timeout.
+ *
+ * The bytes buffered by the requests(the PARAMS, and the STDIN and DATA
+ * not streamed) and the unparsed input of connections are counted.
+ * The buffered limits are hard caps, besides rejecting the new requests,
+ * the request whose content would exceed a budget is failed with
+ * FCGI_OVERLOADED immediately and its buffers are freed, so a client
+ * can't grow the memory without bound by huge PARAMS or lots of ids.
+ *
+ * The counters of loop are thread local, and the global ones are
+ * atomic, so no lock is required.
+ */
+class AdmissionControl {
+ public:
+  /** Must be set before the server starts */
+  static void SetLimits(FcgiLimits const &limits) noexcept;
+  static FcgiLimits const &GetLimits() noexcept;
+
+  /**
+   * Count a new request if no limit is hit
+   * \return false if the request should be rejected
+   */
+  static bool Admit() noexcept;
+
+  /** The request is complete, its buffered bytes must be removed first */
+  static void Leave() noexcept;
+
+  /**
+   * Count \p n bytes if the loop and global budgets allow
+   * \return false if the bytes should not be buffered
+   */
+  static bool TryAddBuffered(size_t n) noexcept;
+
+  static void AddBuffered(size_t n) noexcept;
+  static void RemoveBuffered(size_t n) noexcept;
+
+  /*-----------------------*/
+  /* Queue depth           */
+  /*-----------------------*/
+
+  /** The number of in-flight requests of current loop */
+  static size_t GetLoopRequestNum() noexcept;
+  static size_t GetRequestNum() noexcept;
+
+  static size_t GetLoopBufferedBytes() noexcept;
+  static size_t GetBufferedBytes() noexcept;
+};
+
+} // namespace fcgi
+
+#endif // FCGI_ADMISSION_H_
@@ -0,0 +1,101 @@
+#ifndef FCGI_CANCEL_TOKEN_H_
+#define FCGI_CANCEL_TOKEN_H_
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "kanon/util/noncopyable.h"
+
+namespace fcgi {
+
+class FcgiCodec;
+class ResponseWriter;
+
+/**
+ * The state of a request shared by the codec and the handler.
+ *
+ * The web server may abort a request(FCGI_ABORT_REQUEST) that is being
+ * processed. The handler can poll IsCancelled() in the long computation,
+ * or register a callback by OnCancel().
+ *
+ * END_REQUEST is sent exactly once, either by the codec when the
+ * request is aborted or by the handler, whichever is first.
+ */
+class CancelToken : kanon::noncopyable {
+  friend class FcgiCodec;
+  friend class ResponseWriter;
+
+ public:
+  using Callback = std::function<void()>;
+
+  bool IsCancelled() const noexcept
+  {
+    return state_.load(std::memory_order_acquire) == ABORTED;
+  }
+
+  /**
+   * \p cb is called in the loop of connection when the request is
+   * aborted, or called immediately if it has been aborted.
+   */
+  void OnCancel(Callback cb)
+  {
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      if (!IsCancelled()) {
+        callbacks_.emplace_back(std::move(cb));
+        return;
+      }
+    }
+
+    cb();
+  }
+
+ private:
+  enum State : int {
+    ACTIVE = 0,
+    ENDED,   /* END_REQUEST has been sent by the handler */
+    ABORTED, /* END_REQUEST has been sent by the codec */
+  };
+
+  /** \return false if the request has been ended or aborted */
+  bool TryEnd() noexcept { return Transit(ENDED); }
+  bool TryCancel() noexcept { return Transit(ABORTED); }
+
+  bool Transit(State state) noexcept
+  {
+    int expected = ACTIVE;
+    return state_.compare_exchange_strong(expected, state,
+                                          std::memory_order_acq_rel);
+  }
+
+  /* Call the callbacks after TryCancel() */
+  void Notify()
+  {
+    std::vector<Callback> callbacks;
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      callbacks.swap(callbacks_);
+    }
+
+    for (auto &cb : callbacks) {
+      cb();
+    }
+  }
+
+  /* Reused by next request, the capacity is kept */
+  void Reset() noexcept
+  {
+    state_.store(ACTIVE, std::memory_order_relaxed);
+    callbacks_.clear();
+  }
+
+  std::atomic<int> state_{ACTIVE};
+  std::mutex mutex_;
+  std::vector<Callback> callbacks_;
+};
+
+} // namespace fcgi
+
+#endif // FCGI_CANCEL_TOKEN_H_
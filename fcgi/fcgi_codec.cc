@@ -1,365 +1,1153 @@
 #include "fcgi_codec.h"
 
+#include <algorithm>
+#include <endian.h>
+#include <sys/stat.h>
+
+#include "fcgi_admission.h"
+#include "fcgi_record.h"
+#include "fcgi_trace.h"
+
 #include "kanon/log/logger.h"
-#include "kanon/net/tcp_connection.h"
+#include "kanon/net/event_loop.h"
+#include "kanon/net/endian_api.h"
 
 using namespace kanon;
 using namespace fcgi;
 
-static constexpr int FCGI_RECORD_HEADER_LENGTH = sizeof(RecordHeader);
-static constexpr int FCGI_BEGIN_REQUEST_BODY_LENGTH = sizeof(BeginRequestBody);
-static constexpr int FCGI_END_REQUEST_BODY_LENGTH = sizeof(EndRequestBody);
-static constexpr int FCGI_UNKNOWN_TYPE_BODY_LENGTH = sizeof(UnknownTypeBody);
-static constexpr int FCGI_UNKNOWN_RECORD_LENGTH = sizeof(UnknownTypeRecord);
-static constexpr uint16_t MAX_CONTENT_LENGTH = (uint16_t)-1;
-
-static_assert(FCGI_RECORD_HEADER_LENGTH == 8,
-              "The length of record header must be 8 bytes");
-static_assert(FCGI_BEGIN_REQUEST_BODY_LENGTH == 8,
-              "The length of BEGIN_REQUEST body must be 8 bytes");
-static_assert(FCGI_END_REQUEST_BODY_LENGTH == 8,
-              "The length of END_REQUEST body must be 8 bytes");
-static_assert(FCGI_UNKNOWN_TYPE_BODY_LENGTH == 8,
-              "The length of UNKNOWN_TYPE body must be 8 bytes");
-static_assert(FCGI_UNKNOWN_RECORD_LENGTH ==
-                  FCGI_RECORD_HEADER_LENGTH + FCGI_UNKNOWN_TYPE_BODY_LENGTH,
-              "The length of UnknownType record must equal to the "
-              "(FCGI_RECORD_HEADER_LENGTH + FCGI_UNKNOWN_TYPE_BODY_LENGTH)");
-static_assert(MAX_CONTENT_LENGTH == 65535,
-              "MAX_CONTENT_LENGTH must equal  to maximum of the uint16_t");
-
-#define PARSE_ERR -1
-#define PARSE_SHORT 1
-#define PARSE_OK 0
-#define PARSE_OK_PARTLY 2
-
-FcgiCodec::FcgiCodec(TcpConnectionPtr const &conn)
-{
-  conn->SetMessageCallback(
-      [this](TcpConnectionPtr const &conn, Buffer &buffer, TimeStamp) {
-        for (;;) {
-          switch (ParseRequest(conn, buffer)) {
-            case PARSE_ERR:
-            {
-              LOG_ERROR << "Parse error";
-              return;
-            } break;
-            case PARSE_SHORT:
-            {
-              LOG_TRACE << "Parse short, waiting entire message";
-              return;
-            } break;
-
-            case PARSE_OK_PARTLY:
-            {
-              LOG_TRACE << "Parse ok partly, receive request part";
-            } break;
-
-            case PARSE_OK:
-            {
-              LOG_TRACE << "Parse ok complete, receive entire request";
-            } break;
-          }
-        }
-      });
-}
-
-int FcgiCodec::ParseRequest(TcpConnectionPtr const &conn, Buffer &buffer)
-{
-  uint32_t required_length = 0;
-  if (buffer.GetReadableSize() >= FCGI_RECORD_HEADER_LENGTH) {
-    /* Parse record header */
-    RecordHeader header;
-    memcpy(&header, buffer.GetReadBegin(), FCGI_RECORD_HEADER_LENGTH);
-    header.request_id = sock::ToHostByteOrder16(header.request_id);
-    header.content_length = sock::ToHostByteOrder16(header.content_length);
-
-    /* We parse entire message only when the buffer has required_length content
-     * at least */
-    required_length = header.content_length + header.padding_length +
-                      FCGI_RECORD_HEADER_LENGTH;
-    if (buffer.GetReadableSize() < required_length) return PARSE_SHORT;
-
-    LOG_TRACE << "Version: " << header.version;
-    LOG_TRACE << "Type: " << FcgiType2String((FcgiType)header.type);
-    LOG_TRACE << "Request id: " << header.request_id;
-    LOG_TRACE << "Content length: " << header.content_length;
-    LOG_TRACE << "Padding length: " << header.padding_length;
-
-    /* Header has consumed */
-    buffer.AdvanceRead(FCGI_RECORD_HEADER_LENGTH);
-    /* Convenient for advance later */
-    required_length -= FCGI_RECORD_HEADER_LENGTH;
-
-    switch (header.type) {
-      case FCGI_BEGIN_REQUEST:
-      {
-        BeginRequestBody body;
-        memcpy(&body, buffer.GetReadBegin(), FCGI_BEGIN_REQUEST_BODY_LENGTH);
-        body.role = sock::ToHostByteOrder32(body.role);
-        LOG_TRACE << "Role: " << body.role;
-        LOG_TRACE << "IsKeepConn: " << IsKeepConnection(body.flags);
-        auto &request = request_map_[header.request_id];
-        request.role = (FcgiRole)body.role;
-        request.request_id = header.request_id;
-        request.flags = body.flags;
-      } break;
-
-      case FCGI_ABORT_REQUEST:
-      {
-        /* FIXME */
-        RemoveRequest(header.request_id);
-        EndRequest(conn, header.request_id, 0, FCGI_REQUEST_COMPLETE);
-      } break;
+/* Reported in FCGI_GET_VALUES_RESULT */
+static FcgiValues fcgi_values;
 
-      case FCGI_PARAMS:
-      {
-        auto &request = request_map_[header.request_id];
-        if (header.content_length > 0) {
-          request.param_stream.Append(buffer.GetReadBegin(),
-                                      header.content_length);
-        } else {
-          /* Terminator of the FCGI_PARAMS */
-          LOG_TRACE << "Terminator of PARAMS";
-          /* NOTICE
-           * ParseParams will advance read index
-           * return parse result early */
-          ParseParams(request);
-          request.param_stream.Shrink(0);
-          buffer.AdvanceRead(header.padding_length);
-          return PARSE_OK_PARTLY;
-        }
-      } break;
 
-      case FCGI_STDIN:
-      {
-        auto &request = request_map_[header.request_id];
-        if (header.content_length > 0) {
-          request.stdin_stream.Append(buffer.GetReadBegin(),
-                                      header.content_length);
-        } else {
-          /* Request complete, can process it */
-          request.codec = this;
-          buffer.AdvanceRead(required_length);
-          request_handler_(conn, std::move(request));
-          return PARSE_OK;
-        }
+FcgiCodec::FcgiCodec(TransportPtr const &conn)
+  : transport_(conn)
+  , loop_(conn->GetLoop())
+{
+  conn->SetMessageCallback([this](TransportPtr const &conn, char const *data,
+                                  size_t len, TimeStamp receive_time) {
+    return OnMessage(conn, data, len, receive_time);
+  });
+  conn->SetWriteCompleteCallback([this](TransportPtr const &) {
+    OnWriteComplete();
+  });
+}
 
-      } break;
+FcgiCodec::FcgiCodec(EventLoop *loop)
+  : loop_(loop)
+{
+}
 
-      case FCGI_DATA:
-      {
+FcgiCodec::~FcgiCodec() noexcept
+{
+  /* The transport may be held by the handler */
+  if (transport_) {
+    transport_->SetMessageCallback(nullptr);
+    transport_->SetWriteCompleteCallback(nullptr);
+    transport_->SetOutputScheduler(nullptr);
+  }
 
-      } break;
+  SetInputBuffered(0);
 
-      /* Management record */
-      case FCGI_GET_VALUES:
-      {
+  request_map_.ForEach([](RequestSlot *slot) {
+    if (!slot->dispatched || slot->released) {
+      FreeSlot(slot);
+    } else {
+      /* The handler still references it, it is freed when released */
+      slot->codec = nullptr;
+    }
+  });
+}
+
+void FcgiCodec::OnMessage(TransportPtr const &conn, Buffer &buffer,
+                          TimeStamp receive_time)
+{
+  buffer.AdvanceRead(OnMessage(conn, buffer.GetReadBegin(),
+                               buffer.GetReadableSize(), receive_time));
+}
+
+size_t FcgiCodec::OnMessage(TransportPtr const &conn, char const *data,
+                            size_t len, TimeStamp receive_time)
+{
+  /* The records can't be trusted after a malformed one */
+  if (broken_) return len;
+
+  if (FcgiStats::IsEnabled()) {
+    receive_time_ = receive_time.IsValid()
+                        ? receive_time.GetMicrosecondsSinceEpoch()
+                        : FcgiStats::Now();
+  }
+
+  /* Decode the headers of all complete records first, then apply them in
+   * one pass. The contents are referenced in place, the input is consumed
+   * once the batch is done. */
+  char const *base = data;
+  ScanRecords(base, len);
+
+  size_t i = 0;
+  /* The handler may pause reading during parsing */
+  while (i < records_.size() && !paused_) {
+    auto n = AppendRecords(conn, i, base);
+    if (n > 0) {
+      i += n;
+      continue;
+    }
+
+    auto const &record = records_[i++];
+    if (!HandleRecord(conn, record, base + record.offset)) {
+      LOG_ERROR << "Parse error, the input of connection is discarded";
+      broken_ = true;
+      conn->StopRead();
+      Close(conn, nullptr);
+      SetInputBuffered(0);
+      return len;
+    }
+  }
+
+  size_t consumed = 0;
+  if (i > 0) {
+    auto const &last = records_[i - 1];
+    consumed = last.offset + last.content_length + last.padding_length;
+  }
+
+  if (i == records_.size() && len > consumed) {
+    /* Waiting entire record */
+    FCGI_TRACE(ParseShort, 0, len - consumed, 0);
+  }
+
+  FcgiStats::Add(Counter::BytesIn, consumed);
+  SetInputBuffered(len - consumed);
+  return consumed;
+}
+
+void FcgiCodec::ScanRecords(char const *data, size_t len)
+{
+  records_.clear();
+
+  size_t pos = 0;
+  while (len - pos >= FCGI_RECORD_HEADER_LENGTH) {
+    /* Swap all fields of header at once instead of one by one:
+     * version | type | request_id | content_length | padding | reserved */
+    uint64_t header;
+    memcpy(&header, data + pos, FCGI_RECORD_HEADER_LENGTH);
+    header = be64toh(header);
+
+    RecordInfo record;
+    record.type = header >> 48;
+    record.request_id = header >> 32;
+    record.content_length = header >> 16;
+    record.padding_length = header >> 8;
+
+    size_t record_length = FCGI_RECORD_HEADER_LENGTH +
+                           record.content_length + record.padding_length;
+    if (len - pos < record_length) break;
+
+    record.offset = pos + FCGI_RECORD_HEADER_LENGTH;
+    records_.push_back(record);
+    pos += record_length;
+  }
+}
 
-      } break;
+size_t FcgiCodec::AppendRecords(TransportPtr const &conn, size_t first,
+                                char const *base)
+{
+  auto const &head = records_[first];
+  if (head.content_length == 0) return 0;
 
-        /* Unknown type request */
-      default:
+  /* Only the contents buffered in the undispatched request are merged,
+   * the others are handled one by one */
+  auto slot = request_map_.Find(head.request_id);
+  if (!slot || slot->dispatched) return 0;
+
+  auto &request = slot->data;
+  switch (head.type) {
+    case FCGI_PARAMS:
+      break;
+    case FCGI_STDIN:
+      if (IsStdinStreamed(request)) return 0;
+      break;
+    case FCGI_DATA:
+      if (data_handler_ || request.role != FCGI_FILTER ||
+          !slot->stdin_complete)
       {
-        UnknownTypeRecord unknown_record{
-            .header{
-                .version = FCGI_VERSION_1,
-                .type = FCGI_UNKNOWN_TYPE,
-                .request_id = sock::ToHostByteOrder16(header.request_id),
-                .content_length =
-                    sock::ToHostByteOrder16(FCGI_UNKNOWN_TYPE_BODY_LENGTH),
-                .padding_length = 0,
-                .reserved = 0,
-            },
-            .body{
-                .type = header.type,
-                .reserved = {0, 0, 0, 0, 0, 0, 0},
-            }};
-
-        conn->Send(&unknown_record, FCGI_UNKNOWN_RECORD_LENGTH);
-        RemoveRequest(header.request_id);
-        Close(conn, nullptr);
+        return 0;
       }
-    }
+      break;
+    default:
+      return 0;
+  }
 
-    if (buffer.GetReadableSize() >= required_length) {
-      LOG_TRACE << "advanced length = " << required_length;
-      buffer.AdvanceRead(required_length);
+  /* The following records of the same stream, e.g. the PARAMS or STDIN
+   * split into many records by the web server */
+  size_t last = first + 1;
+  size_t total = head.content_length;
+  for (; last < records_.size(); ++last) {
+    auto const &record = records_[last];
+    if (record.type != head.type || record.request_id != head.request_id ||
+        record.content_length == 0)
+    {
+      break;
     }
+    total += record.content_length;
+  }
+
+  if (!AddBuffered(slot, total)) {
+    RejectOverBudget(conn, slot, total);
+    return last - first;
+  }
+
+  Buffer *stream = nullptr;
+  if (head.type == FCGI_PARAMS) {
+    request.params.Reserve(total);
+  } else {
+    stream = (head.type == FCGI_STDIN) ? &request.stdin_stream
+                                       : &request.data_stream;
+    stream->ReserveWriteSpace(total);
+  }
+
+  for (size_t i = first; i < last; ++i) {
+    auto const &record = records_[i];
+    FCGI_TRACE(RecordIn, record.request_id, record.content_length,
+               record.type);
 
-    return PARSE_OK_PARTLY;
+    if (stream) {
+      stream->Append(base + record.offset, record.content_length);
+    } else {
+      request.params.Append(base + record.offset, record.content_length);
+    }
   }
 
-  return PARSE_SHORT;
+  return last - first;
 }
 
-static uint32_t ReadNamePairLength(Buffer &buffer)
+bool FcgiCodec::HandleRecord(TransportPtr const &conn,
+                             RecordInfo const &record, char const *content)
 {
-  assert(buffer.GetReadableSize() >= 1);
-  auto len8 = buffer.GetReadBegin8();
-  if ((len8 >> 7) == 1) {
-    assert(buffer.GetReadableSize() >= 4);
-    /* Clear the highest bit */
-    return buffer.Read32() & 0x7fffffff;
+  FCGI_TRACE(RecordIn, record.request_id, record.content_length, record.type);
+
+  switch (record.type) {
+    case FCGI_BEGIN_REQUEST:
+    {
+      if (record.content_length < FCGI_BEGIN_REQUEST_BODY_LENGTH) {
+        LOG_ERROR << "Malformed BEGIN_REQUEST of request: "
+                  << record.request_id;
+        return false;
+      }
+
+      BeginRequestBody body;
+      memcpy(&body, content, FCGI_BEGIN_REQUEST_BODY_LENGTH);
+      body.role = sock::ToHostByteOrder16(body.role);
+
+      if (body.role < FCGI_RESPONDER || body.role > FCGI_FILTER) {
+        LOG_WARN << "Unknown role " << body.role
+                 << " of request: " << record.request_id;
+        RemoveRequest(record.request_id);
+        FCGI_TRACE(Reject, record.request_id, 0, FCGI_UNKNOWN_ROLE);
+        EndRequest(conn, record.request_id, 0, FCGI_UNKNOWN_ROLE);
+        break;
+      }
+
+      auto slot = request_map_.Find(record.request_id);
+      if (slot && slot->dispatched) {
+        /* The id is reused before the handler releases the request */
+        request_map_.Remove(record.request_id);
+        buffered_ -= slot->buffered;
+        slot->codec = nullptr;
+        slot = nullptr;
+      }
+
+      if (slot) {
+        AdmissionControl::RemoveBuffered(slot->buffered);
+        buffered_ -= slot->buffered;
+        slot->Reset();
+      } else {
+        auto status = AdmitRequest();
+        if (status != FCGI_REQUEST_COMPLETE) {
+          LOG_WARN << "Reject request " << record.request_id << ": "
+                   << FcgiProtocolStatus2String(status);
+          FCGI_TRACE(Reject, record.request_id, 0, status);
+          EndRequest(conn, record.request_id, 0, status);
+          FcgiStats::Add(Counter::Rejected);
+          break;
+        }
+
+        slot = AcquireSlot();
+        request_map_.Insert(record.request_id, slot);
+      }
+
+      /* Reset() clears the owner also */
+      slot->codec = this;
+      slot->loop = loop_;
+
+      auto &request = slot->data;
+      request.token = slot->token;
+      request.times = RequestTimes();
+      request.times.begin_time = receive_time_;
+      request.role = (FcgiRole)body.role;
+      request.request_id = record.request_id;
+      request.flags = body.flags;
+    } break;
+
+    case FCGI_ABORT_REQUEST:
+    {
+      AbortRequest(conn, record.request_id);
+    } break;
+
+    case FCGI_PARAMS:
+    {
+      auto slot = request_map_.Find(record.request_id);
+      if (!slot || slot->dispatched) {
+        /* e.g. The request is rejected */
+        FCGI_TRACE(UnknownRequest, record.request_id, 0, record.type);
+        break;
+      }
+
+      auto &request = slot->data;
+      if (record.content_length > 0) {
+        if (!AddBuffered(slot, record.content_length)) {
+          RejectOverBudget(conn, slot, record.content_length);
+          break;
+        }
+        request.params.Append(content, record.content_length);
+      } else {
+        /* Terminator of the FCGI_PARAMS */
+        if (!ParseParams(request)) {
+          /* Only the request is failed, the records are still framed */
+          auto id = record.request_id;
+          LOG_ERROR << "Malformed PARAMS of request: " << id;
+          EraseSlot(slot);
+          FCGI_TRACE(Reject, id, 0, FCGI_REQUEST_COMPLETE);
+          EndRequest(conn, id, 1, FCGI_REQUEST_COMPLETE);
+          break;
+        }
+        request.times.params_time = FcgiStats::Now();
+
+        /* In streaming mode, process request before receiving STDIN */
+        if (IsStdinStreamed(request)) DispatchRequest(conn, *slot);
+      }
+    } break;
+
+    case FCGI_STDIN:
+    {
+      auto slot = request_map_.Find(record.request_id);
+      if (!slot) {
+        FCGI_TRACE(UnknownRequest, record.request_id, 0, record.type);
+        break;
+      }
+
+      StringView chunk(content, record.content_length);
+      if (IsStdinStreamed(slot->data)) {
+        if (!slot->dispatched) {
+          LOG_WARN << "STDIN before PARAMS complete, request: "
+                   << record.request_id;
+          break;
+        }
+
+        stdin_handler_(conn, record.request_id, chunk);
+        if (chunk.empty()) {
+          /* The slot may be removed by the handler */
+          slot = request_map_.Find(record.request_id);
+          if (slot) {
+            slot->stdin_complete = true;
+            if (slot->released && slot->IsInputComplete()) EraseSlot(slot);
+          }
+        }
+      } else if (slot->dispatched) {
+        LOG_WARN << "STDIN of processing request: " << record.request_id;
+      } else if (record.content_length > 0) {
+        if (!AddBuffered(slot, chunk.size())) {
+          RejectOverBudget(conn, slot, chunk.size());
+          break;
+        }
+        slot->data.stdin_stream.Append(chunk.data(), chunk.size());
+      } else {
+        slot->stdin_complete = true;
+        slot->data.times.stdin_time = FcgiStats::Now();
+        /* The filter request is complete when the FCGI_DATA is complete,
+         * unless the FCGI_DATA is streamed */
+        if (slot->data.role != FCGI_FILTER || data_handler_) {
+          DispatchRequest(conn, *slot);
+        }
+      }
+    } break;
+
+    case FCGI_DATA:
+    {
+      auto slot = request_map_.Find(record.request_id);
+      if (!slot) {
+        FCGI_TRACE(UnknownRequest, record.request_id, 0, record.type);
+        break;
+      }
+
+      if (slot->data.role != FCGI_FILTER) {
+        LOG_WARN << "DATA of non-filter request: " << record.request_id;
+        break;
+      }
+
+      if (!slot->stdin_complete) {
+        LOG_WARN << "DATA before STDIN complete, request: "
+                 << record.request_id;
+        break;
+      }
+
+      /* The buffered request is dispatched once the FCGI_DATA is complete,
+       * the following DATA belongs to nothing */
+      if (slot->dispatched && !data_handler_) {
+        LOG_WARN << "DATA of processing request: " << record.request_id;
+        break;
+      }
+
+      StringView chunk(content, record.content_length);
+      if (data_handler_) {
+        /* The request has been dispatched when the STDIN is complete */
+        data_handler_(conn, record.request_id, chunk);
+        if (chunk.empty()) {
+          slot = request_map_.Find(record.request_id);
+          if (slot) {
+            slot->data_complete = true;
+            if (slot->released) EraseSlot(slot);
+          }
+        }
+      } else if (record.content_length > 0) {
+        if (!AddBuffered(slot, chunk.size())) {
+          RejectOverBudget(conn, slot, chunk.size());
+          break;
+        }
+        slot->data.data_stream.Append(chunk.data(), chunk.size());
+      } else {
+        /* Filter request complete, can process it */
+        slot->data_complete = true;
+        DispatchRequest(conn, *slot);
+      }
+    } break;
+
+    /* Management record */
+    case FCGI_GET_VALUES:
+    {
+      HandleGetValues(conn, content, record.content_length);
+    } break;
+
+      /* Unknown type request */
+    default:
+    {
+      UnknownTypeRecord unknown_record{
+          .header{
+              .version = FCGI_VERSION_1,
+              .type = FCGI_UNKNOWN_TYPE,
+              .request_id = sock::ToHostByteOrder16(record.request_id),
+              .content_length =
+                  sock::ToHostByteOrder16(FCGI_UNKNOWN_TYPE_BODY_LENGTH),
+              .padding_length = 0,
+              .reserved = 0,
+          },
+          .body{
+              .type = record.type,
+              .reserved = {0, 0, 0, 0, 0, 0, 0},
+          }};
+
+      conn->Send(&unknown_record, FCGI_UNKNOWN_RECORD_LENGTH);
+      FcgiStats::Add(Counter::BytesOut, FCGI_UNKNOWN_RECORD_LENGTH);
+      RemoveRequest(record.request_id);
+      Close(conn, nullptr);
+    }
   }
-  return buffer.Read8();
+
+  return true;
 }
 
 bool FcgiCodec::ParseParams(RequestData &data)
 {
-  auto &stream = data.param_stream;
-  uint32_t name_len = 0;
-  uint32_t value_len = 0;
-  std::string name;
-  std::string value;
-  while (stream.GetReadableSize() > 0) {
-    name_len = ReadNamePairLength(stream);
-    value_len = ReadNamePairLength(stream);
-    name = stream.RetrieveAsString(name_len);
-    value = stream.RetrieveAsString(value_len);
-    LOG_TRACE << name << ": " << value;
-    data.param_map[std::move(name)] = std::move(value);
+  /* The names and values are referenced in place, don't copy them */
+  if (!data.params.Parse()) return false;
+  FCGI_TRACE(ParamsComplete, data.request_id, data.params.size(), 0);
+  return true;
+}
+
+/* The values set, bounded by the limits of AdmissionControl in effect */
+static FcgiValues GetEffectiveValues() noexcept
+{
+  auto values = fcgi_values;
+  auto const &limits = AdmissionControl::GetLimits();
+  if (limits.max_requests && limits.max_requests < values.max_reqs) {
+    values.max_reqs = (uint32_t)limits.max_requests;
   }
 
-  return true;
+  /* The connections more than it can't be served at the same time */
+  values.max_conns = std::min(values.max_conns, values.max_reqs);
+
+  /* The second request of a connection is rejected */
+  if (limits.max_conn_requests == 1) values.mpxs_conns = false;
+  return values;
 }
 
-static inline void SendStream(TcpConnectionPtr const &conn, FcgiType type,
-                              uint16_t id, char const *data, size_t len)
-{
-  int count = len / MAX_CONTENT_LENGTH + 1;
-  size_t has_written = 0;
-  for (int i = 0; i < count; ++i) {
-    ChunkList output;
-    uint16_t clen =
-        ((i == count - 1) ? (uint16_t)len : (uint16_t)MAX_CONTENT_LENGTH);
-    RecordHeader header{
-        .version = FCGI_VERSION_1,
-        .type = type,
-        .request_id = id,
-        .content_length = clen,
-        .padding_length = (uint8_t)(-clen & 7), /* completion of 8 */
-        .reserved = 0,
-    };
-
-    LOG_TRACE << "ContentLength = " << header.content_length;
-    LOG_TRACE << "PaddingLength = " << header.padding_length;
-
-    header.content_length = sock::ToNetworkByteOrder16(header.content_length);
-    header.request_id = sock::ToNetworkByteOrder16(header.request_id);
-
-    output.Append(&header, FCGI_RECORD_HEADER_LENGTH);
-    /* The header.content_length has converted to network byteorder */
-    output.Append(data + has_written, clen);
-    has_written += clen;
-    LOG_TRACE << "has_written = " << has_written;
-    output.Append("\0\0\0\0\0\0\0\0", header.padding_length);
-    conn->Send(output);
-    len -= clen;
+void FcgiCodec::HandleGetValues(TransportPtr const &conn,
+                                char const *data, size_t len)
+{
+  FcgiParams query;
+  query.Append(data, len);
+  if (!query.Parse()) {
+    LOG_ERROR << "Malformed GET_VALUES";
+    return;
   }
+
+  /* The unknown variables are ignored */
+  auto values = GetEffectiveValues();
+  Buffer result;
+  for (auto pair : query) {
+    LOG_TRACE << "GET_VALUES: " << pair.name;
+    if (pair.name == StringView(FCGI_MAX_CONNS)) {
+      AppendNameValuePair(result, pair.name,
+                          std::to_string(values.max_conns));
+    } else if (pair.name == StringView(FCGI_MAX_REQS)) {
+      AppendNameValuePair(result, pair.name, std::to_string(values.max_reqs));
+    } else if (pair.name == StringView(FCGI_MPXS_CONNS)) {
+      AppendNameValuePair(result, pair.name, values.mpxs_conns ? "1" : "0");
+    } else if (pair.name == StringView(FCGI_QUEUE_DEPTH)) {
+      AppendNameValuePair(result, pair.name,
+                          std::to_string(AdmissionControl::GetRequestNum()));
+    }
+  }
+
+  ChunkList output;
+  if (result.GetReadableSize() > 0) {
+    AppendStreamRecords(output, FCGI_GET_VALUES_RESULT, FCGI_NULL_REQUEST_ID,
+                        result.GetReadBegin(), result.GetReadableSize());
+  } else {
+    /* No variable is known */
+    AppendTerminator(output, FCGI_GET_VALUES_RESULT, FCGI_NULL_REQUEST_ID);
+  }
+  FcgiStats::Add(Counter::BytesOut, output.GetReadableSize());
+  conn->Send(output);
+}
+
+void FcgiCodec::SetValues(FcgiValues const &values) noexcept
+{
+  fcgi_values = values;
+}
+
+FcgiValues const &FcgiCodec::GetValues() noexcept { return fcgi_values; }
+
+/* The request of \p token may be aborted after it is checked in other
+ * thread, the codec has sent the END_REQUEST then. Check it again in the
+ * loop, the same as ResponseWriter::Flush(). */
+static void SendRecords(TransportPtr const &conn, uint16_t id,
+                        ChunkList &output,
+                        std::shared_ptr<CancelToken> const &token)
+{
+  auto loop = conn->GetLoop();
+  if (!token || loop->IsLoopInThread()) {
+    FcgiStats::Add(Counter::BytesOut, output.GetReadableSize());
+    OutputScheduler::Send(conn, id, output);
+    return;
+  }
+
+  auto moved = std::make_shared<ChunkList>(std::move(output));
+  loop->QueueToLoop([conn, id, moved, token]() {
+    if (token->IsCancelled()) return;
+    FcgiStats::Add(Counter::BytesOut, moved->GetReadableSize());
+    OutputScheduler::Send(conn, id, *moved);
+  });
+}
+
+static inline void
+SendStream(TransportPtr const &conn, FcgiType type, uint16_t id,
+           char const *data, size_t len,
+           std::shared_ptr<CancelToken> const &token = nullptr)
+{
+  /* Send all records at once instead of one send per record */
+  ChunkList output;
+  AppendStreamRecords(output, type, id, data, len);
+  if (output.GetReadableSize() > 0) SendRecords(conn, id, output, token);
+}
+
+static inline void
+SendStream(TransportPtr const &conn, FcgiType type, uint16_t id,
+           ChunkList &payload,
+           std::shared_ptr<CancelToken> const &token = nullptr)
+{
+  ChunkList output;
+  AppendStreamRecords(output, type, id, payload);
+  if (output.GetReadableSize() > 0) SendRecords(conn, id, output, token);
 }
 
-void FcgiCodec::SendStdout(TcpConnectionPtr const &conn, uint16_t id,
+void FcgiCodec::SendStdout(TransportPtr const &conn, uint16_t id,
                            char const *data, size_t len)
 {
-  LOG_TRACE << "stdout";
   SendStream(conn, FCGI_STDOUT, id, data, len);
 }
 
-void FcgiCodec::SendStdout(TcpConnectionPtr const &conn, uint16_t id,
+void FcgiCodec::SendStdout(TransportPtr const &conn,
+                           FcgiRequest const &request, char const *data,
+                           size_t len)
+{
+  if (request.IsAborted()) return;
+  SendStream(conn, FCGI_STDOUT, request.request_id, data, len, request.token);
+}
+
+void FcgiCodec::SendStdout(TransportPtr const &conn, uint16_t id,
                            ChunkList &output)
 {
+  SendStream(conn, FCGI_STDOUT, id, output);
+}
+
+void FcgiCodec::SendStdout(TransportPtr const &conn,
+                           FcgiRequest const &request, ChunkList &output)
+{
+  if (request.IsAborted()) return;
+  SendStream(conn, FCGI_STDOUT, request.request_id, output, request.token);
 }
 
-void FcgiCodec::SendStderr(TcpConnectionPtr const &conn, uint16_t id,
+/* The content length of records framing a file except the last one, the
+ * multiple of 8 needs no padding, so the pieces of file are contiguous */
+static constexpr uint16_t FILE_RECORD_LENGTH = MAX_CONTENT_LENGTH & ~7;
+
+static void SendFileRecords(TransportPtr const &conn, uint16_t id,
+                            FileHandlePtr const &file, off_t offset,
+                            size_t len)
+{
+  /* Framed by the scheduler when it is sent */
+  auto scheduler = conn->GetOutputScheduler();
+  if (scheduler) {
+    FcgiStats::Add(Counter::BytesOut, len);
+    scheduler->EnqueueFile(id, file, offset, len);
+    return;
+  }
+
+  ChunkList head;
+  uint8_t padding = 0;
+
+  while (len > 0) {
+    uint16_t clen = len > FILE_RECORD_LENGTH ? FILE_RECORD_LENGTH : len;
+    padding = AppendRecordHeader(head, FCGI_STDOUT, id, clen);
+    FcgiStats::Add(Counter::BytesOut,
+                   FCGI_RECORD_HEADER_LENGTH + clen + padding);
+    conn->SendFile(head, file, offset, clen);
+    offset += clen;
+    len -= clen;
+  }
+
+  if (padding > 0) {
+    AppendPadding(head, padding);
+    conn->Send(head);
+  }
+}
+
+bool FcgiCodec::SendStdoutFile(TransportPtr const &conn, uint16_t id, int fd,
+                               off_t offset, size_t len,
+                               std::shared_ptr<CancelToken> const &token)
+{
+  struct stat st;
+  if (::fstat(fd, &st) < 0) {
+    LOG_SYSERROR << "Failed to stat file " << fd;
+    return false;
+  }
+
+  if (!S_ISREG(st.st_mode) || offset < 0 ||
+      (uint64_t)offset + len > (uint64_t)st.st_size)
+  {
+    LOG_ERROR << "The region [" << offset << ", " << offset + len
+              << ") isn't in the regular file " << fd;
+    return false;
+  }
+
+  if (len == 0) return true;
+
+  /* Shared by the records, the pending sends hold it */
+  auto file = FileHandle::Dup(fd);
+  if (!file) return false;
+
+  auto loop = conn->GetLoop();
+  if (loop->IsLoopInThread()) {
+    SendFileRecords(conn, id, file, offset, len);
+    return true;
+  }
+
+  /* e.g. In worker thread.
+   * Frame all records in the loop instead of one post per record */
+  loop->QueueToLoop([conn, id, file, offset, len, token]() {
+    if (token && token->IsCancelled()) return;
+    SendFileRecords(conn, id, file, offset, len);
+  });
+  return true;
+}
+
+void FcgiCodec::SendStderr(TransportPtr const &conn, uint16_t id,
                            char const *data, size_t len)
 {
-  LOG_TRACE << "stderr";
   SendStream(conn, FCGI_STDERR, id, data, len);
 }
 
-void FcgiCodec::SendStderr(TcpConnectionPtr const &conn, uint16_t id,
-                           ChunkList &output)
+void FcgiCodec::SendStderr(TransportPtr const &conn,
+                           FcgiRequest const &request, char const *data,
+                           size_t len)
 {
+  if (request.IsAborted()) return;
+  SendStream(conn, FCGI_STDERR, request.request_id, data, len, request.token);
 }
 
-static inline void EndTerminator(TcpConnectionPtr const &conn, FcgiType type,
-                                 uint16_t id)
+void FcgiCodec::SendStderr(TransportPtr const &conn, uint16_t id,
+                           ChunkList &output)
 {
-  LOG_TRACE << FcgiType2String(type);
-  RecordHeader header{
-      .version = FCGI_VERSION_1,
-      .type = type,
-      .request_id = id,
-      .content_length = 0,
-      .padding_length = 0,
-      .reserved = 0,
-  };
+  SendStream(conn, FCGI_STDERR, id, output);
+}
 
-  LOG_TRACE << "request_id = " << header.request_id;
-  header.request_id = sock::ToNetworkByteOrder16(header.request_id);
+void FcgiCodec::SendStderr(TransportPtr const &conn,
+                           FcgiRequest const &request, ChunkList &output)
+{
+  if (request.IsAborted()) return;
+  SendStream(conn, FCGI_STDERR, request.request_id, output, request.token);
+}
 
-  conn->Send(&header, FCGI_RECORD_HEADER_LENGTH);
+static inline void
+EndTerminator(TransportPtr const &conn, FcgiType type, uint16_t id,
+              std::shared_ptr<CancelToken> const &token = nullptr)
+{
+  ChunkList output;
+  AppendTerminator(output, type, id);
+  SendRecords(conn, id, output, token);
 }
 
-void FcgiCodec::EndRequest(TcpConnectionPtr const &conn, uint16_t id,
+void FcgiCodec::EndRequest(TransportPtr const &conn, uint16_t id,
                            uint32_t as, FcgiProtocolStatus ps)
 {
-  LOG_TRACE << "Send END_REQUEST Message";
-  LOG_TRACE << "request_id = " << id;
-
-  RecordHeader header{
-      .version = FCGI_VERSION_1,
-      .type = FCGI_END_REQUEST,
-      .request_id = sock::ToNetworkByteOrder16(id),
-      .content_length =
-          sock::ToNetworkByteOrder16(FCGI_END_REQUEST_BODY_LENGTH),
-      .padding_length = 0,
-      .reserved = 0,
-  };
-
   ChunkList output;
-  output.Append(&header, FCGI_RECORD_HEADER_LENGTH);
-
-  EndRequestBody body{.app_status = sock::ToNetworkByteOrder32(as),
-                      .protocol_status = ps,
-                      .reserved = {0, 0, 0}};
-  output.Append(&body, FCGI_END_REQUEST_BODY_LENGTH);
-  conn->Send(output);
+  AppendEndRequest(output, id, as, ps);
+  FcgiStats::Add(Counter::BytesOut, output.GetReadableSize());
+  OutputScheduler::Send(conn, id, output);
 }
 
-void FcgiCodec::EndStdout(TcpConnectionPtr const &conn, uint16_t id)
+void FcgiCodec::EndStdout(TransportPtr const &conn, uint16_t id)
 {
   EndTerminator(conn, FCGI_STDOUT, id);
 }
 
-void FcgiCodec::EndStderr(TcpConnectionPtr const &conn, uint16_t id)
+void FcgiCodec::EndStdout(TransportPtr const &conn, FcgiRequest const &request)
+{
+  if (request.IsAborted()) return;
+  EndTerminator(conn, FCGI_STDOUT, request.request_id, request.token);
+}
+
+void FcgiCodec::EndStderr(TransportPtr const &conn, uint16_t id)
 {
   EndTerminator(conn, FCGI_STDERR, id);
 }
 
-void FcgiCodec::Close(TcpConnectionPtr const &conn, FcgiRequest const *request)
+void FcgiCodec::EndStderr(TransportPtr const &conn, FcgiRequest const &request)
+{
+  if (request.IsAborted()) return;
+  EndTerminator(conn, FCGI_STDERR, request.request_id, request.token);
+}
+
+void FcgiCodec::Close(TransportPtr const &conn, FcgiRequest const *request)
 {
   if (!request || !IsKeepConnection(request->flags)) {
     conn->ShutdownWrite();
   }
 }
 
+void FcgiCodec::SetRequestHandler(TcpRequestHandler handler)
+{
+  if (!handler) {
+    request_handler_ = nullptr;
+    return;
+  }
+
+  request_handler_ = [handler](TransportPtr const &conn,
+                               FcgiRequest request) {
+    auto transport = std::dynamic_pointer_cast<TcpTransport>(conn);
+    if (!transport) {
+      LOG_ERROR << "The TcpRequestHandler requires TcpTransport, request "
+                << request.request_id << " is ended";
+      EndRequest(conn, request, 1);
+      return;
+    }
+
+    handler(transport->GetConnection(), std::move(request));
+  };
+}
+
+void FcgiCodec::DispatchRequest(TransportPtr const &conn,
+                                RequestSlot &slot)
+{
+  if (FcgiStats::IsManagementRequest(slot.data.params)) {
+    ServeStats(conn, slot);
+    return;
+  }
+
+  if (cache_ && ServeCache(conn, slot)) return;
+
+  FCGI_TRACE(Dispatch, slot.data.request_id, slot.buffered, 0);
+
+  slot.dispatched = true;
+  slot.data.codec = this;
+  slot.data.slot = &slot;
+
+  if (!worker_pool_) {
+    /* The slot keeps the moved-from request to track the state.
+     * NOTICE
+     * The slot may be removed by the handler, don't touch it after call */
+    slot.data.times.handler_time = FcgiStats::Now();
+    request_handler_(conn, std::move(slot.data));
+    return;
+  }
+
+  /* The slot is alive until the request is released, and the loop doesn't
+   * touch the data of dispatched slot, so it is safe to move the data in
+   * worker. The handler is copied since the codec may be destroyed. */
+  auto slot_ptr = &slot;
+  auto handler = request_handler_;
+  bool pushed = worker_pool_->TryPush([conn, slot_ptr, handler]() {
+    slot_ptr->data.times.handler_time = FcgiStats::Now();
+    handler(conn, std::move(slot_ptr->data));
+  });
+
+  if (!pushed) {
+    auto id = slot.data.request_id;
+    LOG_WARN << "The worker pool is full, reject request " << id;
+    slot.dispatched = false;
+    slot.data.codec = nullptr;
+    slot.data.slot = nullptr;
+    EraseSlot(&slot);
+    FCGI_TRACE(Reject, id, 0, FCGI_OVERLOADED);
+    EndRequest(conn, id, 0, FCGI_OVERLOADED);
+    FcgiStats::Add(Counter::Rejected);
+  }
+}
+
+void FcgiCodec::ServeStats(TransportPtr const &conn, RequestSlot &slot)
+{
+  auto id = slot.data.request_id;
+  LOG_DEBUG << "Serve stats to request " << id;
+
+  auto content = FcgiStats::GetSnapshot().ToString();
+  content.insert(0, "Content-Type: text/plain\r\n\r\n");
+
+  ChunkList output;
+  AppendStreamRecords(output, FCGI_STDOUT, id, content.data(),
+                      content.size());
+  AppendTerminator(output, FCGI_STDOUT, id);
+  AppendEndRequest(output, id, 0, FCGI_REQUEST_COMPLETE);
+  FcgiStats::Add(Counter::BytesOut, output.GetReadableSize());
+  OutputScheduler::Send(conn, id, output);
+
+  /* The streamed STDIN of it is ignored since it is unknown then */
+  EraseSlot(&slot);
+}
+
+bool FcgiCodec::ServeCache(TransportPtr const &conn, RequestSlot &slot)
+{
+  auto &request = slot.data;
+  if (request.role != FCGI_RESPONDER || !slot.stdin_complete ||
+      request.stdin_stream.GetReadableSize() != 0 ||
+      !ResponseCache::IsCacheable(request.params))
+  {
+    return false;
+  }
+
+  request.cache_key = cache_->MakeKey(request.params);
+  auto response = cache_->Find(request.cache_key);
+  if (!response) {
+    /* Filled by the ResponseWriter of handler */
+    request.cache = cache_;
+    FcgiStats::Add(Counter::CacheMisses);
+    return false;
+  }
+
+  FcgiStats::Add(Counter::CacheHits);
+  FcgiStats::Add(Counter::BytesOut, response->GetSize());
+  OutputScheduler::Send(conn, request.request_id, response);
+
+  request.times.handler_time = FcgiStats::Now();
+  FcgiStats::RecordRequest(request.times);
+  EraseSlot(&slot);
+  return true;
+}
+
+FcgiProtocolStatus FcgiCodec::AdmitRequest() noexcept
+{
+  if (!fcgi_values.mpxs_conns && !request_map_.empty()) {
+    return FCGI_CANT_MPX_CONN;
+  }
+
+  auto max_conn_requests = AdmissionControl::GetLimits().max_conn_requests;
+  if (max_conn_requests && request_map_.size() >= max_conn_requests) {
+    return FCGI_OVERLOADED;
+  }
+
+  if (!AdmissionControl::Admit()) return FCGI_OVERLOADED;
+  return FCGI_REQUEST_COMPLETE;
+}
+
+bool FcgiCodec::AddBuffered(RequestSlot *slot, size_t n) noexcept
+{
+  auto const &limits = AdmissionControl::GetLimits();
+  if (limits.max_request_buffered_bytes &&
+      slot->buffered + n > limits.max_request_buffered_bytes)
+  {
+    return false;
+  }
+
+  if (limits.max_conn_buffered_bytes &&
+      buffered_ + input_buffered_ + n > limits.max_conn_buffered_bytes)
+  {
+    return false;
+  }
+
+  if (!AdmissionControl::TryAddBuffered(n)) return false;
+
+  slot->buffered += n;
+  buffered_ += n;
+  return true;
+}
+
+void FcgiCodec::RejectOverBudget(TransportPtr const &conn, RequestSlot *slot,
+                                 size_t n)
+{
+  auto id = slot->data.request_id;
+  LOG_WARN << "Reject request " << id << " over the memory budget: "
+           << slot->buffered << " bytes buffered, " << n << " bytes more";
+
+  /* The following records of it are ignored */
+  EraseSlot(slot);
+  FCGI_TRACE(Reject, id, n, FCGI_OVERLOADED);
+  EndRequest(conn, id, 0, FCGI_OVERLOADED);
+  FcgiStats::Add(Counter::Rejected);
+}
+
+void FcgiCodec::SetInputBuffered(size_t n) noexcept
+{
+  if (n > input_buffered_) {
+    AdmissionControl::AddBuffered(n - input_buffered_);
+  } else {
+    AdmissionControl::RemoveBuffered(input_buffered_ - n);
+  }
+  input_buffered_ = n;
+}
+
 void FcgiCodec::RemoveRequest(uint16_t request_id)
 {
-  auto iter = request_map_.find(request_id);
+  auto slot = request_map_.Find(request_id);
   /*
-   * If the codec is not nullptr,
+   * If the request is dispatched,
    * the request handler may processing.
    *
    * Resource is managed by handler.
    */
-  if (iter != request_map_.end() && !iter->second.codec) {
-    request_map_.erase(iter);
+  if (slot && !slot->dispatched) {
+    EraseSlot(slot);
+  }
+}
+
+void FcgiCodec::AbortRequest(TransportPtr const &conn, uint16_t request_id)
+{
+  /* The output queued is useless even if the request has completed, the
+   * END_REQUEST isn't blocked by it */
+  auto slot = request_map_.Find(request_id);
+  if (!slot) {
+    /* e.g. The request has completed */
+    LOG_TRACE << "ABORT_REQUEST of unknown request: " << request_id;
+    if (scheduler_) scheduler_->Drop(request_id, true);
+    return;
+  }
+
+  /* The slot may be freed, keep the token alive */
+  auto token = slot->token;
+  if (!token->TryCancel()) {
+    LOG_TRACE << "ABORT_REQUEST of ended request: " << request_id;
+    if (scheduler_) scheduler_->Drop(request_id, true);
+    return;
+  }
+
+  if (scheduler_) scheduler_->Drop(request_id, false);
+
+  LOG_DEBUG << "Request " << request_id << " is aborted";
+  FCGI_TRACE(Abort, request_id, 0, 0);
+  FcgiStats::Add(Counter::Aborted);
+
+  if (!slot->dispatched || slot->released) {
+    EraseSlot(slot);
+  } else {
+    /* The handler is still running, the slot is erased when it releases
+     * the request. No more STDIN is expected in streaming mode. */
+    slot->stdin_complete = true;
+    slot->data_complete = true;
+  }
+
+  EndRequest(conn, request_id, 0, FCGI_REQUEST_COMPLETE);
+  token->Notify();
+}
+
+void FcgiCodec::ReleaseRequest(RequestData &data) noexcept
+{
+  auto slot = data.slot;
+  assert(slot && slot->dispatched);
+
+  /* Give the buffers back, they are reused by next request.
+   * The handler owns the data exclusively, it is safe in any thread. */
+  slot->data.params = std::move(data.params);
+  slot->data.stdin_stream = std::move(data.stdin_stream);
+  slot->data.data_stream = std::move(data.data_stream);
+  data.codec = nullptr;
+  data.slot = nullptr;
+  /* Or the token is never reused since the request holds it */
+  data.token.reset();
+
+  auto loop = slot->loop;
+  if (loop->IsLoopInThread()) {
+    ReleaseSlot(slot);
+  } else {
+    loop->QueueToLoop([slot]() { ReleaseSlot(slot); });
+  }
+}
+
+void FcgiCodec::ReleaseSlot(RequestSlot *slot) noexcept
+{
+  slot->released = true;
+
+  auto codec = slot->codec;
+  if (!codec) {
+    /* Detached, not in any table */
+    FreeSlot(slot);
+    return;
   }
+
+  /* In streaming mode, the STDIN or DATA may be incomplete */
+  if (!slot->IsInputComplete()) return;
+
+  codec->EraseSlot(slot);
+}
+
+void FcgiCodec::EraseSlot(RequestSlot *slot) noexcept
+{
+  request_map_.Remove(slot->data.request_id);
+  FreeSlot(slot);
+}
+
+void FcgiCodec::EnableOutputScheduler(size_t record_size)
+{
+  assert(transport_);
+  scheduler_.reset(new OutputScheduler(transport_.get(), record_size));
+  transport_->SetOutputScheduler(scheduler_.get());
+}
+
+void FcgiCodec::OnWriteComplete()
+{
+  /* Refill the output before the waiters measure it, the waiters
+   * wait again only if the output is above the record size, so the
+   * transport will call it again */
+  if (scheduler_) scheduler_->Pump();
+
+  if (write_waiters_.empty()) return;
+
+  /* The waiters may wait again */
+  std::vector<std::function<void()>> waiters;
+  waiters.swap(write_waiters_);
+  for (auto &cb : waiters) {
+    cb();
+  }
+}
+
+FcgiCodec *FcgiCodec::RequestData::GetCodec() const noexcept
+{
+  return slot ? slot->codec : nullptr;
+}
+
+/* Don't pool the buffer holding large body, e.g. upload file */
+#define MAX_RECYCLED_BUFFER_SIZE (64 * 1024)
+
+/* Free slots exceed the limit are deleted */
+#define MAX_FREE_SLOT_NUM 1024
+
+static inline void RecycleBuffer(Buffer &buffer) noexcept
+{
+  buffer.AdvanceAll();
+  if (buffer.GetWritableSize() > MAX_RECYCLED_BUFFER_SIZE) buffer.Shrink(0);
+}
+
+void FcgiCodec::RequestSlot::Reset() noexcept
+{
+  data.params.Clear();
+  RecycleBuffer(data.stdin_stream);
+  RecycleBuffer(data.data_stream);
+  data.codec = nullptr;
+  data.slot = nullptr;
+  data.token.reset();
+  data.cache = nullptr;
+  data.cache_key.clear();
+  /* Someone still holds the token of last request */
+  if (token.use_count() > 1) {
+    token = std::make_shared<CancelToken>();
+  } else {
+    token->Reset();
+  }
+  dispatched = false;
+  released = false;
+  stdin_complete = false;
+  data_complete = false;
+  buffered = 0;
+  codec = nullptr;
+  loop = nullptr;
+}
+
+auto FcgiCodec::GetSlotPool() noexcept -> SlotPool &
+{
+  /* One loop per thread */
+  static thread_local SlotPool pool;
+  return pool;
+}
+
+auto FcgiCodec::AcquireSlot() -> RequestSlot *
+{
+  auto &pool = GetSlotPool();
+  if (pool.empty()) return new RequestSlot;
+
+  auto slot = pool.back().release();
+  pool.pop_back();
+  return slot;
+}
+
+void FcgiCodec::FreeSlot(RequestSlot *slot) noexcept
+{
+  /* The request leaves, its buffers are freed or reused */
+  if (slot->codec) slot->codec->buffered_ -= slot->buffered;
+  AdmissionControl::RemoveBuffered(slot->buffered);
+  AdmissionControl::Leave();
+
+  auto &pool = GetSlotPool();
+  if (pool.size() >= MAX_FREE_SLOT_NUM) {
+    delete slot;
+    return;
+  }
+
+  slot->Reset();
+  pool.emplace_back(slot);
+}
+
+void FcgiCodec::PauseRead(TransportPtr const &conn)
+{
+  FCGI_TRACE(Pause, 0, conn->GetInputBuffer()->GetReadableSize(), 0);
+  paused_ = true;
+  conn->StopRead();
+}
+
+void FcgiCodec::ResumeRead(TransportPtr const &conn)
+{
+  if (!paused_) return;
+
+  FCGI_TRACE(Resume, 0, conn->GetInputBuffer()->GetReadableSize(), 0);
+  paused_ = false;
+  conn->StartRead();
+
+  /* The received records are not parsed when paused.
+   * Parse them in next loop iteration instead of the callee of handler. */
+  conn->GetLoop()->QueueToLoop([this, conn]() {
+    /* The codec is destroyed if the connection is down */
+    if (conn->IsConnected() && !paused_) {
+      OnMessage(conn, *conn->GetInputBuffer());
+    }
+  });
 }
 
 FcgiCodec::RequestData::~RequestData() noexcept
 {
-  if (codec) codec->request_map_.erase(request_id);
+  if (slot) ReleaseRequest(*this);
 }
@@ -1,147 +1,355 @@
 #ifndef FCGI_CODEC_H_
 #define FCGI_CODEC_H_
 
-#include <unordered_map>
+#include <memory>
+#include <vector>
 
+#include "fcgi_cancel_token.h"
 #include "fcgi_constant.h"
+#include "fcgi_output_scheduler.h"
+#include "fcgi_params.h"
+#include "fcgi_request_table.h"
+#include "fcgi_response_cache.h"
+#include "fcgi_stats.h"
+#include "fcgi_tcp_transport.h"
+#include "fcgi_transport.h"
 #include "fcgi_type.h"
+#include "fcgi_worker_pool.h"
 #include "kanon/buffer/chunk_list.h"
 #include "kanon/net/buffer.h"
 #include "kanon/util/noncopyable.h"
+#include "kanon/util/time_stamp.h"
+
+namespace kanon {
+
+class EventLoop;
+
+} // namespace kanon
 
 namespace fcgi {
 
 class FcgiCodec : kanon::noncopyable {
-  using ParamMap = std::unordered_map<std::string, std::string>;
+  struct RequestSlot;
 
  public:
   struct RequestData {
     FcgiRole role;
     FcgiFlag flags;
     uint16_t request_id;
-    kanon::Buffer param_stream;
-    ParamMap param_map;
+    FcgiParams params;
     kanon::Buffer stdin_stream;
     kanon::Buffer data_stream;
     FcgiCodec *codec = nullptr;
-
-    /** The request resource is managed by RequestHandler */
+    RequestSlot *slot = nullptr; /* The slot in the codec */
+    std::shared_ptr<CancelToken> token;
+    RequestTimes times; /* Recorded if the FcgiStats is enabled */
+    /* Not nullptr if the response is cacheable but missed */
+    ResponseCache *cache = nullptr;
+    std::string cache_key;
+
+    RequestData() = default;
+
+    /** The moved-from request doesn't release the request in codec */
+    RequestData(RequestData &&other) noexcept
+      : role(other.role)
+      , flags(other.flags)
+      , request_id(other.request_id)
+      , params(std::move(other.params))
+      , stdin_stream(std::move(other.stdin_stream))
+      , data_stream(std::move(other.data_stream))
+      , codec(other.codec)
+      , slot(other.slot)
+      , token(std::move(other.token))
+      , times(other.times)
+      , cache(other.cache)
+      , cache_key(std::move(other.cache_key))
+    {
+      other.codec = nullptr;
+      other.slot = nullptr;
+    }
+
+    kanon::StringView Get(Param p) const noexcept { return params.Get(p); }
+
+    /** The web server has aborted the request, the output is dropped */
+    bool IsAborted() const noexcept { return token && token->IsCancelled(); }
+
+    /**
+     * The token can be held by the asynchronous job of the handler
+     * to check the abort after the request is released.
+     */
+    std::shared_ptr<CancelToken> const &GetCancelToken() const noexcept
+    {
+      return token;
+    }
+
+    kanon::StringView Get(kanon::StringView name) const noexcept
+    {
+      return params.Get(name);
+    }
+
+    /**
+     * The codec dispatching the request, called in the loop.
+     * nullptr if the codec is destroyed or the request is detached from
+     * it(e.g. the id is reused).
+     */
+    FcgiCodec *GetCodec() const noexcept;
+
+    /**
+     * The request resource is managed by RequestHandler.
+     * The buffers are given back to the codec for reusing.
+     *
+     * It can be destroyed in any thread(e.g. worker thread), the slot
+     * is released in the loop of codec.
+     */
     ~RequestData() noexcept;
   };
 
   friend struct RequestData;
   using RequestHandler =
+      std::function<void(TransportPtr const &, RequestData data)>;
+
+  /**
+   * The handler before the transport is introduced, it is called with the
+   * connection of TcpTransport
+   */
+  using TcpRequestHandler =
       std::function<void(kanon::TcpConnectionPtr const &, RequestData data)>;
 
-  using RequestMap = std::unordered_map<uint16_t, RequestData>;
+  /**
+   * Receive the content of a FCGI_STDIN record in streaming mode.
+   * The chunk references the input buffer, it is invalid after return.
+   * The empty chunk indicates the end of STDIN.
+   */
+  using StdinHandler = std::function<void(TransportPtr const &, uint16_t id,
+                                          kanon::StringView chunk)>;
+
+  /**
+   * Receive the content of a FCGI_DATA record of filter request
+   * in streaming mode, same as the StdinHandler.
+   */
+  using DataHandler = StdinHandler;
+
   using FcgiRequest = FcgiCodec::RequestData;
 
-  explicit FcgiCodec(kanon::TcpConnectionPtr const &conn);
+  /** The codec takes over the message callback of \p conn */
+  explicit FcgiCodec(TransportPtr const &conn);
+
+  /** Same as FcgiCodec(TcpTransport::New(conn)) */
+  explicit FcgiCodec(kanon::TcpConnectionPtr const &conn)
+    : FcgiCodec(TcpTransport::New(conn))
+  {
+  }
+
+  /**
+   * The codec isn't bound to a connection, the input is fed by
+   * OnMessage() manually, e.g. benchmark and replaying captured records.
+   * \p loop must be the loop of current thread.
+   */
+  explicit FcgiCodec(kanon::EventLoop *loop);
+
+  /**
+   * The dispatched requests must be released before the codec is destroyed
+   */
+  ~FcgiCodec() noexcept;
 
   /*----------------------*/
   /* Output stdout stream */
   /*----------------------*/
 
-  static void SendStdout(kanon::TcpConnectionPtr const &conn, uint16_t id,
+  static void SendStdout(TransportPtr const &conn, uint16_t id,
                          char const *data, size_t len);
 
   /** Convenient API for id version */
-  static void SendStdout(kanon::TcpConnectionPtr const &conn,
+  /**
+   * The request version drops the output of aborted request. If it is
+   * called out of the loop(e.g. in worker), the request is checked again
+   * in the loop before sending, since the codec has sent the END_REQUEST
+   * if it is aborted in between.
+   * The id version doesn't know it, prefer the request version
+   * or ResponseWriter.
+   */
+  static void SendStdout(TransportPtr const &conn,
                          FcgiRequest const &request, char const *data,
-                         size_t len)
-  {
-    SendStdout(conn, request.request_id, data, len);
-  }
+                         size_t len);
 
-  static void SendStdout(kanon::TcpConnectionPtr const &conn, uint16_t id,
+  static void SendStdout(TransportPtr const &conn, uint16_t id,
                          kanon::StringView data)
   {
     SendStdout(conn, id, data.data(), data.size());
   }
 
-  static void SendStdout(kanon::TcpConnectionPtr const &conn,
+  static void SendStdout(TransportPtr const &conn,
                          FcgiRequest const &request, kanon::StringView data)
   {
-    SendStdout(conn, request.request_id, data);
+    SendStdout(conn, request, data.data(), data.size());
   }
 
-  static void SendStdout(kanon::TcpConnectionPtr const &conn, uint16_t id,
+  /**
+   * The chunks of \p output are copied to the records one by one instead
+   * of being flattened first(see AppendStreamRecords()), and they are
+   * consumed
+   */
+  static void SendStdout(TransportPtr const &conn, uint16_t id,
                          kanon::ChunkList &output);
 
-  // static void SendStdout(kanon::TcpConnectionPtr const &conn, FcgiRequest
-  // const&request,
-  //                        kanon::ChunkList &output);
+  static void SendStdout(TransportPtr const &conn,
+                         FcgiRequest const &request, kanon::ChunkList &output);
+
+  /**
+   * Send the [offset, offset+len) of regular file \p fd as STDOUT.
+   *
+   * The codec frames the records and the transport sends the content
+   * from the file, e.g. by sendfile(2) in TcpTransport, so the body
+   * doesn't enter the user space. The file is duplicated, \p fd can be
+   * closed after return.
+   *
+   * If it is called out of the loop, the records are framed in the loop
+   * and \p token(if any) is checked there.
+   *
+   * \return false if the region isn't in the file, nothing is sent
+   */
+  static bool
+  SendStdoutFile(TransportPtr const &conn, uint16_t id, int fd, off_t offset,
+                 size_t len,
+                 std::shared_ptr<CancelToken> const &token = nullptr);
+
+  static bool SendStdoutFile(TransportPtr const &conn,
+                             FcgiRequest const &request, int fd, off_t offset,
+                             size_t len)
+  {
+    if (request.IsAborted()) return true;
+    return SendStdoutFile(conn, request.request_id, fd, offset, len,
+                          request.token);
+  }
 
   /*----------------------*/
   /* Output stderr stream */
   /*----------------------*/
 
-  static void SendStderr(kanon::TcpConnectionPtr const &conn, uint16_t id,
+  static void SendStderr(TransportPtr const &conn, uint16_t id,
                          char const *data, size_t len);
 
-  static void SendStderr(kanon::TcpConnectionPtr const &conn,
+  static void SendStderr(TransportPtr const &conn,
                          FcgiRequest const &request, char const *data,
-                         size_t len)
-  {
-    SendStderr(conn, request.request_id, data, len);
-  }
+                         size_t len);
 
-  static void SendStderr(kanon::TcpConnectionPtr const &conn, uint16_t id,
+  static void SendStderr(TransportPtr const &conn, uint16_t id,
                          kanon::StringView data)
   {
     SendStderr(conn, id, data.data(), data.size());
   }
 
-  static void SendStderr(kanon::TcpConnectionPtr const &conn,
+  static void SendStderr(TransportPtr const &conn,
                          FcgiRequest const &request, kanon::StringView data)
   {
-    SendStderr(conn, request.request_id, data);
+    SendStderr(conn, request, data.data(), data.size());
   }
 
-  static void SendStderr(kanon::TcpConnectionPtr const &conn, uint16_t id,
+  static void SendStderr(TransportPtr const &conn, uint16_t id,
                          kanon::ChunkList &output);
 
-  // static void SendStderr(kanon::TcpConnectionPtr const &conn, FcgiRequest
-  // const&request,
-  //                        kanon::ChunkList &output);
+  static void SendStderr(TransportPtr const &conn,
+                         FcgiRequest const &request, kanon::ChunkList &output);
+
   /*-------------------*/
   /* Send terminator   */
   /*-------------------*/
 
   static void
-  EndRequest(kanon::TcpConnectionPtr const &conn, uint16_t id,
+  EndRequest(TransportPtr const &conn, uint16_t id,
              uint32_t app_status = 0,
              FcgiProtocolStatus protocol_status = FCGI_REQUEST_COMPLETE);
 
+  /**
+   * Nothing is sent if the request has been aborted,
+   * since the codec has sent the END_REQUEST.
+   */
   static void
-  EndRequest(kanon::TcpConnectionPtr const &conn, FcgiRequest const &request,
+  EndRequest(TransportPtr const &conn, FcgiRequest const &request,
              uint32_t app_status = 0,
              FcgiProtocolStatus protocol_status = FCGI_REQUEST_COMPLETE)
   {
+    if (request.token && !request.token->TryEnd()) return;
     EndRequest(conn, request.request_id, app_status, protocol_status);
+    FcgiStats::RecordRequest(request.times);
   }
 
-  static void EndStdout(kanon::TcpConnectionPtr const &conn, uint16_t id);
-  static void EndStdout(kanon::TcpConnectionPtr const &conn,
-                        FcgiRequest const &request)
+  /**
+   * Send the STDOUT and END_REQUEST encoded in \p response, which can be
+   * shared by requests(see EncodedResponse).
+   */
+  static void EndRequest(TransportPtr const &conn, FcgiRequest const &request,
+                         EncodedResponsePtr const &response)
   {
-    EndStdout(conn, request.request_id);
+    if (request.token && !request.token->TryEnd()) return;
+    FcgiStats::Add(Counter::BytesOut, response->GetSize());
+    OutputScheduler::Send(conn, request.request_id, response);
+    FcgiStats::RecordRequest(request.times);
   }
 
-  static void EndStderr(kanon::TcpConnectionPtr const &conn, uint16_t id);
-  static void EndStderr(kanon::TcpConnectionPtr const &conn,
-                        FcgiRequest const &request)
-  {
-    EndStderr(conn, request.request_id);
-  }
+  static void EndStdout(TransportPtr const &conn, uint16_t id);
+  static void EndStdout(TransportPtr const &conn,
+                        FcgiRequest const &request);
+
+  static void EndStderr(TransportPtr const &conn, uint16_t id);
+  static void EndStderr(TransportPtr const &conn,
+                        FcgiRequest const &request);
 
   /*-----------------------*/
   /* Connection management */
   /*-----------------------*/
 
-  static void Close(kanon::TcpConnectionPtr const &conn,
+  static void Close(TransportPtr const &conn,
                     FcgiRequest const *request);
 
+  /*------------------------------*/
+  /* Compatibility with kanon API */
+  /*------------------------------*/
+
+  /**
+   * The output API taking kanon::TcpConnectionPtr, the arguments after
+   * \p conn are the same as the ones of TransportPtr version.
+   *
+   * The connection is wrapped by a TcpTransport for the call, which isn't
+   * the transport of codec, so the output isn't interleaved by the
+   * OutputScheduler. Prefer the TransportPtr passed to RequestHandler.
+   */
+  template <typename... Args>
+  static void SendStdout(kanon::TcpConnectionPtr const &conn, Args &&...args)
+  {
+    SendStdout(WrapConnection(conn), std::forward<Args>(args)...);
+  }
+
+  template <typename... Args>
+  static void SendStderr(kanon::TcpConnectionPtr const &conn, Args &&...args)
+  {
+    SendStderr(WrapConnection(conn), std::forward<Args>(args)...);
+  }
+
+  template <typename... Args>
+  static void EndRequest(kanon::TcpConnectionPtr const &conn, Args &&...args)
+  {
+    EndRequest(WrapConnection(conn), std::forward<Args>(args)...);
+  }
+
+  template <typename... Args>
+  static void EndStdout(kanon::TcpConnectionPtr const &conn, Args &&...args)
+  {
+    EndStdout(WrapConnection(conn), std::forward<Args>(args)...);
+  }
+
+  template <typename... Args>
+  static void EndStderr(kanon::TcpConnectionPtr const &conn, Args &&...args)
+  {
+    EndStderr(WrapConnection(conn), std::forward<Args>(args)...);
+  }
+
+  static void Close(kanon::TcpConnectionPtr const &conn,
+                    FcgiRequest const *request)
+  {
+    Close(WrapConnection(conn), request);
+  }
+
   /*-----------------------*/
   /* Handler register      */
   /*-----------------------*/
@@ -151,13 +359,282 @@ class FcgiCodec : kanon::noncopyable {
     request_handler_ = std::move(handler);
   }
 
+  /**
+   * The transport of codec must be TcpTransport(e.g. the codec is created
+   * from kanon::TcpConnection or by SocketServer), otherwise the request
+   * is ended with the app status 1.
+   */
+  void SetRequestHandler(TcpRequestHandler handler);
+
+  /**
+   * Enable the streaming mode of STDIN.
+   *
+   * In streaming mode, the request handler is called once the PARAMS
+   * is complete, and the STDIN is not buffered in the request, the
+   * content of each FCGI_STDIN record is passed to \p handler instead.
+   * Therefore, the large request body isn't hold in memory entirely,
+   * and it can be processed during transfering.
+   *
+   * The STDIN of filter request is still buffered if the FCGI_DATA isn't
+   * streamed(see SetDataHandler()), since the request is dispatched once
+   * with both of them.
+   */
+  void SetStdinHandler(StdinHandler handler)
+  {
+    stdin_handler_ = std::move(handler);
+  }
+
+  /**
+   * Enable the streaming mode of FCGI_DATA of the filter request(FCGI_FILTER).
+   *
+   * The filter request receives the file to be filtered in FCGI_DATA
+   * after the STDIN. In streaming mode, the request handler is called
+   * once the STDIN is complete(or the PARAMS is complete if the STDIN is
+   * streamed also), then the content of each FCGI_DATA record is passed to
+   * \p handler, so the filter can transform the file chunk by chunk.
+   *
+   * Otherwise, the data is buffered in RequestData::data_stream, and
+   * the handler is called once the FCGI_DATA is complete.
+   */
+  void SetDataHandler(DataHandler handler)
+  {
+    data_handler_ = std::move(handler);
+  }
+
+  /**
+   * Run the request handler in \p pool instead of the IO loop.
+   *
+   * The complete request is moved to the worker, and it is rejected with
+   * FCGI_OVERLOADED if the queue of pool is full.
+   * The handler should use ResponseWriter to output, which posts the
+   * records to the loop in one go when flushing.
+   * The StdinHandler and DataHandler are still called in the loop.
+   *
+   * \p pool can be shared by codecs and must outlive them.
+   */
+  void SetWorkerPool(WorkerPool *pool) noexcept { worker_pool_ = pool; }
+
+  /**
+   * Answer the cacheable requests from \p cache if hit, the handler is
+   * skipped. The response of missed request is inserted by the
+   * ResponseWriter constructed from the request.
+   *
+   * Only the requests whose STDIN is buffered(i.e. not streaming mode)
+   * and empty are looked up.
+   *
+   * \p cache can be shared by codecs and must outlive them.
+   */
+  void SetResponseCache(ResponseCache *cache) noexcept { cache_ = cache; }
+
+  /**
+   * Interleave the responses of the multiplexed requests(see
+   * OutputScheduler), then a large response doesn't block the small
+   * ones on the same connection.
+   *
+   * \param record_size The maximum content length of STDOUT records
+   *
+   * Must be called before any request is received, only for the codec
+   * bound to a connection.
+   */
+  void EnableOutputScheduler(size_t record_size = 16 * 1024);
+
+  /** nullptr if not enabled, e.g. set the weight of a request */
+  OutputScheduler *GetOutputScheduler() const noexcept
+  {
+    return scheduler_.get();
+  }
+
+  /*-----------------------*/
+  /* Management            */
+  /*-----------------------*/
+
+  /**
+   * Set the values answered to the FCGI_GET_VALUES of web server.
+   * The values are shared by all codecs(i.e. the application),
+   * must be set before the server starts.
+   *
+   * The answer is bounded by the limits of AdmissionControl, i.e.
+   * FCGI_MAX_REQS by max_requests, FCGI_MAX_CONNS by FCGI_MAX_REQS, and
+   * FCGI_MPXS_CONNS is 0 if max_conn_requests is 1.
+   */
+  static void SetValues(FcgiValues const &values) noexcept;
+  static FcgiValues const &GetValues() noexcept;
+
+  /*-----------------------*/
+  /* Flow control          */
+  /*-----------------------*/
+
+  /**
+   * Stop reading and parsing the input of \p conn.
+   * Useful when the StdinHandler falls behind.
+   */
+  void PauseRead(TransportPtr const &conn);
+
+  /** Restart reading and parse the records that have been received */
+  void ResumeRead(TransportPtr const &conn);
+
+  /**
+   * Call \p cb once when the output of connection is drained, e.g. resume
+   * the producer stopped at the high-water mark(see StdoutStream).
+   * Called in the loop. The waiters are dropped without being called if
+   * the codec is destroyed, i.e. the connection is closed.
+   */
+  void WaitWriteComplete(std::function<void()> cb)
+  {
+    write_waiters_.emplace_back(std::move(cb));
+  }
+
+  /**
+   * Parse the records in \p buffer and call the handlers
+   * \param receive_time The time when the input is received, used by
+   *                     the FcgiStats. Invalid indicates now.
+   */
+  void OnMessage(TransportPtr const &conn, kanon::Buffer &buffer,
+                 kanon::TimeStamp receive_time = kanon::TimeStamp());
+
+  /**
+   * Parse the records in [data, data+len)
+   * \return The bytes of the records parsed, the partial record and the
+   *         records not parsed(paused) are left to the caller. All bytes
+   *         are consumed since a malformed record is received, which
+   *         closes the connection.
+   */
+  size_t OnMessage(TransportPtr const &conn, char const *data, size_t len,
+                   kanon::TimeStamp receive_time = kanon::TimeStamp());
+
  private:
-  int ParseRequest(kanon::TcpConnectionPtr const &conn, kanon::Buffer &buffer);
+  struct RequestSlot {
+    RequestData data;
+    bool dispatched = false;     /* data has been moved to the handler */
+    bool released = false;       /* The handler has released the data */
+    bool stdin_complete = false;
+    bool data_complete = false; /* Used by filter request only */
+    size_t buffered = 0;         /* Bytes of params and streams */
+    /* The owner, nullptr indicates the slot is detached from the codec
+     * (e.g. the id is reused or the codec is destroyed), and it is freed
+     * once the handler releases it */
+    FcgiCodec *codec = nullptr;
+    kanon::EventLoop *loop = nullptr;
+    /* Shared with the request, reused if no one holds it */
+    std::shared_ptr<CancelToken> token = std::make_shared<CancelToken>();
+
+    /* Clear the content but keep the capacity of buffers */
+    void Reset() noexcept;
+
+    /* The slot can be erased only if no more input is expected */
+    bool IsInputComplete() const noexcept
+    {
+      return stdin_complete && (data.role != FCGI_FILTER || data_complete);
+    }
+  };
+
+  /**
+   * The free slots of the loop, shared by the codecs in the same loop.
+   * Recycled slots keep the capacity of their buffers, then the steady
+   * state request handling don't allocate.
+   */
+  using SlotPool = std::vector<std::unique_ptr<RequestSlot>>;
+  using RequestMap = RequestTable<RequestSlot>;
+
+  static SlotPool &GetSlotPool() noexcept;
+
+  /* The transport of the compatibility API */
+  static TransportPtr WrapConnection(kanon::TcpConnectionPtr const &conn)
+  {
+    return std::make_shared<TcpTransport>(conn);
+  }
+  static RequestSlot *AcquireSlot();
+  static void FreeSlot(RequestSlot *slot) noexcept;
+
+  void DispatchRequest(TransportPtr const &conn, RequestSlot &slot);
+
+  /* The header of a complete record in the input buffer */
+  struct RecordInfo {
+    size_t offset; /* The offset of content from the read begin */
+    uint16_t request_id;
+    uint16_t content_length;
+    uint8_t type;
+    uint8_t padding_length;
+  };
+
+  /* Decode the headers of complete records into records_ */
+  void ScanRecords(char const *data, size_t len);
+
+  /**
+   * Append the contents of consecutive records of the same buffered
+   * stream(PARAMS, STDIN, DATA) starting at \p first in one go.
+   * \return The number of records consumed, 0 if records_[first] should
+   *         be handled by HandleRecord()
+   */
+  size_t AppendRecords(TransportPtr const &conn, size_t first,
+                       char const *base);
+
+  /**
+   * \return false if the record is malformed, then the connection is
+   *         closed. The malformed content of a request(e.g. PARAMS) only
+   *         fails the request.
+   */
+  bool HandleRecord(TransportPtr const &conn,
+                    RecordInfo const &record, char const *content);
 
   bool ParseParams(RequestData &data);
 
+  /* The STDIN of \p request is passed to the StdinHandler */
+  bool IsStdinStreamed(RequestData const &request) const noexcept
+  {
+    return stdin_handler_ && (request.role != FCGI_FILTER || data_handler_);
+  }
+
+  /* Answer the FCGI_GET_VALUES with FCGI_GET_VALUES_RESULT */
+  static void HandleGetValues(TransportPtr const &conn,
+                              char const *data, size_t len);
+
   void RemoveRequest(uint16_t request_id);
 
+  /* Answer the request of management path with the stats snapshot */
+  void ServeStats(TransportPtr const &conn, RequestSlot &slot);
+
+  /**
+   * Answer the request from cache
+   * \return false if the request isn't cacheable or missed
+   */
+  bool ServeCache(TransportPtr const &conn, RequestSlot &slot);
+
+  /* Handle the FCGI_ABORT_REQUEST */
+  void AbortRequest(TransportPtr const &conn, uint16_t request_id);
+
+  /* Called when the handler releases the request */
+  static void ReleaseRequest(RequestData &data) noexcept;
+
+  /* Called in the loop after the handler releases the request */
+  static void ReleaseSlot(RequestSlot *slot) noexcept;
+
+  /**
+   * Check the limits of admission control and multiplexing
+   * \return FCGI_REQUEST_COMPLETE if the new request is admitted,
+   *         otherwise the protocol status of END_REQUEST
+   */
+  FcgiProtocolStatus AdmitRequest() noexcept;
+
+  /**
+   * Count \p n bytes buffered by the request of \p slot
+   * \return false if a budget is exceeded, nothing is counted
+   */
+  bool AddBuffered(RequestSlot *slot, size_t n) noexcept;
+
+  /* Fail the request whose \p n more bytes exceed the budget */
+  void RejectOverBudget(TransportPtr const &conn, RequestSlot *slot,
+                        size_t n);
+
+  /* Count the \p n bytes of input left unparsed */
+  void SetInputBuffered(size_t n) noexcept;
+
+  /* Remove the slot from table and free it */
+  void EraseSlot(RequestSlot *slot) noexcept;
+
+  /* Call the waiters of write complete */
+  void OnWriteComplete();
+
   /**
    * Because FasgCgi allow interleaved request,
    * and the request may process complete asynchronously.
@@ -171,6 +648,37 @@ class FcgiCodec : kanon::noncopyable {
    * The request owner is transfered to the handler(By move).
    */
   RequestHandler request_handler_;
+
+  /* Not empty indicates the streaming mode of STDIN */
+  StdinHandler stdin_handler_;
+
+  /* Not empty indicates the streaming mode of FCGI_DATA */
+  DataHandler data_handler_;
+
+  /* nullptr if the input is fed manually */
+  TransportPtr transport_;
+  kanon::EventLoop *loop_;
+  WorkerPool *worker_pool_ = nullptr;
+  ResponseCache *cache_ = nullptr;
+  std::unique_ptr<OutputScheduler> scheduler_;
+
+  /* The receive time(us) of the input being parsed, 0 if stats is disabled */
+  int64_t receive_time_ = 0;
+
+  /* The records of the input being parsed, reused to avoid allocation */
+  std::vector<RecordInfo> records_;
+
+  std::vector<std::function<void()>> write_waiters_;
+
+  /* The bytes buffered by the requests of the codec, not including the
+   * detached ones */
+  size_t buffered_ = 0;
+  size_t input_buffered_ = 0;
+
+  bool paused_ = false;
+
+  /* A malformed record is received, the following input is discarded */
+  bool broken_ = false;
 };
 
 using FcgiRequest = FcgiCodec::RequestData;
@@ -50,8 +50,8 @@ char const *fcgi::FcgiProtocolStatus2String(FcgiProtocolStatus ps) noexcept
   switch (ps) {
     case FCGI_REQUEST_COMPLETE:
       return "Request complete";
-    case FCGI_CANT_MAX_CONN:
-      return "Can't max conn";
+    case FCGI_CANT_MPX_CONN:
+      return "Can't multiplex conn";
     case FCGI_OVERLOADED:
       return "Overloaded";
     case FCGI_UNKNOWN_ROLE:
@@ -27,6 +27,13 @@ enum FcgiType : unsigned char {
 /* Used for management record header */
 #define FCGI_NULL_REQUEST_ID 0
 
+/* Variables of FCGI_GET_VALUES/FCGI_GET_VALUES_RESULT records */
+#define FCGI_MAX_CONNS "FCGI_MAX_CONNS"
+#define FCGI_MAX_REQS "FCGI_MAX_REQS"
+#define FCGI_MPXS_CONNS "FCGI_MPXS_CONNS"
+/* Extension: The number of requests in process of application */
+#define FCGI_QUEUE_DEPTH "FCGI_QUEUE_DEPTH"
+
 /* Used for FCGI_END_REQUEST Body */
 enum FcgiRole : unsigned char {
   FCGI_RESPONDER = 1,
@@ -44,9 +51,22 @@ using FcgiFlag = uint8_t;
 /* Protocol Status for FCGI_END_REQUEST Body */
 enum FcgiProtocolStatus : unsigned char {
   FCGI_REQUEST_COMPLETE = 0,
-  FCGI_CANT_MAX_CONN,
+  FCGI_CANT_MPX_CONN,
   FCGI_OVERLOADED,
   FCGI_UNKNOWN_ROLE,
+  /* Misspelled name of FCGI_CANT_MPX_CONN, kept for compatibility */
+  FCGI_CANT_MAX_CONN = FCGI_CANT_MPX_CONN,
+};
+
+/* Values reported in the FCGI_GET_VALUES_RESULT */
+struct FcgiValues {
+  /* The maximum number of concurrent transport connections */
+  uint32_t max_conns = 1024;
+  /* The maximum number of concurrent requests */
+  uint32_t max_reqs = 1024 * 16;
+  /* Whether multiplex connections(i.e. handle concurrent requests over
+   * each connection) */
+  bool mpxs_conns = true;
 };
 
 char const *FcgiType2String(FcgiType t) noexcept;
@@ -0,0 +1,265 @@
+#include "fcgi_coroutine.h"
+
+#include <vector>
+
+#include "fcgi_request_table.h"
+
+#include "kanon/net/buffer.h"
+#include "kanon/net/event_loop.h"
+
+using namespace kanon;
+using namespace fcgi;
+
+/* The STDIN buffered for a request before the input is paused */
+#define MAX_PENDING_STDIN (64 * 1024)
+
+namespace fcgi {
+
+class CoConnection;
+
+/* The state of a request shared by the coroutine and the connection */
+struct CoRequestState : kanon::noncopyable {
+  TransportPtr conn;
+  uint16_t id = 0;
+  std::shared_ptr<CancelToken> token;
+  CoConnection *connection = nullptr; /* nullptr if the codec is destroyed */
+  std::coroutine_handle<> reader;     /* Waiting for STDIN */
+  /* The chunk passed to the waiting reader, it references the input */
+  StringView chunk;
+  Buffer pending; /* The STDIN received when no one is waiting */
+  bool eof = false;
+
+  bool IsClosed() const noexcept
+  {
+    return !connection || !conn->IsConnected() ||
+           (token && token->IsCancelled());
+  }
+
+  void WakeReader()
+  {
+    if (reader) std::exchange(reader, nullptr).resume();
+  }
+};
+
+/* The coroutine requests of a connection, owned by the handlers of codec */
+class CoConnection : kanon::noncopyable {
+ public:
+  CoConnection(FcgiCodec *codec, EventLoop *loop) noexcept
+    : codec_(codec)
+    , loop_(loop)
+  {
+  }
+
+  ~CoConnection() noexcept;
+
+  void AddRequest(CoRequestState *state);
+  void RemoveRequest(CoRequestState *state);
+
+  void OnStdin(TransportPtr const &conn, uint16_t id, StringView chunk);
+  void OnWriteComplete();
+
+  /* Resume the input paused by the STDIN backlog */
+  void ResumeInput(TransportPtr const &conn);
+
+  void AddWriter(std::coroutine_handle<> handle)
+  {
+    /* The waiters are dropped with the codec which owns this */
+    if (writers_.empty()) {
+      codec_->WaitWriteComplete([this]() { OnWriteComplete(); });
+    }
+    writers_.push_back(handle);
+  }
+
+ private:
+  FcgiCodec *codec_;
+  EventLoop *loop_;
+  RequestTable<CoRequestState> requests_;
+  /* Waiting for the output below the high-water mark */
+  std::vector<std::coroutine_handle<>> writers_;
+  /* The capacity of writers_ being resumed, reused by next round */
+  std::vector<std::coroutine_handle<>> spare_writers_;
+  bool paused_ = false;
+};
+
+} // namespace fcgi
+
+CoConnection::~CoConnection() noexcept
+{
+  std::vector<std::coroutine_handle<>> handles;
+  handles.swap(writers_);
+  requests_.ForEach([&handles](CoRequestState *state) {
+    state->connection = nullptr;
+    if (state->reader) handles.push_back(std::exchange(state->reader, nullptr));
+  });
+
+  if (handles.empty()) return;
+
+  /* Don't run the handlers in the destructor of codec */
+  loop_->QueueToLoop([handles]() {
+    for (auto handle : handles) {
+      handle.resume();
+    }
+  });
+}
+
+void CoConnection::AddRequest(CoRequestState *state)
+{
+  /* The aborted request may be running, its id is reused */
+  auto old = requests_.Remove(state->id);
+  if (old) old->connection = nullptr;
+
+  requests_.Insert(state->id, state);
+}
+
+void CoConnection::RemoveRequest(CoRequestState *state)
+{
+  if (requests_.Find(state->id) == state) requests_.Remove(state->id);
+  if (state->pending.GetReadableSize() > 0) ResumeInput(state->conn);
+}
+
+void CoConnection::OnStdin(TransportPtr const &conn, uint16_t id,
+                           StringView chunk)
+{
+  /* The request has been released before the end of STDIN */
+  auto state = requests_.Find(id);
+  if (!state) return;
+
+  if (chunk.empty()) state->eof = true;
+
+  if (state->reader) {
+    /* Zero copy, the chunk is consumed before the reader suspends again */
+    state->chunk = chunk;
+    state->WakeReader();
+    return;
+  }
+
+  if (chunk.empty()) return;
+
+  state->pending.Append(chunk.data(), chunk.size());
+  if (!paused_ && state->pending.GetReadableSize() > MAX_PENDING_STDIN) {
+    paused_ = true;
+    codec_->PauseRead(conn);
+  }
+}
+
+void CoConnection::OnWriteComplete()
+{
+  if (writers_.empty()) return;
+
+  /* The resumed writers may wait again */
+  auto resuming = std::move(writers_);
+  writers_.swap(spare_writers_);
+
+  for (auto handle : resuming) {
+    handle.resume();
+  }
+
+  resuming.clear();
+  spare_writers_ = std::move(resuming);
+}
+
+void CoConnection::ResumeInput(TransportPtr const &conn)
+{
+  if (!paused_) return;
+
+  paused_ = false;
+  codec_->ResumeRead(conn);
+}
+
+/*-----------------------*/
+/* Awaiters              */
+/*-----------------------*/
+
+bool StdinAwaiter::await_ready() const noexcept
+{
+  return state_->pending.GetReadableSize() > 0 || state_->eof ||
+         state_->IsClosed();
+}
+
+void StdinAwaiter::await_suspend(std::coroutine_handle<> handle) noexcept
+{
+  state_->reader = handle;
+}
+
+StringView StdinAwaiter::await_resume() noexcept
+{
+  StringView chunk;
+  if (!state_->chunk.empty()) {
+    chunk = state_->chunk;
+    state_->chunk = StringView();
+  } else if (state_->pending.GetReadableSize() > 0) {
+    /* The bytes are kept until the next append */
+    chunk = StringView(state_->pending.GetReadBegin(),
+                       state_->pending.GetReadableSize());
+    state_->pending.AdvanceAll();
+    if (state_->connection) state_->connection->ResumeInput(state_->conn);
+  }
+
+  return chunk;
+}
+
+bool DrainAwaiter::await_ready() const noexcept
+{
+  return state_->IsClosed() ||
+         OutputScheduler::GetOutputSize(state_->conn, state_->id) <=
+             high_water_mark_;
+}
+
+void DrainAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+  state_->connection->AddWriter(handle);
+}
+
+bool DrainAwaiter::await_resume() const noexcept
+{
+  return !state_->IsClosed();
+}
+
+void SleepAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+  loop_->RunAfter([handle]() { handle.resume(); }, seconds_);
+}
+
+/*-----------------------*/
+/* Handler               */
+/*-----------------------*/
+
+CoRequest::~CoRequest() noexcept
+{
+  /* Moved-from */
+  if (!state_) return;
+
+  if (state_->connection) state_->connection->RemoveRequest(state_.get());
+}
+
+void fcgi::SetCoroutineHandler(FcgiCodec &codec, TransportPtr const &conn,
+                               CoroutineHandler handler)
+{
+  auto connection = std::make_shared<CoConnection>(&codec, conn->GetLoop());
+
+  codec.SetRequestHandler([connection, handler](TransportPtr const &conn,
+                                                FcgiRequest request) {
+    auto state = std::make_shared<CoRequestState>();
+    state->conn = conn;
+    state->id = request.request_id;
+    state->token = request.GetCancelToken();
+    state->connection = connection.get();
+    connection->AddRequest(state.get());
+
+    /* No more STDIN is sent for the aborted request */
+    if (state->token) {
+      std::weak_ptr<CoRequestState> weak_state = state;
+      state->token->OnCancel([weak_state]() {
+        auto state = weak_state.lock();
+        if (state) state->WakeReader();
+      });
+    }
+
+    handler(CoRequest(conn, std::move(request), std::move(state))).Start();
+  });
+
+  codec.SetStdinHandler([connection](TransportPtr const &conn, uint16_t id,
+                                     StringView chunk) {
+    connection->OnStdin(conn, id, chunk);
+  });
+}
@@ -0,0 +1,292 @@
+#ifndef FCGI_COROUTINE_H_
+#define FCGI_COROUTINE_H_
+
+#if __cplusplus < 202002L
+#error "fcgi_coroutine.h requires C++20, configure with -DBUILD_COROUTINE=ON"
+#endif
+
+#include <coroutine>
+#include <functional>
+#include <memory>
+#include <utility>
+
+#include "fcgi_codec.h"
+#include "fcgi_response_writer.h"
+#include "kanon/string/string_view.h"
+#include "kanon/util/noncopyable.h"
+
+namespace kanon {
+
+class EventLoop;
+
+} // namespace kanon
+
+namespace fcgi {
+
+struct CoRequestState;
+
+/**
+ * The coroutine type of the handler and its asynchronous steps.
+ *
+ * The coroutine is lazy. It is started by Start(), which detaches it and
+ * the frame is destroyed when it finishes, or by co_await in another
+ * coroutine, which is resumed when it finishes.
+ *
+ * The exception escaping from the coroutine is propagated to the one
+ * resumes it, i.e. the loop, same as the synchronous handler.
+ */
+class Task {
+ public:
+  struct promise_type;
+  using Handle = std::coroutine_handle<promise_type>;
+
+  struct promise_type {
+    std::coroutine_handle<> continuation;
+    bool detached = false;
+
+    Task get_return_object() noexcept
+    {
+      return Task(Handle::from_promise(*this));
+    }
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    struct FinalAwaiter {
+      bool await_ready() noexcept { return false; }
+
+      std::coroutine_handle<> await_suspend(Handle handle) noexcept
+      {
+        auto next = handle.promise().continuation;
+        if (handle.promise().detached) handle.destroy();
+        if (next) return next;
+        return std::noop_coroutine();
+      }
+
+      void await_resume() noexcept {}
+    };
+
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void return_void() noexcept {}
+    void unhandled_exception() { throw; }
+  };
+
+  Task(Task &&other) noexcept
+    : handle_(std::exchange(other.handle_, nullptr))
+  {
+  }
+
+  ~Task() noexcept
+  {
+    if (handle_) handle_.destroy();
+  }
+
+  /** Run until the first suspension, then the coroutine owns itself */
+  void Start()
+  {
+    auto handle = std::exchange(handle_, nullptr);
+    handle.promise().detached = true;
+    handle.resume();
+  }
+
+  bool await_ready() const noexcept { return !handle_ || handle_.done(); }
+
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting)
+  {
+    handle_.promise().continuation = awaiting;
+    return handle_;
+  }
+
+  void await_resume() const noexcept {}
+
+ private:
+  explicit Task(Handle handle) noexcept
+    : handle_(handle)
+  {
+  }
+
+  Handle handle_;
+};
+
+/** co_await the next chunk of STDIN */
+class StdinAwaiter {
+ public:
+  explicit StdinAwaiter(CoRequestState *state) noexcept
+    : state_(state)
+  {
+  }
+
+  bool await_ready() const noexcept;
+  void await_suspend(std::coroutine_handle<> handle) noexcept;
+
+  /**
+   * \return The chunk which is valid until the next suspension,
+   *         the empty chunk indicates the end of STDIN, or the request
+   *         is aborted or the connection is closed.
+   */
+  kanon::StringView await_resume() noexcept;
+
+ private:
+  CoRequestState *state_;
+};
+
+/** co_await the output of connection below the high-water mark */
+class DrainAwaiter {
+ public:
+  DrainAwaiter(CoRequestState *state, size_t high_water_mark) noexcept
+    : state_(state)
+    , high_water_mark_(high_water_mark)
+  {
+  }
+
+  bool await_ready() const noexcept;
+  void await_suspend(std::coroutine_handle<> handle);
+
+  /** \return false if the request is aborted or the connection is closed */
+  bool await_resume() const noexcept;
+
+ private:
+  CoRequestState *state_;
+  size_t high_water_mark_;
+};
+
+/** co_await a timer of the loop */
+class SleepAwaiter {
+ public:
+  SleepAwaiter(kanon::EventLoop *loop, double seconds) noexcept
+    : loop_(loop)
+    , seconds_(seconds)
+  {
+  }
+
+  bool await_ready() const noexcept { return seconds_ <= 0; }
+  void await_suspend(std::coroutine_handle<> handle);
+  void await_resume() const noexcept {}
+
+ private:
+  kanon::EventLoop *loop_;
+  double seconds_;
+};
+
+/** Resume the coroutine in \p loop after \p seconds */
+inline SleepAwaiter Sleep(kanon::EventLoop *loop, double seconds) noexcept
+{
+  return SleepAwaiter(loop, seconds);
+}
+
+/**
+ * The request passed to the coroutine handler, it is moved into the
+ * coroutine frame and releases the request when the coroutine finishes.
+ */
+class CoRequest {
+ public:
+  CoRequest(TransportPtr const &conn, FcgiRequest data,
+            std::shared_ptr<CoRequestState> state) noexcept
+    : conn_(conn)
+    , data_(std::move(data))
+    , state_(std::move(state))
+  {
+  }
+
+  CoRequest(CoRequest &&other) noexcept = default;
+  ~CoRequest() noexcept;
+
+  TransportPtr const &GetConnection() const noexcept { return conn_; }
+  kanon::EventLoop *GetLoop() const noexcept { return conn_->GetLoop(); }
+
+  FcgiRequest &GetData() noexcept { return data_; }
+  FcgiRequest const &GetData() const noexcept { return data_; }
+
+  kanon::StringView Get(Param p) const noexcept { return data_.Get(p); }
+  kanon::StringView Get(kanon::StringView name) const noexcept
+  {
+    return data_.Get(name);
+  }
+
+  bool IsAborted() const noexcept { return data_.IsAborted(); }
+
+  /**
+   * \code
+   *   for (;;) {
+   *     auto chunk = co_await request.ReadStdin();
+   *     if (chunk.empty()) break;
+   *     ...
+   *   }
+   * \endcode
+   */
+  StdinAwaiter ReadStdin() noexcept { return StdinAwaiter(state_.get()); }
+
+  CoRequestState *GetState() const noexcept { return state_.get(); }
+
+ private:
+  TransportPtr conn_;
+  FcgiRequest data_;
+  std::shared_ptr<CoRequestState> state_;
+};
+
+/**
+ * The ResponseWriter of coroutine handler whose writes suspend while
+ * the output of connection is above the high-water mark, so the large
+ * response is produced at the pace of the web server.
+ */
+class CoResponseWriter : kanon::noncopyable {
+ public:
+  explicit CoResponseWriter(CoRequest &request,
+                            size_t high_water_mark = 64 * 1024)
+    : writer_(request.GetConnection(), request.GetData())
+    , state_(request.GetState())
+    , high_water_mark_(high_water_mark)
+  {
+  }
+
+  /**
+   * Send \p data as STDOUT, then co_await the drain.
+   * The small pieces should be written to GetWriter() and followed by
+   * a Drain() instead.
+   */
+  DrainAwaiter Write(kanon::StringView data)
+  {
+    writer_.WriteStdout(data);
+    return Drain();
+  }
+
+  /** Flush the pending records, then co_await the drain */
+  DrainAwaiter Drain()
+  {
+    writer_.Flush();
+    return DrainAwaiter(state_, high_water_mark_);
+  }
+
+  void EndRequest(uint32_t app_status = 0) { writer_.EndRequest(app_status); }
+
+  ResponseWriter &GetWriter() noexcept { return writer_; }
+
+ private:
+  ResponseWriter writer_;
+  CoRequestState *state_;
+  size_t high_water_mark_;
+};
+
+using CoroutineHandler = std::function<Task(CoRequest request)>;
+
+/**
+ * Handle the requests of \p codec by coroutines.
+ *
+ * The STDIN is streamed(see FcgiCodec::SetStdinHandler()) to
+ * CoRequest::ReadStdin(), the input of connection is paused while a
+ * request buffers too much STDIN.
+ *
+ * The coroutines are resumed by the callbacks in the loop of \p conn,
+ * i.e. the STDIN and write completion of connection and the timers, so
+ * the steps don't hop threads or allocate closures. Therefore, the
+ * codec must not run handlers in WorkerPool, and the CPU bound work
+ * should be posted by the handler.
+ *
+ * The suspended coroutines are resumed when the codec is destroyed, the
+ * awaiters return the empty chunk or false.
+ */
+void SetCoroutineHandler(FcgiCodec &codec, TransportPtr const &conn,
+                         CoroutineHandler handler);
+
+} // namespace fcgi
+
+#endif // FCGI_COROUTINE_H_
@@ -0,0 +1,85 @@
+#include "fcgi_encoded_response.h"
+
+#include <string.h>
+
+#include "fcgi_record.h"
+
+#include "kanon/net/endian_api.h"
+
+using namespace kanon;
+using namespace fcgi;
+
+EncodedResponsePtr EncodedResponse::New(StringView stdout_data,
+                                        uint32_t app_status)
+{
+  return std::make_shared<EncodedResponse>(stdout_data, app_status);
+}
+
+EncodedResponse::EncodedResponse(StringView stdout_data, uint32_t app_status)
+{
+  static char const padding_bytes[8] = {0};
+
+  size_t len = stdout_data.size();
+  size_t record_num = len / MAX_CONTENT_LENGTH + 3;
+  records_.reserve(len + record_num * 16);
+  headers_.reserve(record_num);
+
+  /* The STDOUT records, the empty one is the terminator */
+  char const *data = stdout_data.data();
+  for (;;) {
+    uint16_t clen = (len > MAX_CONTENT_LENGTH) ? MAX_CONTENT_LENGTH : len;
+    RecordHeader header{
+        .version = FCGI_VERSION_1,
+        .type = FCGI_STDOUT,
+        .request_id = 0,
+        .content_length = sock::ToNetworkByteOrder16(clen),
+        .padding_length = (uint8_t)(-clen & 7),
+        .reserved = 0,
+    };
+
+    headers_.push_back(records_.size());
+    records_.append(reinterpret_cast<char const *>(&header),
+                    FCGI_RECORD_HEADER_LENGTH);
+    if (clen == 0) break;
+
+    records_.append(data, clen);
+    records_.append(padding_bytes, header.padding_length);
+    data += clen;
+    len -= clen;
+  }
+
+  RecordHeader header{
+      .version = FCGI_VERSION_1,
+      .type = FCGI_END_REQUEST,
+      .request_id = 0,
+      .content_length =
+          sock::ToNetworkByteOrder16(FCGI_END_REQUEST_BODY_LENGTH),
+      .padding_length = 0,
+      .reserved = 0,
+  };
+  EndRequestBody body{.app_status = sock::ToNetworkByteOrder32(app_status),
+                      .protocol_status = FCGI_REQUEST_COMPLETE,
+                      .reserved = {0, 0, 0}};
+
+  headers_.push_back(records_.size());
+  records_.append(reinterpret_cast<char const *>(&header),
+                  FCGI_RECORD_HEADER_LENGTH);
+  records_.append(reinterpret_cast<char const *>(&body),
+                  FCGI_END_REQUEST_BODY_LENGTH);
+}
+
+void EncodedResponse::AppendTo(ChunkList &output, uint16_t id) const
+{
+  uint16_t net_id = sock::ToNetworkByteOrder16(id);
+
+  for (size_t i = 0; i < headers_.size(); ++i) {
+    RecordHeader header;
+    memcpy(&header, records_.data() + headers_[i], FCGI_RECORD_HEADER_LENGTH);
+    header.request_id = net_id;
+    output.Append(&header, FCGI_RECORD_HEADER_LENGTH);
+
+    size_t body = headers_[i] + FCGI_RECORD_HEADER_LENGTH;
+    size_t end = (i + 1 < headers_.size()) ? headers_[i + 1] : records_.size();
+    if (end > body) output.Append(records_.data() + body, end - body);
+  }
+}
@@ -0,0 +1,77 @@
+#ifndef FCGI_ENCODED_RESPONSE_H_
+#define FCGI_ENCODED_RESPONSE_H_
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "fcgi_constant.h"
+#include "kanon/buffer/chunk_list.h"
+#include "kanon/string/string_view.h"
+#include "kanon/util/noncopyable.h"
+
+namespace fcgi {
+
+class EncodedResponse;
+using EncodedResponsePtr = std::shared_ptr<EncodedResponse const>;
+
+/**
+ * A complete response encoded to records once, i.e. the STDOUT records,
+ * the terminator of STDOUT and the END_REQUEST.
+ *
+ * It is immutable and ref-counted, so it can be sent to any number of
+ * requests and connections in any thread. The request id in the headers
+ * is 0, only the id is rewritten per send, the padding and byte order
+ * of headers aren't computed again. The constant responses(e.g. health
+ * check, 404 page, static JSON) can be encoded at startup:
+ * \code
+ *   static auto not_found = EncodedResponse::New(
+ *       "Status: 404 Not Found\r\nContent-Type: text/plain\r\n\r\n"
+ *       "Not Found");
+ *   ...
+ *   ResponseWriter writer(conn, request);
+ *   writer.EndRequest(not_found);
+ * \endcode
+ *
+ * TcpTransport sends the payload from the response directly if its output
+ * is empty, the others copy it to their output buffer.
+ */
+class EncodedResponse : kanon::noncopyable {
+ public:
+  /**
+   * \param stdout_data The HTTP headers and the body
+   * \param app_status The app status of END_REQUEST
+   */
+  static EncodedResponsePtr New(kanon::StringView stdout_data,
+                                uint32_t app_status = 0);
+
+  EncodedResponse(kanon::StringView stdout_data, uint32_t app_status);
+
+  /** The records whose request id is 0 */
+  kanon::StringView GetRecords() const noexcept
+  {
+    return kanon::StringView(records_.data(), records_.size());
+  }
+
+  size_t GetSize() const noexcept { return records_.size(); }
+
+  /** The offsets of record headers in GetRecords() */
+  std::vector<uint32_t> const &GetHeaders() const noexcept
+  {
+    return headers_;
+  }
+
+  size_t GetRecordNum() const noexcept { return headers_.size(); }
+
+  /** Append a copy of records with the request id \p id */
+  void AppendTo(kanon::ChunkList &output, uint16_t id) const;
+
+ private:
+  std::string records_;
+  std::vector<uint32_t> headers_;
+};
+
+} // namespace fcgi
+
+#endif // FCGI_ENCODED_RESPONSE_H_
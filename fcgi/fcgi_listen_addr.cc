@@ -0,0 +1,159 @@
+#include "fcgi_listen_addr.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "kanon/log/logger.h"
+
+using namespace kanon;
+using namespace fcgi;
+
+ListenAddr::ListenAddr(InetAddr const &addr)
+  : inet_addr_(addr)
+  , ip_port_(addr.ToIpPort())
+{
+  auto sock_addr = addr.ToSockaddr();
+  len_ = (sock_addr->sa_family == AF_INET6) ? sizeof(struct sockaddr_in6)
+                                            : sizeof(struct sockaddr_in);
+  memset(&addr_, 0, sizeof addr_);
+  memcpy(&addr_, sock_addr, len_);
+}
+
+ListenAddr ListenAddr::Unix(std::string const &path, mode_t mode)
+{
+  ListenAddr ret;
+  memset(&ret.addr_, 0, sizeof ret.addr_);
+
+  auto &un = reinterpret_cast<sockaddr_un &>(ret.addr_);
+  un.sun_family = AF_UNIX;
+  if (path.size() >= sizeof un.sun_path) {
+    LOG_FATAL << "The path of Unix domain socket is too long: " << path;
+  }
+
+  memcpy(un.sun_path, path.data(), path.size());
+  ret.len_ = offsetof(sockaddr_un, sun_path) + path.size() + 1;
+  ret.path_ = path;
+  ret.mode_ = mode;
+  return ret;
+}
+
+ListenAddr ListenAddr::AbstractUnix(std::string const &name)
+{
+  ListenAddr ret;
+  memset(&ret.addr_, 0, sizeof ret.addr_);
+
+  auto &un = reinterpret_cast<sockaddr_un &>(ret.addr_);
+  un.sun_family = AF_UNIX;
+  if (name.size() + 1 > sizeof un.sun_path) {
+    LOG_FATAL << "The name of abstract Unix domain socket is too long: "
+              << name;
+  }
+
+  /* The leading '\0' indicates the abstract namespace, the name isn't
+   * terminated by '\0' */
+  memcpy(un.sun_path + 1, name.data(), name.size());
+  ret.len_ = offsetof(sockaddr_un, sun_path) + 1 + name.size();
+  return ret;
+}
+
+int ListenAddr::Listen(bool reuseport) const
+{
+  int fd = ::socket(addr_.ss_family,
+                    SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    LOG_SYSERROR << "Failed to create the listening socket";
+    return -1;
+  }
+
+  int on = 1;
+  if (!IsUnix()) {
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+    if (reuseport &&
+        ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof on) < 0)
+    {
+      LOG_SYSERROR << "Failed to set SO_REUSEPORT";
+      ::close(fd);
+      return -1;
+    }
+  } else if (!path_.empty() && !RemoveStaleFile()) {
+    ::close(fd);
+    return -1;
+  }
+
+  if (::bind(fd, GetSockaddr(), len_) < 0) {
+    LOG_SYSERROR << "Failed to bind " << ToString();
+    ::close(fd);
+    return -1;
+  }
+
+  if (mode_ != 0 && ::chmod(path_.c_str(), mode_) < 0) {
+    LOG_SYSERROR << "Failed to change the mode of " << path_;
+    ::close(fd);
+    return -1;
+  }
+
+  if (::listen(fd, SOMAXCONN) < 0) {
+    LOG_SYSERROR << "Failed to listen on " << ToString();
+    ::close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+bool ListenAddr::RemoveStaleFile() const
+{
+  struct stat st;
+  if (::stat(path_.c_str(), &st) < 0 || !S_ISSOCK(st.st_mode)) return true;
+
+  /* The file isn't stale if a server is still accepting on it */
+  int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    LOG_SYSERROR << "Failed to create the socket to probe " << path_;
+    return false;
+  }
+
+  int ret = ::connect(fd, GetSockaddr(), len_);
+  int saved_errno = errno;
+  ::close(fd);
+
+  /* EAGAIN: The backlog of the server is full */
+  if (ret == 0 || saved_errno == EAGAIN) {
+    LOG_ERROR << "Another server is listening on " << ToString();
+    return false;
+  }
+
+  if (saved_errno != ECONNREFUSED) {
+    errno = saved_errno;
+    LOG_SYSERROR << "Failed to probe the socket file " << path_;
+    return false;
+  }
+
+  /* Left by the last run */
+  if (::unlink(path_.c_str()) < 0 && errno != ENOENT) {
+    LOG_SYSERROR << "Failed to remove the stale socket file " << path_;
+    return false;
+  }
+
+  return true;
+}
+
+void ListenAddr::Unlink() const noexcept
+{
+  if (!path_.empty()) ::unlink(path_.c_str());
+}
+
+std::string ListenAddr::ToString() const
+{
+  if (!IsUnix()) return ip_port_;
+
+  if (IsAbstract()) {
+    auto &un = reinterpret_cast<sockaddr_un const &>(addr_);
+    size_t name_len = len_ - offsetof(sockaddr_un, sun_path) - 1;
+    return "unix:@" + std::string(un.sun_path + 1, name_len);
+  }
+
+  return "unix:" + path_;
+}
@@ -0,0 +1,88 @@
+#ifndef FCGI_LISTEN_ADDR_H_
+#define FCGI_LISTEN_ADDR_H_
+
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "kanon/net/inet_addr.h"
+
+namespace fcgi {
+
+/**
+ * The address to listen on, TCP or Unix domain socket.
+ *
+ * The web server on the same host usually connects to the application
+ * by Unix domain socket, which skips the TCP/IP stack:
+ * \code
+ *   fastcgi_pass unix:/run/echo_cgi.sock;
+ * \endcode
+ */
+class ListenAddr {
+ public:
+  /** TCP */
+  ListenAddr(kanon::InetAddr const &addr);
+
+  /**
+   * Unix domain socket bound to \p path in file system.
+   * The stale socket file is removed before binding, i.e. no server is
+   * listening on it(connect(2) is refused). Listening fails if a server
+   * is still using it. The file is removed when the listening socket is
+   * closed.
+   * \param mode The permission of the socket file(e.g. 0660), the
+   *             web server must have the write permission. 0 indicates
+   *             the default(umask).
+   */
+  static ListenAddr Unix(std::string const &path, mode_t mode = 0);
+
+  /**
+   * Unix domain socket in the abstract namespace(Linux only), which
+   * isn't in the file system, so no file to clean up and no permission.
+   * The web server connects to it by "@name".
+   */
+  static ListenAddr AbstractUnix(std::string const &name);
+
+  bool IsUnix() const noexcept { return addr_.ss_family == AF_UNIX; }
+  bool IsAbstract() const noexcept { return IsUnix() && path_.empty(); }
+
+  sockaddr const *GetSockaddr() const noexcept
+  {
+    return reinterpret_cast<sockaddr const *>(&addr_);
+  }
+
+  socklen_t GetLength() const noexcept { return len_; }
+
+  /** Only for TCP */
+  kanon::InetAddr const &GetInetAddr() const noexcept { return inet_addr_; }
+
+  /**
+   * Create a non-blocking listening socket bound to the address
+   * \param reuseport Set SO_REUSEPORT, only for TCP
+   * \return -1 if failed
+   */
+  int Listen(bool reuseport = false) const;
+
+  /** Remove the socket file of Unix domain socket */
+  void Unlink() const noexcept;
+
+  /* e.g. 0.0.0.0:9000, unix:/run/echo_cgi.sock, unix:@echo_cgi */
+  std::string ToString() const;
+
+ private:
+  ListenAddr() = default;
+
+  /* \return false if the socket file is in use or can't be removed */
+  bool RemoveStaleFile() const;
+
+  sockaddr_storage addr_;
+  socklen_t len_ = 0;
+  std::string path_; /* Empty if TCP or abstract */
+  kanon::InetAddr inet_addr_;
+  std::string ip_port_;
+  mode_t mode_ = 0;
+};
+
+} // namespace fcgi
+
+#endif // FCGI_LISTEN_ADDR_H_
@@ -0,0 +1,415 @@
+#include "fcgi_output_scheduler.h"
+
+#include <algorithm>
+#include <string.h>
+
+#include "fcgi_record.h"
+
+#include "kanon/log/logger.h"
+#include "kanon/net/endian_api.h"
+#include "kanon/net/event_loop.h"
+
+using namespace kanon;
+using namespace fcgi;
+
+/* The freed queues exceed it are deleted */
+#define MAX_SPARE_QUEUE_NUM 64
+
+/* Copy \p n bytes at \p offset of \p list which may span chunks */
+static void PeekBytes(ChunkList const &list, size_t offset, void *dst,
+                      size_t n) noexcept
+{
+  auto out = static_cast<char *>(dst);
+  for (auto const &chunk : list) {
+    if (n == 0) break;
+
+    size_t size = chunk.GetReadableSize();
+    if (offset >= size) {
+      offset -= size;
+      continue;
+    }
+
+    size_t len = std::min(size - offset, n);
+    memcpy(out, chunk.GetReadBegin() + offset, len);
+    out += len;
+    n -= len;
+    offset = 0;
+  }
+}
+
+/* Move the first \p n bytes of \p from to the end of \p to */
+static void MoveBytes(ChunkList &from, ChunkList &to, size_t n)
+{
+  if (n == from.GetReadableSize() && to.IsEmpty()) {
+    to.swap(from);
+    return;
+  }
+
+  size_t left = n;
+  for (auto const &chunk : from) {
+    if (left == 0) break;
+
+    size_t len = std::min((size_t)chunk.GetReadableSize(), left);
+    to.Append(chunk.GetReadBegin(), len);
+    left -= len;
+  }
+
+  from.AdvanceRead(n);
+}
+
+static inline bool IsSplittable(uint8_t type) noexcept
+{
+  return type == FCGI_STDOUT || type == FCGI_STDERR;
+}
+
+OutputScheduler::OutputScheduler(Transport *conn, size_t record_size)
+  : conn_(conn)
+  , record_size_(std::max(std::min(record_size, (size_t)MAX_CONTENT_LENGTH),
+                          (size_t)8))
+  , max_piece_(record_size_ & ~(size_t)7)
+{
+}
+
+OutputScheduler::~OutputScheduler() noexcept
+{
+  queues_.ForEach([](Queue *queue) { delete queue; });
+}
+
+void OutputScheduler::SetWeight(uint16_t id, unsigned weight)
+{
+  GetQueue(id)->weight = weight > 0 ? weight : 1;
+}
+
+void OutputScheduler::Enqueue(uint16_t id, ChunkList &records)
+{
+  size_t total = records.GetReadableSize();
+  if (total == 0) return;
+
+  /* Nothing to interleave with, no record needs to be split */
+  if (ring_.empty() && total <= record_size_ && !queues_.Find(id) &&
+      conn_->GetOutputSize() < record_size_)
+  {
+    conn_->Send(records);
+    return;
+  }
+
+  /* Index the records, the contents are not touched */
+  auto queue = GetQueue(id);
+  auto old_num = queue->items.size();
+  size_t offset = 0;
+  while (total - offset >= FCGI_RECORD_HEADER_LENGTH) {
+    RecordHeader header;
+    PeekBytes(records, offset, &header, FCGI_RECORD_HEADER_LENGTH);
+
+    size_t clen = sock::ToHostByteOrder16(header.content_length);
+    size_t length = FCGI_RECORD_HEADER_LENGTH + clen + header.padding_length;
+    if (total - offset < length) break;
+
+    queue->items.push_back(Item{header.type, header.padding_length, clen,
+                                nullptr, 0, queue->generation});
+    queue->size += clen;
+    offset += length;
+    if (header.type == FCGI_END_REQUEST) ++queue->generation;
+  }
+
+  if (offset != total) {
+    LOG_ERROR << "The output of request " << id
+              << " isn't composed of complete records, it is dropped";
+    while (queue->items.size() > old_num) {
+      queue->size -= queue->items.back().length;
+      if (queue->items.back().type == FCGI_END_REQUEST) --queue->generation;
+      queue->items.pop_back();
+    }
+    records.AdvanceAll();
+    return;
+  }
+
+  if (queue->bytes.IsEmpty()) {
+    queue->bytes.swap(records);
+  } else {
+    for (auto const &chunk : records) {
+      queue->bytes.Append(chunk.GetReadBegin(), chunk.GetReadableSize());
+    }
+    records.AdvanceAll();
+  }
+
+  Activate(queue);
+  Pump();
+}
+
+void OutputScheduler::Enqueue(uint16_t id, EncodedResponsePtr const &response)
+{
+  /* Nothing to interleave with, send it from the shared response */
+  if (ring_.empty() && !queues_.Find(id) &&
+      response->GetSize() <= record_size_ &&
+      conn_->GetOutputSize() < record_size_)
+  {
+    conn_->Send(response, id);
+    return;
+  }
+
+  ChunkList records;
+  response->AppendTo(records, id);
+  Enqueue(id, records);
+}
+
+void OutputScheduler::EnqueueFile(uint16_t id, FileHandlePtr const &file,
+                                  off_t offset, size_t len)
+{
+  if (len == 0) return;
+
+  auto queue = GetQueue(id);
+  queue->items.push_back(
+      Item{FCGI_STDOUT, 0, len, file, offset, queue->generation});
+  queue->size += len;
+
+  Activate(queue);
+  Pump();
+}
+
+void OutputScheduler::Drop(uint16_t id, bool completed)
+{
+  auto queue = queues_.Find(id);
+  if (!queue) return;
+
+  auto generation = completed ? queue->generation - 1 : queue->generation;
+
+  /* The header of the front record being split has been consumed, the
+   * pieces of it sent are complete records */
+  size_t split_left = queue->split_left;
+  queue->split_left = 0;
+
+  ChunkList kept;
+  std::deque<Item> items;
+  size_t size = 0;
+  for (auto &item : queue->items) {
+    size_t content = split_left > 0 ? split_left : item.length;
+    size_t length = content + item.padding +
+                    (split_left > 0 ? 0 : FCGI_RECORD_HEADER_LENGTH);
+
+    /* The records of the other requests and the END_REQUEST are kept */
+    if (item.generation != generation || item.type == FCGI_END_REQUEST) {
+      if (!item.file) MoveBytes(queue->bytes, kept, length);
+      if (split_left > 0) queue->split_left = split_left;
+      size += content;
+      items.push_back(std::move(item));
+    } else if (!item.file) {
+      queue->bytes.AdvanceRead(length);
+    }
+
+    split_left = 0;
+  }
+
+  queue->bytes.swap(kept);
+  queue->items.swap(items);
+  queue->size = size;
+
+  if (queue->items.empty()) {
+    Deactivate(queue);
+    FreeQueue(queue);
+  }
+}
+
+void OutputScheduler::Pump()
+{
+  /* Enqueued by the callback of transport during sending */
+  if (pumping_) return;
+  pumping_ = true;
+
+  ChunkList batch;
+  for (;;) {
+    /* A round, every active queue takes a turn */
+    for (size_t n = ring_.size(); n > 0; --n) {
+      auto id = ring_.front();
+      ring_.pop_front();
+
+      auto queue = queues_.Find(id);
+      Dequeue(*queue, batch, queue->weight * record_size_);
+
+      if (!queue->items.empty()) {
+        ring_.push_back(id);
+        continue;
+      }
+
+      queue->active = false;
+      if (queue->ended) FreeQueue(queue);
+    }
+
+    if (!batch.IsEmpty()) conn_->Send(batch);
+
+    /* The transport will drain and call Pump() again */
+    if (ring_.empty() || !conn_->IsConnected() ||
+        conn_->GetOutputSize() >= record_size_)
+    {
+      break;
+    }
+  }
+
+  pumping_ = false;
+}
+
+size_t OutputScheduler::GetQueuedSize(uint16_t id) const noexcept
+{
+  auto queue = queues_.Find(id);
+  return queue ? queue->size : 0;
+}
+
+void OutputScheduler::Send(TransportPtr const &conn, uint16_t id,
+                           ChunkList &records)
+{
+  if (!conn->IsOutputScheduled()) {
+    conn->Send(records);
+    return;
+  }
+
+  auto loop = conn->GetLoop();
+  if (!loop->IsLoopInThread()) {
+    auto moved = std::make_shared<ChunkList>(std::move(records));
+    loop->QueueToLoop([conn, id, moved]() { Send(conn, id, *moved); });
+    return;
+  }
+
+  /* nullptr if the codec is destroyed, i.e. the connection is closed */
+  auto scheduler = conn->GetOutputScheduler();
+  if (scheduler) {
+    scheduler->Enqueue(id, records);
+  } else {
+    conn->Send(records);
+  }
+}
+
+void OutputScheduler::Send(TransportPtr const &conn, uint16_t id,
+                           EncodedResponsePtr const &response)
+{
+  if (!conn->IsOutputScheduled()) {
+    conn->Send(response, id);
+    return;
+  }
+
+  auto loop = conn->GetLoop();
+  if (!loop->IsLoopInThread()) {
+    loop->QueueToLoop([conn, id, response]() { Send(conn, id, response); });
+    return;
+  }
+
+  auto scheduler = conn->GetOutputScheduler();
+  if (scheduler) {
+    scheduler->Enqueue(id, response);
+  } else {
+    conn->Send(response, id);
+  }
+}
+
+size_t OutputScheduler::GetOutputSize(TransportPtr const &conn,
+                                      uint16_t id) noexcept
+{
+  auto scheduler = conn->GetOutputScheduler();
+  size_t queued = scheduler ? scheduler->GetQueuedSize(id) : 0;
+  return conn->GetOutputSize() + queued;
+}
+
+auto OutputScheduler::GetQueue(uint16_t id) -> Queue *
+{
+  auto queue = queues_.Find(id);
+  if (queue) return queue;
+
+  if (spare_queues_.empty()) {
+    queue = new Queue;
+  } else {
+    queue = spare_queues_.back().release();
+    spare_queues_.pop_back();
+  }
+
+  queue->id = id;
+  queues_.Insert(id, queue);
+  return queue;
+}
+
+void OutputScheduler::Activate(Queue *queue)
+{
+  if (queue->active) return;
+  queue->active = true;
+  ring_.push_back(queue->id);
+}
+
+void OutputScheduler::Deactivate(Queue *queue)
+{
+  if (!queue->active) return;
+  queue->active = false;
+  ring_.erase(std::find(ring_.begin(), ring_.end(), queue->id));
+}
+
+void OutputScheduler::FreeQueue(Queue *queue) noexcept
+{
+  queues_.Remove(queue->id);
+  if (spare_queues_.size() >= MAX_SPARE_QUEUE_NUM) {
+    delete queue;
+    return;
+  }
+
+  /* The chunks of bytes are kept */
+  queue->weight = 1;
+  queue->ended = false;
+  spare_queues_.emplace_back(queue);
+}
+
+void OutputScheduler::Dequeue(Queue &queue, ChunkList &batch, size_t quantum)
+{
+  while (quantum > 0 && !queue.items.empty()) {
+    auto &item = queue.items.front();
+    /* The records after the END_REQUEST are of the request reusing id */
+    queue.ended = false;
+
+    if (item.file) {
+      /* Framed when it is sent, only the last piece is padded */
+      size_t piece = std::min(item.length, max_piece_);
+      auto padding = AppendRecordHeader(batch, FCGI_STDOUT, queue.id, piece);
+      conn_->SendFile(batch, item.file, item.offset, piece);
+      if (padding > 0) AppendPadding(batch, padding);
+
+      item.offset += piece;
+      item.length -= piece;
+      queue.size -= piece;
+      quantum -= std::min(quantum, piece);
+      if (item.length == 0) queue.items.pop_front();
+      continue;
+    }
+
+    if (queue.split_left == 0 &&
+        (item.length <= max_piece_ || !IsSplittable(item.type)))
+    {
+      MoveBytes(queue.bytes, batch,
+                FCGI_RECORD_HEADER_LENGTH + item.length + item.padding);
+      queue.size -= item.length;
+      quantum -= std::min(quantum, item.length);
+
+      /* The weight is for the request, the id may be reused */
+      if (item.type == FCGI_END_REQUEST) {
+        queue.weight = 1;
+        queue.ended = true;
+      }
+      queue.items.pop_front();
+      continue;
+    }
+
+    /* Split the long record, the header is replaced by the pieces' */
+    if (queue.split_left == 0) {
+      queue.bytes.AdvanceRead(FCGI_RECORD_HEADER_LENGTH);
+      queue.split_left = item.length;
+    }
+
+    size_t piece = std::min(queue.split_left, max_piece_);
+    auto padding = AppendRecordHeader(batch, (FcgiType)item.type, queue.id,
+                                      piece);
+    MoveBytes(queue.bytes, batch, piece);
+    queue.split_left -= piece;
+    queue.size -= piece;
+    quantum -= std::min(quantum, piece);
+
+    if (queue.split_left == 0) {
+      queue.bytes.AdvanceRead(item.padding);
+      if (padding > 0) AppendPadding(batch, padding);
+      queue.items.pop_front();
+    }
+  }
+}
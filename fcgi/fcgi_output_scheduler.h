@@ -0,0 +1,154 @@
+#ifndef FCGI_OUTPUT_SCHEDULER_H_
+#define FCGI_OUTPUT_SCHEDULER_H_
+
+#include <deque>
+#include <memory>
+#include <sys/types.h>
+#include <vector>
+
+#include "fcgi_request_table.h"
+#include "fcgi_transport.h"
+#include "kanon/buffer/chunk_list.h"
+#include "kanon/util/noncopyable.h"
+
+namespace fcgi {
+
+/**
+ * Interleave the responses of the requests multiplexed on a connection.
+ *
+ * Without it, the records are written in the order they are sent, so a
+ * large response(e.g. a download) blocks the small responses sent after
+ * it on the same connection.
+ *
+ * The scheduler keeps a queue of records per request id. The queues
+ * take turns in round-robin, each turn sends weight * record_size bytes
+ * of content at most. The STDOUT and STDERR records longer than the
+ * record size are split when they are sent.
+ *
+ * The queues are only drained into the transport while its output is
+ * below the record size, then the response arriving later waits one
+ * round at most instead of the whole backlog. The remaining records are
+ * sent when the transport drains.
+ *
+ * Enabled by FcgiCodec::EnableOutputScheduler(), all output of the
+ * requests of codec is sent through it, including the ResponseWriter
+ * and the API of FcgiCodec. The queue of aborted request is dropped.
+ *
+ * The methods except the static ones are called in the loop.
+ */
+class OutputScheduler : kanon::noncopyable {
+ public:
+  /**
+   * \param record_size The maximum content length of the STDOUT and
+   *                    STDERR records, at least 8
+   */
+  OutputScheduler(Transport *conn, size_t record_size);
+  ~OutputScheduler() noexcept;
+
+  /**
+   * The share of request \p id, a turn of it sends weight * record_size
+   * bytes at most. The weight is kept until the request ends.
+   * 1 by default.
+   */
+  void SetWeight(uint16_t id, unsigned weight);
+
+  /** Queue the framed records of request \p id, they are consumed */
+  void Enqueue(uint16_t id, kanon::ChunkList &records);
+
+  /** Queue the records of \p response with the request id \p id */
+  void Enqueue(uint16_t id, EncodedResponsePtr const &response);
+
+  /** Queue the [offset, offset+len) of \p file as STDOUT of \p id */
+  void EnqueueFile(uint16_t id, FileHandlePtr const &file, off_t offset,
+                   size_t len);
+
+  /**
+   * Drop the queued STDOUT and STDERR of a request of \p id, e.g. it is
+   * aborted. The END_REQUEST queued is kept.
+   *
+   * The id may be reused once the END_REQUEST is queued, so the records
+   * are told apart by the request they belong to:
+   * \param completed If true, the request whose END_REQUEST is queued
+   *                  last, otherwise the request which hasn't completed.
+   *                  The records of the other requests are kept.
+   *
+   * The queue is freed if it becomes empty.
+   */
+  void Drop(uint16_t id, bool completed);
+
+  /** Send the queued records while the transport accepts */
+  void Pump();
+
+  /** The content bytes queued for request \p id */
+  size_t GetQueuedSize(uint16_t id) const noexcept;
+
+  size_t GetRecordSize() const noexcept { return record_size_; }
+
+  /*-----------------------*/
+  /* Routing               */
+  /*-----------------------*/
+
+  /*
+   * Send the records of request \p id by the scheduler of \p conn if it
+   * is scheduled, otherwise by the transport directly.
+   * Can be called in any thread.
+   */
+
+  static void Send(TransportPtr const &conn, uint16_t id,
+                   kanon::ChunkList &records);
+
+  static void Send(TransportPtr const &conn, uint16_t id,
+                   EncodedResponsePtr const &response);
+
+  /**
+   * The output of transport plus the content queued for request \p id,
+   * i.e. the backlog of the request. Called in the loop.
+   */
+  static size_t GetOutputSize(TransportPtr const &conn, uint16_t id) noexcept;
+
+ private:
+  /* A record queued, or the content of file framed when it is sent */
+  struct Item {
+    uint8_t type;
+    uint8_t padding;
+    size_t length; /* The content length */
+    FileHandlePtr file;
+    off_t offset;
+    unsigned generation; /* The request of the id it belongs to */
+  };
+
+  struct Queue {
+    uint16_t id = 0;
+    unsigned weight = 1;
+    kanon::ChunkList bytes; /* The records of items except files */
+    std::deque<Item> items;
+    size_t size = 0;       /* The content bytes of items */
+    size_t split_left = 0; /* The content left of the front record split */
+    bool active = false;   /* In the ring */
+    bool ended = false;    /* The END_REQUEST has been sent */
+    /* Bumped by the END_REQUEST queued, the records queued after it are of
+     * the request reusing id */
+    unsigned generation = 0;
+  };
+
+  Queue *GetQueue(uint16_t id);
+  void Activate(Queue *queue);
+  void Deactivate(Queue *queue);
+  void FreeQueue(Queue *queue) noexcept;
+
+  /* Move a turn of \p queue to \p batch */
+  void Dequeue(Queue &queue, kanon::ChunkList &batch, size_t quantum);
+
+  Transport *conn_;
+  size_t record_size_;
+  size_t max_piece_; /* The record size aligned to 8, no padding */
+  RequestTable<Queue> queues_;
+  std::deque<uint16_t> ring_; /* The ids whose queue isn't empty */
+  /* The freed queues reused by the following requests */
+  std::vector<std::unique_ptr<Queue>> spare_queues_;
+  bool pumping_ = false;
+};
+
+} // namespace fcgi
+
+#endif // FCGI_OUTPUT_SCHEDULER_H_
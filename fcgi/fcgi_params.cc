@@ -0,0 +1,208 @@
+#include "fcgi_params.h"
+
+#include <string.h>
+
+using namespace kanon;
+using namespace fcgi;
+
+struct ParamName {
+  char const *name;
+  size_t len;
+};
+
+#define PARAM_NAME(name) {name, sizeof(name) - 1}
+
+/* Indexed by Param */
+static constexpr ParamName param_names[] = {
+    PARAM_NAME("GATEWAY_INTERFACE"),
+    PARAM_NAME("SERVER_SOFTWARE"),
+    PARAM_NAME("SERVER_PROTOCOL"),
+    PARAM_NAME("SERVER_NAME"),
+    PARAM_NAME("SERVER_ADDR"),
+    PARAM_NAME("SERVER_PORT"),
+    PARAM_NAME("REQUEST_METHOD"),
+    PARAM_NAME("REQUEST_URI"),
+    PARAM_NAME("REQUEST_SCHEME"),
+    PARAM_NAME("QUERY_STRING"),
+    PARAM_NAME("CONTENT_TYPE"),
+    PARAM_NAME("CONTENT_LENGTH"),
+    PARAM_NAME("SCRIPT_NAME"),
+    PARAM_NAME("SCRIPT_FILENAME"),
+    PARAM_NAME("PATH_INFO"),
+    PARAM_NAME("DOCUMENT_URI"),
+    PARAM_NAME("DOCUMENT_ROOT"),
+    PARAM_NAME("REMOTE_ADDR"),
+    PARAM_NAME("REMOTE_PORT"),
+    PARAM_NAME("REDIRECT_STATUS"),
+    PARAM_NAME("HTTPS"),
+    PARAM_NAME("HTTP_HOST"),
+    PARAM_NAME("HTTP_USER_AGENT"),
+    PARAM_NAME("HTTP_ACCEPT"),
+    PARAM_NAME("HTTP_ACCEPT_ENCODING"),
+    PARAM_NAME("HTTP_ACCEPT_LANGUAGE"),
+    PARAM_NAME("HTTP_CONNECTION"),
+    PARAM_NAME("HTTP_COOKIE"),
+    PARAM_NAME("HTTP_REFERER"),
+    PARAM_NAME("HTTP_CONTENT_TYPE"),
+    PARAM_NAME("HTTP_CONTENT_LENGTH"),
+};
+
+#undef PARAM_NAME
+
+static_assert(sizeof(param_names) / sizeof(param_names[0]) ==
+                  (size_t)Param::Unknown,
+              "The names of well-known params must match the Param");
+
+/*
+ * The hash is perfect on the well-known names(Generated by brute force
+ * search), it only looks at the length and two characters.
+ * The shortest well-known name is "HTTPS", names shorter than 4 bytes
+ * must be rejected before hashing.
+ */
+#define PARAM_HASH_SLOT_NUM 64
+
+static constexpr uint32_t HashParamName(char const *name, size_t len) noexcept
+{
+  return (len * 19 + (unsigned char)name[3] * 22 +
+          (unsigned char)name[len - 2]) &
+         (PARAM_HASH_SLOT_NUM - 1);
+}
+
+#define P(x) Param::x
+static constexpr Param param_slots[PARAM_HASH_SLOT_NUM] = {
+    /*  0 */ P(Unknown), P(HttpAccept), P(ServerName), P(Unknown),
+    /*  4 */ P(DocumentUri), P(Unknown), P(Unknown), P(ServerPort),
+    /*  8 */ P(Unknown), P(HttpReferer), P(Unknown), P(HttpUserAgent),
+    /* 12 */ P(HttpConnection), P(Unknown), P(Unknown), P(Https),
+    /* 16 */ P(ServerProtocol), P(Unknown), P(Unknown), P(ServerSoftware),
+    /* 20 */ P(DocumentRoot), P(Unknown), P(ContentLength), P(Unknown),
+    /* 24 */ P(Unknown), P(Unknown), P(Unknown), P(Unknown),
+    /* 28 */ P(Unknown), P(HttpContentLength), P(HttpHost), P(RemoteAddr),
+    /* 32 */ P(Unknown), P(PathInfo), P(Unknown), P(HttpAcceptLanguage),
+    /* 36 */ P(ScriptName), P(RequestScheme), P(Unknown), P(RequestMethod),
+    /* 40 */ P(Unknown), P(Unknown), P(HttpAcceptEncoding), P(Unknown),
+    /* 44 */ P(ContentType), P(RemotePort), P(Unknown), P(Unknown),
+    /* 48 */ P(ScriptFilename), P(RequestUri), P(Unknown), P(HttpContentType),
+    /* 52 */ P(GatewayInterface), P(Unknown), P(Unknown), P(Unknown),
+    /* 56 */ P(RedirectStatus), P(ServerAddr), P(HttpCookie), P(Unknown),
+    /* 60 */ P(Unknown), P(Unknown), P(QueryString), P(Unknown),
+};
+#undef P
+
+static constexpr bool CheckParamSlots(int i) noexcept
+{
+  return i == (int)Param::Unknown ||
+         (param_slots[HashParamName(param_names[i].name,
+                                    param_names[i].len)] == (Param)i &&
+          CheckParamSlots(i + 1));
+}
+
+static_assert(CheckParamSlots(0),
+              "The hash of well-known params must be perfect, "
+              "regenerate the param_slots if the names are changed");
+
+Param fcgi::String2Param(StringView name) noexcept
+{
+  if (name.size() < 4) return Param::Unknown;
+  auto p = param_slots[HashParamName(name.data(), name.size())];
+  if (p == Param::Unknown) return p;
+
+  auto const &expected = param_names[(int)p];
+  if (expected.len == name.size() &&
+      memcmp(expected.name, name.data(), name.size()) == 0)
+  {
+    return p;
+  }
+  return Param::Unknown;
+}
+
+char const *fcgi::Param2String(Param p) noexcept
+{
+  if (p >= Param::Unknown) return "Unknown param";
+  return param_names[(int)p].name;
+}
+
+/**
+ * The length of name or value is encoded in 1 byte if it is less than 128,
+ * otherwise, 4 bytes(network byte order) and the highest bit is set.
+ */
+static inline bool ReadNamePairLength(char const *&cur, char const *end,
+                                      uint32_t &len) noexcept
+{
+  if (cur >= end) return false;
+
+  auto const *bytes = reinterpret_cast<unsigned char const *>(cur);
+  if ((bytes[0] >> 7) == 0) {
+    len = bytes[0];
+    cur += 1;
+    return true;
+  }
+
+  if (end - cur < 4) return false;
+  /* Clear the highest bit */
+  len = ((uint32_t)(bytes[0] & 0x7f) << 24) | ((uint32_t)bytes[1] << 16) |
+        ((uint32_t)bytes[2] << 8) | (uint32_t)bytes[3];
+  cur += 4;
+  return true;
+}
+
+bool FcgiParams::Parse()
+{
+  index_.clear();
+  ClearWellKnown();
+
+  char const *begin = raw_.GetReadBegin();
+  char const *end = begin + raw_.GetReadableSize();
+  char const *cur = begin;
+
+  Entry entry;
+  while (cur < end) {
+    if (!ReadNamePairLength(cur, end, entry.name_len) ||
+        !ReadNamePairLength(cur, end, entry.value_len))
+    {
+      return false;
+    }
+
+    if ((size_t)(end - cur) < (size_t)entry.name_len + entry.value_len) {
+      return false;
+    }
+
+    entry.offset = cur - begin;
+    index_.push_back(entry);
+
+    auto p = String2Param(StringView(cur, entry.name_len));
+    /* The latter one overrides the former one */
+    if (p != Param::Unknown) well_known_[(int)p] = index_.size();
+    cur += entry.name_len + entry.value_len;
+  }
+
+  return true;
+}
+
+auto FcgiParams::Find(StringView name) const noexcept -> Entry const *
+{
+  auto p = String2Param(name);
+  if (p != Param::Unknown) {
+    auto pos = well_known_[(int)p];
+    return pos ? &index_[pos - 1] : nullptr;
+  }
+
+  /* Search backward to be consistent with the well-known params */
+  char const *begin = raw_.GetReadBegin();
+  for (auto iter = index_.rbegin(); iter != index_.rend(); ++iter) {
+    if (iter->name_len == name.size() &&
+        memcmp(begin + iter->offset, name.data(), name.size()) == 0)
+    {
+      return &*iter;
+    }
+  }
+
+  return nullptr;
+}
+
+StringView FcgiParams::Get(StringView name) const noexcept
+{
+  auto entry = Find(name);
+  if (!entry) return StringView();
+  return MakePair(*entry).value;
+}
@@ -0,0 +1,214 @@
+#ifndef FCGI_PARAMS_H_
+#define FCGI_PARAMS_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "kanon/net/buffer.h"
+#include "kanon/string/string_view.h"
+
+namespace fcgi {
+
+/**
+ * The standard CGI variables and the ones nginx passes by default.
+ *
+ * They are located by a perfect hash when parsing, so the accessors
+ * taking Param don't compare any string.
+ */
+enum class Param : uint8_t {
+  GatewayInterface,
+  ServerSoftware,
+  ServerProtocol,
+  ServerName,
+  ServerAddr,
+  ServerPort,
+  RequestMethod,
+  RequestUri,
+  RequestScheme,
+  QueryString,
+  ContentType,
+  ContentLength,
+  ScriptName,
+  ScriptFilename,
+  PathInfo,
+  DocumentUri,
+  DocumentRoot,
+  RemoteAddr,
+  RemotePort,
+  RedirectStatus,
+  Https,
+  HttpHost,
+  HttpUserAgent,
+  HttpAccept,
+  HttpAcceptEncoding,
+  HttpAcceptLanguage,
+  HttpConnection,
+  HttpCookie,
+  HttpReferer,
+  HttpContentType,
+  HttpContentLength,
+  Unknown, /* Not well-known, also the number of well-known params */
+};
+
+/** Map \p name to the well-known param, Param::Unknown if it isn't */
+Param String2Param(kanon::StringView name) noexcept;
+
+char const *Param2String(Param p) noexcept;
+
+/**
+ * Name-value pairs of the FCGI_PARAMS stream.
+ *
+ * The raw bytes are kept as received, and ParseParams() builds a flat
+ * index of (offset, length) over them in one pass. The names and values
+ * are exposed as StringView into the raw bytes, so lookup and iteration
+ * don't allocate. Use GetString() to get a owned copy.
+ *
+ * The well-known params are also recorded in a slot array indexed by
+ * Param, only the other params are searched in the index.
+ */
+class FcgiParams {
+  struct Entry {
+    uint32_t offset; /* Offset of name, the value follows name */
+    uint32_t name_len;
+    uint32_t value_len;
+  };
+
+  using Index = std::vector<Entry>;
+
+  static constexpr int WELL_KNOWN_PARAM_NUM = (int)Param::Unknown;
+
+ public:
+  struct Pair {
+    kanon::StringView name;
+    kanon::StringView value;
+  };
+
+  class const_iterator {
+   public:
+    const_iterator(FcgiParams const *params, Index::const_iterator iter)
+      : params_(params)
+      , iter_(iter)
+    {
+    }
+
+    Pair operator*() const { return params_->MakePair(*iter_); }
+
+    const_iterator &operator++()
+    {
+      ++iter_;
+      return *this;
+    }
+
+    bool operator==(const_iterator const &rhs) const
+    {
+      return iter_ == rhs.iter_;
+    }
+
+    bool operator!=(const_iterator const &rhs) const
+    {
+      return iter_ != rhs.iter_;
+    }
+
+   private:
+    FcgiParams const *params_;
+    Index::const_iterator iter_;
+  };
+
+  /** Append the content of a FCGI_PARAMS record */
+  void Append(char const *data, size_t len) { raw_.Append(data, len); }
+
+  /** Reserve space for \p len bytes of contents to be appended */
+  void Reserve(size_t len) { raw_.ReserveWriteSpace(len); }
+
+  /**
+   * Build the index over the appended content
+   * \return false if the stream is malformed
+   */
+  bool Parse();
+
+  /**
+   * Search the value of \p name
+   * \return empty view if no such param
+   */
+  kanon::StringView Get(kanon::StringView name) const noexcept;
+
+  /**
+   * O(1) accessor of the well-known params
+   * \return empty view if no such param or \p p is Param::Unknown
+   */
+  kanon::StringView Get(Param p) const noexcept
+  {
+    auto pos = GetPosition(p);
+    if (pos == 0) return kanon::StringView();
+    return MakePair(index_[pos - 1]).value;
+  }
+
+  bool Contains(Param p) const noexcept { return GetPosition(p) != 0; }
+
+  bool Contains(kanon::StringView name) const noexcept
+  {
+    return Find(name) != nullptr;
+  }
+
+  /** Copy the value of \p name out */
+  std::string GetString(kanon::StringView name) const
+  {
+    return Get(name).ToString();
+  }
+
+  std::string GetString(Param p) const { return Get(p).ToString(); }
+
+  size_t size() const noexcept { return index_.size(); }
+  bool empty() const noexcept { return index_.empty(); }
+
+  const_iterator begin() const noexcept
+  {
+    return const_iterator(this, index_.begin());
+  }
+
+  const_iterator end() const noexcept
+  {
+    return const_iterator(this, index_.end());
+  }
+
+  /** Discard the content and index, but keep the capacity */
+  void Clear() noexcept
+  {
+    raw_.AdvanceAll();
+    index_.clear();
+    ClearWellKnown();
+  }
+
+ private:
+  Entry const *Find(kanon::StringView name) const noexcept;
+
+  void ClearWellKnown() noexcept
+  {
+    memset(well_known_, 0, sizeof well_known_);
+  }
+
+  /* Param::Unknown(or a larger value cast to Param) has no slot */
+  uint32_t GetPosition(Param p) const noexcept
+  {
+    return p < Param::Unknown ? well_known_[(int)p] : 0;
+  }
+
+  Pair MakePair(Entry const &entry) const noexcept
+  {
+    char const *name = raw_.GetReadBegin() + entry.offset;
+    return Pair{kanon::StringView(name, entry.name_len),
+                 kanon::StringView(name + entry.name_len, entry.value_len)};
+  }
+
+  kanon::Buffer raw_;
+  Index index_;
+
+  /* Position in the index_ plus 1, 0 indicates the param is absent */
+  uint32_t well_known_[WELL_KNOWN_PARAM_NUM] = {};
+};
+
+} // namespace fcgi
+
+#endif // FCGI_PARAMS_H_
@@ -0,0 +1,162 @@
+#include "fcgi_record.h"
+
+#include "fcgi_trace.h"
+
+#include "kanon/log/logger.h"
+#include "kanon/net/endian_api.h"
+
+using namespace kanon;
+using namespace fcgi;
+
+static char const padding_bytes[8] = {0};
+
+uint8_t fcgi::AppendRecordHeader(ChunkList &output, FcgiType type,
+                                 uint16_t id, uint16_t clen)
+{
+  RecordHeader header{
+      .version = FCGI_VERSION_1,
+      .type = type,
+      .request_id = sock::ToNetworkByteOrder16(id),
+      .content_length = sock::ToNetworkByteOrder16(clen),
+      .padding_length = (uint8_t)(-clen & 7), /* completion of 8 */
+      .reserved = 0,
+  };
+
+  FCGI_TRACE(RecordOut, id, clen, type);
+
+  output.Append(&header, FCGI_RECORD_HEADER_LENGTH);
+  return header.padding_length;
+}
+
+void fcgi::AppendPadding(ChunkList &output, uint8_t padding)
+{
+  output.Append(padding_bytes, padding);
+}
+
+void fcgi::AppendStreamRecords(ChunkList &output, FcgiType type, uint16_t id,
+                               char const *data, size_t len)
+{
+  while (len > 0) {
+    uint16_t clen = (len > MAX_CONTENT_LENGTH) ? MAX_CONTENT_LENGTH : len;
+    auto padding = AppendRecordHeader(output, type, id, clen);
+    output.Append(data, clen);
+    output.Append(padding_bytes, padding);
+    data += clen;
+    len -= clen;
+  }
+}
+
+void fcgi::AppendStreamRecords(ChunkList &output, FcgiType type, uint16_t id,
+                               ChunkList &payload)
+{
+  size_t len = payload.GetReadableSize();
+  size_t record_left = 0;
+  uint8_t padding = 0;
+
+  /* The record boundary may be in the middle of chunk */
+  for (auto const &chunk : payload) {
+    char const *data = chunk.GetReadBegin();
+    size_t chunk_left = chunk.GetReadableSize();
+    while (chunk_left > 0) {
+      if (record_left == 0) {
+        record_left = (len > MAX_CONTENT_LENGTH) ? MAX_CONTENT_LENGTH : len;
+        padding = AppendRecordHeader(output, type, id, record_left);
+      }
+
+      auto part = (chunk_left < record_left) ? chunk_left : record_left;
+      output.Append(data, part);
+      data += part;
+      chunk_left -= part;
+      record_left -= part;
+      len -= part;
+
+      if (record_left == 0) output.Append(padding_bytes, padding);
+    }
+  }
+
+  assert(len == 0 && record_left == 0);
+  payload.AdvanceRead(payload.GetReadableSize());
+}
+
+void fcgi::AppendTerminator(ChunkList &output, FcgiType type, uint16_t id)
+{
+  FCGI_TRACE(RecordOut, id, 0, type);
+
+  RecordHeader header{
+      .version = FCGI_VERSION_1,
+      .type = type,
+      .request_id = sock::ToNetworkByteOrder16(id),
+      .content_length = 0,
+      .padding_length = 0,
+      .reserved = 0,
+  };
+
+  output.Append(&header, FCGI_RECORD_HEADER_LENGTH);
+}
+
+void fcgi::AppendBeginRequest(ChunkList &output, uint16_t id, FcgiRole role,
+                              FcgiFlag flags)
+{
+  FCGI_TRACE(RecordOut, id, FCGI_BEGIN_REQUEST_BODY_LENGTH,
+             FCGI_BEGIN_REQUEST);
+
+  RecordHeader header{
+      .version = FCGI_VERSION_1,
+      .type = FCGI_BEGIN_REQUEST,
+      .request_id = sock::ToNetworkByteOrder16(id),
+      .content_length =
+          sock::ToNetworkByteOrder16(FCGI_BEGIN_REQUEST_BODY_LENGTH),
+      .padding_length = 0,
+      .reserved = 0,
+  };
+  output.Append(&header, FCGI_RECORD_HEADER_LENGTH);
+
+  BeginRequestBody body{.role = sock::ToNetworkByteOrder16(role),
+                        .flags = flags,
+                        .reserved = {0, 0, 0, 0, 0}};
+  output.Append(&body, FCGI_BEGIN_REQUEST_BODY_LENGTH);
+}
+
+void fcgi::AppendEndRequest(ChunkList &output, uint16_t id, uint32_t as,
+                            FcgiProtocolStatus ps)
+{
+  FCGI_TRACE(RecordOut, id, FCGI_END_REQUEST_BODY_LENGTH, FCGI_END_REQUEST);
+
+  RecordHeader header{
+      .version = FCGI_VERSION_1,
+      .type = FCGI_END_REQUEST,
+      .request_id = sock::ToNetworkByteOrder16(id),
+      .content_length =
+          sock::ToNetworkByteOrder16(FCGI_END_REQUEST_BODY_LENGTH),
+      .padding_length = 0,
+      .reserved = 0,
+  };
+  output.Append(&header, FCGI_RECORD_HEADER_LENGTH);
+
+  EndRequestBody body{.app_status = sock::ToNetworkByteOrder32(as),
+                      .protocol_status = ps,
+                      .reserved = {0, 0, 0}};
+  output.Append(&body, FCGI_END_REQUEST_BODY_LENGTH);
+}
+
+/**
+ * The length is encoded in 1 byte if it is less than 128,
+ * otherwise, 4 bytes and the highest bit is set.
+ */
+static inline void AppendNamePairLength(Buffer &output, uint32_t len)
+{
+  if (len < 128) {
+    output.Append8(len);
+  } else {
+    output.Append32(len | 0x80000000);
+  }
+}
+
+void fcgi::AppendNameValuePair(Buffer &output, StringView name,
+                               StringView value)
+{
+  AppendNamePairLength(output, name.size());
+  AppendNamePairLength(output, value.size());
+  output.Append(name.data(), name.size());
+  output.Append(value.data(), value.size());
+}
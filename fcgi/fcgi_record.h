@@ -0,0 +1,88 @@
+#ifndef FCGI_RECORD_H_
+#define FCGI_RECORD_H_
+
+#include <stddef.h>
+
+#include "fcgi_constant.h"
+#include "fcgi_type.h"
+#include "kanon/buffer/chunk_list.h"
+#include "kanon/net/buffer.h"
+
+namespace fcgi {
+
+static constexpr int FCGI_RECORD_HEADER_LENGTH = sizeof(RecordHeader);
+static constexpr int FCGI_BEGIN_REQUEST_BODY_LENGTH = sizeof(BeginRequestBody);
+static constexpr int FCGI_END_REQUEST_BODY_LENGTH = sizeof(EndRequestBody);
+static constexpr int FCGI_UNKNOWN_TYPE_BODY_LENGTH = sizeof(UnknownTypeBody);
+static constexpr int FCGI_UNKNOWN_RECORD_LENGTH = sizeof(UnknownTypeRecord);
+static constexpr uint16_t MAX_CONTENT_LENGTH = (uint16_t)-1;
+
+static_assert(FCGI_RECORD_HEADER_LENGTH == 8,
+              "The length of record header must be 8 bytes");
+static_assert(FCGI_BEGIN_REQUEST_BODY_LENGTH == 8,
+              "The length of BEGIN_REQUEST body must be 8 bytes");
+static_assert(FCGI_END_REQUEST_BODY_LENGTH == 8,
+              "The length of END_REQUEST body must be 8 bytes");
+static_assert(FCGI_UNKNOWN_TYPE_BODY_LENGTH == 8,
+              "The length of UNKNOWN_TYPE body must be 8 bytes");
+static_assert(FCGI_UNKNOWN_RECORD_LENGTH ==
+                  FCGI_RECORD_HEADER_LENGTH + FCGI_UNKNOWN_TYPE_BODY_LENGTH,
+              "The length of UnknownType record must equal to the "
+              "(FCGI_RECORD_HEADER_LENGTH + FCGI_UNKNOWN_TYPE_BODY_LENGTH)");
+static_assert(MAX_CONTENT_LENGTH == 65535,
+              "MAX_CONTENT_LENGTH must equal  to maximum of the uint16_t");
+
+/*
+ * The encoders append the records to the output instead of sending them,
+ * so the caller can gather several records and send them at once.
+ */
+
+/**
+ * Split \p data to records of \p type whose content length
+ * is MAX_CONTENT_LENGTH at most.
+ * Empty data is ignored since the empty record is the terminator.
+ */
+void AppendStreamRecords(kanon::ChunkList &output, FcgiType type, uint16_t id,
+                         char const *data, size_t len);
+
+/**
+ * Same as the above, but the payload is in chunks.
+ * The payload is copied to \p output chunk by chunk, i.e. it isn't
+ * flattened to a contiguous buffer first, but the chunks can't be moved
+ * to \p output either. \p payload is consumed.
+ */
+void AppendStreamRecords(kanon::ChunkList &output, FcgiType type, uint16_t id,
+                         kanon::ChunkList &payload);
+
+/**
+ * Append the header of record whose content length is \p clen,
+ * the content and the padding are appended by the caller,
+ * e.g. the content is sent from a file.
+ * \return The padding length
+ */
+uint8_t AppendRecordHeader(kanon::ChunkList &output, FcgiType type,
+                           uint16_t id, uint16_t clen);
+
+/** Append \p padding zero bytes, 7 at most */
+void AppendPadding(kanon::ChunkList &output, uint8_t padding);
+
+/** Append the empty record of stream \p type */
+void AppendTerminator(kanon::ChunkList &output, FcgiType type, uint16_t id);
+
+/** Used by the client, e.g. load generator */
+void AppendBeginRequest(kanon::ChunkList &output, uint16_t id, FcgiRole role,
+                        FcgiFlag flags);
+
+void AppendEndRequest(kanon::ChunkList &output, uint16_t id,
+                      uint32_t app_status, FcgiProtocolStatus protocol_status);
+
+/**
+ * Encode a name-value pair in the format of FCGI_PARAMS and
+ * FCGI_GET_VALUES(_RESULT) content.
+ */
+void AppendNameValuePair(kanon::Buffer &output, kanon::StringView name,
+                         kanon::StringView value);
+
+} // namespace fcgi
+
+#endif // FCGI_RECORD_H_
@@ -0,0 +1,107 @@
+#ifndef FCGI_REQUEST_TABLE_H_
+#define FCGI_REQUEST_TABLE_H_
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#include "kanon/util/noncopyable.h"
+
+namespace fcgi {
+
+/**
+ * Map request id to the request(pointer).
+ *
+ * The web server allocates the request id from the smallest one
+ * in general(e.g. nginx always uses 1), so the small id is indexed in a
+ * flat slab directly, the sparse id that exceeds the slab falls back to
+ * the hash table.
+ *
+ * The table doesn't own the values.
+ */
+template <typename T>
+class RequestTable : kanon::noncopyable {
+  using Slab = std::vector<T *>;
+  using SparseMap = std::unordered_map<uint16_t, T *>;
+
+ public:
+  /* The slab is large enough for most web servers */
+  static constexpr uint16_t SLAB_SIZE = 256;
+
+  T *Find(uint16_t id) const noexcept
+  {
+    if (id < SLAB_SIZE) {
+      return id < slab_.size() ? slab_[id] : nullptr;
+    }
+
+    auto iter = sparse_.find(id);
+    return iter != sparse_.end() ? iter->second : nullptr;
+  }
+
+  /**
+   * \p id must be absent
+   */
+  void Insert(uint16_t id, T *value)
+  {
+    assert(value);
+    assert(!Find(id));
+    ++size_;
+
+    if (id < SLAB_SIZE) {
+      if (id >= slab_.size()) slab_.resize(id + 1, nullptr);
+      slab_[id] = value;
+      return;
+    }
+
+    sparse_.emplace(id, value);
+  }
+
+  /**
+   * \return The removed value, nullptr if absent
+   */
+  T *Remove(uint16_t id) noexcept
+  {
+    T *ret = nullptr;
+    if (id < SLAB_SIZE) {
+      if (id < slab_.size()) {
+        ret = slab_[id];
+        slab_[id] = nullptr;
+      }
+    } else {
+      auto iter = sparse_.find(id);
+      if (iter != sparse_.end()) {
+        ret = iter->second;
+        sparse_.erase(iter);
+      }
+    }
+
+    if (ret) --size_;
+    return ret;
+  }
+
+  template <typename F>
+  void ForEach(F f) const
+  {
+    for (auto value : slab_) {
+      if (value) f(value);
+    }
+
+    for (auto const &kv : sparse_) {
+      f(kv.second);
+    }
+  }
+
+  size_t size() const noexcept { return size_; }
+  bool empty() const noexcept { return size_ == 0; }
+
+ private:
+  Slab slab_;
+  SparseMap sparse_;
+  size_t size_ = 0;
+};
+
+} // namespace fcgi
+
+#endif // FCGI_REQUEST_TABLE_H_
@@ -0,0 +1,159 @@
+#include "fcgi_response_cache.h"
+
+#include <iterator>
+#include <string.h>
+#include <strings.h>
+
+#include "fcgi_params.h"
+
+#include "kanon/util/time_stamp.h"
+
+using namespace kanon;
+using namespace fcgi;
+
+static inline int64_t NowUs() noexcept
+{
+  return TimeStamp::Now().GetMicrosecondsSinceEpoch();
+}
+
+/* \p line starts with the header \p name(including the ':'), the case of
+ * name is ignored */
+static inline bool IsHeader(StringView line, char const *name) noexcept
+{
+  size_t len = ::strlen(name);
+  return line.size() >= len && ::strncasecmp(line.data(), name, len) == 0;
+}
+
+/* \p value contains \p token, the case is ignored */
+static bool ContainsToken(StringView value, char const *token) noexcept
+{
+  size_t len = ::strlen(token);
+  for (size_t i = 0; i + len <= value.size(); ++i) {
+    if (::strncasecmp(value.data() + i, token, len) == 0) return true;
+  }
+  return false;
+}
+
+ResponseCache::ResponseCache(size_t capacity, double ttl)
+  : capacity_(capacity)
+  , ttl_((int64_t)(ttl * 1000000))
+  , max_entry_size_(capacity / 8)
+  , key_params_{"HTTP_HOST", "REQUEST_URI"}
+{
+}
+
+bool ResponseCache::IsCacheable(FcgiParams const &params) noexcept
+{
+  return params.Get(Param::RequestMethod) == "GET";
+}
+
+bool ResponseCache::IsCacheableResponse(StringView stdout_data) noexcept
+{
+  /* The headers end at the empty line */
+  while (!stdout_data.empty()) {
+    auto pos = stdout_data.find('\n');
+    auto line = stdout_data.substr(0, pos);
+    if (!line.empty() && line[line.size() - 1] == '\r') {
+      line = line.substr(0, line.size() - 1);
+    }
+    if (line.empty()) break;
+
+    if (IsHeader(line, "Status:")) {
+      auto value = line.substr(7);
+      while (!value.empty() && value[0] == ' ') value.remove_prefix(1);
+      if (value.substr(0, 3) != "200") return false;
+    } else if (IsHeader(line, "Location:") || IsHeader(line, "Set-Cookie:")) {
+      return false;
+    } else if (IsHeader(line, "Cache-Control:")) {
+      auto value = line.substr(14);
+      if (ContainsToken(value, "no-store") ||
+          ContainsToken(value, "no-cache") || ContainsToken(value, "private"))
+      {
+        return false;
+      }
+    }
+
+    if (pos == StringView::npos) break;
+    stdout_data.remove_prefix(pos + 1);
+  }
+
+  return true;
+}
+
+std::string ResponseCache::MakeKey(FcgiParams const &params) const
+{
+  std::string key;
+  for (auto const &name : key_params_) {
+    auto value = params.Get(name);
+    key.append(value.data(), value.size());
+    key.push_back('\0');
+  }
+
+  return key;
+}
+
+EncodedResponsePtr ResponseCache::Find(std::string const &key)
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto iter = entries_.find(key);
+  if (iter == entries_.end()) return nullptr;
+
+  auto node = iter->second;
+  if (node->expire_time <= NowUs()) {
+    Erase(node);
+    return nullptr;
+  }
+
+  lru_.splice(lru_.begin(), lru_, node);
+  return node->response;
+}
+
+void ResponseCache::Insert(std::string key, StringView stdout_data)
+{
+  if (stdout_data.size() > max_entry_size_) return;
+  if (!IsCacheableResponse(stdout_data)) return;
+
+  /* Encode out of the lock */
+  auto response = EncodedResponse::New(stdout_data);
+  auto entry_size = response->GetSize();
+  if (entry_size > capacity_) return;
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto iter = entries_.find(key);
+  if (iter != entries_.end()) Erase(iter->second);
+
+  lru_.push_front(Node{key, std::move(response), NowUs() + ttl_});
+  entries_.emplace(std::move(key), lru_.begin());
+  size_ += entry_size;
+
+  while (size_ > capacity_) {
+    Erase(std::prev(lru_.end()));
+  }
+}
+
+void ResponseCache::Clear()
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  entries_.clear();
+  lru_.clear();
+  size_ = 0;
+}
+
+size_t ResponseCache::GetSize() const noexcept
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  return size_;
+}
+
+size_t ResponseCache::GetEntryNum() const noexcept
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  return entries_.size();
+}
+
+void ResponseCache::Erase(NodeList::iterator iter) noexcept
+{
+  size_ -= iter->response->GetSize();
+  entries_.erase(iter->key);
+  lru_.erase(iter);
+}
@@ -0,0 +1,120 @@
+#ifndef FCGI_RESPONSE_CACHE_H_
+#define FCGI_RESPONSE_CACHE_H_
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "fcgi_encoded_response.h"
+#include "kanon/string/string_view.h"
+#include "kanon/util/noncopyable.h"
+
+namespace fcgi {
+
+class FcgiParams;
+
+/**
+ * In-process cache of the responses, placed in front of the request
+ * handler of codec(see FcgiCodec::SetResponseCache()).
+ *
+ * The key is built from the selected params(HTTP_HOST and REQUEST_URI by
+ * default).
+ * Only the GET request without STDIN of FCGI_RESPONDER is served from
+ * cache, the handler of hit request isn't called, the cached
+ * EncodedResponse is sent with the request id patched.
+ *
+ * The response of missed request is captured by ResponseWriter and
+ * inserted when it ends with status 0 and no STDERR. The response whose
+ * CGI headers forbid it isn't inserted(see IsCacheableResponse()). The
+ * handler can also opt out by ResponseWriter::SetCacheable(false), e.g.
+ * the content depends on the params not in the key.
+ *
+ * The entries expire after the TTL, and the least recently used entries
+ * are evicted when the bytes exceed the capacity.
+ *
+ * The cache can be shared by the codecs in different loops and the
+ * workers, it must outlive them.
+ */
+class ResponseCache : kanon::noncopyable {
+ public:
+  /**
+   * \param capacity The maximum bytes of the records cached
+   * \param ttl Seconds an entry is valid
+   */
+  ResponseCache(size_t capacity, double ttl);
+
+  /**
+   * The names of params composing the key. The requests differ in them
+   * must have different responses, e.g. add HTTP_ACCEPT_ENCODING if the
+   * response is compressed according to it.
+   * Must be set before the server starts.
+   */
+  void SetKeyParams(std::vector<std::string> names)
+  {
+    key_params_ = std::move(names);
+  }
+
+  /** The response larger than it isn't cached */
+  void SetMaxEntrySize(size_t size) noexcept { max_entry_size_ = size; }
+  size_t GetMaxEntrySize() const noexcept { return max_entry_size_; }
+
+  /** \return false if the response of request can't be cached */
+  static bool IsCacheable(FcgiParams const &params) noexcept;
+
+  /**
+   * \return false if the CGI headers of \p stdout_data forbid caching:
+   *  - Status other than 200, e.g. the error page
+   *  - Location, i.e. the redirection
+   *  - Set-Cookie
+   *  - Cache-Control with no-store, no-cache or private
+   */
+  static bool IsCacheableResponse(kanon::StringView stdout_data) noexcept;
+
+  /* The values of key params joined by '\0' */
+  std::string MakeKey(FcgiParams const &params) const;
+
+  /** \return nullptr if missed or expired */
+  EncodedResponsePtr Find(std::string const &key);
+
+  /**
+   * Encode \p stdout_data to an EncodedResponse and insert it.
+   * Ignored if it is too large or not cacheable(see
+   * IsCacheableResponse()).
+   */
+  void Insert(std::string key, kanon::StringView stdout_data);
+
+  void Clear();
+
+  size_t GetSize() const noexcept;
+  size_t GetEntryNum() const noexcept;
+
+ private:
+  struct Node {
+    std::string key;
+    /* The hits being sent still hold it after eviction */
+    EncodedResponsePtr response;
+    int64_t expire_time; /* us since epoch */
+  };
+
+  using NodeList = std::list<Node>;
+
+  void Erase(NodeList::iterator iter) noexcept;
+
+  size_t capacity_;
+  int64_t ttl_; /* us */
+  size_t max_entry_size_;
+  std::vector<std::string> key_params_;
+
+  mutable std::mutex mutex_;
+  /* The front is the most recently used */
+  NodeList lru_;
+  std::unordered_map<std::string, NodeList::iterator> entries_;
+  size_t size_ = 0;
+};
+
+} // namespace fcgi
+
+#endif // FCGI_RESPONSE_CACHE_H_
@@ -0,0 +1,172 @@
+#include "fcgi_response_writer.h"
+
+#include "fcgi_record.h"
+#include "fcgi_trace.h"
+
+#include "kanon/log/logger.h"
+#include "kanon/net/event_loop.h"
+
+using namespace kanon;
+using namespace fcgi;
+
+void ResponseWriter::WriteStdout(char const *data, size_t len)
+{
+  assert(!stdout_ended_);
+  if (IsAborted()) return;
+  if (cache_) CacheStdout(data, len);
+  AppendStreamRecords(output_, FCGI_STDOUT, id_, data, len);
+}
+
+void ResponseWriter::WriteStdout(ChunkList &output)
+{
+  assert(!stdout_ended_);
+  if (IsAborted()) return;
+  if (cache_) CacheStdout(output);
+  AppendStreamRecords(output_, FCGI_STDOUT, id_, output);
+}
+
+bool ResponseWriter::WriteStdoutFile(int fd, off_t offset, size_t len)
+{
+  assert(!stdout_ended_);
+  if (IsAborted()) return true;
+  StopCaching();
+
+  /* Keep the order of records */
+  Flush();
+  return FcgiCodec::SendStdoutFile(conn_, id_, fd, offset, len, token_);
+}
+
+void ResponseWriter::WriteStderr(char const *data, size_t len)
+{
+  assert(!stderr_ended_);
+  if (IsAborted()) return;
+  stderr_written_ = true;
+  StopCaching();
+  AppendStreamRecords(output_, FCGI_STDERR, id_, data, len);
+}
+
+void ResponseWriter::WriteStderr(ChunkList &output)
+{
+  assert(!stderr_ended_);
+  if (IsAborted()) return;
+  stderr_written_ = true;
+  StopCaching();
+  AppendStreamRecords(output_, FCGI_STDERR, id_, output);
+}
+
+void ResponseWriter::EndStdout()
+{
+  if (stdout_ended_) return;
+  stdout_ended_ = true;
+  AppendTerminator(output_, FCGI_STDOUT, id_);
+}
+
+void ResponseWriter::EndStderr()
+{
+  if (stderr_ended_) return;
+  stderr_ended_ = true;
+  AppendTerminator(output_, FCGI_STDERR, id_);
+}
+
+void ResponseWriter::EndRequest(uint32_t as, FcgiProtocolStatus ps)
+{
+  /* The request has been aborted and ended by codec */
+  if (token_ && !token_->TryEnd()) {
+    output_.AdvanceRead(output_.GetReadableSize());
+    return;
+  }
+
+  EndStdout();
+  if (stderr_written_) EndStderr();
+  AppendEndRequest(output_, id_, as, ps);
+  Flush();
+  FcgiStats::RecordRequest(times_);
+
+  if (cache_ && as == 0 && ps == FCGI_REQUEST_COMPLETE) {
+    cache_->Insert(std::move(cache_key_), cached_stdout_);
+  }
+  StopCaching();
+}
+
+void ResponseWriter::EndRequest(EncodedResponsePtr const &response)
+{
+  assert(!stdout_ended_);
+  if (token_ && !token_->TryEnd()) {
+    output_.AdvanceRead(output_.GetReadableSize());
+    return;
+  }
+
+  stdout_ended_ = true;
+  if (stderr_written_) EndStderr();
+  Flush();
+
+  /* The Flush() posts to the loop before the send, the order is kept */
+  FcgiStats::Add(Counter::BytesOut, response->GetSize());
+  OutputScheduler::Send(conn_, id_, response);
+  FcgiStats::RecordRequest(times_);
+  StopCaching();
+}
+
+void ResponseWriter::Flush()
+{
+  if (output_.GetReadableSize() == 0) return;
+  FCGI_TRACE(Flush, id_, output_.GetReadableSize(), 0);
+
+  /* The abort is handled in the loop, check it in the loop also,
+   * then no output is sent after the END_REQUEST sent by codec */
+  auto loop = conn_->GetLoop();
+  if (loop->IsLoopInThread()) {
+    if (IsAborted()) {
+      output_.AdvanceRead(output_.GetReadableSize());
+      return;
+    }
+
+    /* The chunks are moved to the output buffer of connection */
+    FcgiStats::Add(Counter::BytesOut, output_.GetReadableSize());
+    OutputScheduler::Send(conn_, id_, output_);
+    return;
+  }
+
+  /* e.g. In worker thread.
+   * Post all pending records to the loop in one go, instead of
+   * one post(and lock) per send call. */
+  auto output = std::make_shared<ChunkList>(std::move(output_));
+  auto conn = conn_;
+  auto id = id_;
+  auto token = token_;
+  loop->QueueToLoop([conn, id, output, token]() {
+    if (token && token->IsCancelled()) return;
+    FcgiStats::Add(Counter::BytesOut, output->GetReadableSize());
+    OutputScheduler::Send(conn, id, *output);
+  });
+}
+
+void ResponseWriter::CacheStdout(char const *data, size_t len)
+{
+  if (cached_stdout_.size() + len > cache_->GetMaxEntrySize()) {
+    StopCaching();
+    return;
+  }
+
+  cached_stdout_.append(data, len);
+}
+
+void ResponseWriter::CacheStdout(ChunkList const &output)
+{
+  if (cached_stdout_.size() + output.GetReadableSize() >
+      cache_->GetMaxEntrySize())
+  {
+    StopCaching();
+    return;
+  }
+
+  for (auto const &chunk : output) {
+    cached_stdout_.append(chunk.GetReadBegin(), chunk.GetReadableSize());
+  }
+}
+
+void ResponseWriter::StopCaching() noexcept
+{
+  cache_ = nullptr;
+  cached_stdout_.clear();
+}
@@ -0,0 +1,135 @@
+#ifndef FCGI_RESPONSE_WRITER_H_
+#define FCGI_RESPONSE_WRITER_H_
+
+#include "fcgi_codec.h"
+#include "kanon/buffer/chunk_list.h"
+#include "kanon/util/noncopyable.h"
+
+namespace fcgi {
+
+/**
+ * Collect the records of a response and send them in one go.
+ *
+ * The FcgiCodec::SendXXX() and EndXXX() API send once per call, a
+ * typical response needs three sends at least(STDOUT, terminator of
+ * STDOUT and END_REQUEST). The writer just appends the records to
+ * a ChunkList, and they are sent in one gathered write when Flush() or
+ * EndRequest() is called.
+ *
+ * The pending records are flushed when the writer is destroyed also.
+ *
+ * The writer can be used in the thread other than the loop of
+ * connection(e.g. WorkerPool), the records are posted to the loop
+ * once per flush.
+ *
+ * If the writer is constructed from a request, the output of the
+ * request aborted by web server is dropped, and END_REQUEST is not sent
+ * again(The codec has sent it).
+ *
+ * If the request is missed in the ResponseCache of codec, the STDOUT is
+ * also kept and inserted to the cache when the request ends successfully.
+ */
+class ResponseWriter : kanon::noncopyable {
+ public:
+  ResponseWriter(TransportPtr const &conn, uint16_t id)
+    : conn_(conn)
+    , id_(id)
+  {
+  }
+
+  ResponseWriter(TransportPtr const &conn,
+                 FcgiRequest const &request)
+    : conn_(conn)
+    , id_(request.request_id)
+    , token_(request.GetCancelToken())
+    , times_(request.times)
+    , cache_(request.cache)
+  {
+    if (cache_) cache_key_ = request.cache_key;
+  }
+
+  ~ResponseWriter() noexcept { Flush(); }
+
+  void WriteStdout(char const *data, size_t len);
+  void WriteStdout(kanon::StringView data)
+  {
+    WriteStdout(data.data(), data.size());
+  }
+
+  /** The chunks of \p output are consumed */
+  void WriteStdout(kanon::ChunkList &output);
+
+  /**
+   * Flush the pending records, then send the [offset, offset+len) of
+   * regular file \p fd as STDOUT(see FcgiCodec::SendStdoutFile()).
+   * The response isn't cached.
+   * \return false if the region isn't in the file, nothing is sent
+   */
+  bool WriteStdoutFile(int fd, off_t offset, size_t len);
+
+  void WriteStderr(char const *data, size_t len);
+  void WriteStderr(kanon::StringView data)
+  {
+    WriteStderr(data.data(), data.size());
+  }
+
+  void WriteStderr(kanon::ChunkList &output);
+
+  void EndStdout();
+  void EndStderr();
+
+  /**
+   * Terminate the streams that are not terminated,
+   * append END_REQUEST, then flush all records.
+   *
+   * STDERR is terminated only if it is written.
+   */
+  void EndRequest(uint32_t app_status = 0,
+                  FcgiProtocolStatus protocol_status = FCGI_REQUEST_COMPLETE);
+
+  /**
+   * Flush the pending records, then send \p response which contains the
+   * STDOUT and the END_REQUEST.
+   * No STDOUT can be written before.
+   */
+  void EndRequest(EncodedResponsePtr const &response);
+
+  /** Send the pending records in one send */
+  void Flush();
+
+  /**
+   * Don't insert the response to the cache, e.g. the content depends on
+   * the params not in the key. The error page and the response setting
+   * cookie aren't inserted anyway(see ResponseCache::IsCacheableResponse()).
+   */
+  void SetCacheable(bool cacheable) noexcept
+  {
+    if (!cacheable) StopCaching();
+  }
+
+  size_t GetPendingSize() const noexcept { return output_.GetReadableSize(); }
+  uint16_t GetRequestId() const noexcept { return id_; }
+
+  bool IsAborted() const noexcept { return token_ && token_->IsCancelled(); }
+
+ private:
+  void CacheStdout(char const *data, size_t len);
+  void CacheStdout(kanon::ChunkList const &output);
+  void StopCaching() noexcept;
+
+  TransportPtr conn_;
+  uint16_t id_;
+  std::shared_ptr<CancelToken> token_; /* nullptr if unknown */
+  RequestTimes times_;
+  ResponseCache *cache_ = nullptr; /* nullptr if not caching */
+  std::string cache_key_;
+  std::string cached_stdout_;
+  bool stdout_ended_ = false;
+  bool stderr_written_ = false;
+  bool stderr_ended_ = false;
+  kanon::ChunkList output_;
+};
+
+} // namespace fcgi
+
+#endif // FCGI_RESPONSE_WRITER_H_
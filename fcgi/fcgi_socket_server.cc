@@ -0,0 +1,217 @@
+#include "fcgi_socket_server.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "fcgi_tcp_transport.h"
+
+#include "kanon/log/logger.h"
+#include "kanon/net/event_loop.h"
+
+using namespace kanon;
+using namespace fcgi;
+
+/* Bound the connections accepted per event, so the loop serves the
+ * accepted connections in time */
+#define MAX_ACCEPT_NUM 64
+
+SocketServer::SocketServer(EventLoop *loop, ListenAddr const &addr,
+                           std::string name)
+  : loop_(loop)
+  , addr_(addr)
+  , name_(std::move(name))
+{
+}
+
+SocketServer::~SocketServer() noexcept
+{
+  /* The servers of kanon are destroyed in their loops */
+  for (size_t i = 0; i < tcp_servers_.size(); ++i) {
+    auto server = tcp_servers_[i].release();
+    server_loops_[i]->RunInLoop([server]() { delete server; });
+  }
+
+  /* The socket file isn't ours if failed to listen, e.g. in use */
+  bool listened = accept_channel_ != nullptr;
+  if (listened) {
+    auto channel = accept_channel_.release();
+    int listen_fd = listen_fd_;
+    int idle_fd = idle_fd_;
+    loop_->RunInLoop([channel, listen_fd, idle_fd]() {
+      channel->DisableAll();
+      channel->Remove();
+      delete channel;
+      ::close(listen_fd);
+      if (idle_fd >= 0) ::close(idle_fd);
+    });
+  }
+
+  decltype(connections_) connections;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    connections.swap(connections_);
+  }
+
+  for (auto &kv : connections) {
+    auto conn = kv.second;
+    conn->GetLoop()->RunInLoop([conn]() { conn->ConnectionDestroyed(); });
+  }
+
+  /* Quit the IO loops after the above are done */
+  pool_.reset();
+
+  if (listened) addr_.Unlink();
+}
+
+bool SocketServer::StartRun()
+{
+  auto on_connection = [this](TcpConnectionPtr const &conn) {
+    OnConnection(conn);
+  };
+
+  bool reuseport = reuseport_;
+  if (reuseport && addr_.IsUnix()) {
+    LOG_WARN << "SO_REUSEPORT doesn't balance Unix domain socket, "
+                "accept in the base loop";
+    reuseport = false;
+  }
+
+  if (!addr_.IsUnix() && !reuseport) {
+    tcp_servers_.emplace_back(
+        new TcpServer(loop_, addr_.GetInetAddr(), name_));
+    server_loops_.push_back(loop_);
+    tcp_servers_.back()->SetLoopNum(loop_num_);
+    tcp_servers_.back()->SetConnectionCallback(on_connection);
+    tcp_servers_.back()->StartRun();
+    return true;
+  }
+
+  pool_.reset(new EventLoopPool(loop_, name_));
+  pool_->SetLoopNum(loop_num_);
+  pool_->StartRun();
+
+  if (addr_.IsUnix()) return ListenUnix();
+
+  /* Every server accepts and serves in its IO loop */
+  int server_num = loop_num_ > 0 ? loop_num_ : 1;
+  for (int i = 0; i < server_num; ++i) {
+    auto io_loop = pool_->GetNextLoop();
+    tcp_servers_.emplace_back(
+        new TcpServer(io_loop, addr_.GetInetAddr(), name_, true));
+    server_loops_.push_back(io_loop);
+    tcp_servers_.back()->SetConnectionCallback(on_connection);
+    tcp_servers_.back()->StartRun();
+  }
+
+  LOG_INFO << "SocketServer " << name_ << " is listening on "
+           << addr_.ToString() << " with " << server_num << " acceptor(s)";
+  return true;
+}
+
+void SocketServer::OnConnection(TcpConnectionPtr const &conn)
+{
+  /* The transport is kept by the connection for the disconnection */
+  if (conn->IsConnected()) {
+    /* The records of a response may be sent in several writes */
+    if (!addr_.IsUnix()) {
+      int on = 1;
+      ::setsockopt(conn->GetFd(), IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+    }
+
+    TransportPtr transport = TcpTransport::New(conn);
+    conn->SetContext(transport);
+    if (connection_callback_) connection_callback_(transport);
+    return;
+  }
+
+  auto context = AnyCast<TransportPtr>(conn->GetContext());
+  if (!context) return;
+
+  /* The transport references the connection, break the cycle */
+  auto transport = std::move(*context);
+  conn->SetContext(Any());
+  if (connection_callback_) connection_callback_(transport);
+}
+
+bool SocketServer::ListenUnix()
+{
+  listen_fd_ = addr_.Listen();
+  if (listen_fd_ < 0) return false;
+
+  idle_fd_ = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+  accept_channel_.reset(new Channel(loop_, listen_fd_));
+  accept_channel_->SetReadCallback([this](TimeStamp) {
+    HandleAccept();
+  });
+  loop_->RunInLoop([this]() { accept_channel_->EnableReading(); });
+
+  LOG_INFO << "SocketServer " << name_ << " is listening on "
+           << addr_.ToString();
+  return true;
+}
+
+void SocketServer::HandleAccept()
+{
+  for (int i = 0; i < MAX_ACCEPT_NUM; ++i) {
+    int fd = ::accept4(listen_fd_, nullptr, nullptr,
+                       SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd >= 0) {
+      NewConnection(fd);
+      continue;
+    }
+
+    if (errno == EINTR || errno == ECONNABORTED) continue;
+    if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+
+    LOG_SYSERROR << "Failed to accept";
+
+    /* The listening socket is level-triggered, reject the connection by
+     * the reserved fd, otherwise the loop is busy */
+    if ((errno == EMFILE || errno == ENFILE) && idle_fd_ >= 0) {
+      ::close(idle_fd_);
+      ::close(::accept(listen_fd_, nullptr, nullptr));
+      idle_fd_ = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+    break;
+  }
+}
+
+void SocketServer::NewConnection(int fd)
+{
+  auto io_loop = pool_->GetNextLoop();
+  auto name = name_ + "-" + std::to_string(next_conn_id_++);
+
+  /* The peer of Unix domain socket has no InetAddr, the addresses are
+   * only used in the log of kanon */
+  auto conn = TcpConnection::NewTcpConnection(io_loop, name, fd, InetAddr(),
+                                              InetAddr());
+  conn->SetConnectionCallback([this](TcpConnectionPtr const &conn) {
+    OnConnection(conn);
+  });
+  conn->SetCloseCallback([this](TcpConnectionPtr const &conn) {
+    RemoveConnection(conn);
+  });
+
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    connections_.emplace(conn.get(), conn);
+  }
+
+  io_loop->RunInLoop([conn]() { conn->ConnectionEstablished(); });
+}
+
+void SocketServer::RemoveConnection(TcpConnectionPtr const &conn)
+{
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    /* Destroyed by the destructor of server */
+    if (connections_.erase(conn.get()) == 0) return;
+  }
+
+  /* After the current event of connection is handled */
+  conn->GetLoop()->QueueToLoop([conn]() { conn->ConnectionDestroyed(); });
+}
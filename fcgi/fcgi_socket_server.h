@@ -0,0 +1,107 @@
+#ifndef FCGI_SOCKET_SERVER_H_
+#define FCGI_SOCKET_SERVER_H_
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "fcgi_listen_addr.h"
+#include "fcgi_transport.h"
+
+#include "kanon/net/channel.h"
+#include "kanon/net/event_loop_pool.h"
+#include "kanon/net/tcp_server.h"
+
+namespace fcgi {
+
+/**
+ * Listen on a ListenAddr by the epoll server of kanon, the connections
+ * are kanon::TcpConnection wrapped by TcpTransport, the same as the ones
+ * of kanon::TcpServer.
+ *
+ * There are three modes:
+ *  - TCP: a kanon::TcpServer, the base loop accepts all connections and
+ *    distributes them to the IO loops in round-robin.
+ *  - TCP in SO_REUSEPORT mode: a kanon::TcpServer in every IO loop, each
+ *    has its own listening socket bound to the port, the kernel
+ *    distributes the connections to the accept queues, so the single
+ *    acceptor isn't the bottleneck when there are lots of short
+ *    connections, and a connection is accepted in the loop where it runs.
+ *  - Unix domain socket: the acceptor of kanon is bound to InetAddr, the
+ *    base loop accepts on the socket of ListenAddr and the connections
+ *    are distributed to the IO loops as kanon::TcpServer does. Linux
+ *    doesn't balance the Unix domain sockets by SO_REUSEPORT, it falls
+ *    back to this mode.
+ *
+ * The file body is sent by sendfile(2)(see TcpTransport), which raises
+ * SIGPIPE if the peer has closed. The application should ignore SIGPIPE.
+ */
+class SocketServer : kanon::noncopyable {
+ public:
+  /** Called with the transport connected and disconnected */
+  using ConnectionCallback = std::function<void(TransportPtr const &)>;
+
+  SocketServer(kanon::EventLoop *loop, ListenAddr const &addr,
+               std::string name);
+
+  /** The transports held by handler can't send after the server is
+   * destroyed */
+  ~SocketServer() noexcept;
+
+  void SetConnectionCallback(ConnectionCallback cb)
+  {
+    connection_callback_ = std::move(cb);
+  }
+
+  /** The number of IO loops, 0 indicates the base loop is the IO loop */
+  void SetLoopNum(int num) noexcept { loop_num_ = num; }
+
+  void SetReusePort(bool on) noexcept { reuseport_ = on; }
+
+  /** \return false if failed to listen on the Unix domain socket */
+  bool StartRun();
+
+  kanon::EventLoop *GetLoop() const noexcept { return loop_; }
+  std::string const &GetName() const noexcept { return name_; }
+
+ private:
+  /* Wrap the connection by TcpTransport and call connection_callback_ */
+  void OnConnection(kanon::TcpConnectionPtr const &conn);
+
+  /* The Unix domain socket */
+  bool ListenUnix();
+  void HandleAccept();
+  void NewConnection(int fd);
+  void RemoveConnection(kanon::TcpConnectionPtr const &conn);
+
+  kanon::EventLoop *loop_;
+  ListenAddr addr_;
+  std::string name_;
+  int loop_num_ = 0;
+  bool reuseport_ = false;
+  ConnectionCallback connection_callback_;
+
+  /* TCP, one per IO loop in SO_REUSEPORT mode */
+  std::vector<std::unique_ptr<kanon::TcpServer>> tcp_servers_;
+  std::vector<kanon::EventLoop *> server_loops_; /* The loops of them */
+
+  /* The IO loops of Unix domain socket and SO_REUSEPORT mode */
+  std::unique_ptr<kanon::EventLoopPool> pool_;
+
+  int listen_fd_ = -1;
+  int idle_fd_ = -1; /* Reserved for rejecting when fds are exhausted */
+  std::unique_ptr<kanon::Channel> accept_channel_;
+  size_t next_conn_id_ = 0;
+
+  /* The connections of Unix domain socket, they are added in the base
+   * loop and removed in the IO loops */
+  std::mutex mutex_;
+  std::unordered_map<kanon::TcpConnection *, kanon::TcpConnectionPtr>
+      connections_;
+};
+
+} // namespace fcgi
+
+#endif // FCGI_SOCKET_SERVER_H_
@@ -0,0 +1,252 @@
+#include "fcgi_stats.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "fcgi_params.h"
+
+#include "kanon/util/time_stamp.h"
+
+using namespace kanon;
+using namespace fcgi;
+
+bool FcgiStats::enabled_ = false;
+
+static std::string management_path;
+
+static char const *counter_strings[] = {
+    "requests", "bytes_in", "bytes_out", "aborted", "rejected",
+    "cache_hits", "cache_misses",
+};
+
+static char const *phase_strings[] = {
+    "params", "stdin", "queue", "handler", "total",
+};
+
+static_assert(sizeof counter_strings / sizeof counter_strings[0] ==
+                  (size_t)Counter::Num,
+              "The strings of counter must match the Counter");
+static_assert(sizeof phase_strings / sizeof phase_strings[0] ==
+                  (size_t)Phase::Num,
+              "The strings of phase must match the Phase");
+
+char const *fcgi::Counter2String(Counter c) noexcept
+{
+  return counter_strings[(int)c];
+}
+
+char const *fcgi::Phase2String(Phase p) noexcept
+{
+  return phase_strings[(int)p];
+}
+
+/*-----------------------*/
+/* Stats block           */
+/*-----------------------*/
+
+/*
+ * The values are written by the owner thread only,
+ * the atomic is just for reading them in snapshot safely.
+ */
+using Value = std::atomic<uint64_t>;
+
+struct HistogramBlock {
+  Value buckets[LatencyHistogram::BUCKET_NUM];
+  Value count;
+  Value sum;
+};
+
+struct StatsBlock {
+  Value counters[(int)Counter::Num];
+  HistogramBlock phases[(int)Phase::Num];
+
+  StatsBlock() noexcept
+  {
+    for (auto &c : counters) c = 0;
+    for (auto &h : phases) {
+      for (auto &b : h.buckets) b = 0;
+      h.count = 0;
+      h.sum = 0;
+    }
+  }
+};
+
+/* The blocks are never freed since the snapshot may be taken after
+ * the thread exits */
+static std::mutex blocks_mutex;
+static std::vector<std::unique_ptr<StatsBlock>> blocks;
+
+static StatsBlock *RegisterBlock()
+{
+  auto block = new StatsBlock;
+  std::lock_guard<std::mutex> guard(blocks_mutex);
+  blocks.emplace_back(block);
+  return block;
+}
+
+static inline StatsBlock &GetBlock()
+{
+  static thread_local StatsBlock *block = RegisterBlock();
+  return *block;
+}
+
+static inline void Increase(Value &value, uint64_t n) noexcept
+{
+  /* Single writer, no RMW is required */
+  value.store(value.load(std::memory_order_relaxed) + n,
+              std::memory_order_relaxed);
+}
+
+static inline int GetBucketIndex(uint64_t us) noexcept
+{
+  if (us == 0) return 0;
+  int index = 64 - __builtin_clzll(us);
+  return index < LatencyHistogram::BUCKET_NUM
+             ? index
+             : LatencyHistogram::BUCKET_NUM - 1;
+}
+
+static inline void Record(HistogramBlock &h, int64_t begin, int64_t end)
+{
+  if (begin == 0 || end < begin) return;
+
+  uint64_t us = end - begin;
+  Increase(h.buckets[GetBucketIndex(us)], 1);
+  Increase(h.count, 1);
+  Increase(h.sum, us);
+}
+
+void FcgiStats::AddSlow(Counter c, uint64_t n) noexcept
+{
+  Increase(GetBlock().counters[(int)c], n);
+}
+
+void FcgiStats::RecordRequestSlow(RequestTimes const &times) noexcept
+{
+  auto end = NowSlow();
+  auto &block = GetBlock();
+  auto phase = [&block](Phase p) -> HistogramBlock & {
+    return block.phases[(int)p];
+  };
+
+  Increase(block.counters[(int)Counter::Requests], 1);
+  Record(phase(Phase::Params), times.begin_time, times.params_time);
+  Record(phase(Phase::Stdin), times.begin_time, times.stdin_time);
+
+  /* In streaming mode, the handler is called once PARAMS is complete */
+  auto ready = (times.stdin_time && times.stdin_time <= times.handler_time)
+                   ? times.stdin_time
+                   : times.params_time;
+  Record(phase(Phase::Queue), ready, times.handler_time);
+  Record(phase(Phase::Handler), times.handler_time, end);
+  Record(phase(Phase::Total), times.begin_time, end);
+}
+
+int64_t FcgiStats::NowSlow() noexcept
+{
+  return TimeStamp::Now().GetMicrosecondsSinceEpoch();
+}
+
+StatsSnapshot FcgiStats::GetSnapshot() noexcept
+{
+  StatsSnapshot snapshot;
+  memset(&snapshot, 0, sizeof snapshot);
+
+  std::lock_guard<std::mutex> guard(blocks_mutex);
+  for (auto const &block : blocks) {
+    for (int i = 0; i < (int)Counter::Num; ++i) {
+      auto const &value = block->counters[i];
+      snapshot.counters[i] += value.load(std::memory_order_relaxed);
+    }
+
+    for (int i = 0; i < (int)Phase::Num; ++i) {
+      auto &dst = snapshot.phases[i];
+      auto const &src = block->phases[i];
+      for (int j = 0; j < LatencyHistogram::BUCKET_NUM; ++j) {
+        dst.buckets[j] += src.buckets[j].load(std::memory_order_relaxed);
+      }
+      dst.count += src.count.load(std::memory_order_relaxed);
+      dst.sum += src.sum.load(std::memory_order_relaxed);
+    }
+  }
+
+  return snapshot;
+}
+
+/*-----------------------*/
+/* Management            */
+/*-----------------------*/
+
+void FcgiStats::SetManagementPath(std::string path)
+{
+  management_path = std::move(path);
+}
+
+std::string const &FcgiStats::GetManagementPath() noexcept
+{
+  return management_path;
+}
+
+bool FcgiStats::IsManagementRequest(FcgiParams const &params) noexcept
+{
+  if (management_path.empty()) return false;
+
+  StringView path = params.Get(Param::DocumentUri);
+  if (path.empty()) {
+    path = params.Get(Param::RequestUri);
+    auto query = path.find('?');
+    if (query != StringView::npos) path = path.substr(0, query);
+  }
+
+  return path == StringView(management_path);
+}
+
+/*-----------------------*/
+/* Snapshot              */
+/*-----------------------*/
+
+uint64_t LatencyHistogram::GetPercentile(double p) const noexcept
+{
+  if (count == 0) return 0;
+
+  uint64_t rank = (uint64_t)(p * count);
+  if (rank >= count) rank = count - 1;
+
+  uint64_t seen = 0;
+  for (int i = 0; i < BUCKET_NUM; ++i) {
+    seen += buckets[i];
+    if (seen > rank) return (uint64_t)1 << i;
+  }
+  return (uint64_t)1 << (BUCKET_NUM - 1);
+}
+
+std::string StatsSnapshot::ToString() const
+{
+  std::string ret;
+  char line[256];
+
+  for (int i = 0; i < (int)Counter::Num; ++i) {
+    ::snprintf(line, sizeof line, "%s %llu\n", counter_strings[i],
+               (unsigned long long)counters[i]);
+    ret += line;
+  }
+
+  /* The percentiles are the upper bound of buckets */
+  for (int i = 0; i < (int)Phase::Num; ++i) {
+    auto const &h = phases[i];
+    ::snprintf(line, sizeof line,
+               "latency_us %s count=%llu mean=%.1f p50=%llu p99=%llu "
+               "p999=%llu\n",
+               phase_strings[i], (unsigned long long)h.count, h.GetMean(),
+               (unsigned long long)h.GetPercentile(0.5),
+               (unsigned long long)h.GetPercentile(0.99),
+               (unsigned long long)h.GetPercentile(0.999));
+    ret += line;
+  }
+
+  return ret;
+}
@@ -0,0 +1,131 @@
+#ifndef FCGI_STATS_H_
+#define FCGI_STATS_H_
+
+#include <stdint.h>
+#include <string>
+
+namespace fcgi {
+
+class FcgiParams;
+
+enum class Counter : uint8_t {
+  Requests,  /* The requests ended by handler */
+  BytesIn,   /* The bytes of records parsed */
+  BytesOut,  /* The bytes of records sent */
+  Aborted,   /* The requests aborted by web server */
+  Rejected,  /* The requests rejected by limits or full worker pool */
+  CacheHits,   /* The requests answered by ResponseCache */
+  CacheMisses, /* The cacheable requests passed to the handler */
+  Num,
+};
+
+/* The phases of a request whose latency is measured */
+enum class Phase : uint8_t {
+  Params,  /* BEGIN_REQUEST -> PARAMS complete */
+  Stdin,   /* BEGIN_REQUEST -> STDIN complete */
+  Queue,   /* Input complete -> handler start, e.g. waiting for worker */
+  Handler, /* Handler start -> END_REQUEST */
+  Total,   /* BEGIN_REQUEST -> END_REQUEST */
+  Num,
+};
+
+char const *Counter2String(Counter c) noexcept;
+char const *Phase2String(Phase p) noexcept;
+
+/**
+ * The timestamps(microseconds since epoch) of a request.
+ * 0 indicates the time isn't recorded, e.g. the stats is disabled,
+ * the STDIN is streamed.
+ */
+struct RequestTimes {
+  int64_t begin_time = 0;   /* The BEGIN_REQUEST is received */
+  int64_t params_time = 0;  /* The PARAMS is complete */
+  int64_t stdin_time = 0;   /* The STDIN is complete */
+  int64_t handler_time = 0; /* The handler is called */
+};
+
+/**
+ * The latencies are counted in the buckets of power of 2 microseconds.
+ * The bucket i counts the latency in [2^(i-1), 2^i) us, bucket 0 counts
+ * the latency less than 1us.
+ */
+struct LatencyHistogram {
+  static constexpr int BUCKET_NUM = 32;
+
+  uint64_t buckets[BUCKET_NUM];
+  uint64_t count;
+  uint64_t sum; /* us */
+
+  /** The upper bound of the bucket where the percentile \p p locates */
+  uint64_t GetPercentile(double p) const noexcept;
+  double GetMean() const noexcept { return count ? (double)sum / count : 0; }
+};
+
+struct StatsSnapshot {
+  uint64_t counters[(int)Counter::Num];
+  LatencyHistogram phases[(int)Phase::Num];
+
+  uint64_t Get(Counter c) const noexcept { return counters[(int)c]; }
+  LatencyHistogram const &Get(Phase p) const noexcept
+  {
+    return phases[(int)p];
+  }
+
+  /** Text format served at the management path */
+  std::string ToString() const;
+};
+
+/**
+ * Per-request latency and counters of the codec.
+ *
+ * Each thread(IO loop or worker) updates its own stats block, which is
+ * registered once when the thread records first time. The block is
+ * only written by the owner, so no lock or atomic RMW is required in the
+ * hot path, the snapshot merges all blocks.
+ *
+ * The stats is disabled by default, the codec doesn't read clock then.
+ */
+class FcgiStats {
+ public:
+  /** Must be set before the server starts */
+  static void Enable(bool enable) noexcept { enabled_ = enable; }
+  static bool IsEnabled() noexcept { return enabled_; }
+
+  /**
+   * The request whose DOCUMENT_URI(or the path of REQUEST_URI) is
+   * \p path is answered with the snapshot by the codec, and it isn't
+   * passed to the handler.
+   * Empty path(default) disables it.
+   * Must be set before the server starts.
+   */
+  static void SetManagementPath(std::string path);
+  static std::string const &GetManagementPath() noexcept;
+  static bool IsManagementRequest(FcgiParams const &params) noexcept;
+
+  static void Add(Counter c, uint64_t n = 1) noexcept
+  {
+    if (enabled_) AddSlow(c, n);
+  }
+
+  /** Called when the handler ends the request */
+  static void RecordRequest(RequestTimes const &times) noexcept
+  {
+    if (enabled_) RecordRequestSlow(times);
+  }
+
+  /** \return 0 if the stats is disabled */
+  static int64_t Now() noexcept { return enabled_ ? NowSlow() : 0; }
+
+  static StatsSnapshot GetSnapshot() noexcept;
+
+ private:
+  static void AddSlow(Counter c, uint64_t n) noexcept;
+  static void RecordRequestSlow(RequestTimes const &times) noexcept;
+  static int64_t NowSlow() noexcept;
+
+  static bool enabled_;
+};
+
+} // namespace fcgi
+
+#endif // FCGI_STATS_H_
@@ -0,0 +1,60 @@
+#include "fcgi_stdout_stream.h"
+
+#include "kanon/net/event_loop.h"
+
+using namespace kanon;
+using namespace fcgi;
+
+void StdoutStream::Start(TransportPtr const &conn, FcgiRequest request,
+                         Producer producer, size_t high_water_mark)
+{
+  auto stream = std::make_shared<StdoutStream>(
+      conn, std::move(request), std::move(producer), high_water_mark);
+
+  auto loop = conn->GetLoop();
+  if (loop->IsLoopInThread()) {
+    Pump(stream);
+  } else {
+    loop->QueueToLoop([stream]() { Pump(stream); });
+  }
+}
+
+StdoutStream::StdoutStream(TransportPtr const &conn, FcgiRequest request,
+                           Producer producer, size_t high_water_mark)
+  : conn_(conn)
+  , request_(std::move(request))
+  , writer_(conn, request_)
+  , producer_(std::move(producer))
+  , high_water_mark_(high_water_mark)
+{
+}
+
+void StdoutStream::Pump(StreamPtr const &stream)
+{
+  auto &self = *stream;
+
+  for (;;) {
+    /* The request is released with the stream */
+    if (!self.conn_->IsConnected() || self.request_.IsAborted()) return;
+
+    /* Including the output queued in the scheduler for the request */
+    auto id = self.request_.request_id;
+    if (OutputScheduler::GetOutputSize(self.conn_, id) >
+        self.high_water_mark_)
+    {
+      auto codec = self.request_.GetCodec();
+      if (!codec) return;
+
+      /* Dropped with the codec if the connection is closed */
+      codec->WaitWriteComplete([stream]() { Pump(stream); });
+      return;
+    }
+
+    if (!self.producer_(self.writer_)) {
+      self.writer_.EndRequest();
+      return;
+    }
+
+    self.writer_.Flush();
+  }
+}
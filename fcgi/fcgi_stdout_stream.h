@@ -0,0 +1,77 @@
+#ifndef FCGI_STDOUT_STREAM_H_
+#define FCGI_STDOUT_STREAM_H_
+
+#include <functional>
+#include <memory>
+
+#include "fcgi_codec.h"
+#include "fcgi_response_writer.h"
+#include "kanon/util/noncopyable.h"
+
+namespace fcgi {
+
+/**
+ * Pull the STDOUT of a response from a producer at the pace of the
+ * connection.
+ *
+ * FcgiCodec::SendStdout() and ResponseWriter copy the content to the
+ * output of connection at once, so a large response(e.g. an export)
+ * to a slow web server is buffered entirely. The stream asks the
+ * producer for the next chunk only while the pending output of
+ * connection is under the high-water mark, and waits for the output
+ * to be drained otherwise. The memory of a response is bounded by the
+ * high-water mark plus a chunk.
+ * \code
+ *   StdoutStream::Start(conn, std::move(request),
+ *                       [fd](ResponseWriter &writer) {
+ *     char buf[16 * 1024];
+ *     auto n = ::read(fd, buf, sizeof buf);
+ *     if (n <= 0) return false;
+ *     writer.WriteStdout(buf, n);
+ *     return true;
+ *   });
+ * \endcode
+ *
+ * The producer is called in the loop of connection. The request is held
+ * by the stream, END_REQUEST is sent once the producer completes. The
+ * stream stops if the request is aborted or the connection is closed.
+ */
+class StdoutStream : kanon::noncopyable {
+ public:
+  /**
+   * Append the next chunk to \p writer, the HTTP headers are the first
+   * chunk usually.
+   * \return false if the content is complete
+   */
+  using Producer = std::function<bool(ResponseWriter &writer)>;
+
+  /**
+   * Start streaming, it can be called in any thread(e.g. the worker),
+   * the stream runs in the loop of \p conn.
+   * \param high_water_mark The pending bytes of connection(plus the
+   *                        bytes of the request queued in the
+   *                        OutputScheduler if any) at which the
+   *                        producer is stopped
+   */
+  static void Start(TransportPtr const &conn, FcgiRequest request,
+                    Producer producer, size_t high_water_mark = 64 * 1024);
+
+  StdoutStream(TransportPtr const &conn, FcgiRequest request,
+               Producer producer, size_t high_water_mark);
+
+ private:
+  using StreamPtr = std::shared_ptr<StdoutStream>;
+
+  /* Produce until the high-water mark or the end */
+  static void Pump(StreamPtr const &stream);
+
+  TransportPtr conn_;
+  FcgiRequest request_;
+  ResponseWriter writer_;
+  Producer producer_;
+  size_t high_water_mark_;
+};
+
+} // namespace fcgi
+
+#endif // FCGI_STDOUT_STREAM_H_
@@ -0,0 +1,301 @@
+#include "fcgi_tcp_transport.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "fcgi_record.h"
+
+#include "kanon/log/logger.h"
+#include "kanon/net/endian_api.h"
+#include "kanon/net/event_loop.h"
+
+using namespace kanon;
+using namespace fcgi;
+
+/* The iovecs of a gather write, i.e. 32 records of EncodedResponse */
+#define MAX_IOV_NUM 64
+
+/* The bytes of file queued in the output of connection when the socket
+ * is full. kanon watches the writable event only if the output isn't
+ * empty, then the file is continued by sendfile(2) when it is drained. */
+#define FILE_SENTINEL_SIZE 1
+
+std::shared_ptr<TcpTransport> TcpTransport::New(TcpConnectionPtr const &conn)
+{
+  auto transport = std::make_shared<TcpTransport>(conn);
+
+  /* The connection doesn't own the transport, the owner is the codec */
+  std::weak_ptr<TcpTransport> weak_transport = transport;
+  conn->SetMessageCallback([weak_transport](TcpConnectionPtr const &conn,
+                                            Buffer &buffer,
+                                            TimeStamp receive_time) {
+    auto transport = weak_transport.lock();
+    if (transport) transport->OnMessage(buffer, receive_time);
+  });
+
+  conn->SetWriteCompleteCallback([weak_transport](TcpConnectionPtr const &) {
+    auto transport = weak_transport.lock();
+    if (transport) transport->OnWriteComplete();
+  });
+
+  return transport;
+}
+
+TcpTransport::TcpTransport(TcpConnectionPtr const &conn)
+  : Transport(conn->GetLoop())
+  , conn_(conn)
+{
+}
+
+void TcpTransport::Send(void const *data, size_t len)
+{
+  if (loop_->IsLoopInThread() && files_.empty()) {
+    conn_->Send(data, len);
+    return;
+  }
+
+  ChunkList output;
+  output.Append(data, len);
+  Send(output);
+}
+
+void TcpTransport::Send(ChunkList &output)
+{
+  if (loop_->IsLoopInThread()) {
+    SendInLoop(output);
+    return;
+  }
+
+  /* The order with the files is kept in the loop */
+  auto moved = std::make_shared<ChunkList>(std::move(output));
+  auto self = std::static_pointer_cast<TcpTransport>(shared_from_this());
+  loop_->QueueToLoop([self, moved]() { self->SendInLoop(*moved); });
+}
+
+void TcpTransport::Send(EncodedResponsePtr const &response, uint16_t id)
+{
+  if (loop_->IsLoopInThread()) {
+    SendInLoop(*response, id);
+    return;
+  }
+
+  /* The response is shared, not copied */
+  auto self = std::static_pointer_cast<TcpTransport>(shared_from_this());
+  loop_->QueueToLoop([self, response, id]() {
+    self->SendInLoop(*response, id);
+  });
+}
+
+void TcpTransport::SendFile(ChunkList &head, FileHandlePtr const &file,
+                            off_t offset, size_t len)
+{
+  if (loop_->IsLoopInThread()) {
+    SendFileInLoop(head, file, offset, len);
+    return;
+  }
+
+  auto moved = std::make_shared<ChunkList>(std::move(head));
+  auto self = std::static_pointer_cast<TcpTransport>(shared_from_this());
+  loop_->QueueToLoop([self, moved, file, offset, len]() {
+    self->SendFileInLoop(*moved, file, offset, len);
+  });
+}
+
+void TcpTransport::ShutdownWrite()
+{
+  if (!loop_->IsLoopInThread()) {
+    auto self = std::static_pointer_cast<TcpTransport>(shared_from_this());
+    loop_->QueueToLoop([self]() { self->ShutdownWrite(); });
+    return;
+  }
+
+  if (files_.empty()) {
+    conn_->ShutdownWrite();
+  } else {
+    shutdown_pending_ = true;
+  }
+}
+
+size_t TcpTransport::GetOutputSize() const noexcept
+{
+  size_t size = conn_->GetOutputBuffer()->GetReadableSize();
+  for (auto const &file : files_) {
+    size += file.len + file.trailing.GetReadableSize();
+  }
+
+  return size;
+}
+
+void TcpTransport::OnMessage(Buffer &buffer, TimeStamp receive_time)
+{
+  if (!message_callback_) return;
+
+  buffer.AdvanceRead(message_callback_(shared_from_this(),
+                                       buffer.GetReadBegin(),
+                                       buffer.GetReadableSize(), receive_time));
+}
+
+void TcpTransport::OnWriteComplete()
+{
+  if (!files_.empty()) SendPendingFiles();
+  if (files_.empty()) WriteComplete();
+}
+
+void TcpTransport::SendInLoop(ChunkList &output)
+{
+  if (files_.empty()) {
+    conn_->Send(output);
+    return;
+  }
+
+  auto &trailing = files_.back().trailing;
+  if (trailing.IsEmpty()) {
+    trailing.swap(output);
+  } else {
+    for (auto const &chunk : output) {
+      trailing.Append(chunk.GetReadBegin(), chunk.GetReadableSize());
+    }
+    output.AdvanceAll();
+  }
+}
+
+void TcpTransport::SendInLoop(EncodedResponse const &response, uint16_t id)
+{
+  auto record_num = response.GetRecordNum();
+  if (!files_.empty() || !conn_->IsConnected() ||
+      conn_->GetOutputBuffer()->GetReadableSize() > 0 ||
+      record_num * 2 > MAX_IOV_NUM)
+  {
+    ChunkList output;
+    response.AppendTo(output, id);
+    SendInLoop(output);
+    return;
+  }
+
+  /* Gather the patched headers and the contents in the response */
+  auto records = response.GetRecords();
+  auto const &offsets = response.GetHeaders();
+  uint16_t net_id = sock::ToNetworkByteOrder16(id);
+  RecordHeader headers[MAX_IOV_NUM / 2];
+  struct iovec iov[MAX_IOV_NUM];
+  int iov_num = 0;
+
+  for (size_t i = 0; i < record_num; ++i) {
+    memcpy(&headers[i], records.data() + offsets[i],
+           FCGI_RECORD_HEADER_LENGTH);
+    headers[i].request_id = net_id;
+    iov[iov_num].iov_base = &headers[i];
+    iov[iov_num].iov_len = FCGI_RECORD_HEADER_LENGTH;
+    ++iov_num;
+
+    size_t body = offsets[i] + FCGI_RECORD_HEADER_LENGTH;
+    size_t end = (i + 1 < record_num) ? offsets[i + 1] : records.size();
+    if (end > body) {
+      iov[iov_num].iov_base = const_cast<char *>(records.data() + body);
+      iov[iov_num].iov_len = end - body;
+      ++iov_num;
+    }
+  }
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof msg);
+  msg.msg_iov = iov;
+  msg.msg_iovlen = iov_num;
+
+  /* The error is reported by the connection when the rest is sent */
+  auto n = ::sendmsg(conn_->GetFd(), &msg, MSG_NOSIGNAL);
+  if (n < 0) n = 0;
+
+  /* Copy the unsent bytes only */
+  ChunkList output;
+  for (int i = 0; i < iov_num; ++i) {
+    size_t len = iov[i].iov_len;
+    if ((size_t)n >= len) {
+      n -= len;
+      continue;
+    }
+
+    output.Append(static_cast<char const *>(iov[i].iov_base) + n, len - n);
+    n = 0;
+  }
+
+  if (!output.IsEmpty()) conn_->Send(output);
+}
+
+void TcpTransport::SendFileInLoop(ChunkList &head, FileHandlePtr const &file,
+                                  off_t offset, size_t len)
+{
+  if (!conn_->IsConnected()) {
+    head.AdvanceAll();
+    return;
+  }
+
+  SendInLoop(head);
+  files_.push_back(PendingFile{file, offset, len, ChunkList()});
+  if (files_.size() == 1) SendPendingFiles();
+}
+
+void TcpTransport::SendPendingFiles()
+{
+  int fd = conn_->GetFd();
+
+  /* The file region follows the bytes in the output of connection */
+  while (!files_.empty() && conn_->IsConnected() &&
+         conn_->GetOutputBuffer()->GetReadableSize() == 0)
+  {
+    auto &file = files_.front();
+    if (file.len == 0) {
+      ChunkList trailing;
+      trailing.swap(file.trailing);
+      files_.pop_front();
+      conn_->Send(trailing);
+      continue;
+    }
+
+    auto n = ::sendfile(fd, file.file->GetFd(), &file.offset, file.len);
+    if (n < 0 && errno == EINTR) continue;
+
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      /* The writable event of connection continues the file */
+      char sentinel[FILE_SENTINEL_SIZE];
+      n = ::pread(file.file->GetFd(), sentinel, sizeof sentinel,
+                  file.offset);
+      if (n > 0) {
+        file.offset += n;
+        file.len -= n;
+        conn_->Send(sentinel, n);
+        break;
+      }
+    }
+
+    if (n <= 0) {
+      if (n < 0) {
+        LOG_SYSERROR << "Failed to send file to " << conn_->GetName();
+      } else {
+        /* The records promise the length */
+        LOG_ERROR << "The file " << file.file->GetFd() << " is truncated, "
+                  << file.len << " bytes are missing";
+      }
+
+      files_.clear();
+      conn_->ForceClose();
+      return;
+    }
+
+    file.len -= n;
+  }
+
+  if (!conn_->IsConnected()) {
+    files_.clear();
+    return;
+  }
+
+  if (files_.empty() && shutdown_pending_) {
+    shutdown_pending_ = false;
+    conn_->ShutdownWrite();
+  }
+}
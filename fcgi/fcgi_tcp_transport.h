@@ -0,0 +1,87 @@
+#ifndef FCGI_TCP_TRANSPORT_H_
+#define FCGI_TCP_TRANSPORT_H_
+
+#include <deque>
+
+#include "fcgi_transport.h"
+
+#include "kanon/net/tcp_connection.h"
+
+namespace fcgi {
+
+/**
+ * The transport over kanon::TcpConnection, i.e. the epoll loop and
+ * the input buffer of connection.
+ *
+ * It is the default transport, the codec is created from it in the
+ * connection callback of kanon::TcpServer:
+ * \code
+ *   auto codec = new FcgiCodec(TcpTransport::New(conn));
+ *   conn->SetContext(codec);
+ * \endcode
+ *
+ * The file is sent by sendfile(2) when the output of connection is
+ * drained, the bytes sent after it wait for it. The records of
+ * EncodedResponse are written from the response by a gather write if the
+ * output is empty. sendfile(2) raises SIGPIPE if the peer has closed, the
+ * application should ignore SIGPIPE.
+ */
+class TcpTransport : public Transport {
+ public:
+  /** The transport takes over the message callback of \p conn */
+  static std::shared_ptr<TcpTransport>
+  New(kanon::TcpConnectionPtr const &conn);
+
+  explicit TcpTransport(kanon::TcpConnectionPtr const &conn);
+
+  void Send(void const *data, size_t len) override;
+  void Send(kanon::ChunkList &output) override;
+  void Send(EncodedResponsePtr const &response, uint16_t id) override;
+  void SendFile(kanon::ChunkList &head, FileHandlePtr const &file,
+                off_t offset, size_t len) override;
+
+  void ShutdownWrite() override;
+  void StopRead() override { conn_->StopRead(); }
+  void StartRead() override { conn_->StartRead(); }
+  bool IsConnected() const noexcept override { return conn_->IsConnected(); }
+
+  size_t GetOutputSize() const noexcept override;
+
+  kanon::Buffer *GetInputBuffer() noexcept override
+  {
+    return conn_->GetInputBuffer();
+  }
+
+  kanon::TcpConnectionPtr const &GetConnection() const noexcept
+  {
+    return conn_;
+  }
+
+ private:
+  /* The region of file and the bytes sent after it */
+  struct PendingFile {
+    FileHandlePtr file;
+    off_t offset;
+    size_t len;
+    kanon::ChunkList trailing;
+  };
+
+  void OnMessage(kanon::Buffer &buffer, kanon::TimeStamp receive_time);
+  void OnWriteComplete();
+
+  void SendInLoop(kanon::ChunkList &output);
+  void SendInLoop(EncodedResponse const &response, uint16_t id);
+  void SendFileInLoop(kanon::ChunkList &head, FileHandlePtr const &file,
+                      off_t offset, size_t len);
+
+  /* Continue the files when the output of connection is drained */
+  void SendPendingFiles();
+
+  kanon::TcpConnectionPtr conn_;
+  std::deque<PendingFile> files_;
+  bool shutdown_pending_ = false;
+};
+
+} // namespace fcgi
+
+#endif // FCGI_TCP_TRANSPORT_H_
@@ -0,0 +1,141 @@
+#include "fcgi_trace.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "kanon/log/logger.h"
+
+using namespace fcgi;
+
+bool FcgiTrace::enabled_ = false;
+
+static size_t ring_capacity = FcgiTrace::DEFAULT_CAPACITY;
+
+static char const *event_strings[] = {
+    "NONE",
+    "RECORD_IN",
+    "RECORD_OUT",
+    "PARSE_SHORT",
+    "PARAMS_COMPLETE",
+    "DISPATCH",
+    "REJECT",
+    "ABORT",
+    "UNKNOWN_REQUEST",
+    "FLUSH",
+    "PAUSE",
+    "RESUME",
+};
+
+static_assert(sizeof event_strings / sizeof event_strings[0] ==
+                  (size_t)TraceEvent::Num,
+              "The strings of event must match the TraceEvent");
+
+char const *fcgi::TraceEvent2String(TraceEvent e) noexcept
+{
+  if (e >= TraceEvent::Num) return "INVALID";
+  return event_strings[(int)e];
+}
+
+struct TraceRing {
+  std::unique_ptr<TraceRecord[]> records;
+  size_t mask;
+  /* Written by the owner thread only */
+  std::atomic<uint64_t> head;
+  uint32_t tid;
+
+  explicit TraceRing(size_t capacity)
+    : records(new TraceRecord[capacity])
+    , mask(capacity - 1)
+    , head(0)
+    , tid((uint32_t)::syscall(SYS_gettid))
+  {
+    memset(records.get(), 0, capacity * sizeof(TraceRecord));
+  }
+};
+
+/* The rings are never freed since they may be dumped after the thread
+ * exits */
+static std::mutex rings_mutex;
+static std::vector<std::unique_ptr<TraceRing>> rings;
+
+static TraceRing *RegisterRing()
+{
+  auto ring = new TraceRing(ring_capacity);
+  std::lock_guard<std::mutex> guard(rings_mutex);
+  rings.emplace_back(ring);
+  return ring;
+}
+
+void FcgiTrace::Enable(size_t capacity) noexcept
+{
+  size_t n = 2;
+  while (n < capacity) n <<= 1;
+  ring_capacity = n;
+  enabled_ = true;
+}
+
+void FcgiTrace::Record(TraceEvent event, uint16_t id, uint32_t length,
+                       uint8_t type) noexcept
+{
+  static thread_local TraceRing *ring = RegisterRing();
+
+  struct timespec ts;
+  ::clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  auto head = ring->head.load(std::memory_order_relaxed);
+  auto &record = ring->records[head & ring->mask];
+  record.timestamp = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+  record.length = length;
+  record.request_id = id;
+  record.event = (uint8_t)event;
+  record.type = type;
+  ring->head.store(head + 1, std::memory_order_release);
+}
+
+bool FcgiTrace::Dump(char const *path)
+{
+  FILE *file = ::fopen(path, "wb");
+  if (!file) {
+    LOG_SYSERROR << "Failed to open the trace file: " << path;
+    return false;
+  }
+
+  std::lock_guard<std::mutex> guard(rings_mutex);
+
+  TraceFileHeader file_header;
+  memcpy(file_header.magic, FCGI_TRACE_MAGIC, sizeof file_header.magic);
+  file_header.ring_num = rings.size();
+  file_header.reserved = 0;
+  bool ok = ::fwrite(&file_header, sizeof file_header, 1, file) == 1;
+
+  for (auto const &ring : rings) {
+    if (!ok) break;
+
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    uint64_t capacity = ring->mask + 1;
+    /* The oldest slot may be being overwritten, skip it */
+    uint64_t num = head < capacity ? head : capacity - 1;
+
+    TraceRingHeader ring_header;
+    ring_header.tid = ring->tid;
+    ring_header.record_num = num;
+    ring_header.overwritten = head - num;
+    ok = ::fwrite(&ring_header, sizeof ring_header, 1, file) == 1;
+
+    for (uint64_t i = head - num; ok && i < head; ++i) {
+      ok = ::fwrite(&ring->records[i & ring->mask], sizeof(TraceRecord), 1,
+                    file) == 1;
+    }
+  }
+
+  if (::fclose(file) != 0) ok = false;
+  if (!ok) LOG_SYSERROR << "Failed to write the trace file: " << path;
+  return ok;
+}
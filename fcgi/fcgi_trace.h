@@ -0,0 +1,112 @@
+#ifndef FCGI_TRACE_H_
+#define FCGI_TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace fcgi {
+
+/*
+ * The meaning of length and type of the record depends on the event.
+ */
+enum class TraceEvent : uint8_t {
+  None = 0,
+  RecordIn,       /* length: content length, type: record type */
+  RecordOut,      /* length: content length, type: record type */
+  ParseShort,     /* length: readable bytes of input */
+  ParamsComplete, /* length: number of params */
+  Dispatch,       /* length: buffered bytes of request */
+  Reject,         /* type: protocol status */
+  Abort,
+  UnknownRequest, /* type: record type */
+  Flush,          /* length: bytes of output */
+  Pause,
+  Resume,
+  Num,
+};
+
+char const *TraceEvent2String(TraceEvent e) noexcept;
+
+struct TraceRecord {
+  uint64_t timestamp; /* ns of CLOCK_MONOTONIC */
+  uint32_t length;
+  uint16_t request_id;
+  uint8_t event;
+  uint8_t type;
+};
+
+static_assert(sizeof(TraceRecord) == 16, "The TraceRecord must be 16 bytes");
+
+/*
+ * The format of dump file:
+ * TraceFileHeader, then (TraceRingHeader, TraceRecord * record_num) of
+ * each thread. The records of a thread are in chronological order.
+ * The integers are in host byte order.
+ */
+#define FCGI_TRACE_MAGIC "FCGITRC1"
+
+struct TraceFileHeader {
+  char magic[8];
+  uint32_t ring_num;
+  uint32_t reserved;
+};
+
+struct TraceRingHeader {
+  uint32_t tid;
+  uint32_t record_num;
+  uint64_t overwritten; /* The number of records overwritten by newer */
+};
+
+/**
+ * Binary trace of the hot path.
+ *
+ * Unlike LOG_TRACE which formats the text in the IO thread, the event is
+ * recorded as a 16 bytes tuple into the fixed-size ring of current
+ * thread, the oldest records are overwritten. Dump() writes the rings
+ * to file, and fcgi_trace_dump decodes it offline.
+ * Therefore, the trace can be enabled in production.
+ *
+ * Define FCGI_DISABLE_TRACE to remove the trace points in compile time.
+ */
+class FcgiTrace {
+ public:
+  static constexpr size_t DEFAULT_CAPACITY = 64 * 1024;
+
+  /**
+   * \p capacity is the number of records of each ring, it is rounded up
+   * to power of 2. Must be called before the server starts.
+   */
+  static void Enable(size_t capacity = DEFAULT_CAPACITY) noexcept;
+  static void Disable() noexcept { enabled_ = false; }
+  static bool IsEnabled() noexcept { return enabled_; }
+
+  static void Record(TraceEvent event, uint16_t id, uint32_t length,
+                     uint8_t type) noexcept;
+
+  /**
+   * Write the rings of all threads to \p path.
+   * It is safe to call in any thread, but the records being written
+   * concurrently may be torn, they are skipped by the dump tool
+   * generally since the event is invalid.
+   */
+  static bool Dump(char const *path);
+
+ private:
+  static bool enabled_;
+};
+
+} // namespace fcgi
+
+#ifdef FCGI_DISABLE_TRACE
+#define FCGI_TRACE(event, id, length, type) ((void)0)
+#else
+#define FCGI_TRACE(event, id, length, type)                                    \
+  do {                                                                         \
+    if (::fcgi::FcgiTrace::IsEnabled()) {                                      \
+      ::fcgi::FcgiTrace::Record(::fcgi::TraceEvent::event, (id), (length),     \
+                                (type));                                       \
+    }                                                                          \
+  } while (0)
+#endif
+
+#endif // FCGI_TRACE_H_
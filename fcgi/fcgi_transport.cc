@@ -0,0 +1,60 @@
+#include "fcgi_transport.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "kanon/log/logger.h"
+
+using namespace kanon;
+using namespace fcgi;
+
+FileHandle::~FileHandle() noexcept
+{
+  ::close(fd_);
+}
+
+FileHandlePtr FileHandle::Dup(int fd)
+{
+  int dup_fd = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+  if (dup_fd < 0) {
+    LOG_SYSERROR << "Failed to duplicate file " << fd;
+    return nullptr;
+  }
+
+  return std::make_shared<FileHandle>(dup_fd);
+}
+
+/* The bytes of file read and sent at a time by the default SendFile() */
+#define FILE_READ_SIZE (64 * 1024)
+
+void Transport::SendFile(ChunkList &head, FileHandlePtr const &file,
+                         off_t offset, size_t len)
+{
+  char buf[FILE_READ_SIZE];
+  int fd = file->GetFd();
+
+  /* The pieces are sent once read instead of being gathered in head */
+  Send(head);
+
+  while (len > 0) {
+    auto n = ::pread(fd, buf, len < sizeof buf ? len : sizeof buf, offset);
+    if (n < 0 && errno == EINTR) continue;
+
+    if (n <= 0) {
+      if (n < 0) {
+        LOG_SYSERROR << "Failed to read file " << fd;
+      } else {
+        LOG_ERROR << "The file " << fd << " is truncated, " << len
+                  << " bytes are missing";
+      }
+
+      ShutdownWrite();
+      return;
+    }
+
+    Send(buf, n);
+    offset += n;
+    len -= n;
+  }
+}
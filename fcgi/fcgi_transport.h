@@ -0,0 +1,206 @@
+#ifndef FCGI_TRANSPORT_H_
+#define FCGI_TRANSPORT_H_
+
+#include <functional>
+#include <memory>
+#include <sys/types.h>
+
+#include "fcgi_encoded_response.h"
+#include "kanon/buffer/chunk_list.h"
+#include "kanon/net/buffer.h"
+#include "kanon/string/string_view.h"
+#include "kanon/util/any.h"
+#include "kanon/util/noncopyable.h"
+#include "kanon/util/time_stamp.h"
+
+namespace kanon {
+
+class EventLoop;
+
+} // namespace kanon
+
+namespace fcgi {
+
+class Transport;
+class OutputScheduler;
+using TransportPtr = std::shared_ptr<Transport>;
+
+/**
+ * An opened file shared by the pending sends of it,
+ * it is closed when the last reference is released.
+ */
+class FileHandle : kanon::noncopyable {
+ public:
+  /** \p fd is owned by the handle */
+  explicit FileHandle(int fd) noexcept
+    : fd_(fd)
+  {
+  }
+
+  ~FileHandle() noexcept;
+
+  /**
+   * Duplicate \p fd, then the caller can close it
+   * \return nullptr if failed
+   */
+  static std::shared_ptr<FileHandle> Dup(int fd);
+
+  int GetFd() const noexcept { return fd_; }
+
+ private:
+  int fd_;
+};
+
+using FileHandlePtr = std::shared_ptr<FileHandle>;
+
+/**
+ * The byte stream under the codec.
+ *
+ * The codec only parses the bytes delivered by the transport and sends
+ * the encoded records through it, so the IO mechanism can be replaced:
+ *  - TcpTransport: kanon::TcpConnection(epoll) over TCP or Unix domain
+ *    socket(see fcgi_socket_server.h), the default, sends the file by
+ *    sendfile(2)
+ *  - UringTransport: io_uring(see fcgi_uring.h), optional
+ *
+ * All the methods are called in the loop of transport except Send(),
+ * which can be called in any thread.
+ */
+class Transport
+  : public std::enable_shared_from_this<Transport>
+  , kanon::noncopyable {
+ public:
+  /**
+   * Called with the received bytes which may reference the buffer owned
+   * by the backend, e.g. the provided buffer of io_uring.
+   * \return The bytes consumed, the remaining bytes are kept by the
+   *         transport and delivered again with the following bytes.
+   */
+  using MessageCallback = std::function<size_t(
+      TransportPtr const &, char const *data, size_t len, kanon::TimeStamp)>;
+
+  /**
+   * Called in the loop when the queued output has been written to the
+   * socket completely, it may also be called after a send which is
+   * written directly.
+   */
+  using WriteCompleteCallback = std::function<void(TransportPtr const &)>;
+
+  explicit Transport(kanon::EventLoop *loop) noexcept
+    : loop_(loop)
+  {
+  }
+
+  virtual ~Transport() = default;
+
+  virtual void Send(void const *data, size_t len) = 0;
+  void Send(kanon::StringView data) { Send(data.data(), data.size()); }
+
+  /** The chunks of \p output are consumed */
+  virtual void Send(kanon::ChunkList &output) = 0;
+
+  /**
+   * Send the records of \p response with the request id \p id.
+   * The records are copied to the output by default, the transport
+   * which can send from \p response directly overrides it.
+   */
+  virtual void Send(EncodedResponsePtr const &response, uint16_t id)
+  {
+    kanon::ChunkList output;
+    response->AppendTo(output, id);
+    Send(output);
+  }
+
+  /**
+   * Send \p head, then the [offset, offset+len) of \p file.
+   * \p head is consumed.
+   *
+   * The file is read and copied to the output by default, 64KB at a time,
+   * the transport which can send it by sendfile(2) overrides it, then the
+   * content doesn't enter the user space. The codec passes a record of
+   * file at most in one call, so the default doesn't read a large file at
+   * once.
+   * The write side is shut down if the file can't be read, since the
+   * bytes promised by \p head(e.g. the record header) can't be sent.
+   */
+  virtual void SendFile(kanon::ChunkList &head, FileHandlePtr const &file,
+                        off_t offset, size_t len);
+
+  /** Shutdown the write side after the pending output is sent */
+  virtual void ShutdownWrite() = 0;
+
+  /** Stop delivering the received bytes */
+  virtual void StopRead() = 0;
+  virtual void StartRead() = 0;
+
+  virtual bool IsConnected() const noexcept = 0;
+
+  /**
+   * The bytes accepted by Send() but not written to the socket yet,
+   * called in the loop. The producer can stop at a high-water mark and
+   * continue in the WriteCompleteCallback.
+   */
+  virtual size_t GetOutputSize() const noexcept = 0;
+
+  /**
+   * The bytes received but not consumed.
+   * They are delivered by the message callback when more bytes arrive,
+   * or parsed by the reader explicitly(e.g. after StartRead()).
+   */
+  virtual kanon::Buffer *GetInputBuffer() noexcept = 0;
+
+  void SetMessageCallback(MessageCallback cb)
+  {
+    message_callback_ = std::move(cb);
+  }
+
+  /* Taken over by the codec, see FcgiCodec::WaitWriteComplete() */
+  void SetWriteCompleteCallback(WriteCompleteCallback cb)
+  {
+    write_complete_callback_ = std::move(cb);
+  }
+
+  kanon::EventLoop *GetLoop() const noexcept { return loop_; }
+
+  /**
+   * The output of requests is sent through \p scheduler, set by the codec
+   * before any request is received. The transport is scheduled since
+   * then, the scheduler is reset to nullptr when the codec is destroyed.
+   */
+  void SetOutputScheduler(OutputScheduler *scheduler) noexcept
+  {
+    output_scheduler_ = scheduler;
+    if (scheduler) output_scheduled_ = true;
+  }
+
+  /* Called in the loop */
+  OutputScheduler *GetOutputScheduler() const noexcept
+  {
+    return output_scheduler_;
+  }
+
+  /* Can be called in any thread, the routing must be done in the loop */
+  bool IsOutputScheduled() const noexcept { return output_scheduled_; }
+
+  /* e.g. The codec of the transport */
+  void SetContext(kanon::Any context) { context_ = std::move(context); }
+  kanon::Any &GetContext() noexcept { return context_; }
+
+ protected:
+  /* Called by the backend when the output is drained */
+  void WriteComplete()
+  {
+    if (write_complete_callback_) write_complete_callback_(shared_from_this());
+  }
+
+  kanon::EventLoop *loop_;
+  MessageCallback message_callback_;
+  WriteCompleteCallback write_complete_callback_;
+  kanon::Any context_;
+  OutputScheduler *output_scheduler_ = nullptr;
+  bool output_scheduled_ = false;
+};
+
+} // namespace fcgi
+
+#endif // FCGI_TRANSPORT_H_
@@ -0,0 +1,757 @@
+#include "fcgi_uring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "kanon/log/logger.h"
+#include "kanon/net/channel.h"
+#include "kanon/net/event_loop.h"
+
+using namespace kanon;
+using namespace fcgi;
+
+/*-----------------------*/
+/* Ring                  */
+/*-----------------------*/
+
+/*
+ * The operation is encoded in the low bits of user_data,
+ * the high bits are the pointer of the owner.
+ */
+enum UringOp : uint64_t {
+  OP_ACCEPT = 0,
+  OP_RECV,
+  OP_SEND,
+  OP_CANCEL,
+  OP_MASK = 7,
+};
+
+static inline uint64_t ToUserData(void *owner, UringOp op) noexcept
+{
+  return (uint64_t)(uintptr_t)owner | op;
+}
+
+static inline int SysSetup(unsigned entries, io_uring_params *params)
+{
+  return (int)::syscall(__NR_io_uring_setup, entries, params);
+}
+
+static inline int SysEnter(int fd, unsigned to_submit, unsigned flags)
+{
+  return (int)::syscall(__NR_io_uring_enter, fd, to_submit, 0, flags, nullptr,
+                        0);
+}
+
+static inline int SysRegister(int fd, unsigned opcode, void *arg, unsigned nr)
+{
+  return (int)::syscall(__NR_io_uring_register, fd, opcode, arg, nr);
+}
+
+namespace fcgi {
+
+/**
+ * The minimal wrapper of io_uring by the raw system calls,
+ * liburing isn't required.
+ * Used in the loop thread only.
+ */
+class UringRing : kanon::noncopyable {
+ public:
+  static constexpr uint16_t BUFFER_GROUP = 0;
+
+  UringRing() = default;
+  ~UringRing() noexcept;
+
+  bool Init(unsigned entries);
+  bool SetupBufferRing(unsigned num, unsigned size);
+  bool RegisterEventFd(int fd);
+
+  /** \return nullptr if the submission queue is full even if submitted */
+  io_uring_sqe *GetSqe() noexcept;
+
+  /* Submit the prepared SQEs in one io_uring_enter() */
+  void Submit() noexcept;
+
+  template <typename F>
+  void ForEachCompletion(F f);
+
+  char *GetBuffer(unsigned bid) noexcept
+  {
+    return buffers_.get() + (size_t)bid * buffer_size_;
+  }
+
+  /* Give the buffer selected by recv back to the kernel */
+  void RecycleBuffer(unsigned bid) noexcept
+  {
+    AddBuffer(bid);
+    __atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+  }
+
+ private:
+  void AddBuffer(unsigned bid) noexcept
+  {
+    /* Don't use buf_ring_->bufs, the empty struct in __DECLARE_FLEX_ARRAY
+     * takes 1 byte in C++, which shifts the array by 8 bytes */
+    auto bufs = reinterpret_cast<io_uring_buf *>(buf_ring_);
+    auto &buf = bufs[buf_tail_ & buf_mask_];
+    buf.addr = (uint64_t)(uintptr_t)GetBuffer(bid);
+    buf.len = buffer_size_;
+    buf.bid = bid;
+    ++buf_tail_;
+  }
+
+  bool IsCqOverflow() const noexcept
+  {
+    return __atomic_load_n(sq_flags_, __ATOMIC_ACQUIRE) &
+           IORING_SQ_CQ_OVERFLOW;
+  }
+
+  int fd_ = -1;
+
+  void *ring_ = MAP_FAILED;
+  size_t ring_size_ = 0;
+  io_uring_sqe *sqes_ = (io_uring_sqe *)MAP_FAILED;
+  size_t sqes_size_ = 0;
+
+  unsigned *sq_head_;
+  unsigned *sq_tail_;
+  unsigned *sq_flags_;
+  unsigned *sq_array_;
+  unsigned sq_mask_;
+  unsigned sq_entries_;
+  unsigned sqe_tail_ = 0; /* The SQEs in [*sq_tail_, sqe_tail_) are prepared */
+
+  unsigned *cq_head_;
+  unsigned *cq_tail_;
+  unsigned cq_mask_;
+  io_uring_cqe *cqes_;
+
+  io_uring_buf_ring *buf_ring_ = (io_uring_buf_ring *)MAP_FAILED;
+  size_t buf_ring_size_ = 0;
+  uint16_t buf_tail_ = 0;
+  unsigned buf_mask_ = 0;
+  unsigned buffer_size_ = 0;
+  std::unique_ptr<char[]> buffers_;
+};
+
+} // namespace fcgi
+
+UringRing::~UringRing() noexcept
+{
+  if (buf_ring_ != MAP_FAILED) ::munmap(buf_ring_, buf_ring_size_);
+  if (sqes_ != MAP_FAILED) ::munmap(sqes_, sqes_size_);
+  if (ring_ != MAP_FAILED) ::munmap(ring_, ring_size_);
+  if (fd_ >= 0) ::close(fd_);
+}
+
+bool UringRing::Init(unsigned entries)
+{
+  io_uring_params params;
+  memset(&params, 0, sizeof params);
+
+  fd_ = SysSetup(entries, &params);
+  if (fd_ < 0) {
+    LOG_SYSERROR << "Failed to setup io_uring";
+    return false;
+  }
+
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP) ||
+      !(params.features & IORING_FEAT_NODROP))
+  {
+    LOG_ERROR << "The io_uring of kernel is too old";
+    return false;
+  }
+
+  /* The SQ and CQ ring share one mapping */
+  ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  size_t cq_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  if (cq_size > ring_size_) ring_size_ = cq_size;
+
+  ring_ = ::mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+  if (ring_ == MAP_FAILED) {
+    LOG_SYSERROR << "Failed to map the ring of io_uring";
+    return false;
+  }
+
+  sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  sqes_ = (io_uring_sqe *)::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, fd_,
+                                 IORING_OFF_SQES);
+  if (sqes_ == MAP_FAILED) {
+    LOG_SYSERROR << "Failed to map the SQEs of io_uring";
+    return false;
+  }
+
+  auto ring = (char *)ring_;
+  sq_head_ = (unsigned *)(ring + params.sq_off.head);
+  sq_tail_ = (unsigned *)(ring + params.sq_off.tail);
+  sq_flags_ = (unsigned *)(ring + params.sq_off.flags);
+  sq_array_ = (unsigned *)(ring + params.sq_off.array);
+  sq_mask_ = *(unsigned *)(ring + params.sq_off.ring_mask);
+  sq_entries_ = params.sq_entries;
+  sqe_tail_ = *sq_tail_;
+
+  cq_head_ = (unsigned *)(ring + params.cq_off.head);
+  cq_tail_ = (unsigned *)(ring + params.cq_off.tail);
+  cq_mask_ = *(unsigned *)(ring + params.cq_off.ring_mask);
+  cqes_ = (io_uring_cqe *)(ring + params.cq_off.cqes);
+  return true;
+}
+
+bool UringRing::SetupBufferRing(unsigned num, unsigned size)
+{
+  if (num == 0 || (num & (num - 1)) != 0 || num > 32768) {
+    LOG_ERROR << "The number of buffers must be power of 2 and <= 32768";
+    return false;
+  }
+
+  buf_ring_size_ = num * sizeof(io_uring_buf);
+  buf_ring_ = (io_uring_buf_ring *)::mmap(nullptr, buf_ring_size_,
+                                          PROT_READ | PROT_WRITE,
+                                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buf_ring_ == MAP_FAILED) {
+    LOG_SYSERROR << "Failed to map the buffer ring";
+    return false;
+  }
+
+  io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof reg);
+  reg.ring_addr = (uint64_t)(uintptr_t)buf_ring_;
+  reg.ring_entries = num;
+  reg.bgid = BUFFER_GROUP;
+  if (SysRegister(fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    LOG_SYSERROR << "Failed to register the buffer ring";
+    return false;
+  }
+
+  buffers_.reset(new char[(size_t)num * size]);
+  buffer_size_ = size;
+  buf_mask_ = num - 1;
+  for (unsigned i = 0; i < num; ++i) {
+    AddBuffer(i);
+  }
+  __atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+  return true;
+}
+
+bool UringRing::RegisterEventFd(int fd)
+{
+  if (SysRegister(fd_, IORING_REGISTER_EVENTFD, &fd, 1) < 0) {
+    LOG_SYSERROR << "Failed to register the eventfd to io_uring";
+    return false;
+  }
+  return true;
+}
+
+io_uring_sqe *UringRing::GetSqe() noexcept
+{
+  unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  if (sqe_tail_ - head >= sq_entries_) {
+    /* Submit them to make room */
+    Submit();
+    head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if (sqe_tail_ - head >= sq_entries_) return nullptr;
+  }
+
+  unsigned index = sqe_tail_ & sq_mask_;
+  sq_array_[index] = index;
+  auto sqe = &sqes_[index];
+  memset(sqe, 0, sizeof *sqe);
+  ++sqe_tail_;
+  return sqe;
+}
+
+void UringRing::Submit() noexcept
+{
+  /* The SQEs not consumed by the kernel, including the ones left by the
+   * last short submit */
+  unsigned to_submit = sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  if (to_submit == 0) return;
+
+  __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+
+  int ret;
+  do {
+    ret = SysEnter(fd_, to_submit, 0);
+  } while (ret < 0 && errno == EINTR);
+
+  if (ret < 0) LOG_SYSERROR << "Failed to submit to io_uring";
+}
+
+template <typename F>
+void UringRing::ForEachCompletion(F f)
+{
+  for (;;) {
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+
+    if (head == tail) {
+      if (!IsCqOverflow()) break;
+      /* Flush the completions overflowed to the CQ */
+      SysEnter(fd_, 0, IORING_ENTER_GETEVENTS);
+      continue;
+    }
+
+    for (; head != tail; ++head) {
+      /* Give the entry back before handling, the callback may
+       * submit and complete more */
+      io_uring_cqe cqe = cqes_[head & cq_mask_];
+      __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+      f(cqe);
+    }
+  }
+}
+
+/*-----------------------*/
+/* Transport             */
+/*-----------------------*/
+
+UringTransport::UringTransport(EventLoop *loop, UringServer *server, int fd)
+  : Transport(loop)
+  , server_(server)
+  , fd_(fd)
+  , connected_(true)
+{
+  memset(&msg_, 0, sizeof msg_);
+  msg_.msg_iov = iov_;
+}
+
+UringTransport::~UringTransport() noexcept
+{
+  if (fd_ >= 0) ::close(fd_);
+}
+
+void UringTransport::Send(void const *data, size_t len)
+{
+  if (loop_->IsLoopInThread()) {
+    if (!IsConnected()) return;
+    output_.Append(data, len);
+    StartSend();
+    return;
+  }
+
+  auto output = std::make_shared<ChunkList>();
+  output->Append(data, len);
+  auto self = std::static_pointer_cast<UringTransport>(shared_from_this());
+  loop_->QueueToLoop([self, output]() { self->SendInLoop(*output); });
+}
+
+void UringTransport::Send(ChunkList &output)
+{
+  if (loop_->IsLoopInThread()) {
+    SendInLoop(output);
+    return;
+  }
+
+  auto moved = std::make_shared<ChunkList>(std::move(output));
+  auto self = std::static_pointer_cast<UringTransport>(shared_from_this());
+  loop_->QueueToLoop([self, moved]() { self->SendInLoop(*moved); });
+}
+
+void UringTransport::SendInLoop(ChunkList &output)
+{
+  if (!IsConnected()) {
+    output.AdvanceAll();
+    return;
+  }
+
+  if (output_.IsEmpty()) {
+    output_.swap(output);
+  } else {
+    /* The chunks in output_ may be referenced by the send in flight */
+    for (auto const &chunk : output) {
+      output_.Append(chunk.GetReadBegin(), chunk.GetReadableSize());
+    }
+    output.AdvanceAll();
+  }
+
+  StartSend();
+}
+
+void UringTransport::ShutdownWrite()
+{
+  if (!loop_->IsLoopInThread()) {
+    auto self = std::static_pointer_cast<UringTransport>(shared_from_this());
+    loop_->QueueToLoop([self]() { self->ShutdownWrite(); });
+    return;
+  }
+
+  if (closed_) return;
+  shutdown_pending_ = true;
+  if (!sending_ && output_.IsEmpty()) ::shutdown(fd_, SHUT_WR);
+}
+
+void UringTransport::StopRead()
+{
+  reading_ = false;
+  CancelRecv();
+}
+
+void UringTransport::StartRead()
+{
+  reading_ = true;
+  if (!recv_armed_ && !closed_) ArmRecv();
+}
+
+void UringTransport::ArmRecv()
+{
+  auto sqe = server_->ring_->GetSqe();
+  if (!sqe) {
+    LOG_ERROR << "The submission queue of io_uring is full";
+    CloseLater();
+    return;
+  }
+
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd_;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = UringRing::BUFFER_GROUP;
+  sqe->user_data = ToUserData(this, OP_RECV);
+
+  recv_armed_ = true;
+  ++inflight_;
+  server_->RequestSubmit();
+}
+
+void UringTransport::CancelRecv()
+{
+  if (!recv_armed_ || !server_) return;
+
+  auto sqe = server_->ring_->GetSqe();
+  if (!sqe) return;
+
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = ToUserData(this, OP_RECV);
+  sqe->user_data = ToUserData(this, OP_CANCEL);
+
+  ++inflight_;
+  server_->RequestSubmit();
+}
+
+void UringTransport::StartSend()
+{
+  if (sending_ || closed_ || output_.IsEmpty()) return;
+
+  int n = 0;
+  for (auto const &chunk : output_) {
+    if (n == MAX_IOV_NUM) break;
+    if (chunk.GetReadableSize() == 0) continue;
+    iov_[n].iov_base = const_cast<char *>(chunk.GetReadBegin());
+    iov_[n].iov_len = chunk.GetReadableSize();
+    ++n;
+  }
+  msg_.msg_iovlen = n;
+
+  auto sqe = server_->ring_->GetSqe();
+  if (!sqe) {
+    LOG_ERROR << "The submission queue of io_uring is full";
+    CloseLater();
+    return;
+  }
+
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = fd_;
+  sqe->addr = (uint64_t)(uintptr_t)&msg_;
+  sqe->len = 1;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = ToUserData(this, OP_SEND);
+
+  sending_ = true;
+  ++inflight_;
+  server_->RequestSubmit();
+}
+
+void UringTransport::OnRecv(int res, unsigned flags, TimeStamp receive_time)
+{
+  if (!(flags & IORING_CQE_F_MORE)) {
+    recv_armed_ = false;
+    --inflight_;
+  }
+
+  if (res > 0) {
+    auto &ring = *server_->ring_;
+    unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+    char const *data = ring.GetBuffer(bid);
+    size_t len = res;
+
+    if (!reading_ || !message_callback_) {
+      input_.Append(data, len);
+    } else if (input_.GetReadableSize() == 0) {
+      /* Parse the provided buffer in place,
+       * only the partial record is copied */
+      auto consumed = message_callback_(shared_from_this(), data, len,
+                                        receive_time);
+      if (consumed < len) input_.Append(data + consumed, len - consumed);
+    } else {
+      input_.Append(data, len);
+      input_.AdvanceRead(message_callback_(shared_from_this(),
+                                           input_.GetReadBegin(),
+                                           input_.GetReadableSize(),
+                                           receive_time));
+    }
+
+    ring.RecycleBuffer(bid);
+  } else if (res == 0 || (res != -ENOBUFS && res != -ECANCELED)) {
+    /* Peer closed or error */
+    if (res < 0 && !closed_) {
+      errno = -res;
+      LOG_SYSERROR << "Failed to receive from fd " << fd_;
+    }
+    HandleClose();
+  }
+
+  if (reading_ && !recv_armed_ && !closed_) ArmRecv();
+  TryDestroy();
+}
+
+void UringTransport::OnSend(int res)
+{
+  sending_ = false;
+  --inflight_;
+
+  if (res < 0) {
+    if (!closed_) {
+      errno = -res;
+      LOG_SYSERROR << "Failed to send to fd " << fd_;
+      HandleClose();
+    }
+    output_.AdvanceAll();
+  } else {
+    output_.AdvanceRead(res);
+    if (!output_.IsEmpty()) {
+      StartSend();
+    } else if (!closed_) {
+      if (shutdown_pending_) ::shutdown(fd_, SHUT_WR);
+      WriteComplete();
+    }
+  }
+
+  TryDestroy();
+}
+
+void UringTransport::OnCancel()
+{
+  --inflight_;
+  TryDestroy();
+}
+
+void UringTransport::HandleClose()
+{
+  if (closed_) return;
+
+  closed_ = true;
+  connected_.store(false, std::memory_order_release);
+
+  /* Complete the operations in flight, e.g. the multishot recv */
+  ::shutdown(fd_, SHUT_RDWR);
+  CancelRecv();
+
+  auto &cb = server_->connection_callback_;
+  if (cb) cb(shared_from_this());
+}
+
+void UringTransport::CloseLater()
+{
+  auto self = std::static_pointer_cast<UringTransport>(shared_from_this());
+  loop_->QueueToLoop([self]() {
+    self->HandleClose();
+    self->TryDestroy();
+  });
+}
+
+void UringTransport::TryDestroy()
+{
+  if (closed_ && inflight_ == 0 && server_) server_->RemoveTransport(this);
+}
+
+/*-----------------------*/
+/* Server                */
+/*-----------------------*/
+
+UringServer::UringServer(EventLoop *loop, ListenAddr const &addr,
+                         std::string name, UringOptions const &options)
+  : loop_(loop)
+  , addr_(addr)
+  , name_(std::move(name))
+  , options_(options)
+{
+}
+
+UringServer::~UringServer() noexcept
+{
+  /* The operations in flight are cancelled when the ring is closed */
+  for (auto &kv : transports_) {
+    auto &transport = *kv.second;
+    transport.server_ = nullptr;
+    transport.closed_ = true;
+    transport.connected_.store(false, std::memory_order_release);
+  }
+
+  if (event_channel_) {
+    event_channel_->DisableAll();
+    event_channel_->Remove();
+  }
+
+  if (event_fd_ >= 0) ::close(event_fd_);
+  if (listen_fd_ >= 0) {
+    ::close(listen_fd_);
+    addr_.Unlink();
+  }
+}
+
+bool UringServer::StartRun()
+{
+  ring_.reset(new UringRing);
+  if (!ring_->Init(options_.entries) ||
+      !ring_->SetupBufferRing(options_.buffer_num, options_.buffer_size))
+  {
+    return false;
+  }
+
+  event_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (event_fd_ < 0) {
+    LOG_SYSERROR << "Failed to create the eventfd";
+    return false;
+  }
+
+  if (!ring_->RegisterEventFd(event_fd_)) return false;
+
+  listen_fd_ = addr_.Listen(reuseport_);
+  if (listen_fd_ < 0) return false;
+
+  /* The ring polls the listening socket, a non-blocking one fails the
+   * accept with EAGAIN on some kernels */
+  ::fcntl(listen_fd_, F_SETFL, ::fcntl(listen_fd_, F_GETFL) & ~O_NONBLOCK);
+
+  event_channel_.reset(new Channel(loop_, event_fd_));
+  event_channel_->SetReadCallback([this](TimeStamp receive_time) {
+    OnCompletion(receive_time);
+  });
+  event_channel_->EnableReading();
+
+  ArmAccept();
+  ring_->Submit();
+
+  LOG_INFO << "UringServer " << name_ << " is listening on "
+           << addr_.ToString();
+  return true;
+}
+
+void UringServer::ArmAccept()
+{
+  auto sqe = ring_->GetSqe();
+  if (!sqe) {
+    LOG_ERROR << "The submission queue of io_uring is full";
+    return;
+  }
+
+  /* The accepted socket is blocking, the io_uring polls it internally */
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = listen_fd_;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_CLOEXEC;
+  sqe->user_data = ToUserData(this, OP_ACCEPT);
+}
+
+void UringServer::OnAccept(int res, unsigned flags)
+{
+  if (res >= 0) {
+    if (!addr_.IsUnix()) {
+      int on = 1;
+      ::setsockopt(res, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+    }
+
+    auto transport = std::make_shared<UringTransport>(loop_, this, res);
+    transports_.emplace(transport.get(), transport);
+    if (connection_callback_) connection_callback_(transport);
+    transport->ArmRecv();
+  } else {
+    errno = -res;
+    LOG_SYSERROR << "Failed to accept";
+  }
+
+  if (!(flags & IORING_CQE_F_MORE)) {
+    if (res >= 0) {
+      ArmAccept();
+    } else {
+      /* e.g. EMFILE, don't retry immediately */
+      loop_->RunAfter(
+          [this]() {
+            ArmAccept();
+            ring_->Submit();
+          },
+          0.1);
+    }
+  }
+}
+
+void UringServer::OnCompletion(TimeStamp receive_time)
+{
+  uint64_t n;
+  if (::read(event_fd_, &n, sizeof n) < 0 && errno != EAGAIN) {
+    LOG_SYSERROR << "Failed to read the eventfd";
+  }
+
+  processing_ = true;
+  ring_->ForEachCompletion([this, receive_time](io_uring_cqe const &cqe) {
+    auto owner = (void *)(uintptr_t)(cqe.user_data & ~(uint64_t)OP_MASK);
+    auto transport = static_cast<UringTransport *>(owner);
+
+    switch (cqe.user_data & OP_MASK) {
+      case OP_ACCEPT:
+        OnAccept(cqe.res, cqe.flags);
+        break;
+      case OP_RECV:
+        transport->OnRecv(cqe.res, cqe.flags, receive_time);
+        break;
+      case OP_SEND:
+        transport->OnSend(cqe.res);
+        break;
+      case OP_CANCEL:
+        transport->OnCancel();
+        break;
+    }
+  });
+  processing_ = false;
+
+  /* The transports removed in this round are kept alive until now,
+   * since they are removed in their own callbacks */
+  closed_transports_.clear();
+
+  /* Submit the SQEs prepared by the callbacks, e.g. the responses,
+   * in one system call */
+  ring_->Submit();
+}
+
+void UringServer::RequestSubmit()
+{
+  if (processing_ || submit_queued_) return;
+
+  /* e.g. Sending in the functor posted by worker, the functors of this
+   * iteration are submitted together */
+  submit_queued_ = true;
+  loop_->QueueToLoop([this]() {
+    submit_queued_ = false;
+    ring_->Submit();
+  });
+}
+
+void UringServer::RemoveTransport(UringTransport *transport)
+{
+  auto iter = transports_.find(transport);
+  if (iter == transports_.end()) return;
+
+  closed_transports_.emplace_back(std::move(iter->second));
+  transports_.erase(iter);
+}
@@ -0,0 +1,183 @@
+#ifndef FCGI_URING_H_
+#define FCGI_URING_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unordered_map>
+#include <vector>
+
+#include "fcgi_listen_addr.h"
+#include "fcgi_transport.h"
+
+namespace kanon {
+
+class Channel;
+
+} // namespace kanon
+
+namespace fcgi {
+
+class UringRing;
+class UringServer;
+
+/**
+ * The transport over io_uring.
+ *
+ * The input is received by a multishot recv, the kernel picks the
+ * buffer from the buffer ring provided by the server. If nothing is left
+ * from the previous input, the codec parses the provided buffer in place,
+ * only the partial record is copied to the input buffer.
+ *
+ * The output is gathered to one SENDMSG of all pending chunks, at most
+ * one send is in flight per connection, the output appended meanwhile is
+ * sent in the next one. The SQEs prepared in a loop iteration are
+ * submitted together.
+ *
+ * Created by UringServer only.
+ */
+class UringTransport : public Transport {
+  friend class UringServer;
+
+ public:
+  UringTransport(kanon::EventLoop *loop, UringServer *server, int fd);
+  ~UringTransport() noexcept override;
+
+  void Send(void const *data, size_t len) override;
+  void Send(kanon::ChunkList &output) override;
+  void ShutdownWrite() override;
+  void StopRead() override;
+  void StartRead() override;
+
+  bool IsConnected() const noexcept override
+  {
+    return connected_.load(std::memory_order_acquire);
+  }
+
+  size_t GetOutputSize() const noexcept override
+  {
+    return output_.GetReadableSize();
+  }
+
+  kanon::Buffer *GetInputBuffer() noexcept override { return &input_; }
+
+  int GetFd() const noexcept { return fd_; }
+
+ private:
+  void SendInLoop(kanon::ChunkList &output);
+  void ArmRecv();
+  void CancelRecv();
+  void StartSend();
+  void OnRecv(int res, unsigned flags, kanon::TimeStamp receive_time);
+  void OnSend(int res);
+  void OnCancel();
+  void HandleClose();
+
+  /* Close in next iteration, the submission may be requested by the
+   * handler which is called by the codec parsing the input */
+  void CloseLater();
+  void TryDestroy();
+
+  static constexpr int MAX_IOV_NUM = 64;
+
+  UringServer *server_; /* nullptr if the server is destroyed */
+  int fd_;
+  std::atomic<bool> connected_;
+  bool reading_ = true;
+  bool recv_armed_ = false;
+  bool sending_ = false;
+  bool shutdown_pending_ = false;
+  bool closed_ = false;
+  int inflight_ = 0; /* The operations submitted but not completed */
+
+  kanon::Buffer input_;
+  kanon::ChunkList output_;
+
+  /* Referenced by the kernel until the send is completed */
+  struct iovec iov_[MAX_IOV_NUM];
+  struct msghdr msg_;
+};
+
+struct UringOptions {
+  unsigned entries = 4096;           /* The entries of submission queue */
+  unsigned buffer_num = 1024;        /* Must be power of 2 */
+  unsigned buffer_size = 16 * 1024;  /* The size of each provided buffer */
+};
+
+/**
+ * Accept the connections by multishot accept on the io_uring of the loop,
+ * and drive the UringTransport of them.
+ *
+ * The completions are notified by the eventfd registered to the ring,
+ * which is watched by the loop, so the server runs in kanon::EventLoop
+ * with the timers and the functors posted by the workers.
+ *
+ * A server is bound to one loop. To run in multiple loops, create a server
+ * with SO_REUSEPORT in each loop, every server has its own ring and
+ * accept queue. Requires Linux 6.0 at least(multishot recv and buffer
+ * ring), StartRun() fails otherwise and the caller can fall back to
+ * SocketServer or kanon::TcpServer with TcpTransport.
+ */
+class UringServer : kanon::noncopyable {
+  friend class UringTransport;
+
+ public:
+  /** Called with the transport connected and disconnected */
+  using ConnectionCallback = std::function<void(TransportPtr const &)>;
+
+  UringServer(kanon::EventLoop *loop, ListenAddr const &addr,
+              std::string name, UringOptions const &options = UringOptions());
+
+  /** The transports held by handler can't send after the server is
+   * destroyed */
+  ~UringServer() noexcept;
+
+  void SetConnectionCallback(ConnectionCallback cb)
+  {
+    connection_callback_ = std::move(cb);
+  }
+
+  /** Only for TCP, see SocketServer */
+  void SetReusePort(bool on) noexcept { reuseport_ = on; }
+
+  /** \return false if io_uring is unavailable or failed to listen */
+  bool StartRun();
+
+  kanon::EventLoop *GetLoop() const noexcept { return loop_; }
+  std::string const &GetName() const noexcept { return name_; }
+
+ private:
+  void ArmAccept();
+  void OnAccept(int res, unsigned flags);
+  void OnCompletion(kanon::TimeStamp receive_time);
+
+  /* Submit the prepared SQEs in the next loop iteration */
+  void RequestSubmit();
+
+  void RemoveTransport(UringTransport *transport);
+
+  kanon::EventLoop *loop_;
+  ListenAddr addr_;
+  std::string name_;
+  UringOptions options_;
+  bool reuseport_ = false;
+  int listen_fd_ = -1;
+  int event_fd_ = -1;
+  bool processing_ = false;
+  bool submit_queued_ = false;
+  std::unique_ptr<UringRing> ring_;
+  std::unique_ptr<kanon::Channel> event_channel_;
+  ConnectionCallback connection_callback_;
+
+  /* The server owns the transports until they are closed and all
+   * operations of them are completed */
+  std::unordered_map<UringTransport *, std::shared_ptr<UringTransport>>
+      transports_;
+  std::vector<std::shared_ptr<UringTransport>> closed_transports_;
+};
+
+} // namespace fcgi
+
+#endif // FCGI_URING_H_
@@ -0,0 +1,81 @@
+#include "fcgi_worker_pool.h"
+
+#include "kanon/log/logger.h"
+
+using namespace fcgi;
+
+WorkerPool::WorkerPool(int thread_num, size_t max_queue_size)
+  : thread_num_(thread_num)
+  , max_queue_size_(max_queue_size)
+{
+  assert(thread_num > 0);
+}
+
+WorkerPool::~WorkerPool() noexcept { StopRun(); }
+
+void WorkerPool::StartRun()
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (running_) return;
+
+  running_ = true;
+  threads_.reserve(thread_num_);
+  for (int i = 0; i < thread_num_; ++i) {
+    threads_.emplace_back(&WorkerPool::RunInThread, this);
+  }
+}
+
+void WorkerPool::StopRun()
+{
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (!running_) return;
+    running_ = false;
+  }
+
+  /* The pending tasks are run before the workers exit, the requests they
+   * hold must be released to keep the accounting of codec */
+  not_empty_.notify_all();
+  for (auto &thread : threads_) {
+    thread.join();
+  }
+  threads_.clear();
+}
+
+bool WorkerPool::TryPush(Task task)
+{
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (!running_) return false;
+    if (max_queue_size_ != 0 && tasks_.size() >= max_queue_size_) {
+      return false;
+    }
+    tasks_.emplace_back(std::move(task));
+  }
+
+  not_empty_.notify_one();
+  return true;
+}
+
+size_t WorkerPool::GetQueueSize() const
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  return tasks_.size();
+}
+
+void WorkerPool::RunInThread()
+{
+  for (;;) {
+    Task task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      not_empty_.wait(lock, [this]() { return !running_ || !tasks_.empty(); });
+      if (tasks_.empty()) return;
+
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+
+    task();
+  }
+}
@@ -0,0 +1,70 @@
+#ifndef FCGI_WORKER_POOL_H_
+#define FCGI_WORKER_POOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "kanon/util/noncopyable.h"
+
+namespace fcgi {
+
+/**
+ * Bounded thread pool running the request handlers.
+ *
+ * The handler runs in IO loop by default, a slow handler stalls all
+ * connections of the loop. The codec that is set a WorkerPool moves
+ * the complete request to the pool instead.
+ *
+ * Unlike the blocking push of general thread pool, TryPush() fails
+ * immediately if the queue is full, so the IO loop is never blocked
+ * and the request can be rejected with FCGI_OVERLOADED.
+ */
+class WorkerPool : kanon::noncopyable {
+ public:
+  using Task = std::function<void()>;
+
+  /**
+   * \param max_queue_size 0 indicates unlimited
+   */
+  WorkerPool(int thread_num, size_t max_queue_size);
+
+  /** Stop and join the workers, see StopRun() */
+  ~WorkerPool() noexcept;
+
+  void StartRun();
+
+  /**
+   * Reject the new tasks, then join the workers after they run the
+   * pending tasks. The pending tasks hold the dispatched requests which
+   * must be released, so they aren't discarded.
+   */
+  void StopRun();
+
+  /**
+   * \return false if the queue is full or the pool is stopped
+   */
+  bool TryPush(Task task);
+
+  size_t GetQueueSize() const;
+  int GetThreadNum() const noexcept { return thread_num_; }
+
+ private:
+  void RunInThread();
+
+  int thread_num_;
+  size_t max_queue_size_;
+  bool running_ = false;
+
+  mutable std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::deque<Task> tasks_;
+  std::vector<std::thread> threads_;
+};
+
+} // namespace fcgi
+
+#endif // FCGI_WORKER_POOL_H_
@@ -0,0 +1,198 @@
+#include "fcgi/fcgi_admission.h"
+
+#include <future>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+using namespace fcgi;
+
+/* The limits are process wide, restore them for other tests */
+class AdmissionTest : public ::testing::Test {
+ protected:
+  AdmissionTest()
+    : loop_num_(AdmissionControl::GetLoopRequestNum())
+    , num_(AdmissionControl::GetRequestNum())
+    , loop_bytes_(AdmissionControl::GetLoopBufferedBytes())
+    , bytes_(AdmissionControl::GetBufferedBytes())
+  {
+  }
+
+  ~AdmissionTest() noexcept override
+  {
+    AdmissionControl::SetLimits(FcgiLimits());
+  }
+
+  /* The counters are left as they are found */
+  void TearDown() override
+  {
+    EXPECT_EQ(AdmissionControl::GetLoopRequestNum(), loop_num_);
+    EXPECT_EQ(AdmissionControl::GetRequestNum(), num_);
+    EXPECT_EQ(AdmissionControl::GetLoopBufferedBytes(), loop_bytes_);
+    EXPECT_EQ(AdmissionControl::GetBufferedBytes(), bytes_);
+  }
+
+  /*
+   * Run \p f in another thread(i.e. another loop), which holds its
+   * admission until the returned promise is set
+   */
+  template <typename F>
+  std::thread RunInOtherLoop(F f, std::promise<void> &done,
+                             std::promise<void> &release)
+  {
+    return std::thread([f, &done, &release]() {
+      auto undo = f();
+      done.set_value();
+      release.get_future().wait();
+      undo();
+    });
+  }
+
+  size_t loop_num_;
+  size_t num_;
+  size_t loop_bytes_;
+  size_t bytes_;
+};
+
+TEST_F(AdmissionTest, Unlimited)
+{
+  for (int i = 0; i < 100; ++i) {
+    ASSERT_TRUE(AdmissionControl::Admit());
+  }
+  EXPECT_EQ(AdmissionControl::GetLoopRequestNum(), loop_num_ + 100);
+  EXPECT_EQ(AdmissionControl::GetRequestNum(), num_ + 100);
+  EXPECT_TRUE(AdmissionControl::TryAddBuffered(1024 * 1024));
+  EXPECT_EQ(AdmissionControl::GetBufferedBytes(), bytes_ + 1024 * 1024);
+
+  AdmissionControl::RemoveBuffered(1024 * 1024);
+  for (int i = 0; i < 100; ++i) {
+    AdmissionControl::Leave();
+  }
+}
+
+TEST_F(AdmissionTest, LoopRequests)
+{
+  FcgiLimits limits;
+  limits.max_loop_requests = loop_num_ + 2;
+  AdmissionControl::SetLimits(limits);
+
+  EXPECT_TRUE(AdmissionControl::Admit());
+  EXPECT_TRUE(AdmissionControl::Admit());
+  EXPECT_FALSE(AdmissionControl::Admit());
+
+  /* The rejected one isn't counted */
+  EXPECT_EQ(AdmissionControl::GetLoopRequestNum(), loop_num_ + 2);
+  EXPECT_EQ(AdmissionControl::GetRequestNum(), num_ + 2);
+
+  AdmissionControl::Leave();
+  EXPECT_TRUE(AdmissionControl::Admit());
+
+  /* Other loops have their own quota */
+  std::promise<void> done, release;
+  bool admitted = false;
+  auto other = RunInOtherLoop(
+      [&admitted]() {
+        admitted = AdmissionControl::Admit();
+        return []() { AdmissionControl::Leave(); };
+      },
+      done, release);
+  done.get_future().wait();
+  EXPECT_TRUE(admitted);
+  EXPECT_EQ(AdmissionControl::GetRequestNum(), num_ + 3);
+  release.set_value();
+  other.join();
+
+  AdmissionControl::Leave();
+  AdmissionControl::Leave();
+}
+
+TEST_F(AdmissionTest, GlobalRequests)
+{
+  FcgiLimits limits;
+  limits.max_requests = num_ + 2;
+  AdmissionControl::SetLimits(limits);
+
+  ASSERT_TRUE(AdmissionControl::Admit());
+
+  std::promise<void> done, release;
+  bool admitted = false;
+  auto other = RunInOtherLoop(
+      [&admitted]() {
+        admitted = AdmissionControl::Admit();
+        return []() { AdmissionControl::Leave(); };
+      },
+      done, release);
+  done.get_future().wait();
+  EXPECT_TRUE(admitted);
+
+  /* The quota is shared by the loops */
+  EXPECT_FALSE(AdmissionControl::Admit());
+  EXPECT_EQ(AdmissionControl::GetLoopRequestNum(), loop_num_ + 1);
+  EXPECT_EQ(AdmissionControl::GetRequestNum(), num_ + 2);
+
+  release.set_value();
+  other.join();
+  EXPECT_TRUE(AdmissionControl::Admit());
+
+  AdmissionControl::Leave();
+  AdmissionControl::Leave();
+}
+
+TEST_F(AdmissionTest, LoopBuffered)
+{
+  FcgiLimits limits;
+  limits.max_loop_buffered_bytes = loop_bytes_ + 100;
+  AdmissionControl::SetLimits(limits);
+
+  EXPECT_TRUE(AdmissionControl::TryAddBuffered(60));
+  EXPECT_FALSE(AdmissionControl::TryAddBuffered(50));
+  EXPECT_EQ(AdmissionControl::GetLoopBufferedBytes(), loop_bytes_ + 60);
+  EXPECT_EQ(AdmissionControl::GetBufferedBytes(), bytes_ + 60);
+
+  /* Up to the budget exactly */
+  EXPECT_TRUE(AdmissionControl::TryAddBuffered(40));
+
+  /* No new request once the budget is used up */
+  EXPECT_FALSE(AdmissionControl::Admit());
+
+  /* The unconditional one may exceed the budget */
+  AdmissionControl::AddBuffered(10);
+  EXPECT_EQ(AdmissionControl::GetLoopBufferedBytes(), loop_bytes_ + 110);
+
+  AdmissionControl::RemoveBuffered(110);
+  EXPECT_TRUE(AdmissionControl::Admit());
+  AdmissionControl::Leave();
+}
+
+TEST_F(AdmissionTest, GlobalBuffered)
+{
+  FcgiLimits limits;
+  limits.max_buffered_bytes = bytes_ + 100;
+  AdmissionControl::SetLimits(limits);
+
+  std::promise<void> done, release;
+  bool added = false;
+  auto other = RunInOtherLoop(
+      [&added]() {
+        added = AdmissionControl::TryAddBuffered(70);
+        return []() { AdmissionControl::RemoveBuffered(70); };
+      },
+      done, release);
+  done.get_future().wait();
+  ASSERT_TRUE(added);
+
+  /* The bytes of other loops count */
+  EXPECT_EQ(AdmissionControl::GetLoopBufferedBytes(), loop_bytes_);
+  EXPECT_FALSE(AdmissionControl::TryAddBuffered(40));
+  EXPECT_EQ(AdmissionControl::GetBufferedBytes(), bytes_ + 70);
+  EXPECT_TRUE(AdmissionControl::TryAddBuffered(30));
+  EXPECT_FALSE(AdmissionControl::Admit());
+
+  release.set_value();
+  other.join();
+  EXPECT_TRUE(AdmissionControl::TryAddBuffered(40));
+  EXPECT_TRUE(AdmissionControl::Admit());
+
+  AdmissionControl::Leave();
+  AdmissionControl::RemoveBuffered(70);
+}
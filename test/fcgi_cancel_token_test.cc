@@ -0,0 +1,251 @@
+#include "fcgi/fcgi_cancel_token.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "fcgi/fcgi_admission.h"
+#include "fcgi/fcgi_codec.h"
+#include "fcgi/fcgi_response_writer.h"
+
+#include "fcgi_test_util.h"
+
+using namespace fcgi;
+using namespace kanon;
+
+static int CountEndRequest(std::vector<Record> const &records, uint16_t id)
+{
+  int num = 0;
+  for (auto const &record : records) {
+    if (record.id == id && record.type == FCGI_END_REQUEST) ++num;
+  }
+  return num;
+}
+
+/* The handler holds the requests, the test ends them */
+class CancelTokenTest : public ::testing::Test {
+ protected:
+  CancelTokenTest()
+    : conn_(std::make_shared<TestTransport>(&loop_))
+    , codec_(conn_)
+    , num_(AdmissionControl::GetLoopRequestNum())
+  {
+    codec_.SetRequestHandler(
+        [this](TransportPtr const &, FcgiRequest request) {
+          held_.emplace_back(new FcgiRequest(std::move(request)));
+        });
+  }
+
+  ~CancelTokenTest() noexcept override
+  {
+    held_.clear();
+    EXPECT_EQ(AdmissionControl::GetLoopRequestNum(), num_);
+  }
+
+  void Feed(std::string const &input)
+  {
+    auto buffer = conn_->GetInputBuffer();
+    buffer->Append(input.data(), input.size());
+    codec_.OnMessage(conn_, *buffer);
+  }
+
+  EventLoop loop_;
+  std::shared_ptr<TestTransport> conn_;
+  FcgiCodec codec_;
+  size_t num_;
+  std::vector<std::unique_ptr<FcgiRequest>> held_;
+};
+
+TEST_F(CancelTokenTest, AbortBeforeEnd)
+{
+  Feed(MakeRequest(1, {{"REQUEST_URI", "/"}}, ""));
+  ASSERT_EQ(held_.size(), 1u);
+  auto &request = *held_[0];
+  auto token = request.GetCancelToken();
+  ASSERT_TRUE(token);
+  EXPECT_FALSE(request.IsAborted());
+
+  int cancelled = 0;
+  token->OnCancel([&cancelled]() { ++cancelled; });
+  EXPECT_EQ(cancelled, 0);
+
+  /* The codec ends the request and notifies the handler */
+  Feed(AbortRequest(1));
+  EXPECT_TRUE(token->IsCancelled());
+  EXPECT_TRUE(request.IsAborted());
+  EXPECT_EQ(cancelled, 1);
+  EXPECT_EQ(CountEndRequest(ParseRecords(conn_->output_), 1), 1);
+
+  /* Called immediately once aborted */
+  token->OnCancel([&cancelled]() { ++cancelled; });
+  EXPECT_EQ(cancelled, 2);
+
+  /* The output and the END_REQUEST of handler are dropped */
+  auto size = conn_->output_.size();
+  {
+    ResponseWriter writer(conn_, request);
+    EXPECT_TRUE(writer.IsAborted());
+    writer.WriteStdout("late");
+    writer.EndRequest();
+  }
+  FcgiCodec::EndRequest(conn_, request);
+  EXPECT_EQ(conn_->output_.size(), size);
+
+  /* Aborted again, nothing happens */
+  Feed(AbortRequest(1));
+  EXPECT_EQ(conn_->output_.size(), size);
+  EXPECT_EQ(cancelled, 2);
+}
+
+TEST_F(CancelTokenTest, EndBeforeAbort)
+{
+  Feed(MakeRequest(1, {{"REQUEST_URI", "/"}}, ""));
+  ASSERT_EQ(held_.size(), 1u);
+  auto &request = *held_[0];
+  auto token = request.GetCancelToken();
+
+  int cancelled = 0;
+  token->OnCancel([&cancelled]() { ++cancelled; });
+
+  {
+    ResponseWriter writer(conn_, request);
+    writer.WriteStdout("done");
+    writer.EndRequest();
+  }
+
+  /* The request is ended but not released yet */
+  auto size = conn_->output_.size();
+  Feed(AbortRequest(1));
+  EXPECT_FALSE(token->IsCancelled());
+  EXPECT_EQ(cancelled, 0);
+  EXPECT_EQ(conn_->output_.size(), size);
+
+  /* Ended once only */
+  FcgiCodec::EndRequest(conn_, request);
+  EXPECT_EQ(conn_->output_.size(), size);
+  EXPECT_EQ(CountEndRequest(ParseRecords(conn_->output_), 1), 1);
+}
+
+TEST_F(CancelTokenTest, Reuse)
+{
+  Feed(MakeRequest(1, {{"REQUEST_URI", "/"}}, ""));
+  ASSERT_EQ(held_.size(), 1u);
+  auto token = held_[0]->GetCancelToken();
+  Feed(AbortRequest(1));
+  ASSERT_TRUE(token->IsCancelled());
+  held_.clear();
+
+  /* The token held by someone isn't reset for the next request */
+  Feed(MakeRequest(1, {{"REQUEST_URI", "/"}}, ""));
+  ASSERT_EQ(held_.size(), 1u);
+  auto next = held_[0]->GetCancelToken();
+  EXPECT_NE(next, token);
+  EXPECT_TRUE(token->IsCancelled());
+  EXPECT_FALSE(next->IsCancelled());
+
+  /* Not held, reset and reused */
+  auto raw = next.get();
+  next.reset();
+  {
+    ResponseWriter writer(conn_, *held_[0]);
+    writer.EndRequest();
+  }
+  held_.clear();
+
+  Feed(MakeRequest(1, {{"REQUEST_URI", "/"}}, ""));
+  ASSERT_EQ(held_.size(), 1u);
+  EXPECT_EQ(held_[0]->GetCancelToken().get(), raw);
+  EXPECT_FALSE(held_[0]->IsAborted());
+
+  /* The ENDED state is reset also */
+  Feed(AbortRequest(1));
+  EXPECT_TRUE(held_[0]->IsAborted());
+}
+
+/*
+ * The web server aborts the request while the worker ends it.
+ * Whichever is first, END_REQUEST is sent exactly once and nothing of
+ * the request follows it.
+ */
+TEST(CancelTokenRace, AbortRacesEndRequest)
+{
+  std::string body(4096, 'r');
+  int aborted_num = 0;
+
+  for (int i = 0; i < 200; ++i) {
+    auto num = AdmissionControl::GetLoopRequestNum();
+    EventLoop loop;
+    auto transport = std::make_shared<TestTransport>(&loop);
+    FcgiCodec codec(transport);
+    WorkerPool pool(1, 0);
+    pool.StartRun();
+    codec.SetWorkerPool(&pool);
+
+    std::atomic<int> cancelled(0);
+    std::atomic<bool> ended(false);
+    codec.SetRequestHandler([&](TransportPtr const &conn,
+                                FcgiRequest request) {
+      request.GetCancelToken()->OnCancel([&cancelled]() { ++cancelled; });
+      ResponseWriter writer(conn, request);
+      writer.WriteStdout(body);
+      writer.Flush();
+
+      /* Vary the point the abort arrives */
+      for (int j = 0; j < i % 16; ++j) {
+        std::this_thread::yield();
+      }
+      writer.WriteStdout(body);
+      writer.EndRequest();
+      ended = true;
+    });
+
+    auto input = MakeRequest(1, {{"REQUEST_URI", "/"}}, "");
+    auto buffer = transport->GetInputBuffer();
+    buffer->Append(input.data(), input.size());
+    codec.OnMessage(transport, *buffer);
+    for (int j = 0; j < i % 8; ++j) {
+      std::this_thread::yield();
+    }
+    auto abort = AbortRequest(1);
+    buffer->Append(abort.data(), abort.size());
+    codec.OnMessage(transport, *buffer);
+
+    pool.StopRun();
+    RunPosted(loop);
+    ASSERT_TRUE(ended);
+
+    auto records = ParseRecords(transport->output_);
+    ASSERT_FALSE(records.empty());
+    ASSERT_EQ(CountEndRequest(records, 1), 1) << "iteration " << i;
+    EXPECT_EQ(records.back().type, FCGI_END_REQUEST);
+    EXPECT_FALSE(transport->sent_out_of_loop_);
+
+    /* The callbacks are called once when the codec wins */
+    std::string stdout_stream;
+    bool stdout_ended = false;
+    for (auto const &record : records) {
+      if (record.type != FCGI_STDOUT) continue;
+      if (record.content.empty()) stdout_ended = true;
+      stdout_stream += record.content;
+    }
+
+    if (cancelled) {
+      ++aborted_num;
+      EXPECT_EQ(cancelled, 1);
+      EXPECT_FALSE(stdout_ended);
+      EXPECT_LT(stdout_stream.size(), body.size() * 2);
+    } else {
+      EXPECT_TRUE(stdout_ended);
+      EXPECT_EQ(stdout_stream, body + body);
+    }
+
+    EXPECT_EQ(AdmissionControl::GetLoopRequestNum(), num);
+  }
+
+  /* Both orders are seen, the racing is real */
+  RecordProperty("aborted", aborted_num);
+}
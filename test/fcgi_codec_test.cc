@@ -0,0 +1,875 @@
+#include "fcgi/fcgi_codec.h"
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "fcgi/fcgi_admission.h"
+#include "fcgi/fcgi_record.h"
+#include "fcgi/fcgi_response_writer.h"
+
+#include "fcgi_test_util.h"
+
+using namespace fcgi;
+using namespace kanon;
+
+/*-----------------------*/
+/* Test fixture          */
+/*-----------------------*/
+
+struct CapturedRequest {
+  uint16_t id;
+  FcgiRole role;
+  FcgiFlag flags;
+  std::map<std::string, std::string> params;
+  std::string stdin_stream;
+  std::string data_stream;
+};
+
+class FcgiCodecTest : public ::testing::Test {
+ protected:
+  FcgiCodecTest()
+    : conn_(std::make_shared<TestTransport>(&loop_))
+    , codec_(conn_)
+  {
+    /* Answer the request with its URI */
+    codec_.SetRequestHandler([this](TransportPtr const &conn,
+                                    FcgiRequest request) {
+      Capture(request);
+      auto uri = request.Get(Param::RequestUri);
+      FcgiCodec::SendStdout(conn, request, "uri=" + uri.ToString());
+      FcgiCodec::EndStdout(conn, request);
+      FcgiCodec::EndRequest(conn, request);
+    });
+  }
+
+  void Capture(FcgiRequest const &request)
+  {
+    CapturedRequest captured;
+    captured.id = request.request_id;
+    captured.role = request.role;
+    captured.flags = request.flags;
+    for (auto pair : request.params) {
+      captured.params[pair.name.ToString()] = pair.value.ToString();
+    }
+    captured.stdin_stream.assign(request.stdin_stream.GetReadBegin(),
+                                 request.stdin_stream.GetReadableSize());
+    captured.data_stream.assign(request.data_stream.GetReadBegin(),
+                                request.data_stream.GetReadableSize());
+    requests_.push_back(std::move(captured));
+  }
+
+  /* Deliver the bytes as they are received by the transport */
+  void Feed(std::string const &input)
+  {
+    auto buffer = conn_->GetInputBuffer();
+    buffer->Append(input.data(), input.size());
+    codec_.OnMessage(conn_, *buffer);
+  }
+
+  void FeedInPieces(std::string const &input, size_t piece)
+  {
+    for (size_t i = 0; i < input.size(); i += piece) {
+      Feed(input.substr(i, piece));
+    }
+  }
+
+  size_t GetUnparsedSize()
+  {
+    return conn_->GetInputBuffer()->GetReadableSize();
+  }
+
+  /* Check the STDOUT, its terminator and the END_REQUEST of \p id */
+  void ExpectResponse(std::vector<Record> const &records, uint16_t id,
+                      std::string const &body)
+  {
+    std::string stdout_stream;
+    bool stdout_ended = false;
+    bool request_ended = false;
+    for (auto const &record : records) {
+      if (record.id != id) continue;
+      ASSERT_FALSE(request_ended) << "Record after END_REQUEST of " << id;
+
+      if (record.type == FCGI_STDOUT) {
+        ASSERT_FALSE(stdout_ended);
+        if (record.content.empty()) {
+          stdout_ended = true;
+        } else {
+          stdout_stream += record.content;
+        }
+      } else if (record.type == FCGI_END_REQUEST) {
+        ASSERT_EQ(record.content.size(), 8u);
+        /* app_status = 0, protocol_status = FCGI_REQUEST_COMPLETE */
+        EXPECT_EQ(record.content.substr(0, 5), std::string(5, '\0'));
+        request_ended = true;
+      } else {
+        ADD_FAILURE() << "Unexpected record type " << (int)record.type;
+      }
+    }
+
+    EXPECT_EQ(stdout_stream, body);
+    EXPECT_TRUE(stdout_ended);
+    EXPECT_TRUE(request_ended);
+  }
+
+  EventLoop loop_;
+  std::shared_ptr<TestTransport> conn_;
+  FcgiCodec codec_;
+  std::vector<CapturedRequest> requests_;
+};
+
+TEST_F(FcgiCodecTest, Request)
+{
+  Feed(MakeRequest(1, {{"REQUEST_URI", "/index"}, {"X_NAME", "x"}}, "body"));
+
+  ASSERT_EQ(requests_.size(), 1u);
+  auto const &request = requests_[0];
+  EXPECT_EQ(request.id, 1);
+  EXPECT_EQ(request.role, FCGI_RESPONDER);
+  EXPECT_EQ(request.flags, FCGI_KEEP_CONN);
+  EXPECT_EQ(request.params.size(), 2u);
+  EXPECT_EQ(request.params.at("REQUEST_URI"), "/index");
+  EXPECT_EQ(request.params.at("X_NAME"), "x");
+  EXPECT_EQ(request.stdin_stream, "body");
+  EXPECT_EQ(GetUnparsedSize(), 0u);
+
+  auto records = ParseRecords(conn_->output_);
+  ASSERT_EQ(records.size(), 3u);
+  EXPECT_EQ(records[0].type, FCGI_STDOUT);
+  EXPECT_EQ(records[1].type, FCGI_STDOUT);
+  EXPECT_EQ(records[2].type, FCGI_END_REQUEST);
+  ExpectResponse(records, 1, "uri=/index");
+  EXPECT_FALSE(conn_->shutdown_);
+}
+
+TEST_F(FcgiCodecTest, Truncated)
+{
+  auto input = MakeRequest(1, {{"REQUEST_URI", "/truncated"}}, "abc");
+
+  /* The STDIN terminator is incomplete */
+  Feed(input.substr(0, input.size() - 1));
+  EXPECT_TRUE(requests_.empty());
+  EXPECT_EQ(GetUnparsedSize(), (size_t)FCGI_RECORD_HEADER_LENGTH - 1);
+  EXPECT_TRUE(conn_->output_.empty());
+
+  Feed(input.substr(input.size() - 1));
+  ASSERT_EQ(requests_.size(), 1u);
+  EXPECT_EQ(requests_[0].stdin_stream, "abc");
+  EXPECT_EQ(GetUnparsedSize(), 0u);
+  ExpectResponse(ParseRecords(conn_->output_), 1, "uri=/truncated");
+}
+
+TEST_F(FcgiCodecTest, TruncatedPadding)
+{
+  /* The content is complete but the padding isn't */
+  auto begin = BeginRequest(1);
+  auto params = StreamRecords(FCGI_PARAMS, 1,
+                              EncodeParams({{"REQUEST_URI", "/pad"}}));
+  ASSERT_GT((uint8_t)params[6], 0);
+  auto input = begin + params;
+
+  Feed(input.substr(0, input.size() - 1));
+  EXPECT_EQ(GetUnparsedSize(), params.size() - 1);
+
+  Feed(input.substr(input.size() - 1) + Terminator(FCGI_PARAMS, 1) +
+       Terminator(FCGI_STDIN, 1));
+  ASSERT_EQ(requests_.size(), 1u);
+  EXPECT_EQ(requests_[0].params.at("REQUEST_URI"), "/pad");
+}
+
+TEST_F(FcgiCodecTest, ByteAtATime)
+{
+  std::string cookie(300, 'c');
+  auto input = MakeRequest(
+      7, {{"REQUEST_URI", "/split"}, {"HTTP_COOKIE", cookie}}, "0123456789");
+
+  for (size_t i = 0; i < input.size(); ++i) {
+    EXPECT_TRUE(requests_.empty()) << "Dispatched at byte " << i;
+    Feed(input.substr(i, 1));
+
+    /* Only the partial record is left */
+    EXPECT_LT(GetUnparsedSize(), (size_t)FCGI_RECORD_HEADER_LENGTH + 512);
+  }
+
+  ASSERT_EQ(requests_.size(), 1u);
+  EXPECT_EQ(requests_[0].id, 7);
+  EXPECT_EQ(requests_[0].params.at("REQUEST_URI"), "/split");
+  EXPECT_EQ(requests_[0].params.at("HTTP_COOKIE"), cookie);
+  EXPECT_EQ(requests_[0].stdin_stream, "0123456789");
+  EXPECT_EQ(GetUnparsedSize(), 0u);
+  ExpectResponse(ParseRecords(conn_->output_), 7, "uri=/split");
+}
+
+TEST_F(FcgiCodecTest, LongParams)
+{
+  /* The lengths are encoded in 4 bytes, and the PARAMS is split into
+   * several records */
+  std::string name(200, 'N');
+  std::string cookie(100 * 1024, 'c');
+  auto input = MakeRequest(
+      1, {{"HTTP_COOKIE", cookie}, {name, "value"}, {"REQUEST_URI", "/"}},
+      "");
+
+  FeedInPieces(input, 4096);
+  ASSERT_EQ(requests_.size(), 1u);
+  EXPECT_EQ(requests_[0].params.at("HTTP_COOKIE"), cookie);
+  EXPECT_EQ(requests_[0].params.at(name), "value");
+  EXPECT_EQ(requests_[0].params.at("REQUEST_URI"), "/");
+  EXPECT_TRUE(requests_[0].stdin_stream.empty());
+}
+
+TEST_F(FcgiCodecTest, LargeStdin)
+{
+  std::string body(200 * 1024, 'b');
+  for (size_t i = 0; i < body.size(); i += 1009) {
+    body[i] = 'a' + (i / 1009) % 26;
+  }
+
+  /* The pieces aren't aligned to the records */
+  FeedInPieces(MakeRequest(1, {{"REQUEST_URI", "/upload"}}, body), 3000);
+  ASSERT_EQ(requests_.size(), 1u);
+  EXPECT_EQ(requests_[0].stdin_stream, body);
+}
+
+TEST_F(FcgiCodecTest, Interleaved)
+{
+  /* The records of two requests are multiplexed, the second one(the id
+   * is larger than 255) completes first */
+  uint16_t a = 1;
+  uint16_t b = 0x1234;
+  auto params_a = EncodeParams({{"REQUEST_URI", "/a"}, {"X_ID", "a"}});
+  auto params_b = EncodeParams({{"REQUEST_URI", "/b"}, {"X_ID", "b"}});
+
+  std::string input;
+  input += BeginRequest(a);
+  input += BeginRequest(b);
+  input += StreamRecords(FCGI_PARAMS, a, params_a.substr(0, 5));
+  input += StreamRecords(FCGI_PARAMS, b, params_b);
+  input += StreamRecords(FCGI_PARAMS, a, params_a.substr(5));
+  input += Terminator(FCGI_PARAMS, b);
+  input += StreamRecords(FCGI_STDIN, a, "a-1");
+  input += StreamRecords(FCGI_STDIN, b, "b-1");
+  input += Terminator(FCGI_PARAMS, a);
+  input += StreamRecords(FCGI_STDIN, b, "b-2");
+  input += StreamRecords(FCGI_STDIN, a, "a-2");
+  input += Terminator(FCGI_STDIN, b);
+  input += StreamRecords(FCGI_STDIN, a, "a-3");
+  input += Terminator(FCGI_STDIN, a);
+
+  /* Same result whether the records are received at once or not */
+  for (size_t piece : {input.size(), (size_t)1, (size_t)13}) {
+    SCOPED_TRACE(piece);
+    requests_.clear();
+    conn_->output_.clear();
+    FeedInPieces(input, piece);
+
+    ASSERT_EQ(requests_.size(), 2u);
+    EXPECT_EQ(requests_[0].id, b);
+    EXPECT_EQ(requests_[0].params.at("X_ID"), "b");
+    EXPECT_EQ(requests_[0].stdin_stream, "b-1b-2");
+    EXPECT_EQ(requests_[1].id, a);
+    EXPECT_EQ(requests_[1].params.at("X_ID"), "a");
+    EXPECT_EQ(requests_[1].stdin_stream, "a-1a-2a-3");
+
+    auto records = ParseRecords(conn_->output_);
+    EXPECT_EQ(records.size(), 6u);
+    ExpectResponse(records, a, "uri=/a");
+    ExpectResponse(records, b, "uri=/b");
+  }
+}
+
+TEST_F(FcgiCodecTest, Pipelined)
+{
+  /* The requests reuse the ids after they complete */
+  std::string input;
+  for (int i = 0; i < 10; ++i) {
+    uint16_t id = 1 + i % 2;
+    input += MakeRequest(id, {{"REQUEST_URI", "/" + std::to_string(i)}},
+                         std::string(i, 'x'));
+  }
+
+  FeedInPieces(input, 7);
+  ASSERT_EQ(requests_.size(), 10u);
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_EQ(requests_[i].id, 1 + i % 2);
+    EXPECT_EQ(requests_[i].params.at("REQUEST_URI"), "/" + std::to_string(i));
+    EXPECT_EQ(requests_[i].stdin_stream, std::string(i, 'x'));
+  }
+  EXPECT_EQ(ParseRecords(conn_->output_).size(), 30u);
+}
+
+TEST_F(FcgiCodecTest, StreamingStdin)
+{
+  std::map<uint16_t, std::string> bodies;
+  std::map<uint16_t, bool> ended;
+  codec_.SetStdinHandler([&](TransportPtr const &conn, uint16_t id,
+                             StringView chunk) {
+    EXPECT_FALSE(ended[id]);
+    if (chunk.empty()) {
+      ended[id] = true;
+      FcgiCodec::EndRequest(conn, id);
+    } else {
+      bodies[id] += chunk.ToString();
+    }
+  });
+  codec_.SetRequestHandler([this](TransportPtr const &, FcgiRequest request) {
+    Capture(request);
+  });
+
+  std::string body(70000, 's');
+  std::string input;
+  input += BeginRequest(1);
+  input += BeginRequest(2);
+  input += StreamRecords(FCGI_PARAMS, 1, EncodeParams({{"X_ID", "1"}}));
+  input += Terminator(FCGI_PARAMS, 1);
+  input += StreamRecords(FCGI_PARAMS, 2, EncodeParams({{"X_ID", "2"}}));
+  input += Terminator(FCGI_PARAMS, 2);
+  input += StreamRecords(FCGI_STDIN, 1, body);
+  input += StreamRecords(FCGI_STDIN, 2, "short");
+  input += Terminator(FCGI_STDIN, 2);
+  input += Terminator(FCGI_STDIN, 1);
+
+  FeedInPieces(input, 1000);
+
+  /* Dispatched once the PARAMS is complete */
+  ASSERT_EQ(requests_.size(), 2u);
+  EXPECT_EQ(requests_[0].params.at("X_ID"), "1");
+  EXPECT_TRUE(requests_[0].stdin_stream.empty());
+  EXPECT_EQ(bodies[1], body);
+  EXPECT_EQ(bodies[2], "short");
+  EXPECT_TRUE(ended[1]);
+  EXPECT_TRUE(ended[2]);
+
+  auto records = ParseRecords(conn_->output_);
+  ASSERT_EQ(records.size(), 2u);
+  EXPECT_EQ(records[0].type, FCGI_END_REQUEST);
+  EXPECT_EQ(records[0].id, 2);
+  EXPECT_EQ(records[1].id, 1);
+}
+
+TEST_F(FcgiCodecTest, Filter)
+{
+  std::string input;
+  input += BeginRequest(3, FCGI_FILTER);
+  input += StreamRecords(FCGI_PARAMS, 3, EncodeParams({{"REQUEST_URI", "/f"}}));
+  input += Terminator(FCGI_PARAMS, 3);
+  input += StreamRecords(FCGI_STDIN, 3, "in");
+  input += Terminator(FCGI_STDIN, 3);
+  input += StreamRecords(FCGI_DATA, 3, "data-1");
+  input += StreamRecords(FCGI_DATA, 3, "data-2");
+
+  /* Dispatched when the DATA is complete */
+  Feed(input);
+  EXPECT_TRUE(requests_.empty());
+
+  Feed(Terminator(FCGI_DATA, 3));
+  ASSERT_EQ(requests_.size(), 1u);
+  EXPECT_EQ(requests_[0].role, FCGI_FILTER);
+  EXPECT_EQ(requests_[0].stdin_stream, "in");
+  EXPECT_EQ(requests_[0].data_stream, "data-1data-2");
+}
+
+TEST_F(FcgiCodecTest, FilterWithStreamingStdin)
+{
+  /* Only the STDIN is streamed, the filter request is buffered and
+   * dispatched once with both of STDIN and DATA */
+  std::string streamed;
+  codec_.SetStdinHandler([&streamed](TransportPtr const &conn, uint16_t id,
+                                     StringView chunk) {
+    streamed += chunk.ToString();
+    if (chunk.empty()) FcgiCodec::EndRequest(conn, id);
+  });
+
+  std::vector<FcgiRequest> held;
+  codec_.SetRequestHandler([this, &held](TransportPtr const &,
+                                         FcgiRequest request) {
+    Capture(request);
+    held.push_back(std::move(request));
+  });
+
+  std::string input;
+  input += BeginRequest(3, FCGI_FILTER);
+  input += StreamRecords(FCGI_PARAMS, 3, EncodeParams({{"REQUEST_URI", "/f"}}));
+  input += Terminator(FCGI_PARAMS, 3);
+  input += StreamRecords(FCGI_STDIN, 3, "in");
+  input += Terminator(FCGI_STDIN, 3);
+  input += StreamRecords(FCGI_DATA, 3, "data-1");
+  input += StreamRecords(FCGI_DATA, 3, "data-2");
+  FeedInPieces(input, 3);
+  EXPECT_TRUE(requests_.empty());
+
+  Feed(Terminator(FCGI_DATA, 3));
+  ASSERT_EQ(requests_.size(), 1u);
+  EXPECT_EQ(requests_[0].role, FCGI_FILTER);
+  EXPECT_EQ(requests_[0].params.at("REQUEST_URI"), "/f");
+  EXPECT_EQ(requests_[0].stdin_stream, "in");
+  EXPECT_EQ(requests_[0].data_stream, "data-1data-2");
+  EXPECT_TRUE(streamed.empty());
+
+  /* The DATA after the terminator doesn't touch the dispatched request */
+  Feed(StreamRecords(FCGI_DATA, 3, "data-3") + Terminator(FCGI_DATA, 3));
+  EXPECT_EQ(requests_.size(), 1u);
+  ASSERT_EQ(held.size(), 1u);
+  EXPECT_EQ(held[0].data_stream.GetReadableSize(), 12u);
+
+  /* The STDIN of responder is still streamed */
+  held.clear();
+  Feed(MakeRequest(4, {{"REQUEST_URI", "/r"}}, "body"));
+  ASSERT_EQ(requests_.size(), 2u);
+  EXPECT_TRUE(requests_[1].stdin_stream.empty());
+  EXPECT_EQ(streamed, "body");
+}
+
+TEST_F(FcgiCodecTest, MalformedParams)
+{
+  /* The value length exceeds the PARAMS */
+  std::string params("\x0b\x40REQUEST_URI/short", 19);
+  auto malformed = BeginRequest(1) + StreamRecords(FCGI_PARAMS, 1, params) +
+                   Terminator(FCGI_PARAMS, 1);
+
+  /* The request following it in the same read is still handled */
+  Feed(malformed + MakeRequest(2, {{"REQUEST_URI", "/valid"}}, "body"));
+  ASSERT_EQ(requests_.size(), 1u);
+  EXPECT_EQ(requests_[0].id, 2);
+  EXPECT_EQ(requests_[0].stdin_stream, "body");
+  EXPECT_EQ(GetUnparsedSize(), 0u);
+
+  /* Only the request is failed with the app status 1 */
+  auto records = ParseRecords(conn_->output_);
+  ASSERT_EQ(records.size(), 4u);
+  EXPECT_EQ(records[0].type, FCGI_END_REQUEST);
+  EXPECT_EQ(records[0].id, 1);
+  EXPECT_EQ(records[0].content.substr(0, 5), std::string("\0\0\0\1\0", 5));
+  ExpectResponse(records, 2, "uri=/valid");
+  EXPECT_FALSE(conn_->shutdown_);
+
+  /* The following records of the failed request are ignored */
+  conn_->output_.clear();
+  Feed(StreamRecords(FCGI_STDIN, 1, "late") + Terminator(FCGI_STDIN, 1));
+  EXPECT_EQ(requests_.size(), 1u);
+  EXPECT_TRUE(conn_->output_.empty());
+
+  /* Same when the 4-byte length is truncated and the records are
+   * received byte by byte */
+  std::string truncated("\x0b\x80\x00", 3);
+  FeedInPieces(BeginRequest(3) + StreamRecords(FCGI_PARAMS, 3, truncated) +
+                   Terminator(FCGI_PARAMS, 3) + Terminator(FCGI_STDIN, 3) +
+                   MakeRequest(4, {{"REQUEST_URI", "/next"}}, ""),
+               1);
+  ASSERT_EQ(requests_.size(), 2u);
+  EXPECT_EQ(requests_[1].id, 4);
+  records = ParseRecords(conn_->output_);
+  ASSERT_EQ(records.size(), 4u);
+  EXPECT_EQ(records[0].type, FCGI_END_REQUEST);
+  EXPECT_EQ(records[0].id, 3);
+  ExpectResponse(records, 4, "uri=/next");
+}
+
+TEST_F(FcgiCodecTest, MalformedRecord)
+{
+  /* The BEGIN_REQUEST is too short, the following records can't be
+   * trusted */
+  ChunkList begin;
+  AppendRecordHeader(begin, FCGI_BEGIN_REQUEST, 1, 4);
+  AppendPadding(begin, 4);
+  AppendPadding(begin, 4);
+
+  Feed(ToString(begin) + MakeRequest(2, {{"REQUEST_URI", "/"}}, ""));
+  EXPECT_TRUE(requests_.empty());
+  EXPECT_TRUE(conn_->output_.empty());
+  EXPECT_TRUE(conn_->shutdown_);
+  EXPECT_EQ(GetUnparsedSize(), 0u);
+
+  /* The input is discarded since then */
+  Feed(MakeRequest(3, {{"REQUEST_URI", "/"}}, ""));
+  EXPECT_TRUE(requests_.empty());
+  EXPECT_EQ(GetUnparsedSize(), 0u);
+}
+
+TEST_F(FcgiCodecTest, Abort)
+{
+  std::string input;
+  input += BeginRequest(5);
+  input += StreamRecords(FCGI_PARAMS, 5, EncodeParams({{"REQUEST_URI", "/"}}));
+  input += Terminator(FCGI_PARAMS, 5);
+
+  ChunkList abort;
+  AppendRecordHeader(abort, FCGI_ABORT_REQUEST, 5, 0);
+  input += ToString(abort);
+
+  /* The following records of the aborted request are ignored */
+  input += Terminator(FCGI_STDIN, 5);
+
+  FeedInPieces(input, 5);
+  EXPECT_TRUE(requests_.empty());
+
+  auto records = ParseRecords(conn_->output_);
+  ASSERT_EQ(records.size(), 1u);
+  EXPECT_EQ(records[0].type, FCGI_END_REQUEST);
+  EXPECT_EQ(records[0].id, 5);
+}
+
+TEST_F(FcgiCodecTest, GetValues)
+{
+  auto query = EncodeParams({{FCGI_MAX_CONNS, ""},
+                             {FCGI_MAX_REQS, ""},
+                             {FCGI_MPXS_CONNS, ""},
+                             {"X_UNKNOWN", ""}});
+  Feed(StreamRecords(FCGI_GET_VALUES, FCGI_NULL_REQUEST_ID, query));
+
+  auto records = ParseRecords(conn_->output_);
+  ASSERT_EQ(records.size(), 1u);
+  EXPECT_EQ(records[0].type, FCGI_GET_VALUES_RESULT);
+  EXPECT_EQ(records[0].id, FCGI_NULL_REQUEST_ID);
+
+  /* The unknown variable is ignored, no limit is set */
+  FcgiParams result;
+  result.Append(records[0].content.data(), records[0].content.size());
+  ASSERT_TRUE(result.Parse());
+  EXPECT_EQ(result.size(), 3u);
+  EXPECT_EQ(result.GetString(FCGI_MAX_CONNS),
+            std::to_string(FcgiCodec::GetValues().max_conns));
+  EXPECT_EQ(result.GetString(FCGI_MAX_REQS),
+            std::to_string(FcgiCodec::GetValues().max_reqs));
+  EXPECT_EQ(result.GetString(FCGI_MPXS_CONNS), "1");
+}
+
+TEST_F(FcgiCodecTest, UnknownType)
+{
+  ChunkList input;
+  AppendRecordHeader(input, (FcgiType)20, 1, 0);
+  Feed(ToString(input));
+
+  auto records = ParseRecords(conn_->output_);
+  ASSERT_EQ(records.size(), 1u);
+  EXPECT_EQ(records[0].type, FCGI_UNKNOWN_TYPE);
+  ASSERT_EQ(records[0].content.size(), 8u);
+  EXPECT_EQ(records[0].content[0], 20);
+  EXPECT_TRUE(conn_->shutdown_);
+}
+
+TEST_F(FcgiCodecTest, LargeResponse)
+{
+  std::string body(150 * 1024, 'r');
+  for (size_t i = 0; i < body.size(); i += 997) {
+    body[i] = 'a' + (i / 997) % 26;
+  }
+
+  /* The contiguous and chunked bodies are split into the same records */
+  codec_.SetRequestHandler([&body](TransportPtr const &conn,
+                                   FcgiRequest request) {
+    if (request.Get(Param::RequestUri) == "/chunked") {
+      ChunkList output;
+      output.Append(body.data(), body.size());
+      FcgiCodec::SendStdout(conn, request, output);
+      EXPECT_TRUE(output.IsEmpty());
+    } else {
+      FcgiCodec::SendStdout(conn, request, body);
+    }
+    FcgiCodec::EndStdout(conn, request);
+    FcgiCodec::EndRequest(conn, request);
+  });
+
+  Feed(MakeRequest(1, {{"REQUEST_URI", "/flat"}}, ""));
+  auto flat = conn_->output_;
+  conn_->output_.clear();
+  Feed(MakeRequest(1, {{"REQUEST_URI", "/chunked"}}, ""));
+  EXPECT_EQ(conn_->output_, flat);
+
+  auto records = ParseRecords(flat);
+  ASSERT_EQ(records.size(), 5u);
+  EXPECT_EQ(records[0].content.size(), MAX_CONTENT_LENGTH);
+  EXPECT_EQ(records[1].content.size(), MAX_CONTENT_LENGTH);
+  EXPECT_EQ(records[2].content.size(), body.size() - 2 * MAX_CONTENT_LENGTH);
+  ExpectResponse(records, 1, body);
+}
+
+TEST_F(FcgiCodecTest, ResponseCache)
+{
+  ResponseCache cache(1024 * 1024, 60);
+  codec_.SetResponseCache(&cache);
+
+  std::map<std::string, int> calls;
+  codec_.SetRequestHandler([&calls](TransportPtr const &conn,
+                                    FcgiRequest request) {
+    auto uri = request.Get(Param::RequestUri).ToString();
+    ++calls[uri];
+
+    ResponseWriter writer(conn, request);
+    if (uri == "/missing") {
+      writer.WriteStdout("Status: 404 Not Found\r\n\r\n");
+    } else {
+      if (uri == "/private") writer.SetCacheable(false);
+      writer.WriteStdout("Content-Type: text/plain\r\n\r\n" + uri);
+    }
+    writer.EndRequest();
+  });
+
+  auto get = [this](uint16_t id, std::string const &uri,
+                    std::string const &host) {
+    conn_->output_.clear();
+    Feed(MakeRequest(id,
+                     {{"REQUEST_METHOD", "GET"},
+                      {"REQUEST_URI", uri},
+                      {"HTTP_HOST", host}},
+                     ""));
+    return ParseRecords(conn_->output_);
+  };
+
+  auto body = "Content-Type: text/plain\r\n\r\n/page";
+  ExpectResponse(get(1, "/page", "a"), 1, body);
+  /* Hit, the id of cached response is patched */
+  ExpectResponse(get(2, "/page", "a"), 2, body);
+  EXPECT_EQ(calls["/page"], 1);
+
+  /* The host is a part of the key */
+  ExpectResponse(get(3, "/page", "b"), 3, body);
+  EXPECT_EQ(calls["/page"], 2);
+
+  /* Opted out by the handler */
+  get(1, "/private", "a");
+  ExpectResponse(get(1, "/private", "a"), 1,
+                 "Content-Type: text/plain\r\n\r\n/private");
+  EXPECT_EQ(calls["/private"], 2);
+
+  /* The error page */
+  get(1, "/missing", "a");
+  ExpectResponse(get(1, "/missing", "a"), 1, "Status: 404 Not Found\r\n\r\n");
+  EXPECT_EQ(calls["/missing"], 2);
+
+  EXPECT_EQ(cache.GetEntryNum(), 2u);
+}
+
+/*-----------------------*/
+/* Memory budgets        */
+/*-----------------------*/
+
+/* The protocol status of the END_REQUEST of \p id, -1 if not found */
+static int GetProtocolStatus(std::vector<Record> const &records, uint16_t id)
+{
+  for (auto const &record : records) {
+    if (record.type == FCGI_END_REQUEST && record.id == id &&
+        record.content.size() == 8)
+    {
+      return (uint8_t)record.content[4];
+    }
+  }
+  return -1;
+}
+
+/* The limits are process-wide, restore them after the test */
+class FcgiBudgetTest : public FcgiCodecTest {
+ protected:
+  ~FcgiBudgetTest() override { AdmissionControl::SetLimits(FcgiLimits()); }
+
+  /* The request is admitted and its PARAMS is buffered */
+  static std::string BeginWithParams(uint16_t id, size_t size)
+  {
+    return BeginRequest(id) +
+           StreamRecords(FCGI_PARAMS, id,
+                         EncodeParams({{"REQUEST_URI", "/"},
+                                       {"X_PAD", std::string(size, 'p')}})) +
+           Terminator(FCGI_PARAMS, id);
+  }
+};
+
+TEST_F(FcgiBudgetTest, RequestParams)
+{
+  FcgiLimits limits;
+  limits.max_request_buffered_bytes = 256;
+  AdmissionControl::SetLimits(limits);
+
+  /* The PARAMS is split into records, then the later one exceeds it */
+  auto params = EncodeParams({{"REQUEST_URI", "/large"},
+                              {"X_PAD", std::string(300, 'p')}});
+  auto input = BeginRequest(1) +
+               StreamRecords(FCGI_PARAMS, 1, params.substr(0, 200)) +
+               StreamRecords(FCGI_PARAMS, 1, params.substr(200)) +
+               Terminator(FCGI_PARAMS, 1) + Terminator(FCGI_STDIN, 1);
+
+  for (size_t piece : {input.size(), (size_t)7}) {
+    conn_->output_.clear();
+    FeedInPieces(input, piece);
+    EXPECT_TRUE(requests_.empty()) << "piece: " << piece;
+
+    /* The following records of it are ignored */
+    auto records = ParseRecords(conn_->output_);
+    ASSERT_EQ(records.size(), 1u);
+    EXPECT_EQ(GetProtocolStatus(records, 1), FCGI_OVERLOADED);
+
+    /* The slot and its bytes are freed */
+    EXPECT_EQ(AdmissionControl::GetRequestNum(), 0u);
+    EXPECT_EQ(AdmissionControl::GetBufferedBytes(), 0u);
+  }
+
+  /* The request under the budget is served */
+  conn_->output_.clear();
+  Feed(MakeRequest(1, {{"REQUEST_URI", "/small"}}, ""));
+  ASSERT_EQ(requests_.size(), 1u);
+  ExpectResponse(ParseRecords(conn_->output_), 1, "uri=/small");
+}
+
+TEST_F(FcgiBudgetTest, RequestStdin)
+{
+  FcgiLimits limits;
+  limits.max_request_buffered_bytes = 256;
+  AdmissionControl::SetLimits(limits);
+
+  std::string body(300, 'b');
+  Feed(MakeRequest(1, {{"REQUEST_URI", "/upload"}}, body) +
+       MakeRequest(2, {{"REQUEST_URI", "/next"}}, "small"));
+
+  ASSERT_EQ(requests_.size(), 1u);
+  EXPECT_EQ(requests_[0].id, 2);
+  auto records = ParseRecords(conn_->output_);
+  EXPECT_EQ(GetProtocolStatus(records, 1), FCGI_OVERLOADED);
+  EXPECT_EQ(std::count_if(records.begin(), records.end(),
+                          [](Record const &r) { return r.id == 1; }),
+            1);
+  ExpectResponse(records, 2, "uri=/next");
+  EXPECT_EQ(AdmissionControl::GetRequestNum(), 0u);
+  EXPECT_EQ(AdmissionControl::GetBufferedBytes(), 0u);
+
+  /* The DATA of the filter request is counted also */
+  conn_->output_.clear();
+  Feed(BeginRequest(3, FCGI_FILTER) + Terminator(FCGI_PARAMS, 3) +
+       StreamRecords(FCGI_STDIN, 3, std::string(200, 's')) +
+       Terminator(FCGI_STDIN, 3) +
+       StreamRecords(FCGI_DATA, 3, std::string(100, 'd')) +
+       Terminator(FCGI_DATA, 3));
+  ASSERT_EQ(requests_.size(), 1u);
+  EXPECT_EQ(GetProtocolStatus(ParseRecords(conn_->output_), 3),
+            FCGI_OVERLOADED);
+  EXPECT_EQ(AdmissionControl::GetBufferedBytes(), 0u);
+}
+
+TEST_F(FcgiBudgetTest, Connection)
+{
+  FcgiLimits limits;
+  limits.max_conn_buffered_bytes = 1000;
+  AdmissionControl::SetLimits(limits);
+
+  /* Wait for the STDIN, the PARAMS are kept */
+  Feed(BeginWithParams(1, 400) + BeginWithParams(2, 400));
+  EXPECT_TRUE(conn_->output_.empty());
+  auto buffered = AdmissionControl::GetBufferedBytes();
+  EXPECT_GT(buffered, 800u);
+
+  /* Only the request exceeding it is failed */
+  Feed(BeginWithParams(3, 400));
+  auto records = ParseRecords(conn_->output_);
+  ASSERT_EQ(records.size(), 1u);
+  EXPECT_EQ(GetProtocolStatus(records, 3), FCGI_OVERLOADED);
+  EXPECT_EQ(AdmissionControl::GetRequestNum(), 2u);
+  EXPECT_EQ(AdmissionControl::GetBufferedBytes(), buffered);
+
+  conn_->output_.clear();
+  Feed(Terminator(FCGI_STDIN, 1) + Terminator(FCGI_STDIN, 2) +
+       Terminator(FCGI_STDIN, 3));
+  ASSERT_EQ(requests_.size(), 2u);
+  records = ParseRecords(conn_->output_);
+  ExpectResponse(records, 1, "uri=/");
+  ExpectResponse(records, 2, "uri=/");
+  EXPECT_EQ(GetProtocolStatus(records, 3), -1);
+  EXPECT_EQ(AdmissionControl::GetRequestNum(), 0u);
+  EXPECT_EQ(AdmissionControl::GetBufferedBytes(), 0u);
+}
+
+TEST_F(FcgiBudgetTest, ConnectionRequests)
+{
+  FcgiLimits limits;
+  limits.max_conn_requests = 2;
+  AdmissionControl::SetLimits(limits);
+
+  Feed(BeginWithParams(1, 0) + BeginWithParams(2, 0) + BeginWithParams(3, 0));
+  auto records = ParseRecords(conn_->output_);
+  ASSERT_EQ(records.size(), 1u);
+  EXPECT_EQ(GetProtocolStatus(records, 3), FCGI_OVERLOADED);
+
+  /* The id is available again once a request completes */
+  Feed(Terminator(FCGI_STDIN, 1));
+  conn_->output_.clear();
+  Feed(MakeRequest(3, {{"REQUEST_URI", "/3"}}, ""));
+  ExpectResponse(ParseRecords(conn_->output_), 3, "uri=/3");
+  EXPECT_EQ(AdmissionControl::GetRequestNum(), 1u);
+}
+
+TEST_F(FcgiBudgetTest, Global)
+{
+  FcgiLimits limits;
+  limits.max_buffered_bytes = 1000;
+  AdmissionControl::SetLimits(limits);
+
+  /* The budget is shared by the connections */
+  auto other = std::make_shared<TestTransport>(&loop_);
+  FcgiCodec other_codec(other);
+  other_codec.SetRequestHandler([](TransportPtr const &conn,
+                                   FcgiRequest request) {
+    FcgiCodec::EndRequest(conn, request);
+  });
+  auto feed_other = [&](std::string const &input) {
+    auto buffer = other->GetInputBuffer();
+    buffer->Append(input.data(), input.size());
+    other_codec.OnMessage(other, *buffer);
+  };
+
+  Feed(BeginWithParams(1, 600));
+  feed_other(BeginWithParams(1, 600));
+  EXPECT_TRUE(conn_->output_.empty());
+  auto records = ParseRecords(other->output_);
+  ASSERT_EQ(records.size(), 1u);
+  EXPECT_EQ(GetProtocolStatus(records, 1), FCGI_OVERLOADED);
+  EXPECT_EQ(AdmissionControl::GetRequestNum(), 1u);
+
+  /* The bytes are returned when the request completes */
+  Feed(Terminator(FCGI_STDIN, 1));
+  ASSERT_EQ(requests_.size(), 1u);
+  EXPECT_EQ(AdmissionControl::GetBufferedBytes(), 0u);
+
+  other->output_.clear();
+  feed_other(BeginWithParams(2, 600) + Terminator(FCGI_STDIN, 2));
+  records = ParseRecords(other->output_);
+  EXPECT_EQ(GetProtocolStatus(records, 2), FCGI_REQUEST_COMPLETE);
+  EXPECT_EQ(AdmissionControl::GetRequestNum(), 0u);
+}
+
+TEST_F(FcgiBudgetTest, GetValues)
+{
+  /* The answer follows the limits in effect */
+  FcgiLimits limits;
+  limits.max_requests = 100;
+  limits.max_conn_requests = 1;
+  AdmissionControl::SetLimits(limits);
+
+  auto query = EncodeParams(
+      {{FCGI_MAX_CONNS, ""}, {FCGI_MAX_REQS, ""}, {FCGI_MPXS_CONNS, ""}});
+  Feed(StreamRecords(FCGI_GET_VALUES, FCGI_NULL_REQUEST_ID, query));
+
+  auto records = ParseRecords(conn_->output_);
+  ASSERT_EQ(records.size(), 1u);
+  FcgiParams result;
+  result.Append(records[0].content.data(), records[0].content.size());
+  ASSERT_TRUE(result.Parse());
+  EXPECT_EQ(result.GetString(FCGI_MAX_REQS), "100");
+  EXPECT_EQ(result.GetString(FCGI_MAX_CONNS), "100");
+  EXPECT_EQ(result.GetString(FCGI_MPXS_CONNS), "0");
+
+  /* The answer isn't larger than the values set */
+  limits.max_requests = 1000 * 1000;
+  limits.max_conn_requests = 8;
+  AdmissionControl::SetLimits(limits);
+  conn_->output_.clear();
+  Feed(StreamRecords(FCGI_GET_VALUES, FCGI_NULL_REQUEST_ID, query));
+
+  records = ParseRecords(conn_->output_);
+  ASSERT_EQ(records.size(), 1u);
+  FcgiParams unbounded;
+  unbounded.Append(records[0].content.data(), records[0].content.size());
+  ASSERT_TRUE(unbounded.Parse());
+  EXPECT_EQ(unbounded.GetString(FCGI_MAX_REQS),
+            std::to_string(FcgiCodec::GetValues().max_reqs));
+  EXPECT_EQ(unbounded.GetString(FCGI_MPXS_CONNS), "1");
+}
@@ -0,0 +1,166 @@
+#include "fcgi/fcgi_encoded_response.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "fcgi/fcgi_response_writer.h"
+
+#include "fcgi_test_util.h"
+
+using namespace fcgi;
+using namespace kanon;
+
+static std::string const HEADER = "Content-Type: text/plain\r\n\r\n";
+
+static std::string AppendTo(EncodedResponse const &response, uint16_t id)
+{
+  ChunkList output;
+  response.AppendTo(output, id);
+  return ToString(output);
+}
+
+TEST(EncodedResponse, Records)
+{
+  auto response = EncodedResponse::New(HEADER + "hello");
+  ASSERT_EQ(response->GetRecordNum(), 3u);
+  EXPECT_EQ(response->GetSize(), response->GetRecords().size());
+
+  auto records = ParseRecords(response->GetRecords().ToString());
+  ASSERT_EQ(records.size(), 3u);
+  EXPECT_EQ(records[0].type, FCGI_STDOUT);
+  EXPECT_EQ(records[0].content, HEADER + "hello");
+  EXPECT_EQ(records[1].type, FCGI_STDOUT);
+  EXPECT_TRUE(records[1].content.empty());
+  EXPECT_EQ(records[2].type, FCGI_END_REQUEST);
+  EXPECT_EQ(records[2].content, std::string(8, '\0'));
+  for (auto const &record : records) {
+    EXPECT_EQ(record.id, 0);
+  }
+
+  /* The offsets of headers */
+  auto const &headers = response->GetHeaders();
+  EXPECT_EQ(headers[0], 0u);
+  EXPECT_EQ(headers[1], response->GetSize() - 16 - 8);
+  EXPECT_EQ(headers[2], response->GetSize() - 16);
+}
+
+TEST(EncodedResponse, PatchId)
+{
+  auto response = EncodedResponse::New(HEADER + std::string(100, 'x'), 7);
+  auto original = response->GetRecords().ToString();
+
+  /* Only the id bytes of headers differ */
+  for (uint16_t id : {1, 0x1234, 0xffff}) {
+    auto patched = AppendTo(*response, id);
+    ASSERT_EQ(patched.size(), original.size());
+
+    auto expected = original;
+    for (auto offset : response->GetHeaders()) {
+      expected[offset + 2] = (char)(id >> 8);
+      expected[offset + 3] = (char)(id & 0xff);
+    }
+    EXPECT_EQ(patched, expected) << "id " << id;
+
+    auto records = ParseRecords(patched);
+    ASSERT_EQ(records.size(), 3u);
+    EXPECT_EQ(records[0].id, id);
+    EXPECT_EQ(records[2].id, id);
+    EXPECT_EQ(records[2].content.substr(0, 4), std::string("\0\0\0\7", 4));
+  }
+
+  /* The shared records are untouched */
+  EXPECT_EQ(response->GetRecords().ToString(), original);
+}
+
+TEST(EncodedResponse, Split)
+{
+  /* Larger than the max content length */
+  std::string body(150 * 1024, 'b');
+  auto response = EncodedResponse::New(body);
+  ASSERT_EQ(response->GetRecordNum(), 5u);
+
+  auto records = ParseRecords(AppendTo(*response, 3));
+  ASSERT_EQ(records.size(), 5u);
+  EXPECT_EQ(records[0].content.size(), (size_t)MAX_CONTENT_LENGTH);
+  EXPECT_EQ(records[1].content.size(), (size_t)MAX_CONTENT_LENGTH);
+  EXPECT_EQ(records[0].content + records[1].content + records[2].content,
+            body);
+  EXPECT_TRUE(records[3].content.empty());
+  EXPECT_EQ(records[4].type, FCGI_END_REQUEST);
+
+  /* The empty STDOUT has the terminator only */
+  auto empty = EncodedResponse::New("");
+  ASSERT_EQ(empty->GetRecordNum(), 2u);
+  records = ParseRecords(AppendTo(*empty, 3));
+  ASSERT_EQ(records.size(), 2u);
+  EXPECT_EQ(records[0].type, FCGI_STDOUT);
+  EXPECT_TRUE(records[0].content.empty());
+  EXPECT_EQ(records[1].type, FCGI_END_REQUEST);
+}
+
+TEST(EncodedResponse, SharedByThreads)
+{
+  auto response = EncodedResponse::New(HEADER + std::string(70000, 's'));
+  auto original = response->GetRecords().ToString();
+
+  std::vector<std::thread> threads;
+  std::vector<int> failures(8, 0);
+  for (uint16_t t = 0; t < 8; ++t) {
+    threads.emplace_back([t, &response, &failures]() {
+      for (int i = 0; i < 100; ++i) {
+        uint16_t id = t * 1000 + i + 1;
+        for (auto const &record : ParseRecords(AppendTo(*response, id))) {
+          if (record.id != id) ++failures[t];
+        }
+      }
+    });
+  }
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  for (auto n : failures) {
+    EXPECT_EQ(n, 0);
+  }
+  EXPECT_EQ(response->GetRecords().ToString(), original);
+}
+
+TEST(EncodedResponse, SendToRequests)
+{
+  EventLoop loop;
+  auto conn = std::make_shared<TestTransport>(&loop);
+  auto response = EncodedResponse::New(HEADER + "shared");
+
+  /* One response for the requests of different ids */
+  {
+    ResponseWriter writer(conn, 1);
+    writer.EndRequest(response);
+  }
+  {
+    ResponseWriter writer(conn, 300);
+    writer.WriteStderr("warning");
+    writer.EndRequest(response);
+  }
+
+  auto records = ParseRecords(conn->output_);
+  ASSERT_EQ(records.size(), 8u);
+  for (size_t i = 0; i < 3; ++i) {
+    EXPECT_EQ(records[i].id, 1);
+  }
+  EXPECT_EQ(records[0].content, HEADER + "shared");
+  EXPECT_EQ(records[2].type, FCGI_END_REQUEST);
+
+  /* The STDERR is terminated before the response */
+  EXPECT_EQ(records[3].type, FCGI_STDERR);
+  EXPECT_EQ(records[4].type, FCGI_STDERR);
+  EXPECT_TRUE(records[4].content.empty());
+  for (size_t i = 3; i < 8; ++i) {
+    EXPECT_EQ(records[i].id, 300);
+  }
+  EXPECT_EQ(records[5].content, HEADER + "shared");
+  EXPECT_EQ(records[7].type, FCGI_END_REQUEST);
+}
@@ -0,0 +1,354 @@
+#include "fcgi/fcgi_output_scheduler.h"
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "fcgi/fcgi_record.h"
+
+using namespace fcgi;
+using namespace kanon;
+
+/*
+ * The bytes sent are captured, and they are counted as the output of
+ * transport until Drain(), then the scheduler stops at it like a slow
+ * socket.
+ */
+class TestTransport : public Transport {
+ public:
+  TestTransport()
+    : Transport(nullptr)
+  {
+  }
+
+  void Send(void const *data, size_t len) override
+  {
+    output_.append(static_cast<char const *>(data), len);
+  }
+
+  void Send(ChunkList &output) override
+  {
+    for (auto const &chunk : output) {
+      output_.append(chunk.GetReadBegin(), chunk.GetReadableSize());
+    }
+    output.AdvanceAll();
+  }
+
+  void ShutdownWrite() override {}
+  void StopRead() override {}
+  void StartRead() override {}
+  bool IsConnected() const noexcept override { return true; }
+
+  size_t GetOutputSize() const noexcept override
+  {
+    return blocked_ ? output_.size() - drained_ : 0;
+  }
+
+  Buffer *GetInputBuffer() noexcept override { return &input_; }
+
+  void Drain() noexcept { drained_ = output_.size(); }
+
+  std::string output_;
+  bool blocked_ = false;
+
+ private:
+  size_t drained_ = 0;
+  Buffer input_;
+};
+
+struct Record {
+  uint8_t type;
+  uint16_t id;
+  std::string content;
+};
+
+/* Split the output into records, the padding is checked and dropped */
+static std::vector<Record> ParseRecords(std::string const &output)
+{
+  std::vector<Record> records;
+  auto bytes = reinterpret_cast<unsigned char const *>(output.data());
+  size_t pos = 0;
+  while (pos < output.size()) {
+    if (output.size() - pos < (size_t)FCGI_RECORD_HEADER_LENGTH) {
+      ADD_FAILURE() << "Truncated record header at " << pos;
+      break;
+    }
+
+    auto header = bytes + pos;
+    EXPECT_EQ(header[0], FCGI_VERSION_1);
+    Record record;
+    record.type = header[1];
+    record.id = (header[2] << 8) | header[3];
+    size_t clen = (header[4] << 8) | header[5];
+    size_t padding = header[6];
+    pos += FCGI_RECORD_HEADER_LENGTH;
+
+    if (output.size() - pos < clen + padding) {
+      ADD_FAILURE() << "Truncated record content at " << pos;
+      break;
+    }
+
+    EXPECT_EQ((clen + padding) % 8, 0u) << "Unaligned record at " << pos;
+    record.content.assign(output.data() + pos, clen);
+    pos += clen + padding;
+    records.push_back(std::move(record));
+  }
+
+  return records;
+}
+
+/* The STDOUT content of request \p id */
+static std::string GetStdout(std::vector<Record> const &records, uint16_t id)
+{
+  std::string content;
+  for (auto const &record : records) {
+    if (record.type == FCGI_STDOUT && record.id == id) {
+      content += record.content;
+    }
+  }
+  return content;
+}
+
+/* The position of the END_REQUEST of request \p id, -1 if not found */
+static int FindEndRequest(std::vector<Record> const &records, uint16_t id)
+{
+  for (size_t i = 0; i < records.size(); ++i) {
+    if (records[i].type == FCGI_END_REQUEST && records[i].id == id) {
+      return (int)i;
+    }
+  }
+  return -1;
+}
+
+/* STDOUT of \p content, and the END_REQUEST if \p end */
+static void Enqueue(OutputScheduler &scheduler, uint16_t id,
+                    std::string const &content, bool end)
+{
+  ChunkList records;
+  AppendStreamRecords(records, FCGI_STDOUT, id, content.data(),
+                      content.size());
+  if (end) {
+    AppendTerminator(records, FCGI_STDOUT, id);
+    AppendEndRequest(records, id, 0, FCGI_REQUEST_COMPLETE);
+  }
+  scheduler.Enqueue(id, records);
+}
+
+/* Drain the transport until the queues are empty */
+static void DrainAll(TestTransport &conn, OutputScheduler &scheduler)
+{
+  for (int i = 0; i < 1000 && conn.GetOutputSize() > 0; ++i) {
+    conn.Drain();
+    scheduler.Pump();
+  }
+}
+
+TEST(OutputScheduler, Split)
+{
+  TestTransport conn;
+  OutputScheduler scheduler(&conn, 20);
+  /* Aligned to 8, then no piece is padded except the last one */
+  std::string content(45, 'a');
+  content[0] = 'b';
+  content[44] = 'z';
+  Enqueue(scheduler, 1, content, true);
+
+  auto records = ParseRecords(conn.output_);
+  ASSERT_EQ(records.size(), 5u);
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(records[i].type, FCGI_STDOUT);
+    EXPECT_EQ(records[i].id, 1);
+  }
+  EXPECT_EQ(records[0].content.size(), 16u);
+  EXPECT_EQ(records[1].content.size(), 16u);
+  EXPECT_EQ(records[2].content.size(), 13u);
+  EXPECT_EQ(GetStdout(records, 1), content);
+
+  /* The terminator and END_REQUEST aren't split */
+  EXPECT_EQ(records[3].type, FCGI_STDOUT);
+  EXPECT_TRUE(records[3].content.empty());
+  EXPECT_EQ(records[4].type, FCGI_END_REQUEST);
+  EXPECT_EQ(records[4].content.size(), 8u);
+  EXPECT_EQ(scheduler.GetQueuedSize(1), 0u);
+}
+
+TEST(OutputScheduler, SmallRecordIsSentDirectly)
+{
+  TestTransport conn;
+  OutputScheduler scheduler(&conn, 64);
+  Enqueue(scheduler, 1, "small", true);
+
+  auto records = ParseRecords(conn.output_);
+  ASSERT_EQ(records.size(), 3u);
+  EXPECT_EQ(GetStdout(records, 1), "small");
+  EXPECT_EQ(FindEndRequest(records, 1), 2);
+}
+
+TEST(OutputScheduler, Interleave)
+{
+  TestTransport conn;
+  conn.blocked_ = true;
+  OutputScheduler scheduler(&conn, 16);
+
+  std::string large(160, 'L');
+  Enqueue(scheduler, 1, large, true);
+  /* A turn is sent, the rest waits for the transport */
+  EXPECT_EQ(ParseRecords(conn.output_).size(), 1u);
+  EXPECT_EQ(scheduler.GetQueuedSize(1), 160u - 16 + 8);
+
+  Enqueue(scheduler, 2, "small", true);
+  DrainAll(conn, scheduler);
+
+  auto records = ParseRecords(conn.output_);
+  EXPECT_EQ(GetStdout(records, 1), large);
+  EXPECT_EQ(GetStdout(records, 2), "small");
+
+  /* The small response doesn't wait for the large one */
+  int end2 = FindEndRequest(records, 2);
+  int end1 = FindEndRequest(records, 1);
+  ASSERT_GE(end2, 0);
+  ASSERT_GE(end1, 0);
+  EXPECT_LT(end2, 6);
+  EXPECT_LT(end2, end1);
+
+  /* The pieces of the large one take turns with the small one */
+  std::vector<uint16_t> ids;
+  for (auto const &record : records) {
+    if (record.type == FCGI_STDOUT && !record.content.empty()) {
+      ids.push_back(record.id);
+    }
+  }
+  ASSERT_GE(ids.size(), 3u);
+  EXPECT_EQ(ids[0], 1);
+  EXPECT_EQ(ids[1], 1);
+  EXPECT_EQ(ids[2], 2);
+  EXPECT_EQ(scheduler.GetQueuedSize(1), 0u);
+  EXPECT_EQ(scheduler.GetQueuedSize(2), 0u);
+}
+
+TEST(OutputScheduler, Weight)
+{
+  TestTransport conn;
+  conn.blocked_ = true;
+  OutputScheduler scheduler(&conn, 16);
+
+  /* Occupy the transport, then the following ones are queued */
+  Enqueue(scheduler, 3, std::string(16, 'x'), false);
+  Enqueue(scheduler, 2, std::string(96, 'b'), true);
+  scheduler.SetWeight(1, 3);
+  Enqueue(scheduler, 1, std::string(96, 'a'), true);
+  DrainAll(conn, scheduler);
+
+  /* A turn of request 1 sends 3 pieces */
+  auto records = ParseRecords(conn.output_);
+  std::vector<uint16_t> ids;
+  for (auto const &record : records) {
+    if (record.type == FCGI_STDOUT && !record.content.empty() &&
+        record.id != 3)
+    {
+      ids.push_back(record.id);
+    }
+  }
+  std::vector<uint16_t> expected = {2, 2, 1, 1, 1, 2, 1, 1, 1, 2, 2, 2};
+  EXPECT_EQ(ids, expected);
+  EXPECT_EQ(GetStdout(records, 1), std::string(96, 'a'));
+  EXPECT_EQ(GetStdout(records, 2), std::string(96, 'b'));
+}
+
+TEST(OutputScheduler, DropKeepsEndRequest)
+{
+  TestTransport conn;
+  conn.blocked_ = true;
+  OutputScheduler scheduler(&conn, 16);
+
+  Enqueue(scheduler, 1, std::string(100, 'a'), true);
+  ASSERT_EQ(ParseRecords(conn.output_).size(), 1u);
+
+  /* The front record is being split, the pieces sent are complete */
+  scheduler.Drop(1, true);
+  EXPECT_EQ(scheduler.GetQueuedSize(1), 8u);
+  DrainAll(conn, scheduler);
+
+  auto records = ParseRecords(conn.output_);
+  ASSERT_EQ(records.size(), 2u);
+  EXPECT_EQ(GetStdout(records, 1), std::string(16, 'a'));
+  EXPECT_EQ(FindEndRequest(records, 1), 1);
+  EXPECT_EQ(scheduler.GetQueuedSize(1), 0u);
+}
+
+TEST(OutputScheduler, DropByRequest)
+{
+  /* The records of the completed request and the request reusing id */
+  auto enqueue_both = [](TestTransport &conn, OutputScheduler &scheduler) {
+    conn.blocked_ = true;
+    /* Occupy the transport, then the records of request 1 are queued.
+     * A turn of each is sent by every Enqueue(). */
+    Enqueue(scheduler, 2, std::string(64, 'x'), true);
+    Enqueue(scheduler, 1, std::string(64, 'c'), true);
+    Enqueue(scheduler, 1, std::string(40, 'n'), false);
+    EXPECT_EQ(scheduler.GetQueuedSize(1), 32u + 8 + 40);
+  };
+
+  {
+    /* The request using id now is aborted */
+    TestTransport conn;
+    OutputScheduler scheduler(&conn, 16);
+    enqueue_both(conn, scheduler);
+    scheduler.Drop(1, false);
+    EXPECT_EQ(scheduler.GetQueuedSize(1), 32u + 8);
+    DrainAll(conn, scheduler);
+
+    auto records = ParseRecords(conn.output_);
+    EXPECT_EQ(GetStdout(records, 1), std::string(64, 'c'));
+    EXPECT_EQ(FindEndRequest(records, 1), (int)records.size() - 1);
+  }
+
+  {
+    /* The completed request is aborted */
+    TestTransport conn;
+    OutputScheduler scheduler(&conn, 16);
+    enqueue_both(conn, scheduler);
+    scheduler.Drop(1, true);
+    EXPECT_EQ(scheduler.GetQueuedSize(1), 8u + 40);
+    DrainAll(conn, scheduler);
+
+    /* The pieces sent before are complete records */
+    auto records = ParseRecords(conn.output_);
+    EXPECT_EQ(GetStdout(records, 1),
+              std::string(32, 'c') + std::string(40, 'n'));
+    EXPECT_GE(FindEndRequest(records, 1), 0);
+  }
+}
+
+TEST(OutputScheduler, DropFreesEmptyQueue)
+{
+  TestTransport conn;
+  conn.blocked_ = true;
+  OutputScheduler scheduler(&conn, 16);
+
+  Enqueue(scheduler, 1, std::string(64, 'a'), true);
+  Enqueue(scheduler, 2, std::string(64, 'b'), false);
+  Enqueue(scheduler, 3, std::string(64, 'c'), true);
+
+  /* Request 2 has no END_REQUEST queued, its queue is removed */
+  scheduler.Drop(2, false);
+  EXPECT_EQ(scheduler.GetQueuedSize(2), 0u);
+  DrainAll(conn, scheduler);
+
+  /* The turns taken by request 2 before */
+  auto records = ParseRecords(conn.output_);
+  EXPECT_EQ(GetStdout(records, 1), std::string(64, 'a'));
+  EXPECT_EQ(GetStdout(records, 2), std::string(32, 'b'));
+  EXPECT_EQ(GetStdout(records, 3), std::string(64, 'c'));
+
+  /* The END_REQUEST of aborted request isn't blocked by anything */
+  conn.blocked_ = false;
+  conn.output_.clear();
+  ChunkList end;
+  AppendEndRequest(end, 2, 0, FCGI_REQUEST_COMPLETE);
+  scheduler.Enqueue(2, end);
+  records = ParseRecords(conn.output_);
+  ASSERT_EQ(records.size(), 1u);
+  EXPECT_EQ(FindEndRequest(records, 2), 0);
+}
@@ -0,0 +1,231 @@
+#include "fcgi/fcgi_params.h"
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "fcgi/fcgi_record.h"
+
+using namespace fcgi;
+using namespace kanon;
+
+static std::string ToString(StringView view)
+{
+  return std::string(view.data(), view.size());
+}
+
+static void AppendRaw(FcgiParams &params, std::string const &raw)
+{
+  params.Append(raw.data(), raw.size());
+}
+
+TEST(FcgiParams, ShortLength)
+{
+  Buffer raw;
+  AppendNameValuePair(raw, "REQUEST_METHOD", "GET");
+  AppendNameValuePair(raw, "REQUEST_URI", "/echo?a=1");
+  AppendNameValuePair(raw, "X_CUSTOM", "custom");
+  AppendNameValuePair(raw, "CONTENT_TYPE", "");
+
+  FcgiParams params;
+  params.Append(raw.GetReadBegin(), raw.GetReadableSize());
+  ASSERT_TRUE(params.Parse());
+
+  EXPECT_EQ(params.size(), 4u);
+  EXPECT_EQ(ToString(params.Get(Param::RequestMethod)), "GET");
+  EXPECT_EQ(ToString(params.Get(Param::RequestUri)), "/echo?a=1");
+  EXPECT_EQ(ToString(params.Get("REQUEST_URI")), "/echo?a=1");
+  EXPECT_EQ(ToString(params.Get("X_CUSTOM")), "custom");
+
+  /* Present but empty */
+  EXPECT_TRUE(params.Contains(Param::ContentType));
+  EXPECT_TRUE(params.Get(Param::ContentType).empty());
+
+  EXPECT_FALSE(params.Contains(Param::HttpCookie));
+  EXPECT_FALSE(params.Contains("X_ABSENT"));
+  EXPECT_TRUE(params.Get("X_ABSENT").empty());
+
+  /* Param::Unknown has no slot */
+  EXPECT_FALSE(params.Contains(Param::Unknown));
+  EXPECT_TRUE(params.Get(Param::Unknown).empty());
+}
+
+TEST(FcgiParams, Iteration)
+{
+  Buffer raw;
+  AppendNameValuePair(raw, "A_NAME", "1");
+  AppendNameValuePair(raw, "SERVER_PORT", "80");
+  AppendNameValuePair(raw, "B_NAME", "2");
+
+  FcgiParams params;
+  params.Append(raw.GetReadBegin(), raw.GetReadableSize());
+  ASSERT_TRUE(params.Parse());
+
+  /* In the order of stream */
+  char const *names[] = {"A_NAME", "SERVER_PORT", "B_NAME"};
+  char const *values[] = {"1", "80", "2"};
+  size_t i = 0;
+  for (auto pair : params) {
+    ASSERT_LT(i, 3u);
+    EXPECT_EQ(ToString(pair.name), names[i]);
+    EXPECT_EQ(ToString(pair.value), values[i]);
+    ++i;
+  }
+  EXPECT_EQ(i, 3u);
+}
+
+TEST(FcgiParams, LongLength)
+{
+  std::string cookie(300, 'c');
+  std::string name(200, 'N');
+  std::string value(128, 'v');
+
+  /* The lengths of them are 4 bytes, the highest bit is set:
+   * HTTP_COOKIE(11) 300 */
+  std::string raw;
+  raw.append("\x0b\x80\x00\x01\x2c", 5);
+  raw.append("HTTP_COOKIE");
+  raw.append(cookie);
+  /* 200 128 */
+  raw.append("\x80\x00\x00\xc8\x80\x00\x00\x80", 8);
+  raw.append(name);
+  raw.append(value);
+  /* Length 127 is the last one encoded in 1 byte */
+  raw.append("\x04\x7f", 2);
+  raw.append("HTTZ");
+  raw.append(127, 's');
+
+  FcgiParams params;
+  AppendRaw(params, raw);
+  ASSERT_TRUE(params.Parse());
+
+  EXPECT_EQ(params.size(), 3u);
+  EXPECT_EQ(ToString(params.Get(Param::HttpCookie)), cookie);
+  EXPECT_EQ(ToString(params.Get(name)), value);
+  EXPECT_EQ(ToString(params.Get("HTTZ")), std::string(127, 's'));
+
+  /* The encoder chooses the same lengths */
+  Buffer encoded;
+  AppendNameValuePair(encoded, "HTTP_COOKIE", cookie);
+  AppendNameValuePair(encoded, name, value);
+  AppendNameValuePair(encoded, "HTTZ", std::string(127, 's'));
+  EXPECT_EQ(ToString(StringView(encoded.GetReadBegin(),
+                                encoded.GetReadableSize())),
+            raw);
+}
+
+TEST(FcgiParams, Truncated)
+{
+  Buffer raw;
+  AppendNameValuePair(raw, "REQUEST_URI", "/index");
+  AppendNameValuePair(raw, "HTTP_COOKIE", std::string(200, 'c'));
+  std::string full(raw.GetReadBegin(), raw.GetReadableSize());
+
+  /* Every proper prefix ending inside a pair is malformed */
+  size_t first_pair = 2 + 11 + 6;
+  for (size_t len = 1; len < full.size(); ++len) {
+    if (len == first_pair) continue;
+
+    FcgiParams params;
+    AppendRaw(params, full.substr(0, len));
+    EXPECT_FALSE(params.Parse()) << "prefix length: " << len;
+  }
+
+  FcgiParams params;
+  AppendRaw(params, full.substr(0, first_pair));
+  ASSERT_TRUE(params.Parse());
+  EXPECT_EQ(params.size(), 1u);
+
+  /* The 4-byte length is truncated */
+  FcgiParams short_length;
+  AppendRaw(short_length, std::string("\x80\x00", 2));
+  EXPECT_FALSE(short_length.Parse());
+
+  FcgiParams short_value_length;
+  AppendRaw(short_value_length, std::string("\x01\x80\x00\x00", 4));
+  EXPECT_FALSE(short_value_length.Parse());
+
+  /* The lengths exceed the content */
+  FcgiParams overflow;
+  AppendRaw(overflow, std::string("\xff\xff\xff\xff\xff\xff\xff\xff", 8));
+  EXPECT_FALSE(overflow.Parse());
+}
+
+TEST(FcgiParams, ByteAtATime)
+{
+  Buffer raw;
+  AppendNameValuePair(raw, "REQUEST_URI", "/split");
+  AppendNameValuePair(raw, "HTTP_COOKIE", std::string(1000, 'c'));
+  AppendNameValuePair(raw, "X_LAST", "last");
+
+  /* The content of PARAMS records is appended piece by piece */
+  FcgiParams params;
+  for (size_t i = 0; i < raw.GetReadableSize(); ++i) {
+    params.Append(raw.GetReadBegin() + i, 1);
+  }
+  ASSERT_TRUE(params.Parse());
+
+  EXPECT_EQ(params.size(), 3u);
+  EXPECT_EQ(ToString(params.Get(Param::RequestUri)), "/split");
+  EXPECT_EQ(ToString(params.Get(Param::HttpCookie)), std::string(1000, 'c'));
+  EXPECT_EQ(ToString(params.Get("X_LAST")), "last");
+}
+
+TEST(FcgiParams, Duplicate)
+{
+  Buffer raw;
+  AppendNameValuePair(raw, "REQUEST_URI", "/first");
+  AppendNameValuePair(raw, "X_NAME", "first");
+  AppendNameValuePair(raw, "REQUEST_URI", "/second");
+  AppendNameValuePair(raw, "X_NAME", "second");
+
+  FcgiParams params;
+  params.Append(raw.GetReadBegin(), raw.GetReadableSize());
+  ASSERT_TRUE(params.Parse());
+
+  /* The latter one overrides the former one */
+  EXPECT_EQ(params.size(), 4u);
+  EXPECT_EQ(ToString(params.Get(Param::RequestUri)), "/second");
+  EXPECT_EQ(ToString(params.Get("REQUEST_URI")), "/second");
+  EXPECT_EQ(ToString(params.Get("X_NAME")), "second");
+}
+
+TEST(FcgiParams, Clear)
+{
+  Buffer raw;
+  AppendNameValuePair(raw, "REQUEST_URI", "/old");
+
+  FcgiParams params;
+  params.Append(raw.GetReadBegin(), raw.GetReadableSize());
+  ASSERT_TRUE(params.Parse());
+
+  /* The slots of the last request don't leak into the next one */
+  params.Clear();
+  EXPECT_TRUE(params.empty());
+  EXPECT_FALSE(params.Contains(Param::RequestUri));
+
+  raw.AdvanceAll();
+  AppendNameValuePair(raw, "QUERY_STRING", "a=1");
+  params.Append(raw.GetReadBegin(), raw.GetReadableSize());
+  ASSERT_TRUE(params.Parse());
+  EXPECT_FALSE(params.Contains(Param::RequestUri));
+  EXPECT_EQ(ToString(params.Get(Param::QueryString)), "a=1");
+
+  /* Empty stream has no param */
+  FcgiParams empty;
+  EXPECT_TRUE(empty.Parse());
+  EXPECT_TRUE(empty.empty());
+}
+
+TEST(FcgiParams, String2Param)
+{
+  for (int i = 0; i < (int)Param::Unknown; ++i) {
+    EXPECT_EQ(String2Param(Param2String((Param)i)), (Param)i);
+  }
+
+  /* Same length and same hashed characters as the well-known ones */
+  EXPECT_EQ(String2Param("HTTPZ"), Param::Unknown);
+  EXPECT_EQ(String2Param("REQUEST_URL"), Param::Unknown);
+  EXPECT_EQ(String2Param("URI"), Param::Unknown);
+  EXPECT_EQ(String2Param(""), Param::Unknown);
+}
@@ -0,0 +1,235 @@
+#include "fcgi/fcgi_codec.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "fcgi/fcgi_record.h"
+
+#include "fcgi_test_util.h"
+
+using namespace fcgi;
+using namespace kanon;
+
+/* The record whose padding is chosen by the test instead of aligning */
+static std::string RawRecord(FcgiType type, uint16_t id,
+                             std::string const &content, uint8_t padding)
+{
+  std::string record;
+  record += (char)FCGI_VERSION_1;
+  record += (char)type;
+  record += (char)(id >> 8);
+  record += (char)(id & 0xff);
+  record += (char)(content.size() >> 8);
+  record += (char)(content.size() & 0xff);
+  record += (char)padding;
+  record += '\0';
+  record += content;
+  /* Not zero, the padding is never read */
+  record.append(padding, '\xff');
+  return record;
+}
+
+/* Split \p content into records of \p piece bytes at most */
+static std::string SplitRecords(FcgiType type, uint16_t id,
+                                std::string const &content, size_t piece,
+                                uint8_t padding = 0)
+{
+  std::string records;
+  for (size_t i = 0; i < content.size(); i += piece) {
+    records += RawRecord(type, id, content.substr(i, piece), padding);
+  }
+  return records + RawRecord(type, id, "", padding);
+}
+
+struct ScannedRequest {
+  uint16_t id;
+  std::string uri;
+  std::string stdin_stream;
+};
+
+/* The whole read is passed in one call, as a transport does */
+class RecordScanTest : public ::testing::Test {
+ protected:
+  RecordScanTest()
+    : conn_(std::make_shared<TestTransport>(&loop_))
+    , codec_(conn_)
+  {
+    codec_.SetRequestHandler([this](TransportPtr const &conn,
+                                    FcgiRequest request) {
+      ScannedRequest scanned;
+      scanned.id = request.request_id;
+      scanned.uri = request.Get(Param::RequestUri).ToString();
+      scanned.stdin_stream.assign(request.stdin_stream.GetReadBegin(),
+                                  request.stdin_stream.GetReadableSize());
+      requests_.push_back(std::move(scanned));
+      if (pause_) codec_.PauseRead(conn);
+    });
+  }
+
+  size_t Scan(std::string const &input)
+  {
+    return codec_.OnMessage(conn_, input.data(), input.size());
+  }
+
+  EventLoop loop_;
+  std::shared_ptr<TestTransport> conn_;
+  FcgiCodec codec_;
+  std::vector<ScannedRequest> requests_;
+  bool pause_ = false;
+};
+
+TEST_F(RecordScanTest, ManySmallRecords)
+{
+  /* The PARAMS and STDIN are split into tiny records, as a web server
+   * streaming the input does */
+  std::string input;
+  for (uint16_t id = 1; id <= 64; ++id) {
+    auto uri = "/" + std::to_string(id);
+    input += BeginRequest(id);
+    input += SplitRecords(FCGI_PARAMS, id,
+                          EncodeParams({{"REQUEST_URI", uri}}), 3);
+    input += SplitRecords(FCGI_STDIN, id, std::string(id * 10, 'a' + id % 26),
+                          7);
+  }
+
+  EXPECT_EQ(Scan(input), input.size());
+  ASSERT_EQ(requests_.size(), 64u);
+  for (uint16_t id = 1; id <= 64; ++id) {
+    auto const &request = requests_[id - 1];
+    EXPECT_EQ(request.id, id);
+    EXPECT_EQ(request.uri, "/" + std::to_string(id));
+    EXPECT_EQ(request.stdin_stream, std::string(id * 10, 'a' + id % 26));
+  }
+}
+
+TEST_F(RecordScanTest, Padding)
+{
+  /* Any padding is skipped, not only the one aligning to 8 bytes */
+  uint8_t paddings[] = {0, 1, 7, 8, 9, 100, 255};
+  std::string input;
+  uint16_t id = 1;
+  for (auto padding : paddings) {
+    input += BeginRequest(id);
+    input += RawRecord(FCGI_PARAMS, id,
+                       EncodeParams({{"REQUEST_URI", "/pad"}}), padding);
+    input += RawRecord(FCGI_PARAMS, id, "", padding);
+    input += SplitRecords(FCGI_STDIN, id, "padded body", 4, padding);
+    ++id;
+  }
+
+  EXPECT_EQ(Scan(input), input.size());
+  ASSERT_EQ(requests_.size(), sizeof paddings);
+  for (auto const &request : requests_) {
+    EXPECT_EQ(request.uri, "/pad");
+    EXPECT_EQ(request.stdin_stream, "padded body");
+  }
+}
+
+TEST_F(RecordScanTest, Partial)
+{
+  auto complete = MakeRequest(1, {{"REQUEST_URI", "/1"}}, "body");
+  auto stdin_record = RawRecord(FCGI_STDIN, 2, "partial", 9);
+  auto prefix = complete + BeginRequest(2) +
+                SplitRecords(FCGI_PARAMS, 2,
+                             EncodeParams({{"REQUEST_URI", "/2"}}), 5);
+
+  /* Cut in the header, the content and the padding of the last record */
+  size_t cuts[] = {3, FCGI_RECORD_HEADER_LENGTH + 2,
+                   FCGI_RECORD_HEADER_LENGTH + 7 + 4};
+  for (auto cut : cuts) {
+    EventLoop loop;
+    auto conn = std::make_shared<TestTransport>(&loop);
+    FcgiCodec codec(conn);
+    int handled = 0;
+    codec.SetRequestHandler(
+        [&handled](TransportPtr const &, FcgiRequest) { ++handled; });
+
+    auto input = prefix + stdin_record.substr(0, cut);
+    EXPECT_EQ(codec.OnMessage(conn, input.data(), input.size()),
+              prefix.size())
+        << "cut at " << cut;
+    EXPECT_EQ(handled, 1);
+  }
+
+  /* The records are parsed again once complete */
+  EXPECT_EQ(Scan(complete), complete.size());
+  auto rest = BeginRequest(2) +
+              SplitRecords(FCGI_PARAMS, 2,
+                           EncodeParams({{"REQUEST_URI", "/2"}}), 5) +
+              stdin_record + RawRecord(FCGI_STDIN, 2, "", 0);
+  EXPECT_EQ(Scan(rest.substr(0, rest.size() - 1)),
+            rest.size() - FCGI_RECORD_HEADER_LENGTH);
+  EXPECT_EQ(Scan(rest.substr(rest.size() - FCGI_RECORD_HEADER_LENGTH)),
+            (size_t)FCGI_RECORD_HEADER_LENGTH);
+  ASSERT_EQ(requests_.size(), 2u);
+  EXPECT_EQ(requests_[1].uri, "/2");
+  EXPECT_EQ(requests_[1].stdin_stream, "partial");
+}
+
+TEST_F(RecordScanTest, Interleaved)
+{
+  /* The contents are merged only within the run of one stream */
+  std::string input = BeginRequest(1) + BeginRequest(2);
+  input += SplitRecords(FCGI_PARAMS, 1, EncodeParams({{"REQUEST_URI", "/1"}}),
+                        100);
+  input += SplitRecords(FCGI_PARAMS, 2, EncodeParams({{"REQUEST_URI", "/2"}}),
+                        100);
+  for (int i = 0; i < 10; ++i) {
+    input += RawRecord(FCGI_STDIN, 1, std::string(1, 'a' + i), 0);
+    input += RawRecord(FCGI_STDIN, 2, std::string(1, 'A' + i), 3);
+    input += RawRecord(FCGI_STDIN, 2, std::string(1, 'k' + i), 0);
+  }
+  input += RawRecord(FCGI_STDIN, 2, "", 0);
+  input += RawRecord(FCGI_STDIN, 1, "", 0);
+
+  EXPECT_EQ(Scan(input), input.size());
+  ASSERT_EQ(requests_.size(), 2u);
+  EXPECT_EQ(requests_[0].id, 2);
+  EXPECT_EQ(requests_[0].stdin_stream, "AkBlCmDnEoFpGqHrIsJt");
+  EXPECT_EQ(requests_[1].id, 1);
+  EXPECT_EQ(requests_[1].stdin_stream, "abcdefghij");
+}
+
+TEST_F(RecordScanTest, Management)
+{
+  /* The management record in the middle of a batch is answered in order */
+  auto query = EncodeParams({{FCGI_MPXS_CONNS, ""}});
+  auto input = MakeRequest(1, {{"REQUEST_URI", "/1"}}, "") +
+               RawRecord(FCGI_GET_VALUES, FCGI_NULL_REQUEST_ID, query, 5) +
+               MakeRequest(2, {{"REQUEST_URI", "/2"}}, "");
+
+  EXPECT_EQ(Scan(input), input.size());
+  ASSERT_EQ(requests_.size(), 2u);
+  auto records = ParseRecords(conn_->output_);
+  ASSERT_EQ(records.size(), 1u);
+  EXPECT_EQ(records[0].type, FCGI_GET_VALUES_RESULT);
+}
+
+TEST_F(RecordScanTest, PauseInBatch)
+{
+  std::string first = MakeRequest(1, {{"REQUEST_URI", "/1"}}, "one");
+  std::string rest = MakeRequest(2, {{"REQUEST_URI", "/2"}}, "two") +
+                     MakeRequest(3, {{"REQUEST_URI", "/3"}}, "three");
+
+  /* The records after the pause are left in the input */
+  pause_ = true;
+  auto buffer = conn_->GetInputBuffer();
+  buffer->Append(first.data(), first.size());
+  buffer->Append(rest.data(), rest.size());
+  codec_.OnMessage(conn_, *buffer);
+  ASSERT_EQ(requests_.size(), 1u);
+  EXPECT_EQ(buffer->GetReadableSize(), rest.size());
+
+  /* Parsed in the loop after resuming */
+  pause_ = false;
+  codec_.ResumeRead(conn_);
+  EXPECT_EQ(requests_.size(), 1u);
+  RunPosted(loop_);
+  ASSERT_EQ(requests_.size(), 3u);
+  EXPECT_EQ(requests_[1].stdin_stream, "two");
+  EXPECT_EQ(requests_[2].stdin_stream, "three");
+  EXPECT_EQ(buffer->GetReadableSize(), 0u);
+}
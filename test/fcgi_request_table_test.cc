@@ -0,0 +1,184 @@
+#include "fcgi/fcgi_request_table.h"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "fcgi/fcgi_admission.h"
+#include "fcgi/fcgi_codec.h"
+
+#include "fcgi_test_util.h"
+
+using namespace fcgi;
+using namespace kanon;
+
+using Table = RequestTable<int>;
+
+TEST(RequestTable, Slab)
+{
+  Table table;
+  int a = 1, b = 2, c = 3;
+  EXPECT_TRUE(table.empty());
+  EXPECT_EQ(table.Find(1), nullptr);
+
+  table.Insert(1, &a);
+  table.Insert(0, &b);
+  table.Insert(Table::SLAB_SIZE - 1, &c);
+  EXPECT_EQ(table.size(), 3u);
+  EXPECT_EQ(table.Find(1), &a);
+  EXPECT_EQ(table.Find(0), &b);
+  EXPECT_EQ(table.Find(Table::SLAB_SIZE - 1), &c);
+  EXPECT_EQ(table.Find(2), nullptr);
+
+  EXPECT_EQ(table.Remove(1), &a);
+  EXPECT_EQ(table.Find(1), nullptr);
+  EXPECT_EQ(table.size(), 2u);
+
+  /* Absent, the size isn't changed */
+  EXPECT_EQ(table.Remove(1), nullptr);
+  EXPECT_EQ(table.Remove(100), nullptr);
+  EXPECT_EQ(table.size(), 2u);
+
+  /* The removed id can be inserted again */
+  table.Insert(1, &c);
+  EXPECT_EQ(table.Find(1), &c);
+}
+
+TEST(RequestTable, Sparse)
+{
+  Table table;
+  int a = 1, b = 2;
+
+  table.Insert(Table::SLAB_SIZE, &a);
+  table.Insert(65535, &b);
+  EXPECT_EQ(table.size(), 2u);
+  EXPECT_EQ(table.Find(Table::SLAB_SIZE), &a);
+  EXPECT_EQ(table.Find(65535), &b);
+  EXPECT_EQ(table.Find(Table::SLAB_SIZE + 1), nullptr);
+
+  /* The sparse id doesn't grow the slab */
+  EXPECT_EQ(table.Find(1), nullptr);
+
+  EXPECT_EQ(table.Remove(65535), &b);
+  EXPECT_EQ(table.Remove(65535), nullptr);
+  EXPECT_EQ(table.Remove(Table::SLAB_SIZE), &a);
+  EXPECT_TRUE(table.empty());
+}
+
+TEST(RequestTable, ForEach)
+{
+  Table table;
+  std::vector<int> values = {1, 2, 3, 4};
+  table.Insert(3, &values[0]);
+  table.Insert(1000, &values[1]);
+  table.Insert(200, &values[2]);
+  table.Insert(40000, &values[3]);
+  table.Remove(200);
+
+  std::vector<int> visited;
+  table.ForEach([&visited](int *value) { visited.push_back(*value); });
+  std::sort(visited.begin(), visited.end());
+  EXPECT_EQ(visited, (std::vector<int>{1, 2, 4}));
+}
+
+/*-----------------------*/
+/* Slots of codec        */
+/*-----------------------*/
+
+/* The requests are held by the handler until they are released */
+class RequestSlotTest : public ::testing::Test {
+ protected:
+  RequestSlotTest()
+    : conn_(std::make_shared<TestTransport>(&loop_))
+    , codec_(new FcgiCodec(conn_))
+  {
+    codec_->SetRequestHandler(
+        [this](TransportPtr const &, FcgiRequest request) {
+          held_.emplace_back(new FcgiRequest(std::move(request)));
+        });
+  }
+
+  void Feed(std::string const &input)
+  {
+    auto buffer = conn_->GetInputBuffer();
+    buffer->Append(input.data(), input.size());
+    codec_->OnMessage(conn_, *buffer);
+  }
+
+  EventLoop loop_;
+  std::shared_ptr<TestTransport> conn_;
+  std::unique_ptr<FcgiCodec> codec_;
+  std::vector<std::unique_ptr<FcgiRequest>> held_;
+};
+
+TEST_F(RequestSlotTest, Reuse)
+{
+  auto num = AdmissionControl::GetLoopRequestNum();
+  std::string body(1000, 'b');
+
+  Feed(MakeRequest(1, {{"REQUEST_URI", "/1"}}, body));
+  ASSERT_EQ(held_.size(), 1u);
+  EXPECT_EQ(held_[0]->GetCodec(), codec_.get());
+  EXPECT_EQ(AdmissionControl::GetLoopRequestNum(), num + 1);
+  auto stdin_data = held_[0]->stdin_stream.GetReadBegin();
+
+  /* The buffers are given back to the pool */
+  held_.clear();
+  EXPECT_EQ(AdmissionControl::GetLoopRequestNum(), num);
+
+  /* The next request reuses them, even with another id */
+  Feed(MakeRequest(300, {{"REQUEST_URI", "/2"}}, body));
+  ASSERT_EQ(held_.size(), 1u);
+  EXPECT_EQ(held_[0]->request_id, 300);
+  EXPECT_EQ(held_[0]->stdin_stream.GetReadBegin(), stdin_data);
+  EXPECT_EQ(held_[0]->Get(Param::RequestUri).ToString(), "/2");
+
+  held_.clear();
+  EXPECT_EQ(AdmissionControl::GetLoopRequestNum(), num);
+}
+
+TEST_F(RequestSlotTest, IdReused)
+{
+  auto num = AdmissionControl::GetLoopRequestNum();
+
+  Feed(MakeRequest(1, {{"REQUEST_URI", "/old"}}, ""));
+  ASSERT_EQ(held_.size(), 1u);
+
+  /* The web server reuses the id before the handler releases it */
+  Feed(MakeRequest(1, {{"REQUEST_URI", "/new"}}, ""));
+  ASSERT_EQ(held_.size(), 2u);
+  EXPECT_EQ(held_[0]->GetCodec(), nullptr);
+  EXPECT_EQ(held_[1]->GetCodec(), codec_.get());
+  EXPECT_EQ(held_[0]->Get(Param::RequestUri).ToString(), "/old");
+  EXPECT_EQ(held_[1]->Get(Param::RequestUri).ToString(), "/new");
+  EXPECT_EQ(AdmissionControl::GetLoopRequestNum(), num + 2);
+
+  /* The detached one doesn't remove the new one */
+  held_[0].reset();
+  EXPECT_EQ(AdmissionControl::GetLoopRequestNum(), num + 1);
+  EXPECT_EQ(held_[1]->GetCodec(), codec_.get());
+
+  held_.clear();
+  EXPECT_EQ(AdmissionControl::GetLoopRequestNum(), num);
+}
+
+TEST_F(RequestSlotTest, CodecDestroyed)
+{
+  auto num = AdmissionControl::GetLoopRequestNum();
+
+  Feed(MakeRequest(1, {{"REQUEST_URI", "/held"}}, "") + BeginRequest(2));
+  ASSERT_EQ(held_.size(), 1u);
+  EXPECT_EQ(AdmissionControl::GetLoopRequestNum(), num + 2);
+
+  /* The incomplete request is freed, the held one is detached */
+  codec_.reset();
+  EXPECT_EQ(AdmissionControl::GetLoopRequestNum(), num + 1);
+  EXPECT_EQ(held_[0]->GetCodec(), nullptr);
+  EXPECT_EQ(held_[0]->Get(Param::RequestUri).ToString(), "/held");
+
+  held_.clear();
+  EXPECT_EQ(AdmissionControl::GetLoopRequestNum(), num);
+}
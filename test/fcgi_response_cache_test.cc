@@ -0,0 +1,174 @@
+#include "fcgi/fcgi_response_cache.h"
+
+#include <string>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "fcgi/fcgi_params.h"
+#include "fcgi/fcgi_record.h"
+
+using namespace fcgi;
+using namespace kanon;
+
+static std::string const HEADER = "Content-Type: text/plain\r\n\r\n";
+
+static std::string
+MakeKey(ResponseCache const &cache,
+        std::vector<std::pair<std::string, std::string>> const &pairs)
+{
+  Buffer raw;
+  for (auto const &pair : pairs) {
+    AppendNameValuePair(raw, pair.first, pair.second);
+  }
+
+  FcgiParams params;
+  params.Append(raw.GetReadBegin(), raw.GetReadableSize());
+  EXPECT_TRUE(params.Parse());
+  return cache.MakeKey(params);
+}
+
+TEST(ResponseCache, Find)
+{
+  ResponseCache cache(1024 * 1024, 60);
+  EXPECT_EQ(cache.Find("/a"), nullptr);
+
+  cache.Insert("/a", HEADER + "a");
+  auto response = cache.Find("/a");
+  ASSERT_NE(response, nullptr);
+  EXPECT_EQ(cache.GetEntryNum(), 1u);
+  EXPECT_EQ(cache.GetSize(), response->GetSize());
+  EXPECT_EQ(cache.Find("/b"), nullptr);
+
+  /* Replaced, the size isn't counted twice */
+  cache.Insert("/a", HEADER + "b");
+  EXPECT_NE(cache.Find("/a"), response);
+  EXPECT_EQ(cache.GetEntryNum(), 1u);
+  EXPECT_EQ(cache.GetSize(), cache.Find("/a")->GetSize());
+
+  cache.Clear();
+  EXPECT_EQ(cache.Find("/a"), nullptr);
+  EXPECT_EQ(cache.GetSize(), 0u);
+}
+
+TEST(ResponseCache, Expire)
+{
+  ResponseCache cache(1024 * 1024, 0.5);
+  cache.Insert("/a", HEADER + "a");
+  ASSERT_NE(cache.Find("/a"), nullptr);
+
+  /* The hit doesn't extend the TTL */
+  ::usleep(200 * 1000);
+  ASSERT_NE(cache.Find("/a"), nullptr);
+  ::usleep(400 * 1000);
+  EXPECT_EQ(cache.Find("/a"), nullptr);
+  EXPECT_EQ(cache.GetEntryNum(), 0u);
+  EXPECT_EQ(cache.GetSize(), 0u);
+
+  /* Inserted again */
+  cache.Insert("/a", HEADER + "a");
+  EXPECT_NE(cache.Find("/a"), nullptr);
+}
+
+TEST(ResponseCache, Evict)
+{
+  std::string body(100, 'x');
+  size_t entry_size;
+  {
+    ResponseCache probe(1024 * 1024, 60);
+    probe.Insert("/probe", HEADER + body);
+    entry_size = probe.GetSize();
+    ASSERT_GT(entry_size, body.size());
+  }
+
+  /* Room for 3 entries */
+  ResponseCache cache(entry_size * 3 + entry_size / 2, 60);
+  /* The STDOUT is compared, not the records */
+  cache.SetMaxEntrySize(HEADER.size() + body.size());
+  cache.Insert("/1", HEADER + body);
+  cache.Insert("/2", HEADER + body);
+  cache.Insert("/3", HEADER + body);
+  EXPECT_EQ(cache.GetEntryNum(), 3u);
+
+  /* The least recently used is /2 since /1 is hit */
+  ASSERT_NE(cache.Find("/1"), nullptr);
+  cache.Insert("/4", HEADER + body);
+  EXPECT_EQ(cache.GetEntryNum(), 3u);
+  EXPECT_EQ(cache.GetSize(), entry_size * 3);
+  EXPECT_EQ(cache.Find("/2"), nullptr);
+  EXPECT_NE(cache.Find("/1"), nullptr);
+  EXPECT_NE(cache.Find("/3"), nullptr);
+  EXPECT_NE(cache.Find("/4"), nullptr);
+
+  /* The evicted response held by the hit is still valid */
+  auto held = cache.Find("/3");
+  cache.Insert("/5", HEADER + body);
+  cache.Insert("/6", HEADER + body);
+  cache.Insert("/7", HEADER + body);
+  EXPECT_EQ(cache.Find("/3"), nullptr);
+  EXPECT_EQ(held->GetSize(), entry_size);
+
+  /* Larger than the maximum entry size */
+  cache.Insert("/large", HEADER + body + "x");
+  EXPECT_EQ(cache.Find("/large"), nullptr);
+  EXPECT_EQ(cache.GetEntryNum(), 3u);
+}
+
+TEST(ResponseCache, CacheableResponse)
+{
+  EXPECT_TRUE(ResponseCache::IsCacheableResponse(HEADER + "body"));
+  EXPECT_TRUE(ResponseCache::IsCacheableResponse("Status: 200 OK\r\n\r\n"));
+  EXPECT_TRUE(ResponseCache::IsCacheableResponse(
+      "Cache-Control: max-age=60\nContent-Type: text/html\n\n"));
+  EXPECT_TRUE(ResponseCache::IsCacheableResponse("no header"));
+  EXPECT_TRUE(ResponseCache::IsCacheableResponse(""));
+
+  EXPECT_FALSE(ResponseCache::IsCacheableResponse(
+      "Status: 404 Not Found\r\n" + HEADER + "missing"));
+  EXPECT_FALSE(ResponseCache::IsCacheableResponse("status:500\r\n\r\n"));
+  EXPECT_FALSE(ResponseCache::IsCacheableResponse("Location: /new\r\n\r\n"));
+  EXPECT_FALSE(ResponseCache::IsCacheableResponse(
+      "Content-Type: text/html\r\nSet-Cookie: id=1\r\n\r\n"));
+  EXPECT_FALSE(ResponseCache::IsCacheableResponse(
+      "Cache-Control: max-age=0, no-store\r\n\r\n"));
+  EXPECT_FALSE(
+      ResponseCache::IsCacheableResponse("cache-control: No-Cache\n\n"));
+  EXPECT_FALSE(
+      ResponseCache::IsCacheableResponse("Cache-Control: private\r\n\r\n"));
+
+  /* The body isn't the headers */
+  EXPECT_TRUE(ResponseCache::IsCacheableResponse(
+      HEADER + "Set-Cookie: id=1\r\nStatus: 404\r\n"));
+
+  /* Not inserted */
+  ResponseCache cache(1024 * 1024, 60);
+  cache.Insert("/missing", "Status: 404 Not Found\r\n\r\n");
+  cache.Insert("/login", "Set-Cookie: id=1\r\n\r\n");
+  EXPECT_EQ(cache.GetEntryNum(), 0u);
+}
+
+TEST(ResponseCache, Key)
+{
+  ResponseCache cache(1024 * 1024, 60);
+
+  /* The host is a part of the key by default */
+  auto a = MakeKey(cache, {{"REQUEST_URI", "/index"}, {"HTTP_HOST", "a"}});
+  auto b = MakeKey(cache, {{"HTTP_HOST", "b"}, {"REQUEST_URI", "/index"}});
+  auto a2 = MakeKey(cache, {{"HTTP_HOST", "a"},
+                            {"REQUEST_URI", "/index"},
+                            {"HTTP_COOKIE", "id=1"}});
+  EXPECT_NE(a, b);
+  EXPECT_EQ(a, a2);
+
+  /* The values don't run into each other */
+  EXPECT_NE(MakeKey(cache, {{"HTTP_HOST", "a/"}, {"REQUEST_URI", "b"}}),
+            MakeKey(cache, {{"HTTP_HOST", "a"}, {"REQUEST_URI", "/b"}}));
+
+  cache.SetKeyParams({"REQUEST_URI", "HTTP_ACCEPT_ENCODING"});
+  EXPECT_EQ(MakeKey(cache, {{"REQUEST_URI", "/"}, {"HTTP_HOST", "a"}}),
+            MakeKey(cache, {{"REQUEST_URI", "/"}, {"HTTP_HOST", "b"}}));
+  EXPECT_NE(
+      MakeKey(cache,
+              {{"REQUEST_URI", "/"}, {"HTTP_ACCEPT_ENCODING", "gzip"}}),
+      MakeKey(cache, {{"REQUEST_URI", "/"}}));
+}
@@ -0,0 +1,137 @@
+#include "fcgi/fcgi_response_writer.h"
+
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "fcgi_test_util.h"
+
+using namespace fcgi;
+using namespace kanon;
+
+TEST(ResponseWriter, Coalesce)
+{
+  EventLoop loop;
+  auto conn = std::make_shared<TestTransport>(&loop);
+
+  {
+    ResponseWriter writer(conn, 1);
+    writer.WriteStdout("Content-Type: text/plain\r\n\r\n");
+    writer.WriteStdout("body");
+    EXPECT_GT(writer.GetPendingSize(), 0u);
+    EXPECT_EQ(conn->send_num_, 0);
+
+    /* STDOUT, its terminator and END_REQUEST in one send */
+    writer.EndRequest();
+    EXPECT_EQ(writer.GetPendingSize(), 0u);
+    EXPECT_EQ(conn->send_num_, 1);
+  }
+
+  /* Nothing is left to flush */
+  EXPECT_EQ(conn->send_num_, 1);
+
+  auto records = ParseRecords(conn->output_);
+  ASSERT_EQ(records.size(), 4u);
+  EXPECT_EQ(records[0].type, FCGI_STDOUT);
+  EXPECT_EQ(records[1].type, FCGI_STDOUT);
+  EXPECT_EQ(records[1].content, "body");
+  EXPECT_EQ(records[2].type, FCGI_STDOUT);
+  EXPECT_TRUE(records[2].content.empty());
+  EXPECT_EQ(records[3].type, FCGI_END_REQUEST);
+  for (auto const &record : records) {
+    EXPECT_EQ(record.id, 1);
+  }
+}
+
+TEST(ResponseWriter, Stderr)
+{
+  EventLoop loop;
+  auto conn = std::make_shared<TestTransport>(&loop);
+
+  /* STDERR isn't terminated if it isn't written */
+  {
+    ResponseWriter writer(conn, 1);
+    writer.EndRequest();
+  }
+
+  auto records = ParseRecords(conn->output_);
+  ASSERT_EQ(records.size(), 2u);
+  EXPECT_EQ(records[0].type, FCGI_STDOUT);
+  EXPECT_EQ(records[1].type, FCGI_END_REQUEST);
+
+  conn->output_.clear();
+  {
+    ResponseWriter writer(conn, 2);
+    writer.WriteStderr("error");
+    writer.EndRequest(1);
+  }
+
+  records = ParseRecords(conn->output_);
+  ASSERT_EQ(records.size(), 4u);
+  EXPECT_EQ(records[0].type, FCGI_STDERR);
+  EXPECT_EQ(records[0].content, "error");
+  EXPECT_EQ(records[1].type, FCGI_STDOUT);
+  EXPECT_EQ(records[2].type, FCGI_STDERR);
+  EXPECT_TRUE(records[2].content.empty());
+  EXPECT_EQ(records[3].type, FCGI_END_REQUEST);
+  /* app_status in big endian */
+  EXPECT_EQ(records[3].content.substr(0, 4), std::string("\0\0\0\1", 4));
+}
+
+TEST(ResponseWriter, FlushOnDestroy)
+{
+  EventLoop loop;
+  auto conn = std::make_shared<TestTransport>(&loop);
+
+  {
+    ResponseWriter writer(conn, 3);
+    writer.WriteStdout("partial");
+    EXPECT_TRUE(conn->output_.empty());
+  }
+
+  /* No terminator or END_REQUEST is made up */
+  auto records = ParseRecords(conn->output_);
+  ASSERT_EQ(records.size(), 1u);
+  EXPECT_EQ(records[0].type, FCGI_STDOUT);
+  EXPECT_EQ(records[0].content, "partial");
+}
+
+TEST(ResponseWriter, FlushFromWorker)
+{
+  EventLoop loop;
+  auto conn = std::make_shared<TestTransport>(&loop);
+
+  std::string body(100 * 1024, 'w');
+  std::thread worker([&loop, &conn, &body]() {
+    ResponseWriter writer(conn, 1);
+    writer.WriteStdout(body);
+    writer.Flush();
+    EXPECT_EQ(writer.GetPendingSize(), 0u);
+
+    writer.WriteStdout("tail");
+    writer.EndRequest();
+
+    /* Run after the posted flushes */
+    loop.QueueToLoop([&loop]() { loop.Quit(); });
+  });
+
+  /* The records are sent in the loop, once per flush */
+  loop.StartLoop();
+  worker.join();
+
+  EXPECT_FALSE(conn->sent_out_of_loop_);
+  EXPECT_EQ(conn->send_num_, 2);
+
+  std::string stdout_stream;
+  auto records = ParseRecords(conn->output_);
+  ASSERT_GE(records.size(), 3u);
+  for (size_t i = 0; i + 2 < records.size(); ++i) {
+    EXPECT_EQ(records[i].type, FCGI_STDOUT);
+    stdout_stream += records[i].content;
+  }
+  EXPECT_EQ(stdout_stream, body + "tail");
+  EXPECT_EQ(records[records.size() - 2].type, FCGI_STDOUT);
+  EXPECT_TRUE(records[records.size() - 2].content.empty());
+  EXPECT_EQ(records.back().type, FCGI_END_REQUEST);
+}
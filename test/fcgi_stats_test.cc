@@ -0,0 +1,195 @@
+#include "fcgi/fcgi_stats.h"
+
+#include <string.h>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "fcgi/fcgi_codec.h"
+#include "fcgi/fcgi_params.h"
+
+#include "fcgi_test_util.h"
+
+using namespace fcgi;
+using namespace kanon;
+
+/* The stats is process wide, the snapshot is compared with the last one */
+class FcgiStatsTest : public ::testing::Test {
+ protected:
+  FcgiStatsTest() { FcgiStats::Enable(true); }
+
+  ~FcgiStatsTest() noexcept override
+  {
+    FcgiStats::Enable(false);
+    FcgiStats::SetManagementPath("");
+  }
+
+  void TakeSnapshot() { last_ = FcgiStats::GetSnapshot(); }
+
+  uint64_t GetDelta(Counter c)
+  {
+    return FcgiStats::GetSnapshot().Get(c) - last_.Get(c);
+  }
+
+  uint64_t GetDelta(Phase p)
+  {
+    return FcgiStats::GetSnapshot().Get(p).count - last_.Get(p).count;
+  }
+
+  uint64_t GetBucketDelta(Phase p, int bucket)
+  {
+    return FcgiStats::GetSnapshot().Get(p).buckets[bucket] -
+           last_.Get(p).buckets[bucket];
+  }
+
+  StatsSnapshot last_;
+};
+
+TEST_F(FcgiStatsTest, Disabled)
+{
+  FcgiStats::Enable(false);
+  TakeSnapshot();
+
+  FcgiStats::Add(Counter::BytesIn, 100);
+  RequestTimes times;
+  times.begin_time = 1;
+  FcgiStats::RecordRequest(times);
+  EXPECT_EQ(FcgiStats::Now(), 0);
+
+  EXPECT_EQ(GetDelta(Counter::BytesIn), 0u);
+  EXPECT_EQ(GetDelta(Counter::Requests), 0u);
+  EXPECT_EQ(GetDelta(Phase::Total), 0u);
+}
+
+TEST_F(FcgiStatsTest, Counter)
+{
+  TakeSnapshot();
+  FcgiStats::Add(Counter::BytesIn, 100);
+  FcgiStats::Add(Counter::Aborted);
+  EXPECT_EQ(GetDelta(Counter::BytesIn), 100u);
+  EXPECT_EQ(GetDelta(Counter::Aborted), 1u);
+
+  /* The blocks of threads are merged, even if the threads exit */
+  std::thread([]() {
+    for (int i = 0; i < 1000; ++i) {
+      FcgiStats::Add(Counter::BytesIn, 2);
+    }
+  }).join();
+  EXPECT_EQ(GetDelta(Counter::BytesIn), 2100u);
+  EXPECT_EQ(GetDelta(Counter::Rejected), 0u);
+}
+
+TEST_F(FcgiStatsTest, RecordRequest)
+{
+  TakeSnapshot();
+
+  RequestTimes times;
+  times.begin_time = FcgiStats::Now() - 100000;
+  times.params_time = times.begin_time + 10;
+  times.stdin_time = times.begin_time + 20;
+  times.handler_time = times.begin_time + 100;
+  FcgiStats::RecordRequest(times);
+
+  EXPECT_EQ(GetDelta(Counter::Requests), 1u);
+  for (int i = 0; i < (int)Phase::Num; ++i) {
+    EXPECT_EQ(GetDelta((Phase)i), 1u) << Phase2String((Phase)i);
+  }
+
+  /* [2^(i-1), 2^i) */
+  EXPECT_EQ(GetBucketDelta(Phase::Params, 4), 1u);
+  EXPECT_EQ(GetBucketDelta(Phase::Stdin, 5), 1u);
+  EXPECT_EQ(GetBucketDelta(Phase::Queue, 7), 1u);
+
+  /* 100ms at least */
+  auto now = FcgiStats::GetSnapshot();
+  auto const &total = now.Get(Phase::Total);
+  EXPECT_GE(total.sum - last_.Get(Phase::Total).sum, 100000u);
+  EXPECT_EQ(GetBucketDelta(Phase::Total, 0), 0u);
+
+  /* The times not recorded are skipped, e.g. streamed STDIN */
+  TakeSnapshot();
+  RequestTimes streamed;
+  streamed.begin_time = FcgiStats::Now();
+  streamed.params_time = streamed.begin_time;
+  streamed.handler_time = streamed.begin_time;
+  FcgiStats::RecordRequest(streamed);
+  EXPECT_EQ(GetDelta(Phase::Params), 1u);
+  EXPECT_EQ(GetDelta(Phase::Stdin), 0u);
+  EXPECT_EQ(GetDelta(Phase::Queue), 1u);
+  EXPECT_EQ(GetBucketDelta(Phase::Queue, 0), 1u);
+
+  TakeSnapshot();
+  FcgiStats::RecordRequest(RequestTimes());
+  EXPECT_EQ(GetDelta(Counter::Requests), 1u);
+  EXPECT_EQ(GetDelta(Phase::Total), 0u);
+}
+
+TEST(LatencyHistogram, Percentile)
+{
+  LatencyHistogram h;
+  memset(&h, 0, sizeof h);
+  EXPECT_EQ(h.GetPercentile(0.5), 0u);
+  EXPECT_EQ(h.GetMean(), 0);
+
+  h.buckets[3] = 90;
+  h.buckets[10] = 10;
+  h.count = 100;
+  h.sum = 90 * 6 + 10 * 1000;
+  EXPECT_EQ(h.GetPercentile(0.5), 8u);
+  EXPECT_EQ(h.GetPercentile(0.89), 8u);
+  EXPECT_EQ(h.GetPercentile(0.9), 1024u);
+  EXPECT_EQ(h.GetPercentile(0.99), 1024u);
+  EXPECT_EQ(h.GetPercentile(1), 1024u);
+  EXPECT_DOUBLE_EQ(h.GetMean(), 105.4);
+}
+
+TEST_F(FcgiStatsTest, Management)
+{
+  FcgiStats::SetManagementPath("/status");
+
+  /* The query string is ignored, DOCUMENT_URI is preferred */
+  auto is_management = [](std::string const &name, std::string const &value) {
+    Buffer raw;
+    AppendNameValuePair(raw, name, value);
+    FcgiParams params;
+    params.Append(raw.GetReadBegin(), raw.GetReadableSize());
+    EXPECT_TRUE(params.Parse());
+    return FcgiStats::IsManagementRequest(params);
+  };
+  EXPECT_TRUE(is_management("REQUEST_URI", "/status"));
+  EXPECT_TRUE(is_management("REQUEST_URI", "/status?full=1"));
+  EXPECT_TRUE(is_management("DOCUMENT_URI", "/status"));
+  EXPECT_FALSE(is_management("REQUEST_URI", "/status/"));
+  EXPECT_FALSE(is_management("REQUEST_URI", "/"));
+
+  /* Served by the codec instead of the handler */
+  EventLoop loop;
+  auto conn = std::make_shared<TestTransport>(&loop);
+  FcgiCodec codec(conn);
+  int handled = 0;
+  codec.SetRequestHandler(
+      [&handled](TransportPtr const &, FcgiRequest) { ++handled; });
+
+  TakeSnapshot();
+  auto input = MakeRequest(1, {{"REQUEST_URI", "/status?x"}}, "");
+  conn->GetInputBuffer()->Append(input.data(), input.size());
+  codec.OnMessage(conn, *conn->GetInputBuffer());
+  EXPECT_EQ(handled, 0);
+  EXPECT_EQ(GetDelta(Counter::BytesIn), input.size());
+
+  std::string body;
+  auto records = ParseRecords(conn->output_);
+  ASSERT_FALSE(records.empty());
+  EXPECT_EQ(records.back().type, FCGI_END_REQUEST);
+  for (auto const &record : records) {
+    if (record.type == FCGI_STDOUT) body += record.content;
+  }
+  EXPECT_NE(body.find("Content-Type: text/plain\r\n\r\n"), std::string::npos);
+  EXPECT_NE(body.find("\nbytes_in "), std::string::npos);
+  EXPECT_NE(body.find("latency_us total count="), std::string::npos);
+
+  /* Disabled */
+  FcgiStats::SetManagementPath("");
+  EXPECT_FALSE(is_management("REQUEST_URI", "/status"));
+}
@@ -0,0 +1,186 @@
+#ifndef FCGI_TEST_UTIL_H_
+#define FCGI_TEST_UTIL_H_
+
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "fcgi/fcgi_record.h"
+#include "fcgi/fcgi_transport.h"
+
+#include "kanon/net/event_loop.h"
+
+/* The helpers shared by the tests feeding records to the codec */
+
+namespace fcgi {
+
+/* The output of codec is captured instead of being written to socket */
+class TestTransport : public Transport {
+ public:
+  explicit TestTransport(kanon::EventLoop *loop)
+    : Transport(loop)
+  {
+  }
+
+  void Send(void const *data, size_t len) override
+  {
+    Count();
+    output_.append(static_cast<char const *>(data), len);
+  }
+
+  void Send(kanon::ChunkList &output) override
+  {
+    Count();
+    for (auto const &chunk : output) {
+      output_.append(chunk.GetReadBegin(), chunk.GetReadableSize());
+    }
+    output.AdvanceAll();
+  }
+
+  void ShutdownWrite() override { shutdown_ = true; }
+  void StopRead() override {}
+  void StartRead() override {}
+  bool IsConnected() const noexcept override { return true; }
+  size_t GetOutputSize() const noexcept override { return 0; }
+  kanon::Buffer *GetInputBuffer() noexcept override { return &input_; }
+
+  std::string output_;
+  int send_num_ = 0;
+  bool sent_out_of_loop_ = false; /* The transport isn't thread-safe */
+  bool shutdown_ = false;
+
+ private:
+  void Count() noexcept
+  {
+    ++send_num_;
+    if (!GetLoop()->IsLoopInThread()) sent_out_of_loop_ = true;
+  }
+
+  kanon::Buffer input_;
+};
+
+struct Record {
+  uint8_t type;
+  uint16_t id;
+  std::string content;
+};
+
+/* Split the output into records, the padding is checked and dropped */
+inline std::vector<Record> ParseRecords(std::string const &output)
+{
+  std::vector<Record> records;
+  auto bytes = reinterpret_cast<unsigned char const *>(output.data());
+  size_t pos = 0;
+  while (pos < output.size()) {
+    if (output.size() - pos < (size_t)FCGI_RECORD_HEADER_LENGTH) {
+      ADD_FAILURE() << "Truncated record header at " << pos;
+      break;
+    }
+
+    auto header = bytes + pos;
+    EXPECT_EQ(header[0], FCGI_VERSION_1);
+    Record record;
+    record.type = header[1];
+    record.id = (header[2] << 8) | header[3];
+    size_t clen = (header[4] << 8) | header[5];
+    size_t padding = header[6];
+    pos += FCGI_RECORD_HEADER_LENGTH;
+
+    if (output.size() - pos < clen + padding) {
+      ADD_FAILURE() << "Truncated record content at " << pos;
+      break;
+    }
+
+    /* The records are aligned to 8 bytes */
+    EXPECT_EQ((clen + padding) % 8, 0u);
+    record.content = output.substr(pos, clen);
+    records.push_back(std::move(record));
+    pos += clen + padding;
+  }
+
+  return records;
+}
+
+inline std::string ToString(kanon::ChunkList const &output)
+{
+  std::string str;
+  for (auto const &chunk : output) {
+    str.append(chunk.GetReadBegin(), chunk.GetReadableSize());
+  }
+  return str;
+}
+
+/*-----------------------*/
+/* Record stream builder */
+/*-----------------------*/
+
+inline std::string BeginRequest(uint16_t id, FcgiRole role = FCGI_RESPONDER)
+{
+  kanon::ChunkList output;
+  AppendBeginRequest(output, id, role, FCGI_KEEP_CONN);
+  return ToString(output);
+}
+
+inline std::string StreamRecords(FcgiType type, uint16_t id,
+                                 std::string const &content)
+{
+  kanon::ChunkList output;
+  AppendStreamRecords(output, type, id, content.data(), content.size());
+  return ToString(output);
+}
+
+inline std::string Terminator(FcgiType type, uint16_t id)
+{
+  kanon::ChunkList output;
+  AppendTerminator(output, type, id);
+  return ToString(output);
+}
+
+inline std::string
+EncodeParams(std::vector<std::pair<std::string, std::string>> const &pairs)
+{
+  kanon::Buffer params;
+  for (auto const &pair : pairs) {
+    AppendNameValuePair(params, pair.first, pair.second);
+  }
+  return std::string(params.GetReadBegin(), params.GetReadableSize());
+}
+
+/* A complete request whose PARAMS and STDIN are terminated */
+inline std::string
+MakeRequest(uint16_t id,
+            std::vector<std::pair<std::string, std::string>> const &pairs,
+            std::string const &body)
+{
+  return BeginRequest(id) +
+         StreamRecords(FCGI_PARAMS, id, EncodeParams(pairs)) +
+         Terminator(FCGI_PARAMS, id) + StreamRecords(FCGI_STDIN, id, body) +
+         Terminator(FCGI_STDIN, id);
+}
+
+inline std::string AbortRequest(uint16_t id)
+{
+  kanon::ChunkList output;
+  AppendRecordHeader(output, FCGI_ABORT_REQUEST, id, 0);
+  return ToString(output);
+}
+
+/*
+ * Run the functors posted to \p loop by other threads(e.g. the workers
+ * that have been joined), then return. The loop can't be started again.
+ */
+inline void RunPosted(kanon::EventLoop &loop)
+{
+  /* Post from another thread, which wakes up the loop */
+  std::thread([&loop]() {
+    loop.QueueToLoop([&loop]() { loop.Quit(); });
+  }).join();
+  loop.StartLoop();
+}
+
+} // namespace fcgi
+
+#endif // FCGI_TEST_UTIL_H_
@@ -0,0 +1,172 @@
+#include "fcgi/fcgi_trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace fcgi;
+
+struct DumpedRing {
+  TraceRingHeader header;
+  std::vector<TraceRecord> records;
+};
+
+/* The rings of threads are registered once, each test records in new
+ * threads to get the rings of the capacity it enables */
+class FcgiTraceTest : public ::testing::Test {
+ protected:
+  FcgiTraceTest()
+  {
+    char path[] = "/tmp/fcgi_trace_test_XXXXXX";
+    int fd = ::mkstemp(path);
+    EXPECT_GE(fd, 0);
+    ::close(fd);
+    path_ = path;
+  }
+
+  ~FcgiTraceTest() noexcept override
+  {
+    FcgiTrace::Enable(FcgiTrace::DEFAULT_CAPACITY);
+    FcgiTrace::Disable();
+    ::unlink(path_.c_str());
+  }
+
+  /* Call \p f in a new thread, \return the tid of it */
+  template <typename F>
+  uint32_t RunInThread(F f)
+  {
+    uint32_t tid = 0;
+    std::thread([&tid, &f]() {
+      tid = (uint32_t)::syscall(SYS_gettid);
+      f();
+    }).join();
+    return tid;
+  }
+
+  std::vector<DumpedRing> ReadDump()
+  {
+    std::vector<DumpedRing> rings;
+    FILE *file = ::fopen(path_.c_str(), "rb");
+    if (!file) {
+      ADD_FAILURE() << "No dump file";
+      return rings;
+    }
+
+    TraceFileHeader file_header;
+    EXPECT_EQ(::fread(&file_header, sizeof file_header, 1, file), 1u);
+    EXPECT_EQ(memcmp(file_header.magic, FCGI_TRACE_MAGIC, 8), 0);
+
+    for (uint32_t i = 0; i < file_header.ring_num; ++i) {
+      DumpedRing ring;
+      if (::fread(&ring.header, sizeof ring.header, 1, file) != 1) {
+        ADD_FAILURE() << "Truncated ring header";
+        break;
+      }
+
+      ring.records.resize(ring.header.record_num);
+      auto n = ::fread(ring.records.data(), sizeof(TraceRecord),
+                       ring.records.size(), file);
+      EXPECT_EQ(n, ring.records.size());
+      rings.push_back(std::move(ring));
+    }
+
+    /* No trailing bytes */
+    EXPECT_EQ(::fgetc(file), EOF);
+    ::fclose(file);
+    return rings;
+  }
+
+  DumpedRing const *FindRing(std::vector<DumpedRing> const &rings,
+                             uint32_t tid)
+  {
+    for (auto const &ring : rings) {
+      if (ring.header.tid == tid) return &ring;
+    }
+    return nullptr;
+  }
+
+  std::string path_;
+};
+
+TEST_F(FcgiTraceTest, Record)
+{
+  FcgiTrace::Enable(16);
+  auto tid = RunInThread([]() {
+    FCGI_TRACE(RecordIn, 1, 8, 1);
+    FCGI_TRACE(Dispatch, 1, 100, 0);
+    FCGI_TRACE(Reject, 2, 0, 3);
+  });
+
+  ASSERT_TRUE(FcgiTrace::Dump(path_.c_str()));
+  auto rings = ReadDump();
+  auto ring = FindRing(rings, tid);
+  ASSERT_NE(ring, nullptr);
+  EXPECT_EQ(ring->header.overwritten, 0u);
+  ASSERT_EQ(ring->records.size(), 3u);
+
+  auto const &records = ring->records;
+  EXPECT_EQ(records[0].event, (uint8_t)TraceEvent::RecordIn);
+  EXPECT_EQ(records[0].request_id, 1);
+  EXPECT_EQ(records[0].length, 8u);
+  EXPECT_EQ(records[0].type, 1);
+  EXPECT_EQ(records[1].event, (uint8_t)TraceEvent::Dispatch);
+  EXPECT_EQ(records[1].length, 100u);
+  EXPECT_EQ(records[2].event, (uint8_t)TraceEvent::Reject);
+  EXPECT_EQ(records[2].request_id, 2);
+  EXPECT_EQ(records[2].type, 3);
+  EXPECT_LE(records[0].timestamp, records[1].timestamp);
+  EXPECT_LE(records[1].timestamp, records[2].timestamp);
+}
+
+TEST_F(FcgiTraceTest, Overwrite)
+{
+  /* Rounded up to 8 */
+  FcgiTrace::Enable(5);
+  auto tid = RunInThread([]() {
+    for (uint16_t i = 0; i < 20; ++i) {
+      FCGI_TRACE(Flush, i, i, 0);
+    }
+  });
+
+  ASSERT_TRUE(FcgiTrace::Dump(path_.c_str()));
+  auto rings = ReadDump();
+  auto ring = FindRing(rings, tid);
+  ASSERT_NE(ring, nullptr);
+
+  /* The oldest slot is skipped since it may be being overwritten */
+  ASSERT_EQ(ring->records.size(), 7u);
+  EXPECT_EQ(ring->header.overwritten, 13u);
+  for (size_t i = 0; i < ring->records.size(); ++i) {
+    EXPECT_EQ(ring->records[i].request_id, 13 + i);
+    if (i > 0) {
+      EXPECT_LE(ring->records[i - 1].timestamp, ring->records[i].timestamp);
+    }
+  }
+}
+
+TEST_F(FcgiTraceTest, Disabled)
+{
+  FcgiTrace::Enable(16);
+  FcgiTrace::Disable();
+  auto tid = RunInThread([]() { FCGI_TRACE(Abort, 1, 0, 0); });
+
+  /* The ring is registered by the first record */
+  ASSERT_TRUE(FcgiTrace::Dump(path_.c_str()));
+  EXPECT_EQ(FindRing(ReadDump(), tid), nullptr);
+}
+
+TEST_F(FcgiTraceTest, Dump)
+{
+  EXPECT_FALSE(FcgiTrace::Dump("/nonexistent/fcgi_trace"));
+
+  EXPECT_STREQ(TraceEvent2String(TraceEvent::RecordIn), "RECORD_IN");
+  EXPECT_STREQ(TraceEvent2String(TraceEvent::Resume), "RESUME");
+  EXPECT_STREQ(TraceEvent2String(TraceEvent::Num), "INVALID");
+}
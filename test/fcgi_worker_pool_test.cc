@@ -0,0 +1,224 @@
+#include "fcgi/fcgi_worker_pool.h"
+
+#include <atomic>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "fcgi/fcgi_admission.h"
+#include "fcgi/fcgi_codec.h"
+#include "fcgi/fcgi_response_writer.h"
+
+#include "fcgi_test_util.h"
+
+using namespace fcgi;
+using namespace kanon;
+
+TEST(WorkerPool, Run)
+{
+  WorkerPool pool(4, 0);
+  EXPECT_EQ(pool.GetThreadNum(), 4);
+
+  /* Not started */
+  EXPECT_FALSE(pool.TryPush([]() {}));
+  pool.StartRun();
+
+  std::atomic<int> count(0);
+  std::atomic<bool> in_caller(false);
+  auto caller = std::this_thread::get_id();
+  for (int i = 0; i < 1000; ++i) {
+    ASSERT_TRUE(pool.TryPush([&count, &in_caller, caller]() {
+      if (std::this_thread::get_id() == caller) in_caller = true;
+      ++count;
+    }));
+  }
+
+  pool.StopRun();
+  EXPECT_EQ(count, 1000);
+  EXPECT_FALSE(in_caller);
+  EXPECT_EQ(pool.GetQueueSize(), 0u);
+
+  /* Stopped */
+  EXPECT_FALSE(pool.TryPush([]() {}));
+}
+
+TEST(WorkerPool, Bounded)
+{
+  WorkerPool pool(1, 2);
+  pool.StartRun();
+
+  /* The worker is blocked, then the tasks stay in the queue */
+  std::promise<void> started, gate;
+  auto gate_future = gate.get_future().share();
+  ASSERT_TRUE(pool.TryPush([&started, gate_future]() {
+    started.set_value();
+    gate_future.wait();
+  }));
+  started.get_future().wait();
+
+  std::atomic<int> count(0);
+  EXPECT_TRUE(pool.TryPush([&count]() { ++count; }));
+  EXPECT_TRUE(pool.TryPush([&count]() { ++count; }));
+  EXPECT_FALSE(pool.TryPush([&count]() { ++count; }));
+  EXPECT_EQ(pool.GetQueueSize(), 2u);
+
+  gate.set_value();
+  pool.StopRun();
+  EXPECT_EQ(count, 2);
+}
+
+TEST(WorkerPool, StopRunsPending)
+{
+  WorkerPool pool(1, 0);
+  pool.StartRun();
+
+  std::promise<void> started, gate;
+  auto gate_future = gate.get_future().share();
+  ASSERT_TRUE(pool.TryPush([&started, gate_future]() {
+    started.set_value();
+    gate_future.wait();
+  }));
+  started.get_future().wait();
+
+  std::atomic<int> count(0);
+  for (int i = 0; i < 10; ++i) {
+    ASSERT_TRUE(pool.TryPush([&count]() { ++count; }));
+  }
+
+  /* The pending tasks aren't discarded by the stop */
+  std::thread stopper([&pool]() { pool.StopRun(); });
+  while (pool.TryPush([&count]() { ++count; })) {
+    std::this_thread::yield();
+  }
+  EXPECT_EQ(count, 0);
+
+  gate.set_value();
+  stopper.join();
+  EXPECT_GE(count, 10);
+  EXPECT_EQ(pool.GetQueueSize(), 0u);
+}
+
+/*-----------------------*/
+/* Dispatch of codec     */
+/*-----------------------*/
+
+class WorkerDispatchTest : public ::testing::Test {
+ protected:
+  WorkerDispatchTest()
+    : conn_(std::make_shared<TestTransport>(&loop_))
+    , codec_(conn_)
+  {
+  }
+
+  void Feed(std::string const &input)
+  {
+    auto buffer = conn_->GetInputBuffer();
+    buffer->Append(input.data(), input.size());
+    codec_.OnMessage(conn_, *buffer);
+  }
+
+  EventLoop loop_;
+  std::shared_ptr<TestTransport> conn_;
+  FcgiCodec codec_;
+};
+
+TEST_F(WorkerDispatchTest, Response)
+{
+  auto num = AdmissionControl::GetLoopRequestNum();
+  WorkerPool pool(4, 0);
+  pool.StartRun();
+  codec_.SetWorkerPool(&pool);
+
+  auto caller = std::this_thread::get_id();
+  std::atomic<bool> in_caller(false);
+  codec_.SetRequestHandler(
+      [caller, &in_caller](TransportPtr const &conn, FcgiRequest request) {
+        if (std::this_thread::get_id() == caller) in_caller = true;
+        ResponseWriter writer(conn, request);
+        writer.WriteStdout("uri=" + request.Get(Param::RequestUri).ToString());
+        writer.EndRequest();
+      });
+
+  std::string input;
+  for (uint16_t id = 1; id <= 100; ++id) {
+    input += MakeRequest(id, {{"REQUEST_URI", "/" + std::to_string(id)}}, "");
+  }
+  Feed(input);
+
+  /* The responses and the releases are posted to the loop */
+  pool.StopRun();
+  EXPECT_TRUE(conn_->output_.empty());
+  EXPECT_EQ(AdmissionControl::GetLoopRequestNum(), num + 100);
+  RunPosted(loop_);
+
+  EXPECT_FALSE(in_caller);
+  EXPECT_FALSE(conn_->sent_out_of_loop_);
+  EXPECT_EQ(AdmissionControl::GetLoopRequestNum(), num);
+
+  /* The records of a response are in order, not interleaved */
+  std::vector<std::string> bodies(101);
+  std::vector<int> ended(101, 0);
+  for (auto const &record : ParseRecords(conn_->output_)) {
+    ASSERT_GE(record.id, 1);
+    ASSERT_LE(record.id, 100);
+    ASSERT_EQ(ended[record.id], 0) << "Record after END_REQUEST";
+    if (record.type == FCGI_STDOUT) {
+      bodies[record.id] += record.content;
+    } else {
+      EXPECT_EQ(record.type, FCGI_END_REQUEST);
+      ++ended[record.id];
+    }
+  }
+
+  for (int id = 1; id <= 100; ++id) {
+    EXPECT_EQ(bodies[id], "uri=/" + std::to_string(id));
+    EXPECT_EQ(ended[id], 1);
+  }
+}
+
+TEST_F(WorkerDispatchTest, Overloaded)
+{
+  auto num = AdmissionControl::GetLoopRequestNum();
+  WorkerPool pool(1, 1);
+  pool.StartRun();
+  codec_.SetWorkerPool(&pool);
+
+  std::promise<void> started, gate;
+  auto gate_future = gate.get_future().share();
+  std::atomic<int> handled(0);
+  codec_.SetRequestHandler([&started, gate_future, &handled](
+                               TransportPtr const &conn, FcgiRequest request) {
+    if (request.request_id == 1) {
+      started.set_value();
+      gate_future.wait();
+    }
+    ++handled;
+    ResponseWriter writer(conn, request);
+    writer.EndRequest();
+  });
+
+  /* The first one blocks the worker, the second one fills the queue */
+  Feed(MakeRequest(1, {{"REQUEST_URI", "/"}}, ""));
+  started.get_future().wait();
+  Feed(MakeRequest(2, {{"REQUEST_URI", "/"}}, ""));
+  Feed(MakeRequest(3, {{"REQUEST_URI", "/"}}, ""));
+
+  /* Rejected in the loop immediately */
+  auto records = ParseRecords(conn_->output_);
+  ASSERT_EQ(records.size(), 1u);
+  EXPECT_EQ(records[0].type, FCGI_END_REQUEST);
+  EXPECT_EQ(records[0].id, 3);
+  EXPECT_EQ((uint8_t)records[0].content[4], FCGI_OVERLOADED);
+  EXPECT_EQ(AdmissionControl::GetLoopRequestNum(), num + 2);
+
+  gate.set_value();
+  pool.StopRun();
+  RunPosted(loop_);
+  EXPECT_EQ(handled, 2);
+  EXPECT_EQ(AdmissionControl::GetLoopRequestNum(), num);
+  EXPECT_EQ(ParseRecords(conn_->output_).size(), 5u);
+}
@@ -0,0 +1,127 @@
+/*
+ * Decode the trace file written by FcgiTrace::Dump().
+ *
+ * Usage: fcgi_trace_dump [-m] trace_file
+ *   -m  merge the records of all threads in chronological order
+ */
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "fcgi/fcgi_constant.h"
+#include "fcgi/fcgi_trace.h"
+
+using namespace fcgi;
+
+struct ThreadRecord {
+  uint32_t tid;
+  TraceRecord record;
+};
+
+static bool HasRecordType(TraceEvent event) noexcept
+{
+  return event == TraceEvent::RecordIn || event == TraceEvent::RecordOut ||
+         event == TraceEvent::UnknownRequest;
+}
+
+static void PrintRecord(uint32_t tid, TraceRecord const &r, uint64_t base)
+{
+  auto event = (TraceEvent)r.event;
+  printf("%12.3f us  [%u] %-16s id=%-5u len=%-8u", (r.timestamp - base) / 1e3,
+         tid, TraceEvent2String(event), r.request_id, r.length);
+
+  if (HasRecordType(event)) {
+    printf(" type=%s", FcgiType2String((FcgiType)r.type));
+  } else if (event == TraceEvent::Reject) {
+    printf(" status=%s",
+           FcgiProtocolStatus2String((FcgiProtocolStatus)r.type));
+  }
+  printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+  bool merge = false;
+  char const *path = nullptr;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-m") == 0) {
+      merge = true;
+    } else {
+      path = argv[i];
+    }
+  }
+
+  if (!path) {
+    fprintf(stderr, "Usage: %s [-m] trace_file\n", argv[0]);
+    return 1;
+  }
+
+  FILE *file = ::fopen(path, "rb");
+  if (!file) {
+    perror("fopen");
+    return 1;
+  }
+
+  TraceFileHeader file_header;
+  if (::fread(&file_header, sizeof file_header, 1, file) != 1 ||
+      memcmp(file_header.magic, FCGI_TRACE_MAGIC, sizeof file_header.magic))
+  {
+    fprintf(stderr, "%s isn't a trace file\n", path);
+    return 1;
+  }
+
+  std::vector<ThreadRecord> records;
+  uint64_t skipped = 0;
+  for (uint32_t i = 0; i < file_header.ring_num; ++i) {
+    TraceRingHeader ring_header;
+    if (::fread(&ring_header, sizeof ring_header, 1, file) != 1) {
+      fprintf(stderr, "The trace file is truncated\n");
+      return 1;
+    }
+
+    printf("thread %u: %u records, %llu overwritten\n", ring_header.tid,
+           ring_header.record_num,
+           (unsigned long long)ring_header.overwritten);
+
+    for (uint32_t j = 0; j < ring_header.record_num; ++j) {
+      ThreadRecord r;
+      r.tid = ring_header.tid;
+      if (::fread(&r.record, sizeof r.record, 1, file) != 1) {
+        fprintf(stderr, "The trace file is truncated\n");
+        return 1;
+      }
+
+      /* Torn when dumping */
+      if (r.record.event == (uint8_t)TraceEvent::None ||
+          r.record.event >= (uint8_t)TraceEvent::Num)
+      {
+        ++skipped;
+        continue;
+      }
+      records.push_back(r);
+    }
+  }
+  ::fclose(file);
+
+  if (skipped > 0) {
+    printf("%llu invalid records\n", (unsigned long long)skipped);
+  }
+  if (records.empty()) return 0;
+
+  if (merge) {
+    std::stable_sort(records.begin(), records.end(),
+                     [](ThreadRecord const &x, ThreadRecord const &y) {
+                       return x.record.timestamp < y.record.timestamp;
+                     });
+  }
+
+  uint64_t base = records[0].record.timestamp;
+  for (auto const &r : records) {
+    base = std::min(base, r.record.timestamp);
+  }
+
+  for (auto const &r : records) {
+    PrintRecord(r.tid, r.record, base);
+  }
+}